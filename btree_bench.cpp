@@ -0,0 +1,536 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "util/btree/btree_map.h"
+#include "util/btree/btree_set.h"
+#include "util/benchmark.h"
+#include "util/less.h"
+#include "util/workload.h"
+
+// Single-threaded benchmark: the scenarios of the tests (forward, backward
+// and middle insert and erase, iterate, reverse iterate, find and mixed
+// operations) with int and string keys, and YCSB-style workloads with skewed
+// key distributions. The results are printed as a table and written as JSON.
+//
+// Usage: btree_bench [number_keys] [json_file]
+
+static const int kNodeSize = 256;
+
+typedef util::btree::btree_map<int,
+                               int,
+                               util::less<int>,
+                               kNodeSize> int_map_type;
+
+typedef util::btree::btree_set<int,
+                               util::less<int>,
+                               kNodeSize> int_set_type;
+
+typedef util::btree::btree_map<std::string,
+                               std::string,
+                               util::less<std::string>,
+                               kNodeSize> string_map_type;
+
+typedef util::btree::btree_set<std::string,
+                               util::less<std::string>,
+                               kNodeSize> string_set_type;
+
+typedef util::btree::btree_map<uint64_t,
+                               uint64_t,
+                               util::less<uint64_t>,
+                               kNodeSize> workload_map_type;
+
+// Insert key.
+template<typename _Key,
+         typename _Tp,
+         typename _Compare,
+         size_t _NodeSize,
+         typename _Allocator>
+static inline bool insert(util::btree::btree_map<_Key,
+                                                 _Tp,
+                                                 _Compare,
+                                                 _NodeSize,
+                                                 _Allocator>& tree,
+                          const _Key& key)
+{
+  return tree.insert(key, _Tp());
+}
+
+template<typename _Key,
+         typename _Compare,
+         size_t _NodeSize,
+         typename _Allocator>
+static inline bool insert(util::btree::btree_set<_Key,
+                                                 _Compare,
+                                                 _NodeSize,
+                                                 _Allocator>& tree,
+                          const _Key& key)
+{
+  return tree.insert(key);
+}
+
+// Generate keys (in ascending order).
+static void generate_keys(std::vector<int>& keys, size_t count)
+{
+  for (size_t i = 0; i < count; i++) {
+    keys.push_back(static_cast<int>(i));
+  }
+}
+
+static void generate_keys(std::vector<std::string>& keys, size_t count)
+{
+  // Zero-padded, so the string order is the numeric order.
+  for (size_t i = 0; i < count; i++) {
+    char key[32];
+    snprintf(key, sizeof(key), "%016lu", i);
+
+    keys.push_back(key);
+  }
+}
+
+// xorshift64*.
+static inline uint64_t next_random(uint64_t& state)
+{
+  state ^= state >> 12;
+  state ^= state << 25;
+  state ^= state >> 27;
+  return state * 2685821657736338717ULL;
+}
+
+// Orders in which the keys are visited.
+static void forward_order(std::vector<size_t>& order, size_t count)
+{
+  order.clear();
+  for (size_t i = 0; i < count; i++) {
+    order.push_back(i);
+  }
+}
+
+static void backward_order(std::vector<size_t>& order, size_t count)
+{
+  order.clear();
+  for (size_t i = count; i > 0; i--) {
+    order.push_back(i - 1);
+  }
+}
+
+// From the middle towards both ends.
+static void middle_order(std::vector<size_t>& order, size_t count)
+{
+  order.clear();
+
+  size_t middle = count / 2;
+  order.push_back(middle);
+
+  for (size_t i = 1; order.size() < count; i++) {
+    if (middle >= i) {
+      order.push_back(middle - i);
+    }
+
+    if (middle + i < count) {
+      order.push_back(middle + i);
+    }
+  }
+}
+
+static void random_order(std::vector<size_t>& order, size_t count)
+{
+  forward_order(order, count);
+
+  uint64_t state = 0x9e3779b97f4a7c15ULL;
+  for (size_t i = count; i > 1; i--) {
+    size_t j = next_random(state) % i;
+
+    size_t tmp = order[i - 1];
+    order[i - 1] = order[j];
+    order[j] = tmp;
+  }
+}
+
+template<typename tree_type, typename key_type>
+static void insert_keys(tree_type& tree,
+                        const std::vector<key_type>& keys,
+                        const std::vector<size_t>& order,
+                        util::benchmark& b)
+{
+  b.start();
+
+  for (size_t i = 0; i < order.size(); i++) {
+    uint64_t begin = util::benchmark::ticks();
+    insert(tree, keys[order[i]]);
+    b.record(begin);
+  }
+
+  b.stop();
+}
+
+template<typename tree_type, typename key_type>
+static void erase_keys(tree_type& tree,
+                       const std::vector<key_type>& keys,
+                       const std::vector<size_t>& order,
+                       util::benchmark& b)
+{
+  b.start();
+
+  for (size_t i = 0; i < order.size(); i++) {
+    uint64_t begin = util::benchmark::ticks();
+    tree.erase(keys[order[i]]);
+    b.record(begin);
+  }
+
+  b.stop();
+}
+
+template<typename tree_type, typename key_type>
+static size_t find_keys(const tree_type& tree,
+                        const std::vector<key_type>& keys,
+                        const std::vector<size_t>& order,
+                        util::benchmark& b)
+{
+  typename tree_type::const_iterator it;
+  size_t found = 0;
+
+  b.start();
+
+  for (size_t i = 0; i < order.size(); i++) {
+    uint64_t begin = util::benchmark::ticks();
+    found += tree.find(keys[order[i]], it);
+    b.record(begin);
+  }
+
+  b.stop();
+
+  return found;
+}
+
+template<typename tree_type>
+static size_t iterate(const tree_type& tree, util::benchmark& b)
+{
+  typename tree_type::const_iterator it;
+  size_t n = 0;
+
+  b.start();
+
+  uint64_t begin = util::benchmark::ticks();
+  if (tree.begin(it)) {
+    do {
+      b.record(begin);
+      n++;
+
+      begin = util::benchmark::ticks();
+    } while (tree.next(it));
+  }
+
+  b.stop();
+
+  return n;
+}
+
+template<typename tree_type>
+static size_t reverse_iterate(const tree_type& tree, util::benchmark& b)
+{
+  typename tree_type::const_iterator it;
+  size_t n = 0;
+
+  b.start();
+
+  uint64_t begin = util::benchmark::ticks();
+  if (tree.end(it)) {
+    do {
+      b.record(begin);
+      n++;
+
+      begin = util::benchmark::ticks();
+    } while (tree.prev(it));
+  }
+
+  b.stop();
+
+  return n;
+}
+
+// Mixed operations (1/3 insert, 1/3 erase, 1/3 find) on random keys.
+template<typename tree_type, typename key_type>
+static size_t mix(tree_type& tree,
+                  const std::vector<key_type>& keys,
+                  util::benchmark& b)
+{
+  typename tree_type::const_iterator it;
+  uint64_t state = 0x2545f4914f6cdd1dULL;
+  size_t found = 0;
+
+  b.start();
+
+  for (size_t i = 0; i < keys.size(); i++) {
+    uint64_t rnd = next_random(state);
+    const key_type& key = keys[(rnd >> 8) % keys.size()];
+
+    uint64_t begin = util::benchmark::ticks();
+
+    switch (rnd % 3) {
+      case 0:
+        insert(tree, key);
+        break;
+      case 1:
+        tree.erase(key);
+        break;
+      default:
+        found += tree.find(key, it);
+    }
+
+    b.record(begin);
+  }
+
+  b.stop();
+
+  return found;
+}
+
+template<typename tree_type, typename key_type>
+static bool run_suite(const char* suite,
+                      size_t count,
+                      util::benchmark_report& report)
+{
+  printf("Running %s benchmarks...\n", suite);
+
+  std::vector<key_type> keys;
+  generate_keys(keys, count);
+
+  util::benchmark b;
+  if (!b.init(count)) {
+    printf("Couldn't allocate the latency samples.\n");
+    return false;
+  }
+
+  std::vector<size_t> order;
+  size_t checksum = 0;
+
+  tree_type tree;
+
+  forward_order(order, count);
+  insert_keys(tree, keys, order, b);
+  report.add(suite, "forward_insert", b);
+
+  checksum += iterate(tree, b);
+  report.add(suite, "iterate", b);
+
+  checksum += reverse_iterate(tree, b);
+  report.add(suite, "reverse_iterate", b);
+
+  random_order(order, count);
+  checksum += find_keys(tree, keys, order, b);
+  report.add(suite, "find", b);
+
+  forward_order(order, count);
+  erase_keys(tree, keys, order, b);
+  report.add(suite, "forward_erase", b);
+
+  backward_order(order, count);
+  insert_keys(tree, keys, order, b);
+  report.add(suite, "backward_insert", b);
+
+  erase_keys(tree, keys, order, b);
+  report.add(suite, "backward_erase", b);
+
+  middle_order(order, count);
+  insert_keys(tree, keys, order, b);
+  report.add(suite, "middle_insert", b);
+
+  erase_keys(tree, keys, order, b);
+  report.add(suite, "middle_erase", b);
+
+  // Half of the keys are in the tree when the mixed operations start.
+  random_order(order, count / 2);
+  for (size_t i = 0; i < order.size(); i++) {
+    insert(tree, keys[order[i] * 2]);
+  }
+
+  checksum += mix(tree, keys, b);
+  report.add(suite, "mix", b);
+
+  // Keep the lookups from being optimized away.
+  if (checksum == 1) {
+    printf(" ");
+  }
+
+  return true;
+}
+
+// Run workload: 'count' records are loaded and 'count' operations are run.
+// The key of a record is its index, so the popular records of a Zipfian
+// distribution are neighbours (they share leaves), while the scrambled
+// Zipfian distribution spreads them over the tree.
+static bool run_workload(const util::workload& w,
+                         const char* name,
+                         size_t count,
+                         util::benchmark_report& report)
+{
+  util::workload_generator generator;
+  if (!generator.init(w, count, 0x5851f42d4c957f2dULL)) {
+    printf("Invalid workload %s.\n", name);
+    return false;
+  }
+
+  util::benchmark b;
+  if (!b.init(count)) {
+    printf("Couldn't allocate the latency samples.\n");
+    return false;
+  }
+
+  workload_map_type map;
+  for (uint64_t i = 0; i < count; i++) {
+    map.insert(i, i);
+  }
+
+  workload_map_type::const_iterator it;
+  uint64_t sum = 0;
+
+  b.start();
+
+  for (size_t i = 0; i < count; i++) {
+    uint64_t key;
+    size_t scan_length;
+    util::workload_generator::operation op = generator.next(key, scan_length);
+
+    uint64_t begin = util::benchmark::ticks();
+
+    switch (op) {
+      case util::workload_generator::kRead:
+        {
+          uint64_t value;
+          if (map.get(key, value)) {
+            sum += value;
+          }
+        }
+
+        break;
+      case util::workload_generator::kUpdate:
+      case util::workload_generator::kInsert:
+        map.insert(key, i);
+        break;
+      case util::workload_generator::kScan:
+        if (map.lower_bound(key, it)) {
+          do {
+            sum += it.value();
+          } while ((--scan_length > 0) && (map.next(it)));
+        }
+
+        break;
+      case util::workload_generator::kErase:
+        map.erase(key);
+        break;
+    }
+
+    b.record(begin);
+  }
+
+  b.stop();
+
+  report.add("ycsb", name, b);
+
+  // Keep the lookups from being optimized away.
+  if (sum == 1) {
+    printf(" ");
+  }
+
+  return true;
+}
+
+static bool run_workloads(size_t count, util::benchmark_report& report)
+{
+  printf("Running ycsb benchmarks...\n");
+
+  static const util::workload* const workloads[] = {
+    &util::kWorkloadA,
+    &util::kWorkloadB,
+    &util::kWorkloadC,
+    &util::kWorkloadD,
+    &util::kWorkloadE
+  };
+
+  for (size_t i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++) {
+    if (!run_workload(*workloads[i], workloads[i]->name, count, report)) {
+      return false;
+    }
+  }
+
+  // Read-only workload with each key distribution.
+  static const util::key_distribution::type distributions[] = {
+    util::key_distribution::kUniform,
+    util::key_distribution::kZipfian,
+    util::key_distribution::kScrambledZipfian,
+    util::key_distribution::kLatest,
+    util::key_distribution::kHotspot
+  };
+
+  size_t ndistributions = sizeof(distributions) / sizeof(distributions[0]);
+
+  for (size_t i = 0; i < ndistributions; i++) {
+    util::workload w = util::kWorkloadC;
+    w.distribution = distributions[i];
+
+    char name[64];
+    snprintf(name,
+             sizeof(name),
+             "read_%s",
+             util::key_distribution::name(distributions[i]));
+
+    if (!run_workload(w, name, count, report)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+int main(int argc, const char** argv)
+{
+  size_t count = 1000 * 1000;
+  const char* json = "btree_bench.json";
+
+  if (argc > 1) {
+    count = strtoul(argv[1], NULL, 10);
+  }
+
+  if (argc > 2) {
+    json = argv[2];
+  }
+
+  if (count == 0) {
+    printf("Usage: %s [number_keys] [json_file]\n", argv[0]);
+    return -1;
+  }
+
+  printf("Keys: %lu, node size: %d.\n\n", count, kNodeSize);
+
+  util::benchmark_report report;
+
+  if ((!run_suite<int_map_type, int>("int_map", count, report)) ||
+      (!run_suite<int_set_type, int>("int_set", count, report)) ||
+      (!run_suite<string_map_type, std::string>("string_map",
+                                                count,
+                                                report)) ||
+      (!run_suite<string_set_type, std::string>("string_set",
+                                                count,
+                                                report)) ||
+      (!run_workloads(count, report))) {
+    return -1;
+  }
+
+  printf("\n");
+  report.print_table(stdout);
+
+  FILE* file;
+  if ((file = fopen(json, "w")) == NULL) {
+    printf("Couldn't open %s.\n", json);
+    return -1;
+  }
+
+  report.print_json(file);
+  fclose(file);
+
+  printf("\nResults written to %s.\n", json);
+
+  return 0;
+}
@@ -0,0 +1,249 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "util/btree/btree_map.h"
+#include "util/btree/concurrent_btree_map.h"
+#include "util/minus.h"
+#include "util/workload.h"
+
+// Multi-threaded throughput benchmark: concurrent_btree_map against a
+// btree_map protected by a mutex, with 1 to N threads.
+// The keys are drawn from the given distribution (uniform, zipfian,
+// scrambled_zipfian, latest or hotspot) over twice the number of keys.
+//
+// Usage: concurrent_bench [max_threads] [number_keys] [operations]
+//                         [distribution]
+
+static const int kNodeSize = 256;
+
+typedef util::btree::concurrent_btree_map<uint64_t,
+                                          uint64_t,
+                                          util::minus<uint64_t>,
+                                          kNodeSize> concurrent_map_type;
+
+typedef util::btree::btree_map<uint64_t,
+                               uint64_t,
+                               util::minus<uint64_t>,
+                               kNodeSize> map_type;
+
+// Workload: percentages of finds and inserts (the rest are erases).
+struct workload {
+  const char* name;
+  unsigned find;
+  unsigned insert;
+};
+
+static const workload kWorkloads[] = {
+  {"read-only (100% find)", 100, 0},
+  {"read-mostly (90% find, 5% insert, 5% erase)", 90, 5},
+  {"balanced (50% find, 25% insert, 25% erase)", 50, 25},
+  {"write-heavy (10% find, 45% insert, 45% erase)", 10, 45}
+};
+
+// Tree protected by a mutex.
+class locked_map {
+  public:
+    bool insert(uint64_t key, uint64_t value)
+    {
+      std::lock_guard<std::mutex> lock(_M_mutex);
+      return _M_map.insert(key, value);
+    }
+
+    bool erase(uint64_t key)
+    {
+      std::lock_guard<std::mutex> lock(_M_mutex);
+      return _M_map.erase(key);
+    }
+
+    bool get(uint64_t key, uint64_t& value)
+    {
+      std::lock_guard<std::mutex> lock(_M_mutex);
+      return _M_map.get(key, value);
+    }
+
+  private:
+    std::mutex _M_mutex;
+    map_type _M_map;
+};
+
+// xorshift64*.
+static inline uint64_t next_random(uint64_t& state)
+{
+  state ^= state >> 12;
+  state ^= state << 25;
+  state ^= state >> 27;
+  return state * 2685821657736338717ULL;
+}
+
+template<typename tree_type>
+static double run(tree_type& tree,
+                  const workload& w,
+                  unsigned nthreads,
+                  uint64_t nkeys,
+                  uint64_t nops,
+                  util::key_distribution::type distribution)
+{
+  std::atomic<unsigned> ready(0);
+  std::atomic<bool> start(false);
+
+  std::vector<std::thread> threads;
+
+  for (unsigned t = 0; t < nthreads; t++) {
+    threads.push_back(std::thread([&, t]() {
+      uint64_t state = 0x9e3779b97f4a7c15ULL * (t + 1);
+      uint64_t n = nops / nthreads;
+      uint64_t sum = 0;
+
+      util::key_distribution keys;
+      keys.init(distribution, 2 * nkeys, state);
+
+      ready++;
+      while (!start) {
+        std::this_thread::yield();
+      }
+
+      for (uint64_t i = 0; i < n; i++) {
+        uint64_t rnd = next_random(state);
+        uint64_t key = keys.next();
+        unsigned op = static_cast<unsigned>(rnd & 0x7f) % 100;
+
+        if (op < w.find) {
+          uint64_t value;
+          if (tree.get(key, value)) {
+            sum += value;
+          }
+        } else if (op < w.find + w.insert) {
+          tree.insert(key, key);
+        } else {
+          tree.erase(key);
+        }
+      }
+
+      // Keep the finds from being optimized away.
+      if (sum == 1) {
+        printf(" ");
+      }
+    }));
+  }
+
+  while (ready < nthreads) {
+    std::this_thread::yield();
+  }
+
+  std::chrono::steady_clock::time_point begin =
+                                             std::chrono::steady_clock::now();
+
+  start = true;
+
+  for (size_t t = 0; t < threads.size(); t++) {
+    threads[t].join();
+  }
+
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() -
+                                          begin;
+
+  return (nops / nthreads) * nthreads / elapsed.count();
+}
+
+template<typename tree_type>
+static void prefill(tree_type& tree, uint64_t nkeys)
+{
+  // Half of the key space is inserted.
+  for (uint64_t key = 0; key < 2 * nkeys; key += 2) {
+    tree.insert(key, key);
+  }
+}
+
+int main(int argc, const char** argv)
+{
+  unsigned max_threads = std::thread::hardware_concurrency();
+  uint64_t nkeys = 1000 * 1000;
+  uint64_t nops = 4 * 1000 * 1000;
+  util::key_distribution::type distribution = util::key_distribution::kUniform;
+
+  if (argc > 1) {
+    max_threads = atoi(argv[1]);
+  }
+
+  if (argc > 2) {
+    nkeys = strtoull(argv[2], NULL, 10);
+  }
+
+  if (argc > 3) {
+    nops = strtoull(argv[3], NULL, 10);
+  }
+
+  if ((argc > 4) && (!util::key_distribution::parse(argv[4], distribution))) {
+    printf("Unknown distribution %s.\n", argv[4]);
+    return -1;
+  }
+
+  if (max_threads == 0) {
+    max_threads = 1;
+  }
+
+  printf("Keys: %llu, operations: %llu, threads: 1 - %u, distribution: %s.\n",
+         static_cast<unsigned long long>(nkeys),
+         static_cast<unsigned long long>(nops),
+         max_threads,
+         util::key_distribution::name(distribution));
+
+  for (size_t i = 0; i < sizeof(kWorkloads) / sizeof(workload); i++) {
+    const workload& w = kWorkloads[i];
+
+    printf("\n%s\n", w.name);
+    printf("%8s %16s %8s %16s %8s\n",
+           "threads",
+           "concurrent op/s",
+           "speedup",
+           "mutex op/s",
+           "speedup");
+
+    double concurrent_base = 0;
+    double locked_base = 0;
+
+    for (unsigned nthreads = 1; ; nthreads *= 2) {
+      if (nthreads > max_threads) {
+        nthreads = max_threads;
+      }
+
+      concurrent_map_type concurrent_map;
+      prefill(concurrent_map, nkeys);
+
+      double concurrent = run(concurrent_map,
+                              w,
+                              nthreads,
+                              nkeys,
+                              nops,
+                              distribution);
+
+      locked_map locked;
+      prefill(locked, nkeys);
+
+      double mutex = run(locked, w, nthreads, nkeys, nops, distribution);
+
+      if (nthreads == 1) {
+        concurrent_base = concurrent;
+        locked_base = mutex;
+      }
+
+      printf("%8u %16.0f %7.2fx %16.0f %7.2fx\n",
+             nthreads,
+             concurrent,
+             concurrent / concurrent_base,
+             mutex,
+             mutex / locked_base);
+
+      if (nthreads == max_threads) {
+        break;
+      }
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,640 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "util/btree/concurrent_btree_map.h"
+#include "util/btree/concurrent_btree_set.h"
+#include "util/minus.h"
+#include "concurrent_map_tests.h"
+
+static const int kNumberKeys = 100 * 1000;
+static const int kNumberThreads = 8;
+
+typedef util::btree::concurrent_btree_map<int,
+                                          int,
+                                          util::minus<int>,
+                                          256> concurrent_map_type;
+
+// Small nodes: deep trees with many splits, rebalances and merges.
+typedef util::btree::concurrent_btree_map<int,
+                                          int,
+                                          util::minus<int>,
+                                          64> concurrent_small_map_type;
+
+typedef util::btree::concurrent_btree_set<int,
+                                          util::minus<int>,
+                                          64> concurrent_set_type;
+
+// Counters of its own (not shared with other instrumented trees).
+struct concurrent_instrumentation_tag {};
+
+typedef util::btree::concurrent_btree_map<int,
+                                          int,
+                                          util::minus<int>,
+                                          64,
+                                          util::btree::malloc_allocator,
+                                          util::btree::counting_instrumentation<
+                                            concurrent_instrumentation_tag
+                                          > > concurrent_instrumented_map_type;
+
+template<typename tree_type>
+static bool perform_tests(tree_type& tree);
+
+template<typename tree_type>
+static bool sequential_test(tree_type& tree);
+
+template<typename tree_type>
+static bool concurrent_insert(tree_type& tree);
+
+template<typename tree_type>
+static bool concurrent_mix(tree_type& tree);
+
+template<typename tree_type>
+static bool concurrent_erase(tree_type& tree);
+
+static bool concurrent_set_test();
+
+static bool concurrent_instrumentation_test();
+
+static bool concurrent_snapshot_test();
+
+bool concurrent_map_tests()
+{
+  printf("\nPerforming concurrent map tests...\n");
+  concurrent_map_type map;
+  if (!perform_tests<concurrent_map_type>(map)) {
+    return false;
+  }
+
+  printf("\nPerforming concurrent map tests (small nodes)...\n");
+  concurrent_small_map_type small_map;
+  if (!perform_tests<concurrent_small_map_type>(small_map)) {
+    return false;
+  }
+
+  printf("\nPerforming concurrent set tests...\n");
+  if (!concurrent_set_test()) {
+    return false;
+  }
+
+  printf("\nPerforming concurrent instrumentation tests...\n");
+  if (!concurrent_instrumentation_test()) {
+    return false;
+  }
+
+  printf("\nPerforming concurrent snapshot tests...\n");
+  if (!concurrent_snapshot_test()) {
+    return false;
+  }
+
+  return true;
+}
+
+template<typename tree_type>
+bool perform_tests(tree_type& tree)
+{
+  if (!sequential_test<tree_type>(tree)) {
+    return false;
+  }
+
+  if (!concurrent_insert<tree_type>(tree)) {
+    return false;
+  }
+
+  if (!concurrent_mix<tree_type>(tree)) {
+    return false;
+  }
+
+  if (!concurrent_erase<tree_type>(tree)) {
+    return false;
+  }
+
+  return true;
+}
+
+template<typename tree_type>
+bool sequential_test(tree_type& tree)
+{
+  printf("[sequential_test] Inserting %d (key, value) pairs...\n",
+         kNumberKeys);
+
+  for (int i = 1; i <= kNumberKeys; i++) {
+    if (!tree.insert(i, i * 2)) {
+      printf("[sequential_test] Couldn't insert key: (%d, %d).\n", i, i * 2);
+      return false;
+    }
+  }
+
+  if (tree.count() != static_cast<size_t>(kNumberKeys)) {
+    printf("Unexpected number of keys (%lu), %d keys expected.\n",
+           tree.count(),
+           kNumberKeys);
+
+    return false;
+  }
+
+  printf("[sequential_test] Erasing odd keys...\n");
+  for (int i = 1; i <= kNumberKeys; i += 2) {
+    if (!tree.erase(i)) {
+      printf("Key (%d) not found.\n", i);
+      return false;
+    }
+  }
+
+  printf("[sequential_test] Finding...\n");
+  for (int i = 1; i <= kNumberKeys; i++) {
+    int value;
+    bool found = tree.get(i, value);
+
+    if ((i % 2) != 0) {
+      if (found) {
+        printf("Key (%d) found after being erased.\n", i);
+        return false;
+      }
+    } else if ((!found) || (value != i * 2)) {
+      printf("Key (%d) not found.\n", i);
+      return false;
+    }
+  }
+
+  printf("[sequential_test] Erasing even keys...\n");
+  for (int i = kNumberKeys; i > 0; i--) {
+    if (((i % 2) == 0) && (!tree.erase(i))) {
+      printf("Key (%d) not found.\n", i);
+      return false;
+    }
+  }
+
+  if (tree.count() != 0) {
+    printf("Unexpected number of keys (%lu), %d keys expected.\n",
+           tree.count(),
+           0);
+
+    return false;
+  }
+
+  return true;
+}
+
+template<typename tree_type>
+bool concurrent_insert(tree_type& tree)
+{
+  printf("[concurrent_insert] Inserting %d (key, value) pairs "
+         "(%d threads)...\n",
+         kNumberKeys,
+         kNumberThreads);
+
+  std::atomic<bool> failed(false);
+  std::atomic<bool> done(false);
+
+  std::vector<std::thread> threads;
+
+  // Each thread inserts the keys 'k' such that k % kNumberThreads == t.
+  for (int t = 0; t < kNumberThreads; t++) {
+    threads.push_back(std::thread([&tree, &failed, t]() {
+      for (int i = 1 + t; i <= kNumberKeys; i += kNumberThreads) {
+        if (!tree.insert(i, i * 2)) {
+          failed = true;
+          return;
+        }
+      }
+    }));
+  }
+
+  // Concurrent reader: every key found must have the right value.
+  std::thread reader([&tree, &failed, &done]() {
+    unsigned seed = 1;
+    while (!done) {
+      seed = (seed * 1103515245) + 12345;
+      int key = 1 + static_cast<int>((seed >> 8) % kNumberKeys);
+
+      int value;
+      if ((tree.get(key, value)) && (value != key * 2)) {
+        failed = true;
+      }
+    }
+  });
+
+  for (size_t t = 0; t < threads.size(); t++) {
+    threads[t].join();
+  }
+
+  done = true;
+  reader.join();
+
+  if (failed) {
+    printf("[concurrent_insert] Failed.\n");
+    return false;
+  }
+
+  if (tree.count() != static_cast<size_t>(kNumberKeys)) {
+    printf("Unexpected number of keys (%lu), %d keys expected.\n",
+           tree.count(),
+           kNumberKeys);
+
+    return false;
+  }
+
+  for (int i = 1; i <= kNumberKeys; i++) {
+    int value;
+    if ((!tree.get(i, value)) || (value != i * 2)) {
+      printf("Key (%d) not found.\n", i);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+template<typename tree_type>
+bool concurrent_mix(tree_type& tree)
+{
+  printf("[concurrent_mix] Erasing odd keys and inserting %d keys "
+         "(%d threads)...\n",
+         kNumberKeys,
+         kNumberThreads);
+
+  std::atomic<bool> failed(false);
+
+  std::vector<std::thread> threads;
+
+  // Each thread erases its odd keys and inserts the keys
+  // (kNumberKeys + 1) - (2 * kNumberKeys) which belong to it.
+  for (int t = 0; t < kNumberThreads; t++) {
+    threads.push_back(std::thread([&tree, &failed, t]() {
+      for (int i = 1 + t; i <= kNumberKeys; i += kNumberThreads) {
+        if (((i % 2) != 0) && (!tree.erase(i))) {
+          failed = true;
+          return;
+        }
+
+        if (!tree.insert(kNumberKeys + i, (kNumberKeys + i) * 2)) {
+          failed = true;
+          return;
+        }
+
+        // The even keys are never modified.
+        int value;
+        int key = (((i / 2) + 1) * 2);
+        if ((key <= kNumberKeys) &&
+            ((!tree.get(key, value)) || (value != key * 2))) {
+          failed = true;
+          return;
+        }
+      }
+    }));
+  }
+
+  for (size_t t = 0; t < threads.size(); t++) {
+    threads[t].join();
+  }
+
+  if (failed) {
+    printf("[concurrent_mix] Failed.\n");
+    return false;
+  }
+
+  size_t expected = kNumberKeys + (kNumberKeys / 2);
+  if (tree.count() != expected) {
+    printf("Unexpected number of keys (%lu), %lu keys expected.\n",
+           tree.count(),
+           expected);
+
+    return false;
+  }
+
+  for (int i = 1; i <= 2 * kNumberKeys; i++) {
+    int value;
+    bool found = tree.get(i, value);
+
+    if ((i <= kNumberKeys) && ((i % 2) != 0)) {
+      if (found) {
+        printf("Key (%d) found after being erased.\n", i);
+        return false;
+      }
+    } else if ((!found) || (value != i * 2)) {
+      printf("Key (%d) not found.\n", i);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+template<typename tree_type>
+bool concurrent_erase(tree_type& tree)
+{
+  printf("[concurrent_erase] Erasing all the keys (%d threads)...\n",
+         kNumberThreads);
+
+  std::atomic<bool> failed(false);
+
+  std::vector<std::thread> threads;
+
+  for (int t = 0; t < kNumberThreads; t++) {
+    threads.push_back(std::thread([&tree, &failed, t]() {
+      for (int i = 1 + t; i <= 2 * kNumberKeys; i += kNumberThreads) {
+        // The odd keys (<= kNumberKeys) have been already erased.
+        bool erased = tree.erase(i);
+        if (erased != ((i > kNumberKeys) || ((i % 2) == 0))) {
+          failed = true;
+          return;
+        }
+      }
+    }));
+  }
+
+  for (size_t t = 0; t < threads.size(); t++) {
+    threads[t].join();
+  }
+
+  if (failed) {
+    printf("[concurrent_erase] Failed.\n");
+    return false;
+  }
+
+  if (tree.count() != 0) {
+    printf("Unexpected number of keys (%lu), %d keys expected.\n",
+           tree.count(),
+           0);
+
+    return false;
+  }
+
+  for (int i = 1; i <= 2 * kNumberKeys; i++) {
+    int value;
+    if (tree.get(i, value)) {
+      printf("Key (%d) found after being erased.\n", i);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool concurrent_set_test()
+{
+  printf("[concurrent_set_test] Inserting %d keys (%d threads)...\n",
+         kNumberKeys,
+         kNumberThreads);
+
+  concurrent_set_type set;
+
+  std::atomic<bool> failed(false);
+
+  std::vector<std::thread> threads;
+
+  for (int t = 0; t < kNumberThreads; t++) {
+    threads.push_back(std::thread([&set, &failed, t]() {
+      for (int i = kNumberKeys - t; i > 0; i -= kNumberThreads) {
+        if (!set.insert(i)) {
+          failed = true;
+          return;
+        }
+      }
+    }));
+  }
+
+  for (size_t t = 0; t < threads.size(); t++) {
+    threads[t].join();
+  }
+
+  if (failed) {
+    printf("[concurrent_set_test] Failed.\n");
+    return false;
+  }
+
+  if (set.count() != static_cast<size_t>(kNumberKeys)) {
+    printf("Unexpected number of keys (%lu), %d keys expected.\n",
+           set.count(),
+           kNumberKeys);
+
+    return false;
+  }
+
+  for (int i = 0; i <= kNumberKeys + 1; i++) {
+    if (set.contains(i) != ((i >= 1) && (i <= kNumberKeys))) {
+      printf("Unexpected result for key (%d).\n", i);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool concurrent_instrumentation_test()
+{
+  concurrent_instrumented_map_type map;
+  concurrent_instrumented_map_type::reset_counters();
+
+  std::vector<std::thread> threads;
+
+  // Each thread inserts its keys and then looks them up; the counters of
+  // the threads which have exited must be kept.
+  for (int t = 0; t < kNumberThreads; t++) {
+    threads.push_back(std::thread([&map, t]() {
+      for (int i = t; i < kNumberKeys; i += kNumberThreads) {
+        map.insert(i, i);
+      }
+
+      for (int i = t; i < kNumberKeys; i += kNumberThreads) {
+        int value;
+        map.get(i, value);
+      }
+    }));
+  }
+
+  for (size_t t = 0; t < threads.size(); t++) {
+    threads[t].join();
+  }
+
+  util::btree::counters c;
+  concurrent_instrumented_map_type::snapshot(c);
+
+  if ((c[util::btree::kLookups] != static_cast<uint64_t>(kNumberKeys)) ||
+      (c[util::btree::kLookupNodeVisits] < 2 * c[util::btree::kLookups]) ||
+      (c[util::btree::kSplits] == 0)) {
+    printf("[concurrent_instrumentation_test] Unexpected counters (lookups: "
+           "%lu, node visits: %lu, splits: %lu).\n",
+           c[util::btree::kLookups],
+           c[util::btree::kLookupNodeVisits],
+           c[util::btree::kSplits]);
+
+    return false;
+  }
+
+  printf("Nodes per lookup: %.2f, splits: %lu.\n",
+         c.nodes_per_lookup(),
+         c[util::btree::kSplits]);
+
+  return true;
+}
+
+// Check the keys of a snapshot: they are visited in order, and each value is
+// the key multiplied by 'factor' (or by 'alt' if not zero).
+struct snapshot_checker {
+  int factor;
+  int alt;
+  int last;
+  size_t count;
+  bool ok;
+
+  snapshot_checker(int factor, int alt)
+    : factor(factor),
+      alt(alt),
+      last(0),
+      count(0),
+      ok(true)
+  {
+  }
+
+  void operator()(int key, int value)
+  {
+    if ((key <= last) ||
+        ((value != key * factor) && ((alt == 0) || (value != key * alt)))) {
+      ok = false;
+    }
+
+    last = key;
+    count++;
+  }
+};
+
+bool concurrent_snapshot_test()
+{
+  printf("[concurrent_snapshot_test] Scanning snapshots while erasing, "
+         "updating and inserting %d keys (%d threads)...\n",
+         kNumberKeys,
+         kNumberThreads);
+
+  concurrent_small_map_type map;
+
+  for (int i = 1; i <= kNumberKeys; i++) {
+    map.insert(i, i * 2);
+  }
+
+  concurrent_small_map_type::snapshot_view view;
+  map.take_snapshot(view);
+
+  std::atomic<bool> failed(false);
+  std::atomic<int> writers(kNumberThreads / 2);
+
+  std::vector<std::thread> threads;
+
+  // Writers: each thread erases its odd keys, updates its even keys and
+  // inserts the keys (kNumberKeys + 1) - (2 * kNumberKeys) which belong to
+  // it.
+  for (int t = 0; t < kNumberThreads / 2; t++) {
+    threads.push_back(std::thread([&map, &failed, &writers, t]() {
+      for (int i = 1 + t; i <= kNumberKeys; i += kNumberThreads / 2) {
+        if ((i % 2) != 0) {
+          if (!map.erase(i)) {
+            failed = true;
+          }
+        } else {
+          map.insert(i, i * 3);
+        }
+
+        if (!map.insert(kNumberKeys + i, (kNumberKeys + i) * 3)) {
+          failed = true;
+        }
+      }
+
+      writers--;
+    }));
+  }
+
+  // Readers: the first snapshot never changes; the snapshots taken while
+  // the writers are running are consistent.
+  for (int t = 0; t < kNumberThreads / 2; t++) {
+    threads.push_back(std::thread([&map, &view, &failed, &writers]() {
+      do {
+        concurrent_small_map_type::snapshot_view v(view);
+
+        snapshot_checker checker(2, 0);
+        if ((v.scan(checker) != static_cast<size_t>(kNumberKeys)) ||
+            (!checker.ok)) {
+          failed = true;
+        }
+
+        int value;
+        if ((!v.get(1, value)) || (value != 2) || (v.contains(0)) ||
+            (v.contains(kNumberKeys + 1))) {
+          failed = true;
+        }
+
+        concurrent_small_map_type::snapshot_view current;
+        map.take_snapshot(current);
+
+        snapshot_checker current_checker(2, 3);
+        current.scan(kNumberKeys / 4, kNumberKeys / 2, current_checker);
+        if (!current_checker.ok) {
+          failed = true;
+        }
+      } while (writers > 0);
+    }));
+  }
+
+  for (size_t t = 0; t < threads.size(); t++) {
+    threads[t].join();
+  }
+
+  if (failed) {
+    printf("[concurrent_snapshot_test] Failed.\n");
+    return false;
+  }
+
+  // The snapshot still has the keys it had when it was taken.
+  snapshot_checker checker(2, 0);
+  if ((view.scan(checker) != static_cast<size_t>(kNumberKeys)) ||
+      (!checker.ok)) {
+    printf("Unexpected keys in the snapshot.\n");
+    return false;
+  }
+
+  snapshot_checker range_checker(2, 0);
+  if ((view.scan(10, 20, range_checker) != 10) || (!range_checker.ok)) {
+    printf("Unexpected keys in the range [10, 20) of the snapshot.\n");
+    return false;
+  }
+
+  view.release();
+
+  // The tree has the keys inserted by the writers.
+  size_t expected = kNumberKeys + (kNumberKeys / 2);
+  if (map.count() != expected) {
+    printf("Unexpected number of keys (%lu), %lu keys expected.\n",
+           map.count(),
+           expected);
+
+    return false;
+  }
+
+  concurrent_small_map_type::snapshot_view current;
+  map.take_snapshot(current);
+
+  snapshot_checker current_checker(3, 0);
+  if ((current.scan(current_checker) != expected) || (!current_checker.ok)) {
+    printf("Unexpected keys in the last snapshot.\n");
+    return false;
+  }
+
+  for (int i = 1; i <= 2 * kNumberKeys; i++) {
+    int value;
+    bool found = map.get(i, value);
+
+    if ((i <= kNumberKeys) && ((i % 2) != 0)) {
+      if (found) {
+        printf("Key (%d) found after being erased.\n", i);
+        return false;
+      }
+    } else if ((!found) || (value != i * 3)) {
+      printf("Key (%d) not found.\n", i);
+      return false;
+    }
+  }
+
+  return true;
+}
@@ -0,0 +1,6 @@
+#ifndef CONCURRENT_MAP_TESTS_H
+#define CONCURRENT_MAP_TESTS_H
+
+bool concurrent_map_tests();
+
+#endif // CONCURRENT_MAP_TESTS_H
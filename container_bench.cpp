@@ -0,0 +1,824 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <malloc.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "util/btree/btree_map.h"
+#include "util/btree/btree_set.h"
+#include "util/less.h"
+
+// Comparison of btree_map, btree_multimap and btree_set with std::map,
+// std::multimap, std::set, std::unordered_map and a sorted std::vector.
+//
+// Every (key type, container, size) combination runs in its own process,
+// so the peak RSS of one doesn't leak into the others. The workloads are
+// sequential insert, random insert, point lookup, range scan (100 keys),
+// erase and mixed operations (1/3 insert, 1/3 erase, 1/3 lookup).
+//
+// Reported per container: time per operation (ns), peak RSS of the process
+// (including the key array shared by all the runs) and heap bytes per key
+// after the random insert.
+//
+// Usage: container_bench [size]...   (default: 10000 1000000 100000000)
+
+static const size_t kScanLength = 100;
+
+// xorshift64*.
+static inline uint64_t next_random(uint64_t& state)
+{
+  state ^= state >> 12;
+  state ^= state << 25;
+  state ^= state >> 27;
+  return state * 2685821657736338717ULL;
+}
+
+// Get number of bytes allocated in the heap.
+static size_t heap_bytes()
+{
+#if defined(__GLIBC__) && \
+    ((__GLIBC__ > 2) || ((__GLIBC__ == 2) && (__GLIBC_MINOR__ >= 33)))
+  return mallinfo2().uordblks;
+#else
+  return static_cast<unsigned>(mallinfo().uordblks);
+#endif
+}
+
+// Get peak RSS (bytes).
+static size_t peak_rss()
+{
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+
+  // Linux reports kilobytes.
+  return static_cast<size_t>(usage.ru_maxrss) * 1024;
+}
+
+// Container adapters.
+// An adapter provides insert(), find(), erase(), scan() and finish() (called
+// after a batch of inserts or erases), and tells whether it supports range
+// scans (kOrdered) and interleaved operations (kMixed).
+template<typename _Key>
+class btree_map_adapter {
+  public:
+    static const bool kOrdered = true;
+    static const bool kMixed = true;
+
+    void insert(const _Key& key, uint64_t value)
+    {
+      _M_map.insert(key, value);
+    }
+
+    bool find(const _Key& key, uint64_t& value) const
+    {
+      return _M_map.get(key, value);
+    }
+
+    void erase(const _Key& key)
+    {
+      _M_map.erase(key);
+    }
+
+    uint64_t scan(const _Key& key, size_t n) const
+    {
+      typename map_type::const_iterator it;
+      uint64_t sum = 0;
+
+      if (_M_map.lower_bound(key, it)) {
+        do {
+          sum += it.value();
+        } while ((--n > 0) && (_M_map.next(it)));
+      }
+
+      return sum;
+    }
+
+    void finish()
+    {
+    }
+
+  private:
+    typedef util::btree::btree_map<_Key, uint64_t, util::less<_Key> > map_type;
+
+    map_type _M_map;
+};
+
+template<typename _Key>
+class btree_multimap_adapter {
+  public:
+    static const bool kOrdered = true;
+    static const bool kMixed = true;
+
+    void insert(const _Key& key, uint64_t value)
+    {
+      _M_map.insert(key, value);
+    }
+
+    bool find(const _Key& key, uint64_t& value) const
+    {
+      return _M_map.get(key, value);
+    }
+
+    void erase(const _Key& key)
+    {
+      _M_map.erase(key);
+    }
+
+    uint64_t scan(const _Key& key, size_t n) const
+    {
+      typename map_type::const_iterator it;
+      uint64_t sum = 0;
+
+      if (_M_map.lower_bound(key, it)) {
+        do {
+          sum += it.value();
+        } while ((--n > 0) && (_M_map.next(it)));
+      }
+
+      return sum;
+    }
+
+    void finish()
+    {
+    }
+
+  private:
+    typedef util::btree::btree_multimap<_Key,
+                                        uint64_t,
+                                        util::less<_Key> > map_type;
+
+    map_type _M_map;
+};
+
+template<typename _Key>
+class btree_set_adapter {
+  public:
+    static const bool kOrdered = true;
+    static const bool kMixed = true;
+
+    void insert(const _Key& key, uint64_t value)
+    {
+      _M_set.insert(key);
+    }
+
+    bool find(const _Key& key, uint64_t& value) const
+    {
+      typename set_type::const_iterator it;
+      if (!_M_set.find(key, it)) {
+        return false;
+      }
+
+      value = 1;
+
+      return true;
+    }
+
+    void erase(const _Key& key)
+    {
+      _M_set.erase(key);
+    }
+
+    uint64_t scan(const _Key& key, size_t n) const
+    {
+      typename set_type::const_iterator it;
+      uint64_t sum = 0;
+
+      if (_M_set.lower_bound(key, it)) {
+        do {
+          sum++;
+        } while ((--n > 0) && (_M_set.next(it)));
+      }
+
+      return sum;
+    }
+
+    void finish()
+    {
+    }
+
+  private:
+    typedef util::btree::btree_set<_Key, util::less<_Key> > set_type;
+
+    set_type _M_set;
+};
+
+template<typename _Key>
+class std_map_adapter {
+  public:
+    static const bool kOrdered = true;
+    static const bool kMixed = true;
+
+    void insert(const _Key& key, uint64_t value)
+    {
+      _M_map.emplace(key, value);
+    }
+
+    bool find(const _Key& key, uint64_t& value) const
+    {
+      typename std::map<_Key, uint64_t>::const_iterator it = _M_map.find(key);
+      if (it == _M_map.end()) {
+        return false;
+      }
+
+      value = it->second;
+
+      return true;
+    }
+
+    void erase(const _Key& key)
+    {
+      _M_map.erase(key);
+    }
+
+    uint64_t scan(const _Key& key, size_t n) const
+    {
+      uint64_t sum = 0;
+
+      typename std::map<_Key, uint64_t>::const_iterator it =
+                                                      _M_map.lower_bound(key);
+
+      for (; (it != _M_map.end()) && (n > 0); ++it, n--) {
+        sum += it->second;
+      }
+
+      return sum;
+    }
+
+    void finish()
+    {
+    }
+
+  private:
+    std::map<_Key, uint64_t> _M_map;
+};
+
+template<typename _Key>
+class std_multimap_adapter {
+  public:
+    static const bool kOrdered = true;
+    static const bool kMixed = true;
+
+    void insert(const _Key& key, uint64_t value)
+    {
+      _M_map.emplace(key, value);
+    }
+
+    bool find(const _Key& key, uint64_t& value) const
+    {
+      typename std::multimap<_Key, uint64_t>::const_iterator it =
+                                                             _M_map.find(key);
+      if (it == _M_map.end()) {
+        return false;
+      }
+
+      value = it->second;
+
+      return true;
+    }
+
+    void erase(const _Key& key)
+    {
+      _M_map.erase(key);
+    }
+
+    uint64_t scan(const _Key& key, size_t n) const
+    {
+      uint64_t sum = 0;
+
+      typename std::multimap<_Key, uint64_t>::const_iterator it =
+                                                      _M_map.lower_bound(key);
+
+      for (; (it != _M_map.end()) && (n > 0); ++it, n--) {
+        sum += it->second;
+      }
+
+      return sum;
+    }
+
+    void finish()
+    {
+    }
+
+  private:
+    std::multimap<_Key, uint64_t> _M_map;
+};
+
+template<typename _Key>
+class std_set_adapter {
+  public:
+    static const bool kOrdered = true;
+    static const bool kMixed = true;
+
+    void insert(const _Key& key, uint64_t value)
+    {
+      _M_set.insert(key);
+    }
+
+    bool find(const _Key& key, uint64_t& value) const
+    {
+      if (_M_set.find(key) == _M_set.end()) {
+        return false;
+      }
+
+      value = 1;
+
+      return true;
+    }
+
+    void erase(const _Key& key)
+    {
+      _M_set.erase(key);
+    }
+
+    uint64_t scan(const _Key& key, size_t n) const
+    {
+      uint64_t sum = 0;
+
+      typename std::set<_Key>::const_iterator it = _M_set.lower_bound(key);
+      for (; (it != _M_set.end()) && (n > 0); ++it, n--) {
+        sum++;
+      }
+
+      return sum;
+    }
+
+    void finish()
+    {
+    }
+
+  private:
+    std::set<_Key> _M_set;
+};
+
+template<typename _Key>
+class std_unordered_map_adapter {
+  public:
+    static const bool kOrdered = false;
+    static const bool kMixed = true;
+
+    void insert(const _Key& key, uint64_t value)
+    {
+      _M_map.emplace(key, value);
+    }
+
+    bool find(const _Key& key, uint64_t& value) const
+    {
+      typename std::unordered_map<_Key, uint64_t>::const_iterator it =
+                                                             _M_map.find(key);
+      if (it == _M_map.end()) {
+        return false;
+      }
+
+      value = it->second;
+
+      return true;
+    }
+
+    void erase(const _Key& key)
+    {
+      _M_map.erase(key);
+    }
+
+    uint64_t scan(const _Key& key, size_t n) const
+    {
+      return 0;
+    }
+
+    void finish()
+    {
+    }
+
+  private:
+    std::unordered_map<_Key, uint64_t> _M_map;
+};
+
+// Sorted vector.
+// Inserting or erasing single elements in the middle is O(n), so inserts
+// are appended and sorted in finish(), and erases mark the elements, which
+// are removed in finish(). Interleaved operations are not supported.
+template<typename _Key>
+class sorted_vector_adapter {
+  public:
+    static const bool kOrdered = true;
+    static const bool kMixed = false;
+
+    void insert(const _Key& key, uint64_t value)
+    {
+      _M_vector.push_back(element(key, value));
+    }
+
+    bool find(const _Key& key, uint64_t& value) const
+    {
+      typename std::vector<element>::const_iterator it = search(key);
+      if ((it == _M_vector.end()) || (it->key != key) || (it->erased)) {
+        return false;
+      }
+
+      value = it->value;
+
+      return true;
+    }
+
+    void erase(const _Key& key)
+    {
+      typename std::vector<element>::iterator it =
+                               _M_vector.begin() + (search(key) -
+                                                    _M_vector.begin());
+
+      if ((it != _M_vector.end()) && (it->key == key)) {
+        it->erased = true;
+      }
+    }
+
+    uint64_t scan(const _Key& key, size_t n) const
+    {
+      uint64_t sum = 0;
+
+      typename std::vector<element>::const_iterator it = search(key);
+      for (; (it != _M_vector.end()) && (n > 0); ++it, n--) {
+        sum += it->value;
+      }
+
+      return sum;
+    }
+
+    void finish()
+    {
+      _M_vector.erase(std::remove_if(_M_vector.begin(),
+                                     _M_vector.end(),
+                                     [](const element& e) {
+                                       return e.erased;
+                                     }),
+                      _M_vector.end());
+
+      std::sort(_M_vector.begin(),
+                _M_vector.end(),
+                [](const element& x, const element& y) {
+                  return x.key < y.key;
+                });
+    }
+
+  private:
+    struct element {
+      _Key key;
+      uint64_t value;
+      bool erased;
+
+      element(const _Key& k, uint64_t v) : key(k), value(v), erased(false) {}
+    };
+
+    std::vector<element> _M_vector;
+
+    typename std::vector<element>::const_iterator search(const _Key& key) const
+    {
+      return std::lower_bound(_M_vector.begin(),
+                              _M_vector.end(),
+                              key,
+                              [](const element& e, const _Key& k) {
+                                return e.key < k;
+                              });
+    }
+};
+
+// Results of a run (nanoseconds per operation; < 0: not supported).
+struct results {
+  double sequential_insert;
+  double random_insert;
+  double lookup;
+  double scan;
+  double erase;
+  double mixed;
+
+  size_t peak_rss;
+  double bytes_per_key;
+};
+
+// Generate keys (in ascending order).
+static void generate_keys(std::vector<uint64_t>& keys, size_t count)
+{
+  for (size_t i = 0; i < count; i++) {
+    keys.push_back(i);
+  }
+}
+
+static void generate_keys(std::vector<std::string>& keys, size_t count)
+{
+  // 24 bytes (not inlined by std::string), zero-padded so the string order
+  // is the numeric order.
+  for (size_t i = 0; i < count; i++) {
+    char key[32];
+    snprintf(key, sizeof(key), "key:%020lu", i);
+
+    keys.push_back(key);
+  }
+}
+
+static double elapsed(std::chrono::steady_clock::time_point begin, size_t n)
+{
+  std::chrono::duration<double, std::nano> d =
+                                    std::chrono::steady_clock::now() - begin;
+
+  return d.count() / n;
+}
+
+// Run the workloads on a container (in the calling process).
+template<typename adapter_type, typename key_type>
+static void run(const std::vector<key_type>& keys,
+                const std::vector<uint32_t>& order,
+                results& r)
+{
+  size_t n = keys.size();
+  uint64_t sum = 0;
+
+  std::chrono::steady_clock::time_point begin;
+
+  // Sequential insert.
+  {
+    adapter_type c;
+
+    begin = std::chrono::steady_clock::now();
+
+    for (size_t i = 0; i < n; i++) {
+      c.insert(keys[i], i);
+    }
+
+    c.finish();
+
+    r.sequential_insert = elapsed(begin, n);
+  }
+
+  // Random insert.
+  size_t heap = heap_bytes();
+
+  adapter_type* c = new adapter_type();
+
+  begin = std::chrono::steady_clock::now();
+
+  for (size_t i = 0; i < n; i++) {
+    c->insert(keys[order[i]], order[i]);
+  }
+
+  c->finish();
+
+  r.random_insert = elapsed(begin, n);
+  r.bytes_per_key = static_cast<double>(heap_bytes() - heap) / n;
+
+  // Point lookup.
+  begin = std::chrono::steady_clock::now();
+
+  for (size_t i = 0; i < n; i++) {
+    uint64_t value;
+    if (c->find(keys[order[n - 1 - i]], value)) {
+      sum += value;
+    }
+  }
+
+  r.lookup = elapsed(begin, n);
+
+  // Range scan.
+  if (adapter_type::kOrdered) {
+    size_t nscans = (n / kScanLength > 0) ? (n / kScanLength) : 1;
+
+    begin = std::chrono::steady_clock::now();
+
+    for (size_t i = 0; i < nscans; i++) {
+      sum += c->scan(keys[order[i]], kScanLength);
+    }
+
+    r.scan = elapsed(begin, nscans);
+  } else {
+    r.scan = -1;
+  }
+
+  // Erase.
+  begin = std::chrono::steady_clock::now();
+
+  for (size_t i = 0; i < n; i++) {
+    c->erase(keys[order[i]]);
+  }
+
+  c->finish();
+
+  r.erase = elapsed(begin, n);
+
+  // Mixed operations, starting with half of the keys.
+  if (adapter_type::kMixed) {
+    for (size_t i = 0; i < n; i += 2) {
+      c->insert(keys[order[i]], order[i]);
+    }
+
+    uint64_t state = 0x2545f4914f6cdd1dULL;
+
+    begin = std::chrono::steady_clock::now();
+
+    for (size_t i = 0; i < n; i++) {
+      uint64_t rnd = next_random(state);
+      const key_type& key = keys[(rnd >> 8) % n];
+
+      switch (rnd % 3) {
+        case 0:
+          c->insert(key, i);
+          break;
+        case 1:
+          c->erase(key);
+          break;
+        default:
+          uint64_t value;
+          if (c->find(key, value)) {
+            sum += value;
+          }
+      }
+    }
+
+    r.mixed = elapsed(begin, n);
+  } else {
+    r.mixed = -1;
+  }
+
+  delete c;
+
+  r.peak_rss = peak_rss();
+
+  // Keep the lookups from being optimized away.
+  if (sum == 1) {
+    printf(" ");
+  }
+}
+
+// Run the workloads on a container in a child process.
+template<typename adapter_type, typename key_type>
+static bool run_process(const char* name,
+                        const std::vector<key_type>& keys,
+                        const std::vector<uint32_t>& order)
+{
+  fflush(stdout);
+
+  int fds[2];
+  if (pipe(fds) < 0) {
+    printf("Couldn't create pipe.\n");
+    return false;
+  }
+
+  pid_t pid;
+  if ((pid = fork()) < 0) {
+    printf("Couldn't fork.\n");
+
+    close(fds[0]);
+    close(fds[1]);
+
+    return false;
+  }
+
+  // Child?
+  if (pid == 0) {
+    close(fds[0]);
+
+    results r;
+    run<adapter_type, key_type>(keys, order, r);
+
+    ssize_t ret = write(fds[1], &r, sizeof(results));
+
+    close(fds[1]);
+
+    _exit((ret == static_cast<ssize_t>(sizeof(results))) ? 0 : 1);
+  }
+
+  close(fds[1]);
+
+  results r;
+  ssize_t ret = read(fds[0], &r, sizeof(results));
+
+  close(fds[0]);
+
+  int status;
+  waitpid(pid, &status, 0);
+
+  if ((ret != static_cast<ssize_t>(sizeof(results))) ||
+      (!WIFEXITED(status)) ||
+      (WEXITSTATUS(status) != 0)) {
+    printf("%-20s run failed (out of memory?)\n", name);
+    return true;
+  }
+
+  char scan[32];
+  char mixed[32];
+
+  if (r.scan < 0) {
+    snprintf(scan, sizeof(scan), "n/a");
+  } else {
+    snprintf(scan, sizeof(scan), "%.1f", r.scan);
+  }
+
+  if (r.mixed < 0) {
+    snprintf(mixed, sizeof(mixed), "n/a");
+  } else {
+    snprintf(mixed, sizeof(mixed), "%.1f", r.mixed);
+  }
+
+  printf("%-20s %10.1f %10.1f %10.1f %10s %10.1f %10s %10.1f %10.1f\n",
+         name,
+         r.sequential_insert,
+         r.random_insert,
+         r.lookup,
+         scan,
+         r.erase,
+         mixed,
+         r.peak_rss / (1024.0 * 1024.0),
+         r.bytes_per_key);
+
+  return true;
+}
+
+template<typename key_type>
+static bool run_size(const char* key_name, size_t n)
+{
+  printf("\n%s keys, %lu elements (ns per operation; scan: ns per %lu "
+         "elements)\n",
+         key_name,
+         n,
+         kScanLength);
+
+  printf("%-20s %10s %10s %10s %10s %10s %10s %10s %10s\n",
+         "container",
+         "seq ins",
+         "rand ins",
+         "lookup",
+         "scan",
+         "erase",
+         "mixed",
+         "RSS (MB)",
+         "bytes/key");
+
+  std::vector<key_type> keys;
+  generate_keys(keys, n);
+
+  // Random permutation.
+  std::vector<uint32_t> order(n);
+  for (size_t i = 0; i < n; i++) {
+    order[i] = static_cast<uint32_t>(i);
+  }
+
+  uint64_t state = 0x9e3779b97f4a7c15ULL;
+  for (size_t i = n; i > 1; i--) {
+    std::swap(order[i - 1], order[next_random(state) % i]);
+  }
+
+  return (run_process<btree_map_adapter<key_type>,
+                      key_type>("btree_map", keys, order)) &&
+         (run_process<btree_multimap_adapter<key_type>,
+                      key_type>("btree_multimap", keys, order)) &&
+         (run_process<btree_set_adapter<key_type>,
+                      key_type>("btree_set", keys, order)) &&
+         (run_process<std_map_adapter<key_type>,
+                      key_type>("std::map", keys, order)) &&
+         (run_process<std_multimap_adapter<key_type>,
+                      key_type>("std::multimap", keys, order)) &&
+         (run_process<std_set_adapter<key_type>,
+                      key_type>("std::set", keys, order)) &&
+         (run_process<std_unordered_map_adapter<key_type>,
+                      key_type>("std::unordered_map", keys, order)) &&
+         (run_process<sorted_vector_adapter<key_type>,
+                      key_type>("sorted std::vector", keys, order));
+}
+
+int main(int argc, const char** argv)
+{
+  std::vector<size_t> sizes;
+
+  for (int i = 1; i < argc; i++) {
+    size_t n = strtoul(argv[i], NULL, 10);
+    if ((n == 0) || (n > UINT32_MAX)) {
+      printf("Usage: %s [size]...\n", argv[0]);
+      return -1;
+    }
+
+    sizes.push_back(n);
+  }
+
+  if (sizes.empty()) {
+    sizes.push_back(10 * 1000);
+    sizes.push_back(1000 * 1000);
+    sizes.push_back(100 * 1000 * 1000);
+  }
+
+  for (size_t i = 0; i < sizes.size(); i++) {
+    if ((!run_size<uint64_t>("int", sizes[i])) ||
+        (!run_size<std::string>("string", sizes[i]))) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
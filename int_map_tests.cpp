@@ -1,8 +1,16 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <limits>
 #include <list>
+#include <memory>
+#include <vector>
 #include "util/btree/btree_map.h"
+#include "util/compare.h"
 #include "util/minus.h"
 #include "util/random_generator.h"
 #include "int_map_tests.h"
@@ -32,59 +40,2775 @@ typedef util::btree::btree_multimap<int,
                                     kNodeSize>::const_iterator
                                     int_multimap_iterator_type;
 
+typedef util::btree::btree_map<int,
+                               int,
+                               util::minus<int>,
+                               kNodeSize,
+                               util::btree::slab_allocator<> >
+                               int_slab_map_type;
+
+typedef util::btree::btree_map<int,
+                               int,
+                               util::minus<int>,
+                               kNodeSize,
+                               util::btree::slab_allocator<> >::const_iterator
+                               int_slab_map_iterator_type;
+
+typedef util::btree::btree_multimap<int,
+                                    int,
+                                    util::minus<int>,
+                                    kNodeSize,
+                                    util::btree::arena_allocator<> >
+                                    int_arena_multimap_type;
+
+typedef util::btree::btree_multimap<int,
+                                    int,
+                                    util::minus<int>,
+                                    kNodeSize,
+                                    util::btree::arena_allocator<> >
+                                    ::const_iterator
+                                    int_arena_multimap_iterator_type;
+
+typedef util::btree::btree_map<int,
+                               int,
+                               util::minus<int>,
+                               kNodeSize,
+                               util::btree::malloc_allocator,
+                               util::btree::counting_instrumentation<> >
+                               int_instrumented_map_type;
+
+typedef util::btree::btree_map<int,
+                               int,
+                               util::minus<int>,
+                               kNodeSize,
+                               util::btree::malloc_allocator,
+                               util::btree::no_instrumentation,
+                               true> int_order_map_type;
+
+typedef util::btree::btree_map<int,
+                               int,
+                               util::minus<int>,
+                               kNodeSize,
+                               util::btree::malloc_allocator,
+                               util::btree::no_instrumentation,
+                               true>::const_iterator
+                               int_order_map_iterator_type;
+
+typedef util::btree::btree_multimap<int,
+                                    int,
+                                    util::minus<int>,
+                                    kNodeSize,
+                                    util::btree::malloc_allocator,
+                                    util::btree::no_instrumentation,
+                                    true> int_order_multimap_type;
+
+typedef util::btree::btree_multimap<int,
+                                    int,
+                                    util::minus<int>,
+                                    kNodeSize,
+                                    util::btree::malloc_allocator,
+                                    util::btree::no_instrumentation,
+                                    true>::const_iterator
+                                    int_order_multimap_iterator_type;
+
+typedef util::btree::btree_map<int,
+                               int,
+                               util::minus<int>,
+                               kNodeSize,
+                               util::btree::malloc_allocator,
+                               util::btree::no_instrumentation,
+                               true,
+                               util::btree::sum_aggregate<int, int64_t> >
+                               int_sum_map_type;
+
+typedef util::btree::btree_multimap<int,
+                                    int,
+                                    util::minus<int>,
+                                    kNodeSize,
+                                    util::btree::malloc_allocator,
+                                    util::btree::no_instrumentation,
+                                    false,
+                                    util::btree::min_aggregate<int> >
+                                    int_min_multimap_type;
+
+typedef util::btree::btree_multimap<int,
+                                    int,
+                                    util::minus<int>,
+                                    kNodeSize,
+                                    util::btree::malloc_allocator,
+                                    util::btree::no_instrumentation,
+                                    false,
+                                    util::btree::max_aggregate<int> >
+                                    int_max_multimap_type;
+
+typedef util::btree::btree_multimap<int,
+                                    int,
+                                    util::minus<int>,
+                                    kNodeSize,
+                                    util::btree::malloc_allocator,
+                                    util::btree::no_instrumentation,
+                                    false,
+                                    util::btree::max_aggregate<int> >
+                                    ::const_iterator
+                                    int_max_multimap_iterator_type;
+
+// Small nodes: a few keys per node, so the trees are deep.
+typedef util::btree::btree_multimap<int64_t,
+                                    int64_t,
+                                    util::less<int64_t>,
+                                    128> int64_multimap_type;
+
+// Small counted nodes: a single key in the internal nodes at the minimum.
+typedef util::btree::btree_multimap<int64_t,
+                                    int64_t,
+                                    util::less<int64_t>,
+                                    128,
+                                    util::btree::malloc_allocator,
+                                    util::btree::no_instrumentation,
+                                    true> int64_order_multimap_type;
+
+// Value which keeps track of the number of live instances.
+struct counted_value {
+  static long live;
+
+  int value;
+
+  counted_value(int v = 0) : value(v) { live++; }
+  counted_value(const counted_value& other) : value(other.value) { live++; }
+  counted_value& operator=(const counted_value& other) = default;
+  ~counted_value() { live--; }
+};
+
+long counted_value::live = 0;
+
+typedef util::btree::btree_multimap<int,
+                                    counted_value,
+                                    util::minus<int>,
+                                    kNodeSize> int_counted_multimap_type;
+
+// Strict weak ordering comparator (binary search).
+struct int64_less {
+  bool operator()(int64_t x, int64_t y) const { return x < y; }
+};
+
+// Three-way comparator (binary search).
+struct int64_compare {
+  int operator()(int64_t x, int64_t y) const { return (x > y) - (x < y); }
+};
+
+// Non-arithmetic key which only defines operator< (ordered by 'hi' and then
+// by 'lo').
+struct pair_key {
+  int hi;
+  int lo;
+
+  pair_key(int h = 0, int l = 0) : hi(h), lo(l) {}
+
+  bool operator<(const pair_key& other) const
+  {
+    return (hi < other.hi) || ((hi == other.hi) && (lo < other.lo));
+  }
+};
+
 template<typename tree_type, typename iterator_type>
 static bool perform_tests(tree_type& tree, int number_repetitions);
 
-template<typename tree_type, typename iterator_type>
-static bool forward_insert(tree_type& tree, int number_repetitions);
+static bool test_slot_construction();
+
+static bool test_stats();
+
+static bool test_append();
+
+static bool test_pop();
+
+static bool test_hint();
+
+static bool test_equal_range();
+
+template<typename tree_type>
+static bool test_erase_range(const char* name);
+
+template<typename tree_type>
+static bool test_erase_duplicates(
+              const char* name,
+              bool split_join,
+              bool (*check)(const tree_type&,
+                            const std::vector<std::pair<int, int> >&)
+            );
+
+template<typename tree_type>
+static bool test_erase_positions(const char* name);
+
+template<typename tree_type>
+static bool check_tree(const tree_type& tree,
+                       const std::vector<std::pair<int, int> >& expected);
+
+template<typename tree_type>
+static bool test_order_statistics(const char* name);
+
+template<typename tree_type>
+static bool check_order_statistics(
+              const tree_type& tree,
+              const std::vector<std::pair<int, int> >& expected,
+              bool full
+            );
+
+template<typename tree_type>
+static bool check_advance(const tree_type& tree,
+                          const std::vector<std::pair<int, int> >& expected);
+
+template<typename tree_type>
+static bool test_split_join(
+              const char* name,
+              bool (*check)(const tree_type&,
+                            const std::vector<std::pair<int, int> >&)
+            );
+
+template<typename tree_type>
+static bool test_set_operations(
+              const char* name,
+              bool (*check)(const tree_type&,
+                            const std::vector<std::pair<int, int> >&)
+            );
+
+template<typename tree_type>
+static bool check_counted_tree(
+              const tree_type& tree,
+              const std::vector<std::pair<int, int> >& expected
+            );
+
+template<typename tree_type>
+static bool check_aggregated_tree(
+              const tree_type& tree,
+              const std::vector<std::pair<int, int> >& expected
+            );
+
+template<typename tree_type>
+static bool test_aggregate(const char* name, bool update_values);
+
+template<typename tree_type>
+static bool check_aggregate(const tree_type& tree,
+                            const std::vector<std::pair<int, int> >& expected);
+
+static bool test_instrumentation();
+
+template<typename key_type, typename compare_type>
+static bool test_comparator(const char* name);
+
+template<typename tree_type>
+static bool test_less_only_key(const char* name);
+
+template<typename tree_type, typename iterator_type>
+static bool forward_insert(tree_type& tree, int number_repetitions);
+
+template<typename tree_type, typename iterator_type>
+static bool backward_insert(tree_type& tree, int number_repetitions);
+
+template<typename tree_type, typename iterator_type>
+static bool middle_insert(tree_type& tree, int number_repetitions);
+
+template<typename tree_type, typename iterator_type>
+static bool forward_erase(tree_type& tree, int number_repetitions);
+
+template<typename tree_type, typename iterator_type>
+static bool backward_erase(tree_type& tree, int number_repetitions);
+
+template<typename tree_type, typename iterator_type>
+static bool middle_erase(tree_type& tree, int number_repetitions);
+
+template<typename tree_type, typename iterator_type>
+static bool test_random(tree_type& tree);
+
+template<typename tree_type, typename iterator_type>
+static bool test_bulk_load(tree_type& tree, int number_repetitions);
+
+template<typename tree_type, typename iterator_type>
+static bool test_multi_get(tree_type& tree, int number_repetitions);
+
+template<typename tree_type, typename iterator_type>
+static bool equal(const tree_type& tree,
+                  const std::list<std::pair<int, int>>& list);
+
+template<typename tree_type, typename iterator_type>
+static bool test_mix(tree_type& tree, int number_repetitions);
+
+template<typename tree_type, typename iterator_type>
+static bool iterate(const tree_type& tree, int number_repetitions);
+
+template<typename tree_type, typename iterator_type>
+static bool reverse_iterate(const tree_type& tree, int number_repetitions);
+
+template<typename tree_type, typename iterator_type>
+static bool find(const tree_type& tree, int number_repetitions);
+
+bool int_map_tests()
+{
+  printf("\nPerforming int map tests...\n");
+  int_map_type int_map;
+  if (!perform_tests<int_map_type, int_map_iterator_type>(int_map, 1)) {
+    return false;
+  }
+
+  printf("\nPerforming int multimap tests...\n");
+  int_multimap_type int_multimap;
+  if (!perform_tests<int_multimap_type,
+                     int_multimap_iterator_type>(int_multimap,
+                                                 kNumberRepetitions)) {
+    return false;
+  }
+
+  printf("\nPerforming int map tests (slab allocator)...\n");
+  int_slab_map_type int_slab_map;
+  if (!perform_tests<int_slab_map_type,
+                     int_slab_map_iterator_type>(int_slab_map, 1)) {
+    return false;
+  }
+
+  printf("\nPerforming int map tests (counted)...\n");
+  int_order_map_type int_order_map;
+  if (!perform_tests<int_order_map_type,
+                     int_order_map_iterator_type>(int_order_map, 1)) {
+    return false;
+  }
+
+  printf("\nPerforming int multimap tests (counted)...\n");
+  int_order_multimap_type int_order_multimap;
+  if (!perform_tests<int_order_multimap_type,
+                     int_order_multimap_iterator_type>(int_order_multimap,
+                                                       1)) {
+    return false;
+  }
+
+  printf("\nPerforming int multimap tests (aggregated)...\n");
+  int_max_multimap_type int_max_multimap;
+  if (!perform_tests<int_max_multimap_type,
+                     int_max_multimap_iterator_type>(int_max_multimap, 1)) {
+    return false;
+  }
+
+  printf("\nPerforming int multimap tests (arena allocator)...\n");
+  int_arena_multimap_type int_arena_multimap;
+  if (!perform_tests<int_arena_multimap_type,
+                     int_arena_multimap_iterator_type>(int_arena_multimap,
+                                                       kNumberRepetitions)) {
+    return false;
+  }
+
+  if (!test_slot_construction()) {
+    return false;
+  }
+
+  if (!test_stats()) {
+    return false;
+  }
+
+  if (!test_append()) {
+    return false;
+  }
+
+  if (!test_pop()) {
+    return false;
+  }
+
+  if (!test_hint()) {
+    return false;
+  }
+
+  if (!test_equal_range()) {
+    return false;
+  }
+
+  if ((!test_erase_range<int_map_type>("map")) ||
+      (!test_erase_range<int_multimap_type>("multimap"))) {
+    return false;
+  }
+
+  if ((!test_erase_duplicates<int64_order_multimap_type>(
+          "counted multimap, small nodes",
+          false,
+          check_counted_tree
+        )) ||
+      (!test_erase_duplicates<int64_multimap_type>(
+          "multimap, small nodes, split and join",
+          true,
+          check_tree
+        )) ||
+      (!test_erase_duplicates<int64_order_multimap_type>(
+          "counted multimap, small nodes, split and join",
+          true,
+          check_counted_tree
+        ))) {
+    return false;
+  }
+
+  if ((!test_erase_positions<int_multimap_type>("multimap")) ||
+      (!test_erase_positions<int_order_multimap_type>("counted multimap")) ||
+      (!test_erase_positions<int64_multimap_type>("multimap, small nodes"))) {
+    return false;
+  }
+
+  if ((!test_order_statistics<int_order_map_type>("map")) ||
+      (!test_order_statistics<int_order_multimap_type>("multimap"))) {
+    return false;
+  }
+
+  if ((!test_aggregate<int_sum_map_type>("sum, counted map", true)) ||
+      (!test_aggregate<int_min_multimap_type>("min, multimap", false)) ||
+      (!test_aggregate<int_max_multimap_type>("max, multimap", false))) {
+    return false;
+  }
+
+  if ((!test_split_join<int_map_type>("map", check_tree)) ||
+      (!test_split_join<int_multimap_type>("multimap", check_tree)) ||
+      (!test_split_join<int_order_multimap_type>("counted multimap",
+                                                 check_counted_tree)) ||
+      (!test_split_join<int_sum_map_type>("sum, counted map",
+                                          check_counted_tree)) ||
+      (!test_split_join<int_min_multimap_type>("min, multimap",
+                                               check_aggregated_tree))) {
+    return false;
+  }
+
+  if ((!test_set_operations<int_map_type>("map", check_tree)) ||
+      (!test_set_operations<int_multimap_type>("multimap", check_tree)) ||
+      (!test_set_operations<int_order_multimap_type>("counted multimap",
+                                                     check_counted_tree)) ||
+      (!test_set_operations<int_min_multimap_type>("min, multimap",
+                                                   check_aggregated_tree))) {
+    return false;
+  }
+
+  if (!test_instrumentation()) {
+    return false;
+  }
+
+  printf("\nPerforming comparator tests...\n");
+  if ((!test_comparator<int64_t, util::less<int64_t> >("util::less")) ||
+      (!test_comparator<int64_t, util::compare<int64_t> >("util::compare")) ||
+      (!test_comparator<uint64_t, std::less<uint64_t> >("std::less")) ||
+      (!test_comparator<int64_t, int64_less>("int64_less")) ||
+      (!test_comparator<int64_t, int64_compare>("int64_compare"))) {
+    return false;
+  }
+
+  if ((!test_less_only_key<util::btree::btree_map<pair_key,
+                                                  int,
+                                                  util::less<pair_key>,
+                                                  kNodeSize> >("map")) ||
+      (!test_less_only_key<util::btree::btree_multimap<pair_key,
+                                                       int,
+                                                       util::less<pair_key>,
+                                                       kNodeSize> >(
+                                                         "multimap"
+                                                       )) ||
+      (!test_less_only_key<util::btree::btree_map<pair_key,
+                                                  int,
+                                                  std::less<pair_key>,
+                                                  kNodeSize> >(
+                                                    "map, std::less"
+                                                  ))) {
+    return false;
+  }
+
+  // Default comparator.
+  util::btree::btree_map<pair_key, int> map;
+  if ((!map.insert(pair_key(1, 2), 12)) ||
+      (!map.insert(pair_key(1, 1), 11)) ||
+      (!map.insert(pair_key(0, 3), 3))) {
+    printf("[test_less_only_key] Couldn't insert key.\n");
+    return false;
+  }
+
+  util::btree::btree_map<pair_key, int>::const_iterator mit;
+  if ((!map.begin(mit)) || (mit.value() != 3) ||
+      (!map.next(mit)) || (mit.value() != 11) ||
+      (!map.next(mit)) || (mit.value() != 12) ||
+      (map.next(mit))) {
+    printf("[test_less_only_key] Invalid order (default comparator).\n");
+    return false;
+  }
+
+  return true;
+}
+
+template<typename key_type, typename compare_type>
+bool test_comparator(const char* name)
+{
+  typedef util::btree::btree_map<key_type,
+                                 key_type,
+                                 compare_type,
+                                 kNodeSize> tree_type;
+
+  static const key_type kMin = std::numeric_limits<key_type>::min();
+  static const key_type kMax = std::numeric_limits<key_type>::max();
+  static const int kNumberExtremeKeys = 1000;
+
+  printf("[test_comparator] Inserting keys near the limits (%s)...\n", name);
+
+  // Keys whose difference overflows: both ends and the middle of the key
+  // range, interleaved.
+  std::vector<key_type> keys;
+  for (int i = 0; i < kNumberExtremeKeys; i++) {
+    keys.push_back(kMax - i);
+    keys.push_back(kMin + i);
+    keys.push_back(kMin / 2 + kMax / 2 + i);
+    keys.push_back(kMin / 2 + kMax / 2 - i - 1);
+  }
+
+  tree_type tree;
+  for (size_t i = 0; i < keys.size(); i++) {
+    if (!tree.insert(keys[i], keys[i])) {
+      printf("[test_comparator] Couldn't insert key.\n");
+      return false;
+    }
+  }
+
+  if (tree.count() != keys.size()) {
+    printf("Unexpected number of keys (%lu), %lu keys expected.\n",
+           tree.count(),
+           keys.size());
+
+    return false;
+  }
+
+  std::sort(keys.begin(), keys.end());
+
+  printf("[test_comparator] Iterating forward (%s)...\n", name);
+
+  typename tree_type::const_iterator it;
+  if (!tree.begin(it)) {
+    printf("[test_comparator] Couldn't get first key.\n");
+    return false;
+  }
+
+  size_t i = 0;
+  do {
+    if ((i == keys.size()) ||
+        (it.key() != keys[i]) ||
+        (it.value() != keys[i])) {
+      printf("[test_comparator] Invalid (key, value) at position %lu.\n", i);
+      return false;
+    }
+
+    i++;
+  } while (tree.next(it));
+
+  if (i != keys.size()) {
+    printf("[test_comparator] Not all the keys were iterated.\n");
+    return false;
+  }
+
+  printf("[test_comparator] Finding (%s)...\n", name);
+
+  for (i = 0; i < keys.size(); i++) {
+    if ((!tree.find(keys[i], it)) || (it.key() != keys[i])) {
+      printf("[test_comparator] Key at position %lu not found.\n", i);
+      return false;
+    }
+  }
+
+  // Keys which are not in the tree.
+  if ((tree.find(kMin + kNumberExtremeKeys, it)) ||
+      (tree.find(kMax - kNumberExtremeKeys, it))) {
+    printf("[test_comparator] Found key which is not in the tree.\n");
+    return false;
+  }
+
+  printf("[test_comparator] Erasing (%s)...\n", name);
+
+  for (i = 0; i < keys.size(); i++) {
+    if (!tree.erase(keys[i])) {
+      printf("[test_comparator] Key at position %lu not found.\n", i);
+      return false;
+    }
+  }
+
+  if (tree.count() != 0) {
+    printf("Unexpected number of keys (%lu), %d keys expected.\n",
+           tree.count(),
+           0);
+
+    return false;
+  }
+
+  return true;
+}
+
+template<typename tree_type>
+bool test_less_only_key(const char* name)
+{
+  static const int kNumberHi = 200;
+  static const int kNumberLo = 50;
+
+  printf("[test_less_only_key] Inserting (%s)...\n", name);
+
+  // Insert in an order which is neither ascending nor descending.
+  tree_type tree;
+  for (int lo = 0; lo < kNumberLo; lo++) {
+    for (int i = 0; i < kNumberHi; i++) {
+      int hi = (i * 7) % kNumberHi;
+      if (!tree.insert(pair_key(hi, lo), (hi * kNumberLo) + lo)) {
+        printf("[test_less_only_key] Couldn't insert key.\n");
+        return false;
+      }
+    }
+  }
+
+  if (tree.count() != static_cast<size_t>(kNumberHi * kNumberLo)) {
+    printf("Unexpected number of keys (%lu), %d keys expected.\n",
+           tree.count(),
+           kNumberHi * kNumberLo);
+
+    return false;
+  }
+
+  printf("[test_less_only_key] Iterating forward (%s)...\n", name);
+
+  typename tree_type::const_iterator it;
+  if (!tree.begin(it)) {
+    printf("[test_less_only_key] Couldn't get first key.\n");
+    return false;
+  }
+
+  int n = 0;
+  do {
+    if ((n == kNumberHi * kNumberLo) || (it.value() != n)) {
+      printf("[test_less_only_key] Invalid value at position %d.\n", n);
+      return false;
+    }
+
+    n++;
+  } while (tree.next(it));
+
+  printf("[test_less_only_key] Finding (%s)...\n", name);
+
+  for (int hi = 0; hi < kNumberHi; hi++) {
+    for (int lo = 0; lo < kNumberLo; lo++) {
+      if ((!tree.find(pair_key(hi, lo), it)) ||
+          (it.value() != (hi * kNumberLo) + lo)) {
+        printf("[test_less_only_key] Key (%d, %d) not found.\n", hi, lo);
+        return false;
+      }
+    }
+  }
+
+  if ((tree.find(pair_key(-1, 0), it)) ||
+      (tree.find(pair_key(0, kNumberLo), it)) ||
+      (tree.find(pair_key(kNumberHi, 0), it))) {
+    printf("[test_less_only_key] Found key which is not in the tree.\n");
+    return false;
+  }
+
+  printf("[test_less_only_key] Erasing (%s)...\n", name);
+
+  for (int hi = 0; hi < kNumberHi; hi++) {
+    for (int lo = 0; lo < kNumberLo; lo++) {
+      if (!tree.erase(pair_key(hi, lo))) {
+        printf("[test_less_only_key] Key (%d, %d) not found.\n", hi, lo);
+        return false;
+      }
+    }
+  }
+
+  if (tree.count() != 0) {
+    printf("Unexpected number of keys (%lu), %d keys expected.\n",
+           tree.count(),
+           0);
+
+    return false;
+  }
+
+  return true;
+}
+
+bool test_stats()
+{
+  printf("\nTesting statistics...\n");
+
+  int_map_type map;
+
+  int_map_type::statistics stats = map.stats();
+  if ((stats.height != 0) || (stats.allocated_bytes != 0)) {
+    printf("[test_stats] Unexpected statistics of an empty tree.\n");
+    return false;
+  }
+
+  // Random order, so the leaves are not completely full.
+  for (int i = 0; i < kNumberKeys; i++) {
+    int key = static_cast<int>((static_cast<int64_t>(i) * 7919) % kNumberKeys);
+    if (!map.insert(key, i)) {
+      printf("[test_stats] Couldn't insert key %d.\n", key);
+      return false;
+    }
+  }
+
+  stats = map.stats();
+
+  if ((stats.keys != static_cast<size_t>(kNumberKeys)) ||
+      (stats.height < 2) ||
+      (stats.levels.size() != stats.height) ||
+      (stats.levels[0].nodes != 1)) {
+    printf("[test_stats] Unexpected height or number of keys.\n");
+    return false;
+  }
+
+  // Each level has one child per key and node of the level above.
+  size_t internal_nodes = 0;
+  for (size_t i = 0; i + 1 < stats.height; i++) {
+    if (stats.levels[i + 1].nodes != stats.levels[i].keys +
+                                     stats.levels[i].nodes) {
+      printf("[test_stats] Unexpected number of nodes in level %lu.\n",
+             i + 1);
+
+      return false;
+    }
+
+    internal_nodes += stats.levels[i].nodes;
+  }
+
+  const int_map_type::level_statistics& leaves =
+                                              stats.levels[stats.height - 1];
+
+  if ((stats.internal_nodes != internal_nodes) ||
+      (stats.leaf_nodes != leaves.nodes) ||
+      (leaves.keys != stats.keys)) {
+    printf("[test_stats] Unexpected number of nodes.\n");
+    return false;
+  }
+
+  for (size_t i = 0; i < stats.height; i++) {
+    const int_map_type::level_statistics& l = stats.levels[i];
+
+    if ((l.min_fill <= 0) ||
+        (l.min_fill > l.average_fill) ||
+        (l.average_fill > 1) ||
+        ((i > 0) && (l.min_fill < 0.3))) {
+      printf("[test_stats] Unexpected fill in level %lu (%f, %f).\n",
+             i,
+             l.min_fill,
+             l.average_fill);
+
+      return false;
+    }
+  }
+
+  if ((stats.allocated_bytes != stats.internal_nodes *
+                                stats.internal_node_size +
+                                stats.leaf_nodes * stats.leaf_node_size) ||
+      (stats.allocated_bytes != stats.key_bytes +
+                                stats.value_bytes +
+                                stats.overhead_bytes) ||
+      (stats.value_bytes != stats.keys * sizeof(int)) ||
+      (stats.key_bytes < stats.keys * sizeof(int)) ||
+      (stats.bytes_per_key !=
+       static_cast<double>(stats.allocated_bytes) / stats.keys)) {
+    printf("[test_stats] Unexpected sizes.\n");
+    return false;
+  }
+
+  printf("Height: %lu, internal nodes: %lu, leaves: %lu, "
+         "leaf fill: %.2f (min %.2f), bytes per key: %.2f.\n",
+         stats.height,
+         stats.internal_nodes,
+         stats.leaf_nodes,
+         leaves.average_fill,
+         leaves.min_fill,
+         stats.bytes_per_key);
+
+  return true;
+}
+
+bool test_append()
+{
+  printf("\nTesting appends...\n");
+
+  int_map_type map;
+
+  // Ascending order: the leaves are split unevenly.
+  for (int i = 0; i < kNumberKeys; i++) {
+    if (!map.insert(2 * i, i)) {
+      printf("[test_append] Couldn't insert key %d.\n", 2 * i);
+      return false;
+    }
+  }
+
+  int_map_type::statistics stats = map.stats();
+  if (stats.levels[stats.height - 1].average_fill < 0.9) {
+    printf("[test_append] Unexpected leaf fill (%f).\n",
+           stats.levels[stats.height - 1].average_fill);
+
+    return false;
+  }
+
+  // Already inserted key (not an append).
+  if ((!map.insert(2 * (kNumberKeys - 1), 0)) ||
+      (map.count() != static_cast<size_t>(kNumberKeys))) {
+    printf("[test_append] Inserted duplicated key.\n");
+    return false;
+  }
+
+  // Keys in between, erasing the last keys and appending again.
+  for (int i = 0; i < kNumberKeys; i += 2) {
+    if ((!map.insert(2 * i + 1, i)) ||
+        (!map.erase(2 * (kNumberKeys - 1) - i)) ||
+        (!map.insert(2 * kNumberKeys + i, i))) {
+      printf("[test_append] Couldn't insert or erase key %d.\n", i);
+      return false;
+    }
+  }
+
+  if (map.count() != static_cast<size_t>(kNumberKeys + kNumberKeys / 2)) {
+    printf("[test_append] Unexpected number of keys (%lu).\n", map.count());
+    return false;
+  }
+
+  int_map_iterator_type it;
+  if (!map.begin(it)) {
+    printf("[test_append] Empty tree.\n");
+    return false;
+  }
+
+  int last = it.key();
+  size_t count = 1;
+  while (map.next(it)) {
+    if (it.key() <= last) {
+      printf("[test_append] Keys not sorted (%d, %d).\n", last, it.key());
+      return false;
+    }
+
+    last = it.key();
+    count++;
+  }
+
+  if ((count != map.count()) || (last != 2 * kNumberKeys + kNumberKeys - 2)) {
+    printf("[test_append] Unexpected iteration.\n");
+    return false;
+  }
+
+  // Duplicated keys are appended after the equal ones.
+  int_multimap_type multimap;
+  for (int i = 0; i < kNumberKeys; i++) {
+    if (!multimap.insert(i / 4, i)) {
+      printf("[test_append] Couldn't insert key %d.\n", i / 4);
+      return false;
+    }
+  }
+
+  int_multimap_iterator_type mit;
+  if (!multimap.begin(mit)) {
+    printf("[test_append] Empty tree.\n");
+    return false;
+  }
+
+  int i = 0;
+  do {
+    if ((mit.key() != i / 4) || (mit.value() != i)) {
+      printf("[test_append] Unexpected key %d (value %d).\n",
+             mit.key(),
+             mit.value());
+
+      return false;
+    }
+
+    i++;
+  } while (multimap.next(mit));
+
+  if (i != kNumberKeys) {
+    printf("[test_append] Unexpected number of keys (%d).\n", i);
+    return false;
+  }
+
+  // Erasing everything.
+  for (i = 0; i < kNumberKeys; i++) {
+    if (!multimap.erase(i / 4)) {
+      printf("[test_append] Couldn't erase key %d.\n", i / 4);
+      return false;
+    }
+  }
+
+  if ((multimap.count() != 0) || (!multimap.insert(1, 1))) {
+    printf("[test_append] Unexpected state after erasing.\n");
+    return false;
+  }
+
+  printf("Leaf fill after appending: %.2f.\n",
+         stats.levels[stats.height - 1].average_fill);
+
+  return true;
+}
+
+bool test_pop()
+{
+  printf("\nTesting pop_front() and pop_back()...\n");
+
+  int_map_type map;
+
+  if ((map.pop_front()) || (map.pop_back())) {
+    printf("[test_pop] Popped key from an empty tree.\n");
+    return false;
+  }
+
+  for (int i = 0; i < kNumberKeys; i++) {
+    int key = static_cast<int>((static_cast<int64_t>(i) * 7919) % kNumberKeys);
+    if (!map.insert(key, key)) {
+      printf("[test_pop] Couldn't insert key %d.\n", key);
+      return false;
+    }
+  }
+
+  // Pop from both ends alternately.
+  int front = 0;
+  int back = kNumberKeys - 1;
+  for (int i = 0; i < kNumberKeys; i++) {
+    int_map_iterator_type it;
+    int key, value;
+
+    if ((i % 2) == 0) {
+      if ((!map.begin(it)) ||
+          (it.key() != front) ||
+          (!map.pop_front(key, value)) ||
+          (key != front) ||
+          (value != front)) {
+        printf("[test_pop] Unexpected first key (%d).\n", front);
+        return false;
+      }
+
+      front++;
+    } else {
+      if ((!map.end(it)) ||
+          (it.key() != back) ||
+          (!map.pop_back(key, value)) ||
+          (key != back) ||
+          (value != back)) {
+        printf("[test_pop] Unexpected last key (%d).\n", back);
+        return false;
+      }
+
+      back--;
+    }
+
+    if (map.count() != static_cast<size_t>(kNumberKeys - i - 1)) {
+      printf("[test_pop] Unexpected number of keys (%lu).\n", map.count());
+      return false;
+    }
+  }
+
+  if ((map.pop_front()) || (map.pop_back())) {
+    printf("[test_pop] Popped key from an empty tree.\n");
+    return false;
+  }
+
+  // Duplicated keys: first in, first out.
+  int_multimap_type multimap;
+  for (int i = 0; i < kNumberKeys; i++) {
+    if (!multimap.insert(i % 1000, i)) {
+      printf("[test_pop] Couldn't insert key %d.\n", i % 1000);
+      return false;
+    }
+  }
+
+  for (int i = 0; i < kNumberKeys / 2; i++) {
+    int key, value;
+
+    if ((!multimap.pop_front(key, value)) ||
+        (key != i / (kNumberKeys / 1000)) ||
+        (value != key + (i % (kNumberKeys / 1000)) * 1000)) {
+      printf("[test_pop] Unexpected first key %d (value %d).\n", key, value);
+      return false;
+    }
+
+    if ((!multimap.pop_back(key, value)) ||
+        (key != 999 - i / (kNumberKeys / 1000)) ||
+        (value != key + (kNumberKeys / 1000 - 1 -
+                         i % (kNumberKeys / 1000)) * 1000)) {
+      printf("[test_pop] Unexpected last key %d (value %d).\n", key, value);
+      return false;
+    }
+  }
+
+  if ((multimap.count() != 0) || (!multimap.insert(1, 1))) {
+    printf("[test_pop] Unexpected state after popping.\n");
+    return false;
+  }
+
+  return true;
+}
+
+bool test_hint()
+{
+  printf("\nTesting hinted operations...\n");
+
+  int_map_type map;
+  int_map_type::iterator hint;
+
+  // Even keys, then odd keys (between the even ones), in ascending order.
+  for (int i = 0; i < 2 * kNumberKeys; i++) {
+    int key = (i < kNumberKeys) ? 2 * i : 2 * (i - kNumberKeys) + 1;
+    if ((!map.insert(hint, key, key)) || (hint.key() != key)) {
+      printf("[test_hint] Couldn't insert key %d.\n", key);
+      return false;
+    }
+  }
+
+  // Already inserted key: the value is replaced.
+  if ((!map.insert(hint, 7, -7)) ||
+      (hint.key() != 7) ||
+      (hint.value() != -7) ||
+      (map.count() != static_cast<size_t>(2 * kNumberKeys))) {
+    printf("[test_hint] Unexpected insertion of duplicated key.\n");
+    return false;
+  }
+
+  int_map_iterator_type it;
+  if (!map.begin(it)) {
+    printf("[test_hint] Empty tree.\n");
+    return false;
+  }
+
+  int i = 0;
+  do {
+    if ((it.key() != i) || (it.value() != ((i == 7) ? -7 : i))) {
+      printf("[test_hint] Unexpected key %d (%d expected).\n", it.key(), i);
+      return false;
+    }
+
+    i++;
+  } while (map.next(it));
+
+  if (i != 2 * kNumberKeys) {
+    printf("[test_hint] Unexpected number of keys (%d).\n", i);
+    return false;
+  }
+
+  // Erase every third key, so some lookups miss.
+  for (i = 0; i < 2 * kNumberKeys; i += 3) {
+    map.erase(i);
+  }
+
+  // Lookups close to (and far from) the previous one must agree with the
+  // ones descending the tree.
+  int_map_iterator_type finger;
+  map.begin(finger);
+
+  for (i = 0; i < kNumberKeys; i++) {
+    int key = ((i % 100) == 0) ?
+                static_cast<int>((static_cast<int64_t>(i) * 7919) %
+                                 (2 * kNumberKeys + 10)) - 5 :
+                finger.key() + (i % 7) - 3;
+
+    int_map_iterator_type expected, found;
+    bool b1 = map.lower_bound(key, expected);
+    bool b2 = map.lower_bound(finger, key, found);
+
+    if ((b1 != b2) || ((b1) && (expected != found))) {
+      printf("[test_hint] Unexpected lower bound of %d.\n", key);
+      return false;
+    }
+
+    if (!map.find(finger, key, found) != !b1) {
+      printf("[test_hint] Unexpected result finding %d.\n", key);
+      return false;
+    }
+
+    if (b1) {
+      finger = found;
+    }
+  }
+
+  // Duplicated keys are inserted after the equal ones.
+  int_multimap_type multimap;
+  int_multimap_type::iterator mhint;
+
+  for (i = 0; i < kNumberKeys; i++) {
+    if (!multimap.insert(mhint, i % 100, i)) {
+      printf("[test_hint] Couldn't insert key %d.\n", i % 100);
+      return false;
+    }
+
+    if ((mhint.key() != i % 100) || (mhint.value() != i)) {
+      printf("[test_hint] Unexpected hint after inserting %d.\n", i);
+      return false;
+    }
+  }
+
+  int_multimap_iterator_type mit;
+  multimap.begin(mit);
+
+  i = 0;
+  do {
+    int key = i / (kNumberKeys / 100);
+    int value = key + (i % (kNumberKeys / 100)) * 100;
+
+    if ((mit.key() != key) || (mit.value() != value)) {
+      printf("[test_hint] Unexpected key %d (value %d).\n",
+             mit.key(),
+             mit.value());
+
+      return false;
+    }
+
+    i++;
+  } while (multimap.next(mit));
+
+  return true;
+}
+
+bool test_equal_range()
+{
+  printf("\nTesting equal_range() and count(key)...\n");
+
+  // Key k is inserted k times: the long runs span several leaf nodes.
+  static const int kMaxKey = 1000;
+
+  int_multimap_type multimap;
+  for (int k = 1; k <= kMaxKey; k++) {
+    for (int i = 0; i < k; i++) {
+      int key = (k * 7919) % kMaxKey + 1;
+      if (!multimap.insert(key, i)) {
+        printf("[test_equal_range] Couldn't insert key %d.\n", key);
+        return false;
+      }
+    }
+  }
+
+  for (int key = 0; key <= kMaxKey + 1; key++) {
+    // Number of times 'key' was inserted.
+    size_t expected = 0;
+    for (int k = 1; k <= kMaxKey; k++) {
+      if ((k * 7919) % kMaxKey + 1 == key) {
+        expected = k;
+      }
+    }
+
+    if (multimap.count(key) != expected) {
+      printf("[test_equal_range] Unexpected count of key %d (%lu, %lu).\n",
+             key,
+             multimap.count(key),
+             expected);
+
+      return false;
+    }
+
+    int_multimap_iterator_type begin, end;
+    if (!multimap.equal_range(key, begin, end)) {
+      if (expected > 0) {
+        printf("[test_equal_range] Key %d not found.\n", key);
+        return false;
+      }
+
+      continue;
+    }
+
+    size_t n = 0;
+    bool more = true;
+    while ((more) && (begin != end)) {
+      if ((begin.key() != key) || (begin.value() != static_cast<int>(n))) {
+        printf("[test_equal_range] Unexpected key %d in range of %d.\n",
+               begin.key(),
+               key);
+
+        return false;
+      }
+
+      n++;
+      more = multimap.next(begin);
+    }
+
+    // 'end' points to the next key (unless 'key' is the last one).
+    if ((n != expected) || ((more) && (end.key() != key + 1))) {
+      printf("[test_equal_range] Unexpected range of key %d.\n", key);
+      return false;
+    }
+  }
+
+  int_map_type map;
+  map.insert(1, 1);
+  map.insert(3, 3);
+
+  int_map_type::iterator begin, end;
+  if ((map.count(1) != 1) ||
+      (map.count(2) != 0) ||
+      (!map.equal_range(1, begin, end)) ||
+      (end.key() != 3)) {
+    printf("[test_equal_range] Unexpected count or range in a map.\n");
+    return false;
+  }
+
+  return true;
+}
+
+template<typename tree_type>
+bool test_erase_range(const char* name)
+{
+  printf("\nTesting range erase (%s)...\n", name);
+
+  static const int kMaxKey = 4 * kNumberKeys;
+  static const int kNumberRounds = 300;
+  static const int kNumberDuplicates = 100;
+
+  typedef std::vector<std::pair<int, int> > vector_type;
+
+  tree_type tree;
+  vector_type expected;
+
+  srand(7);
+
+  for (int round = 0; round < kNumberRounds; round++) {
+    // Refill the tree.
+    while (tree.count() < static_cast<size_t>(kNumberKeys)) {
+      int key = rand() % kMaxKey;
+      size_t count = tree.count();
+
+      if (!tree.insert(key, key)) {
+        printf("[test_erase_range] Couldn't insert key %d.\n", key);
+        return false;
+      }
+
+      if (tree.count() != count) {
+        expected.push_back(std::make_pair(key, key));
+      }
+    }
+
+    std::sort(expected.begin(), expected.end());
+
+    // From a few keys up to the whole tree.
+    int length = ((round % 10) == 9) ?
+                   2 * kMaxKey :
+                   rand() % ((kMaxKey >> (round % 9)) + 1);
+
+    int lo = rand() % kMaxKey - length / 2;
+    int hi = lo + length;
+
+    size_t n = 0;
+
+    switch (round % 3) {
+      case 0:
+        n = tree.erase_range(lo, hi);
+        break;
+      case 1:
+        {
+          // Erase the keys from an iterator to another one (the last one
+          // included or not).
+          typename tree_type::iterator first, last;
+          size_t i = rand() % expected.size();
+          size_t j = i + rand() % (expected.size() - i);
+          bool inclusive = ((rand() % 2) == 0);
+
+          lo = expected[i].first;
+          hi = expected[j].first;
+
+          if ((!tree.find(lo, first)) || (!tree.find(hi, last))) {
+            printf("[test_erase_range] Key not found.\n");
+            return false;
+          }
+
+          // Move the iterators from the first keys equal to theirs to the
+          // positions 'i' and 'j' (among the duplicates).
+          vector_type::iterator it;
+          it = std::lower_bound(expected.begin(),
+                                expected.end(),
+                                std::make_pair(lo, lo));
+
+          for (size_t k = it - expected.begin(); k < i; k++) {
+            tree.next(first);
+          }
+
+          it = std::lower_bound(expected.begin(),
+                                expected.end(),
+                                std::make_pair(hi, hi));
+
+          for (size_t k = it - expected.begin(); k < j; k++) {
+            tree.next(last);
+          }
+
+          n = tree.erase(first, last, inclusive);
+
+          if (inclusive) {
+            j++;
+          }
+
+          if (n != j - i) {
+            printf("[test_erase_range] Unexpected number of keys erased "
+                   "(%lu, %lu expected).\n",
+                   n,
+                   j - i);
+
+            return false;
+          }
+
+          expected.erase(expected.begin() + i, expected.begin() + j);
+
+          if (!check_tree(tree, expected)) {
+            return false;
+          }
+        }
+
+        continue;
+      default:
+        // Erase all the duplicates of a key.
+        lo = rand() % kMaxKey;
+        hi = lo + 1;
+
+        for (int i = 0; i < kNumberDuplicates; i++) {
+          size_t count = tree.count();
+          tree.insert(lo, lo);
+
+          if (tree.count() != count) {
+            expected.push_back(std::make_pair(lo, lo));
+          }
+        }
+
+        std::sort(expected.begin(), expected.end());
+
+        n = tree.erase_all(lo);
+    }
+
+    vector_type::iterator first = std::lower_bound(expected.begin(),
+                                                   expected.end(),
+                                                   std::make_pair(lo, lo));
+
+    vector_type::iterator last = std::lower_bound(expected.begin(),
+                                                  expected.end(),
+                                                  std::make_pair(hi, hi));
+
+    if ((lo < hi) &&
+        (n != static_cast<size_t>(last - first))) {
+      printf("[test_erase_range] Unexpected number of keys erased "
+             "(%lu, %ld expected).\n",
+             n,
+             last - first);
+
+      return false;
+    }
+
+    if (lo < hi) {
+      expected.erase(first, last);
+    }
+
+    if (!check_tree(tree, expected)) {
+      return false;
+    }
+  }
+
+  // The structure of the tree must allow erasing the rest of the keys one
+  // by one.
+  for (size_t i = 0; i < expected.size(); i++) {
+    if (!tree.erase(expected[i].first)) {
+      printf("[test_erase_range] Couldn't erase key %d.\n",
+             expected[i].first);
+
+      return false;
+    }
+  }
+
+  if (tree.count() != 0) {
+    printf("[test_erase_range] Unexpected number of keys (%lu).\n",
+           tree.count());
+
+    return false;
+  }
+
+  return true;
+}
+
+template<typename tree_type>
+bool test_erase_duplicates(
+       const char* name,
+       bool split_join,
+       bool (*check)(const tree_type&,
+                     const std::vector<std::pair<int, int> >&)
+     )
+{
+  printf("\nTesting erase of duplicated keys (%s)...\n", name);
+
+  // Appends, range erases and splits leave nodes with fewer keys than the
+  // minimum; erasing a key equal to a separator must repair a single child.
+  static const int kNumberRounds = 40;
+  static const int kNumberOperations = 1000;
+  static const int kMaxKey = 40;
+
+  for (int round = 0; round < kNumberRounds; round++) {
+    tree_type tree;
+    std::vector<int64_t> expected;
+
+    srand(round);
+
+    int64_t last = 0;
+
+    for (int op = 0; op < kNumberOperations; op++) {
+      int operation = rand() % 8;
+
+      int64_t key = last;
+      if ((operation < 6) || ((split_join) && (operation == 7))) {
+        key = (rand() % kMaxKey) - (kMaxKey / 2);
+      }
+
+      switch (operation) {
+        case 0:
+          tree.insert(key, key);
+          expected.push_back(key);
+          break;
+        case 1:
+          {
+            // Append keys (some of them duplicated).
+            int n = rand() % 40;
+            for (int i = 0; i < n; i++) {
+              if ((rand() % 3) != 0) {
+                last++;
+              }
+
+              tree.insert(last, last);
+              expected.push_back(last);
+            }
+          }
+
+          break;
+        case 2:
+          {
+            typename tree_type::iterator hint;
+            if ((tree.lower_bound(key + (rand() % 5), hint)) ||
+                (tree.end(hint))) {
+              tree.insert(hint, key, key);
+            } else {
+              tree.insert(key, key);
+            }
+
+            expected.push_back(key);
+          }
+
+          break;
+        case 3:
+        case 4:
+          {
+            std::sort(expected.begin(), expected.end());
+
+            std::vector<int64_t>::iterator it =
+                std::lower_bound(expected.begin(), expected.end(), key);
+
+            bool found = ((it != expected.end()) && (*it == key));
+            if (tree.erase(key) != found) {
+              printf("[test_erase_duplicates] Unexpected result erasing "
+                     "key %ld.\n",
+                     static_cast<long>(key));
+
+              return false;
+            }
+
+            if (found) {
+              expected.erase(it);
+            }
+          }
+
+          break;
+        case 5:
+          {
+            int64_t hi = key + rand() % 30;
+            tree.erase_range(key, hi);
+
+            std::sort(expected.begin(), expected.end());
+            expected.erase(std::lower_bound(expected.begin(),
+                                            expected.end(),
+                                            key),
+                           std::lower_bound(expected.begin(),
+                                            expected.end(),
+                                            hi));
+          }
+
+          break;
+        default:
+          std::sort(expected.begin(), expected.end());
+
+          if ((split_join) && (operation == 7)) {
+            // Split the tree and join the halves back.
+            tree_type right;
+            if ((!tree.split(key, right)) ||
+                (!tree.join(right))) {
+              printf("[test_erase_duplicates] Error splitting/joining.\n");
+              return false;
+            }
+          } else {
+            // Look the last appended key up (the tree is left untouched).
+            typename tree_type::const_iterator it;
+            if (tree.find(key, it) != std::binary_search(expected.begin(),
+                                                         expected.end(),
+                                                         key)) {
+              printf("[test_erase_duplicates] Unexpected result looking up "
+                     "key %ld.\n",
+                     static_cast<long>(key));
+
+              return false;
+            }
+
+            continue;
+          }
+      }
+
+      if (last < key) {
+        last = key;
+      }
+
+      // The number of keys must match the keys reached by iterating.
+      std::sort(expected.begin(), expected.end());
+
+      size_t n = 0;
+
+      typename tree_type::const_iterator it;
+      if (tree.begin(it)) {
+        do {
+          if ((n == expected.size()) || (it.key() != expected[n])) {
+            printf("[test_erase_duplicates] Unexpected key %ld.\n",
+                   static_cast<long>(it.key()));
+
+            return false;
+          }
+
+          n++;
+        } while (tree.next(it));
+      }
+
+      if ((n != expected.size()) || (tree.count() != expected.size())) {
+        printf("[test_erase_duplicates] Unexpected number of keys (%lu, "
+               "%lu iterated, %lu expected).\n",
+               tree.count(),
+               n,
+               expected.size());
+
+        return false;
+      }
+
+      // The counts of the subtrees must match as well (counted trees).
+      std::vector<std::pair<int, int> > pairs;
+      for (size_t i = 0; i < expected.size(); i++) {
+        pairs.push_back(std::make_pair(expected[i], expected[i]));
+      }
+
+      if (!check(tree, pairs)) {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+template<typename tree_type>
+bool test_erase_positions(const char* name)
+{
+  printf("\nTesting erase between iterators (%s)...\n", name);
+
+  typedef typename tree_type::key_type key_type;
+  typedef typename tree_type::value_type value_type;
+  typedef std::vector<std::pair<key_type, value_type> > vector_type;
+
+  static const int kNumberRounds = 200;
+  static const int kMaxKey = 20;
+
+  srand(11);
+
+  for (int round = 0; round < kNumberRounds; round++) {
+    // Long runs of duplicates (told apart by their values).
+    tree_type tree;
+    int nkeys = 1 + rand() % 5000;
+    for (int i = 0; i < nkeys; i++) {
+      tree.insert(rand() % kMaxKey, i);
+    }
+
+    vector_type expected;
+
+    typename tree_type::iterator it;
+    tree.begin(it);
+    do {
+      expected.push_back(std::make_pair(it.key(), it.value()));
+    } while (tree.next(it));
+
+    size_t i = rand() % expected.size();
+    size_t j = i + rand() % (expected.size() - i);
+    bool inclusive = ((rand() % 2) == 0);
+
+    typename tree_type::iterator first, last;
+    tree.begin(first);
+    for (size_t k = 0; k < i; k++) {
+      tree.next(first);
+    }
+
+    last = first;
+    for (size_t k = i; k < j; k++) {
+      tree.next(last);
+    }
+
+    size_t n = tree.erase(first, last, inclusive);
+
+    if (inclusive) {
+      j++;
+    }
+
+    if (n != j - i) {
+      printf("[test_erase_positions] Unexpected number of keys erased "
+             "(%lu, %lu expected).\n",
+             n,
+             j - i);
+
+      return false;
+    }
+
+    expected.erase(expected.begin() + i, expected.begin() + j);
+
+    if (tree.count() != expected.size()) {
+      printf("[test_erase_positions] Unexpected number of keys (%lu, %lu "
+             "expected).\n",
+             tree.count(),
+             expected.size());
+
+      return false;
+    }
+
+    // The keys left must be the ones outside of the positions (and the
+    // tree must still be valid for inserting and erasing).
+    size_t k = 0;
+    if (tree.begin(it)) {
+      do {
+        if ((it.key() != expected[k].first) ||
+            (it.value() != expected[k].second)) {
+          printf("[test_erase_positions] Unexpected key %ld (%ld "
+                 "expected).\n",
+                 static_cast<long>(it.key()),
+                 static_cast<long>(expected[k].first));
+
+          return false;
+        }
+
+        k++;
+      } while (tree.next(it));
+    }
+
+    for (k = 0; k < expected.size(); k++) {
+      if (!tree.erase(expected[k].first)) {
+        printf("[test_erase_positions] Couldn't erase key %ld.\n",
+               static_cast<long>(expected[k].first));
+
+        return false;
+      }
+    }
+
+    if (tree.count() != 0) {
+      printf("[test_erase_positions] Unexpected number of keys (%lu).\n",
+             tree.count());
+
+      return false;
+    }
+  }
+
+  return true;
+}
+
+template<typename tree_type>
+bool check_tree(const tree_type& tree,
+                const std::vector<std::pair<int, int> >& expected)
+{
+  if (tree.count() != expected.size()) {
+    printf("[check_tree] Unexpected number of keys (%lu, %lu expected).\n",
+           tree.count(),
+           expected.size());
+
+    return false;
+  }
+
+  if (expected.empty()) {
+    return true;
+  }
+
+  // Forward and backward (the leaf nodes must stay linked).
+  typename tree_type::const_iterator it;
+  tree.begin(it);
+
+  size_t i = 0;
+  do {
+    if ((it.key() != expected[i].first) || (it.value() != expected[i].second)) {
+      printf("[check_tree] Unexpected key %d (%d expected).\n",
+             static_cast<int>(it.key()),
+             expected[i].first);
+
+      return false;
+    }
+
+    i++;
+  } while (tree.next(it));
+
+  tree.end(it);
+
+  size_t j = expected.size();
+  do {
+    if (it.key() != expected[--j].first) {
+      printf("[check_tree] Unexpected key %d (%d expected).\n",
+             static_cast<int>(it.key()),
+             expected[j].first);
+
+      return false;
+    }
+  } while (tree.prev(it));
+
+  if ((i != expected.size()) || (j != 0)) {
+    printf("[check_tree] Unexpected number of keys iterated.\n");
+    return false;
+  }
+
+  // No node below the root without keys.
+  typename tree_type::statistics stats = tree.stats();
+  for (size_t l = 1; l < stats.height; l++) {
+    if (stats.levels[l].min_fill <= 0) {
+      printf("[check_tree] Node without keys in level %lu.\n", l);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+template<typename tree_type>
+bool test_order_statistics(const char* name)
+{
+  printf("\nTesting order statistics (%s)...\n", name);
+
+  static const int kMaxKey = 2 * kNumberKeys;
+  static const int kNumberRounds = 60;
+  static const int kBatchSize = kNumberKeys / 10;
+
+  typedef std::vector<std::pair<int, int> > vector_type;
+
+  tree_type tree;
+  vector_type expected;
+
+  srand(11);
+
+  // Start from a bulk-loaded tree.
+  std::vector<int> keys;
+  for (int i = 0; i < kNumberKeys; i++) {
+    keys.push_back(rand() % kMaxKey);
+  }
+
+  std::sort(keys.begin(), keys.end());
+  keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+  if (!tree.bulk_load(&keys[0], &keys[0], keys.size(), 0.7f)) {
+    printf("[test_order_statistics] Bulk load failed.\n");
+    return false;
+  }
+
+  for (size_t i = 0; i < keys.size(); i++) {
+    expected.push_back(std::make_pair(keys[i], keys[i]));
+  }
+
+  if (!check_order_statistics(tree, expected, true)) {
+    return false;
+  }
+
+  for (int round = 0; round < kNumberRounds; round++) {
+    switch (round % 5) {
+      case 0:
+        // Insert random keys.
+        for (int i = 0; i < kBatchSize; i++) {
+          int key = rand() % kMaxKey;
+          size_t count = tree.count();
+
+          if (!tree.insert(key, key)) {
+            printf("[test_order_statistics] Couldn't insert key %d.\n", key);
+            return false;
+          }
+
+          if (tree.count() != count) {
+            expected.push_back(std::make_pair(key, key));
+          }
+        }
+
+        break;
+      case 1:
+        // Erase random keys (some of them not in the tree).
+        for (int i = 0; i < kBatchSize; i++) {
+          int key = rand() % kMaxKey;
+
+          vector_type::iterator it = std::lower_bound(expected.begin(),
+                                                      expected.end(),
+                                                      std::make_pair(key,
+                                                                     key));
+
+          bool found = ((it != expected.end()) && (it->first == key));
+
+          if (tree.erase(key) != found) {
+            printf("[test_order_statistics] Unexpected result erasing "
+                   "key %d.\n",
+                   key);
+
+            return false;
+          }
+
+          if (found) {
+            expected.erase(it);
+          }
+        }
+
+        break;
+      case 2:
+        // Erase the first and the last keys.
+        for (int i = 0; (i < kBatchSize / 10) && (!expected.empty()); i++) {
+          if (!tree.pop_front()) {
+            printf("[test_order_statistics] pop_front() failed.\n");
+            return false;
+          }
+
+          expected.erase(expected.begin());
+
+          if (!tree.pop_back()) {
+            printf("[test_order_statistics] pop_back() failed.\n");
+            return false;
+          }
+
+          expected.pop_back();
+        }
+
+        break;
+      case 3:
+        // Erase a range.
+        {
+          int lo = rand() % kMaxKey;
+          int hi = lo + rand() % (kMaxKey / 20);
+
+          vector_type::iterator first =
+            std::lower_bound(expected.begin(),
+                             expected.end(),
+                             std::make_pair(lo, lo));
+
+          vector_type::iterator last =
+            std::lower_bound(expected.begin(),
+                             expected.end(),
+                             std::make_pair(hi, hi));
+
+          if (tree.erase_range(lo, hi) != static_cast<size_t>(last - first)) {
+            printf("[test_order_statistics] Unexpected number of keys "
+                   "erased.\n");
+
+            return false;
+          }
+
+          expected.erase(first, last);
+        }
+
+        break;
+      default:
+        // Insert keys close to a hint, selected by position.
+        {
+          typename tree_type::iterator hint;
+          if (!tree.select(rand() % tree.count(), hint)) {
+            printf("[test_order_statistics] select() failed.\n");
+            return false;
+          }
+
+          int key = hint.key();
+
+          for (int i = 0; i < kBatchSize; i++) {
+            size_t count = tree.count();
+
+            if (!tree.insert(hint, key, key)) {
+              printf("[test_order_statistics] Couldn't insert key %d.\n",
+                     key);
+
+              return false;
+            }
+
+            if (tree.count() != count) {
+              expected.push_back(std::make_pair(key, key));
+            }
+
+            key += 1 + rand() % 3;
+          }
+        }
+    }
+
+    std::sort(expected.begin(), expected.end());
+
+    if (!check_order_statistics(tree, expected, (round % 10) == 9)) {
+      return false;
+    }
+  }
+
+  // Walking the leaf nodes (trees without counts) must give the same
+  // result as selecting the position.
+  typedef util::btree::btree_multimap<int,
+                                      int,
+                                      util::minus<int>,
+                                      kNodeSize> plain_tree_type;
+
+  plain_tree_type plain;
+  for (size_t i = 0; i < expected.size(); i++) {
+    plain.insert(expected[i].first, expected[i].second);
+  }
+
+  return ((check_advance(tree, expected)) && (check_advance(plain, expected)));
+}
+
+template<typename tree_type>
+bool check_order_statistics(const tree_type& tree,
+                            const std::vector<std::pair<int, int> >& expected,
+                            bool full)
+{
+  typedef std::vector<std::pair<int, int> > vector_type;
+
+  if (tree.count() != expected.size()) {
+    printf("[check_order_statistics] Unexpected number of keys "
+           "(%lu, %lu expected).\n",
+           tree.count(),
+           expected.size());
+
+    return false;
+  }
+
+  // Select all the positions (or some of them) and go back to them.
+  size_t step = (full) ? 1 : 97;
+
+  typename tree_type::const_iterator it;
+  for (size_t k = 0; k < expected.size(); k += step) {
+    if ((!tree.select(k, it)) || (it.key() != expected[k].first)) {
+      printf("[check_order_statistics] Couldn't select position %lu.\n", k);
+      return false;
+    }
+
+    if (tree.rank(it) != k) {
+      printf("[check_order_statistics] Unexpected rank %lu (%lu "
+             "expected).\n",
+             tree.rank(it),
+             k);
+
+      return false;
+    }
+  }
+
+  if (tree.select(expected.size(), it)) {
+    printf("[check_order_statistics] Position out of range selected.\n");
+    return false;
+  }
+
+  // Ranks and counts of keys (inserted or not).
+  for (int i = 0; i < 1000; i++) {
+    int key = rand() % (2 * kNumberKeys + 2) - 1;
+    int hi = key + rand() % 1000;
+
+    vector_type::const_iterator first =
+      std::lower_bound(expected.begin(),
+                       expected.end(),
+                       std::make_pair(key, std::numeric_limits<int>::min()));
+
+    vector_type::const_iterator last =
+      std::upper_bound(expected.begin(),
+                       expected.end(),
+                       std::make_pair(key, std::numeric_limits<int>::max()));
+
+    vector_type::const_iterator end =
+      std::lower_bound(expected.begin(),
+                       expected.end(),
+                       std::make_pair(hi, std::numeric_limits<int>::min()));
+
+    if ((tree.rank(key) != static_cast<size_t>(first - expected.begin())) ||
+        (tree.count(key) != static_cast<size_t>(last - first)) ||
+        (tree.count_range(key, hi) != static_cast<size_t>(end - first))) {
+      printf("[check_order_statistics] Unexpected rank or count of key "
+             "%d.\n",
+             key);
+
+      return false;
+    }
+  }
+
+  return true;
+}
+
+template<typename tree_type>
+bool check_advance(const tree_type& tree,
+                   const std::vector<std::pair<int, int> >& expected)
+{
+  ptrdiff_t size = expected.size();
+
+  typename tree_type::const_iterator it;
+  tree.begin(it);
+
+  ptrdiff_t k = 0;
+
+  for (int i = 0; i < 10000; i++) {
+    // Short moves (mostly within the leaf node) and long ones.
+    ptrdiff_t n = ((i % 4) == 0) ? rand() % (2 * size) - size :
+                                   rand() % 201 - 100;
+
+    typename tree_type::const_iterator prev = it;
+
+    if (tree.advance(it, n) != ((k + n >= 0) && (k + n < size))) {
+      printf("[check_advance] Unexpected result advancing %ld positions "
+             "from %ld.\n",
+             n,
+             k);
+
+      return false;
+    }
+
+    if ((k + n >= 0) && (k + n < size)) {
+      k += n;
+    } else if (it != prev) {
+      printf("[check_advance] Iterator moved out of range.\n");
+      return false;
+    }
+
+    if (it.key() != expected[k].first) {
+      printf("[check_advance] Unexpected key %d at position %ld (%d "
+             "expected).\n",
+             it.key(),
+             k,
+             expected[k].first);
+
+      return false;
+    }
+  }
+
+  return true;
+}
+
+template<typename tree_type>
+bool test_aggregate(const char* name, bool update_values)
+{
+  printf("\nTesting aggregates (%s)...\n", name);
+
+  static const int kMaxKey = 2 * kNumberKeys;
+  static const int kNumberRounds = 40;
+  static const int kBatchSize = kNumberKeys / 10;
+
+  typedef std::vector<std::pair<int, int> > vector_type;
+
+  tree_type tree;
+  vector_type expected;
+
+  srand(13);
+
+  // The duplicates of a key have the same value unless the values are
+  // updated (maps): the reference doesn't need to know which duplicate is
+  // erased.
+  std::vector<int> keys;
+  std::vector<int> values;
+  for (int i = 0; i < kNumberKeys; i += 3) {
+    keys.push_back(i);
+    values.push_back(i % 1000 - 500);
+    expected.push_back(std::make_pair(i, i % 1000 - 500));
+  }
+
+  if (!tree.bulk_load(&keys[0], &values[0], keys.size(), 0.8f)) {
+    printf("[test_aggregate] Bulk load failed.\n");
+    return false;
+  }
+
+  if (!check_aggregate(tree, expected)) {
+    return false;
+  }
+
+  for (int round = 0; round < kNumberRounds; round++) {
+    switch (round % 4) {
+      case 0:
+        // Insert random keys (and update the values of some of them).
+        for (int i = 0; i < kBatchSize; i++) {
+          int key = rand() % kMaxKey;
+          int value = (update_values) ? rand() % 1000 - 500 : key % 1000 - 500;
+
+          size_t count = tree.count();
+
+          if (!tree.insert(key, value)) {
+            printf("[test_aggregate] Couldn't insert key %d.\n", key);
+            return false;
+          }
+
+          vector_type::iterator it =
+            std::lower_bound(expected.begin(),
+                             expected.end(),
+                             std::make_pair(key,
+                                            std::numeric_limits<int>::min()));
+
+          if (tree.count() != count) {
+            expected.insert(it, std::make_pair(key, value));
+          } else {
+            it->second = value;
+          }
+        }
+
+        break;
+      case 1:
+        // Erase random keys.
+        for (int i = 0; i < kBatchSize; i++) {
+          int key = rand() % kMaxKey;
+
+          vector_type::iterator it =
+            std::lower_bound(expected.begin(),
+                             expected.end(),
+                             std::make_pair(key,
+                                            std::numeric_limits<int>::min()));
+
+          bool found = ((it != expected.end()) && (it->first == key));
+
+          if (tree.erase(key) != found) {
+            printf("[test_aggregate] Unexpected result erasing key %d.\n",
+                   key);
+
+            return false;
+          }
+
+          if (found) {
+            expected.erase(it);
+          }
+        }
+
+        break;
+      case 2:
+        // Erase the first and the last keys.
+        for (int i = 0; (i < kBatchSize / 10) && (!expected.empty()); i++) {
+          if ((!tree.pop_front()) || (!tree.pop_back())) {
+            printf("[test_aggregate] pop_front() / pop_back() failed.\n");
+            return false;
+          }
+
+          expected.erase(expected.begin());
+          expected.pop_back();
+        }
+
+        break;
+      default:
+        // Erase a range.
+        {
+          int lo = rand() % kMaxKey;
+          int hi = lo + rand() % (kMaxKey / 20);
+
+          vector_type::iterator first =
+            std::lower_bound(expected.begin(),
+                             expected.end(),
+                             std::make_pair(lo,
+                                            std::numeric_limits<int>::min()));
+
+          vector_type::iterator last =
+            std::lower_bound(expected.begin(),
+                             expected.end(),
+                             std::make_pair(hi,
+                                            std::numeric_limits<int>::min()));
+
+          if (tree.erase_range(lo, hi) != static_cast<size_t>(last - first)) {
+            printf("[test_aggregate] Unexpected number of keys erased.\n");
+            return false;
+          }
+
+          expected.erase(first, last);
+        }
+    }
+
+    if (!check_aggregate(tree, expected)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+template<typename tree_type>
+bool check_aggregate(const tree_type& tree,
+                     const std::vector<std::pair<int, int> >& expected)
+{
+  typedef typename tree_type::aggregate_type aggregate_type;
+  typedef typename tree_type::summary_type summary_type;
+
+  typedef std::vector<std::pair<int, int> > vector_type;
+
+  if (tree.count() != expected.size()) {
+    printf("[check_aggregate] Unexpected number of keys (%lu, %lu "
+           "expected).\n",
+           tree.count(),
+           expected.size());
+
+    return false;
+  }
+
+  for (int i = 0; i < 200; i++) {
+    // Short and long ranges, some of them covering the whole tree.
+    int lo = rand() % (2 * kNumberKeys + 2) - 1;
+    int hi = ((i % 10) == 0) ? std::numeric_limits<int>::max() :
+                               lo + rand() % ((i % 2) ? 100 : kNumberKeys);
+
+    if ((i % 20) == 0) {
+      lo = std::numeric_limits<int>::min();
+    }
+
+    vector_type::const_iterator first =
+      std::lower_bound(expected.begin(),
+                       expected.end(),
+                       std::make_pair(lo, std::numeric_limits<int>::min()));
+
+    vector_type::const_iterator last =
+      std::lower_bound(expected.begin(),
+                       expected.end(),
+                       std::make_pair(hi, std::numeric_limits<int>::min()));
+
+    summary_type s = aggregate_type::identity();
+    for (; first < last; ++first) {
+      s = aggregate_type::combine(s, aggregate_type::summarize(first->second));
+    }
+
+    if (tree.reduce(lo, hi) != s) {
+      printf("[check_aggregate] Unexpected summary of [%d, %d).\n", lo, hi);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+template<typename tree_type>
+bool test_split_join(const char* name,
+                     bool (*check)(const tree_type&,
+                                   const std::vector<std::pair<int, int> >&))
+{
+  printf("\nTesting split and join (%s)...\n", name);
+
+  static const int kMaxKey = 2 * kNumberKeys;
+  static const int kNumberRounds = 120;
+  static const int kNumberDuplicates = 500;
+  static const int kBatchSize = 100;
+
+  typedef std::vector<std::pair<int, int> > vector_type;
+
+  tree_type tree;
+  vector_type expected;
+
+  srand(17);
+
+  for (int i = 0; i < kNumberKeys; i++) {
+    // A run of duplicates spanning several leaf nodes (multimaps).
+    int key = (i < kNumberDuplicates) ? kMaxKey / 2 : rand() % kMaxKey;
+    size_t count = tree.count();
+
+    if (!tree.insert(key, key)) {
+      printf("[test_split_join] Couldn't insert key %d.\n", key);
+      return false;
+    }
+
+    if (tree.count() != count) {
+      expected.push_back(std::make_pair(key, key));
+    }
+  }
+
+  std::sort(expected.begin(), expected.end());
+
+  if (!check(tree, expected)) {
+    return false;
+  }
+
+  for (int round = 0; round < kNumberRounds; round++) {
+    // Split close to both ends (trees of very different heights), in the
+    // middle of the run of duplicates and out of the range of the keys.
+    int offset = rand() % ((kMaxKey >> (round % 16)) + 1);
+
+    int key;
+    switch (round % 6) {
+      case 0:
+        key = offset;
+        break;
+      case 1:
+        key = kMaxKey - offset;
+        break;
+      case 2:
+        key = kMaxKey / 2;
+        break;
+      case 3:
+        key = ((round % 12) == 3) ? -1 : kMaxKey + 1;
+        break;
+      default:
+        key = rand() % kMaxKey;
+    }
+
+    tree_type right;
+    if (!tree.split(key, right)) {
+      printf("[test_split_join] Couldn't split at key %d.\n", key);
+      return false;
+    }
+
+    vector_type::iterator it =
+      std::lower_bound(expected.begin(),
+                       expected.end(),
+                       std::make_pair(key, std::numeric_limits<int>::min()));
+
+    vector_type left_expected(expected.begin(), it);
+    vector_type right_expected(it, expected.end());
+
+    if ((tree.empty() != left_expected.empty()) ||
+        (right.empty() != right_expected.empty())) {
+      printf("[test_split_join] Unexpected empty tree.\n");
+      return false;
+    }
+
+    // Erase keys before counting them (the number of keys of the trees
+    // which are not counted is only known after count()).
+    if ((round % 5) == 4) {
+      if ((!left_expected.empty()) &&
+          (!tree.erase(left_expected.back().first))) {
+        printf("[test_split_join] Couldn't erase key %d.\n",
+               left_expected.back().first);
+
+        return false;
+      }
+
+      if ((!right_expected.empty()) &&
+          (!right.erase(right_expected.front().first))) {
+        printf("[test_split_join] Couldn't erase key %d.\n",
+               right_expected.front().first);
+
+        return false;
+      }
+
+      if (!left_expected.empty()) {
+        left_expected.pop_back();
+      }
+
+      if (!right_expected.empty()) {
+        right_expected.erase(right_expected.begin());
+      }
+    }
+
+    if ((!check(tree, left_expected)) || (!check(right, right_expected))) {
+      return false;
+    }
+
+    // Both trees keep working on their own.
+    for (int i = 0; i < kBatchSize; i++) {
+      tree_type& t = (i % 2) ? right : tree;
+      vector_type& v = (i % 2) ? right_expected : left_expected;
+
+      int k = (i % 2) ? key + rand() % (kMaxKey / 10) :
+                        key - 1 - rand() % (kMaxKey / 10);
+
+      size_t count = t.count();
+
+      if (!t.insert(k, k)) {
+        printf("[test_split_join] Couldn't insert key %d.\n", k);
+        return false;
+      }
+
+      if (t.count() != count) {
+        v.insert(std::upper_bound(v.begin(), v.end(), std::make_pair(k, k)),
+                 std::make_pair(k, k));
+      }
+    }
+
+    if ((!check(tree, left_expected)) || (!check(right, right_expected))) {
+      return false;
+    }
+
+    // Trees whose keys overlap can't be joined, and a tree can't be split
+    // into a tree which is not empty.
+    if ((tree.count() > 0) && (right.count() > 0)) {
+      if ((right.join(tree)) || (tree.split(key, right))) {
+        printf("[test_split_join] Overlapping trees joined or split.\n");
+        return false;
+      }
+    }
+
+    if (!tree.join(right)) {
+      printf("[test_split_join] Couldn't join the trees.\n");
+      return false;
+    }
+
+    if (right.count() != 0) {
+      printf("[test_split_join] Keys left in the joined tree.\n");
+      return false;
+    }
+
+    expected = left_expected;
+    expected.insert(expected.end(),
+                    right_expected.begin(),
+                    right_expected.end());
+
+    if (!check(tree, expected)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// Compare the keys of two pairs.
+static bool key_less(const std::pair<int, int>& x,
+                     const std::pair<int, int>& y)
+{
+  return (x.first < y.first);
+}
+
+template<typename tree_type>
+bool test_set_operations(
+       const char* name,
+       bool (*check)(const tree_type&, const std::vector<std::pair<int, int> >&)
+     )
+{
+  printf("\nTesting set operations (%s)...\n", name);
+
+  // Sizes of the operands: similar, different, very different (the
+  // larger tree is skipped over) and empty.
+  static const int kSizes[][2] = {
+    {kNumberKeys / 2, kNumberKeys / 2},
+    {kNumberKeys / 2, kNumberKeys / 20},
+    {kNumberKeys / 100, kNumberKeys},
+    {kNumberKeys, kNumberKeys / 1000},
+    {0, kNumberKeys / 10}
+  };
+
+  static const char* kOperations[] = {
+    "union",
+    "intersection",
+    "difference",
+    "symmetric difference",
+    "merge"
+  };
+
+  typedef std::vector<std::pair<int, int> > vector_type;
+
+  // Does the tree keep duplicates?
+  tree_type probe;
+  probe.insert(0, 0);
+  probe.insert(0, 0);
+
+  bool duplicates = (probe.count() == 2);
+
+  srand(19);
+
+  for (size_t s = 0; s < sizeof(kSizes) / sizeof(kSizes[0]); s++) {
+    // The keys of the trees overlap; the values tell where they come from.
+    int max_key = 2 * std::max(kSizes[s][0], kSizes[s][1]);
+
+    tree_type x;
+    tree_type y;
+    vector_type xv;
+    vector_type yv;
+
+    for (int t = 0; t < 2; t++) {
+      tree_type& tree = (t == 0) ? x : y;
+      vector_type& v = (t == 0) ? xv : yv;
+
+      for (int i = 0; i < kSizes[s][t]; i++) {
+        int key = rand() % max_key;
+        int value = (t == 0) ? key : -key;
+        size_t count = tree.count();
+
+        if (!tree.insert(key, value)) {
+          printf("[test_set_operations] Couldn't insert key %d.\n", key);
+          return false;
+        }
+
+        if (tree.count() != count) {
+          v.push_back(std::make_pair(key, value));
+        }
+      }
+
+      std::sort(v.begin(), v.end(), key_less);
+    }
+
+    for (int op = 0; op < 5; op++) {
+      tree_type result;
+      vector_type expected;
+      bool ret = false;
+
+      switch (op) {
+        case 0:
+          ret = result.set_union(x, y);
+          std::set_union(xv.begin(),
+                         xv.end(),
+                         yv.begin(),
+                         yv.end(),
+                         std::back_inserter(expected),
+                         key_less);
+
+          break;
+        case 1:
+          ret = result.set_intersection(x, y);
+          std::set_intersection(xv.begin(),
+                                xv.end(),
+                                yv.begin(),
+                                yv.end(),
+                                std::back_inserter(expected),
+                                key_less);
+
+          break;
+        case 2:
+          ret = result.set_difference(x, y);
+          std::set_difference(xv.begin(),
+                              xv.end(),
+                              yv.begin(),
+                              yv.end(),
+                              std::back_inserter(expected),
+                              key_less);
+
+          break;
+        case 3:
+          ret = result.set_symmetric_difference(x, y);
+          std::set_symmetric_difference(xv.begin(),
+                                        xv.end(),
+                                        yv.begin(),
+                                        yv.end(),
+                                        std::back_inserter(expected),
+                                        key_less);
+
+          break;
+        default:
+          ret = result.merge(x, y);
+
+          // Without duplicates, the keys of 'y' equal to keys of 'x' are
+          // dropped.
+          if (duplicates) {
+            std::merge(xv.begin(),
+                       xv.end(),
+                       yv.begin(),
+                       yv.end(),
+                       std::back_inserter(expected),
+                       key_less);
+          } else {
+            std::set_union(xv.begin(),
+                           xv.end(),
+                           yv.begin(),
+                           yv.end(),
+                           std::back_inserter(expected),
+                           key_less);
+          }
+      }
+
+      if (!ret) {
+        printf("[test_set_operations] Set %s failed.\n", kOperations[op]);
+        return false;
+      }
+
+      if (!check(result, expected)) {
+        printf("[test_set_operations] Unexpected set %s (%d, %d keys).\n",
+               kOperations[op],
+               kSizes[s][0],
+               kSizes[s][1]);
+
+        return false;
+      }
+
+      // The result must be empty.
+      if ((result.count() > 0) && (result.set_union(x, y))) {
+        printf("[test_set_operations] Set union into a non-empty tree.\n");
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+template<typename tree_type>
+bool check_counted_tree(const tree_type& tree,
+                        const std::vector<std::pair<int, int> >& expected)
+{
+  return ((check_tree(tree, expected)) &&
+          (check_order_statistics(tree, expected, false)));
+}
 
-template<typename tree_type, typename iterator_type>
-static bool backward_insert(tree_type& tree, int number_repetitions);
+template<typename tree_type>
+bool check_aggregated_tree(const tree_type& tree,
+                           const std::vector<std::pair<int, int> >& expected)
+{
+  return ((check_tree(tree, expected)) && (check_aggregate(tree, expected)));
+}
 
-template<typename tree_type, typename iterator_type>
-static bool middle_insert(tree_type& tree, int number_repetitions);
+bool test_instrumentation()
+{
+  printf("\nTesting instrumentation...\n");
 
-template<typename tree_type, typename iterator_type>
-static bool forward_erase(tree_type& tree, int number_repetitions);
+  int_instrumented_map_type map;
+  int_instrumented_map_type::reset_counters();
 
-template<typename tree_type, typename iterator_type>
-static bool backward_erase(tree_type& tree, int number_repetitions);
+  util::btree::counters c;
 
-template<typename tree_type, typename iterator_type>
-static bool middle_erase(tree_type& tree, int number_repetitions);
+  for (int i = 0; i < kNumberKeys; i++) {
+    map.insert(i, i);
+  }
 
-template<typename tree_type, typename iterator_type>
-static bool test_random(tree_type& tree);
+  int_instrumented_map_type::snapshot(c);
 
-template<typename tree_type, typename iterator_type>
-static bool equal(const tree_type& tree,
-                  const std::list<std::pair<int, int>>& list);
+  if ((c[util::btree::kSplits] == 0) ||
+      (c[util::btree::kMerges] != 0) ||
+      (c[util::btree::kRebalanceOrMergeAttempts] != 0)) {
+    printf("[test_instrumentation] Unexpected number of splits or merges.\n");
+    return false;
+  }
 
-template<typename tree_type, typename iterator_type>
-static bool test_mix(tree_type& tree, int number_repetitions);
+  // Each lookup visits one node per level.
+  size_t height = map.stats().height;
 
-template<typename tree_type, typename iterator_type>
-static bool iterate(const tree_type& tree, int number_repetitions);
+  int_instrumented_map_type::reset_counters();
 
-template<typename tree_type, typename iterator_type>
-static bool reverse_iterate(const tree_type& tree, int number_repetitions);
+  for (int i = 0; i < kNumberKeys; i++) {
+    int value;
+    if ((!map.get(i, value)) || (value != i)) {
+      printf("[test_instrumentation] Key %d not found.\n", i);
+      return false;
+    }
+  }
 
-template<typename tree_type, typename iterator_type>
-static bool find(const tree_type& tree, int number_repetitions);
+  int_instrumented_map_type::snapshot(c);
 
-bool int_map_tests()
+  if ((c[util::btree::kLookups] != static_cast<uint64_t>(kNumberKeys)) ||
+      (c[util::btree::kLookupNodeVisits] != kNumberKeys * height) ||
+      (c[util::btree::kSplits] != 0) ||
+      (c[util::btree::kRebalanceOrMergeAttempts] != 0)) {
+    printf("[test_instrumentation] Unexpected number of lookups (%lu) or "
+           "node visits (%lu).\n",
+           c[util::btree::kLookups],
+           c[util::btree::kLookupNodeVisits]);
+
+    return false;
+  }
+
+  for (int i = 0; i < kNumberKeys; i++) {
+    map.erase(i);
+  }
+
+  int_instrumented_map_type::snapshot(c);
+
+  if ((c[util::btree::kMerges] == 0) ||
+      (c[util::btree::kRebalancesRightToLeft] == 0)) {
+    printf("[test_instrumentation] Unexpected number of merges or "
+           "rebalances.\n");
+
+    return false;
+  }
+
+  // Every erase tries to repair one child per internal level.
+  if ((c[util::btree::kRebalanceOrMergeAttempts] <
+         static_cast<uint64_t>(kNumberKeys)) ||
+      (c[util::btree::kRebalanceOrMergeAttempts] <
+         c[util::btree::kMerges] +
+         c[util::btree::kRebalancesLeftToRight] +
+         c[util::btree::kRebalancesRightToLeft])) {
+    printf("[test_instrumentation] Unexpected number of rebalance or merge "
+           "attempts (%lu).\n",
+           c[util::btree::kRebalanceOrMergeAttempts]);
+
+    return false;
+  }
+
+  printf("Nodes per lookup: %.2f, merges: %lu, rebalances: %lu, "
+         "rebalance or merge attempts: %lu.\n",
+         c.nodes_per_lookup(),
+         c[util::btree::kMerges],
+         c[util::btree::kRebalancesLeftToRight] +
+         c[util::btree::kRebalancesRightToLeft],
+         c[util::btree::kRebalanceOrMergeAttempts]);
+
+  // Popping keys repairs the edge of the tree.
+  for (int i = 0; i < kNumberKeys; i++) {
+    map.insert(i, i);
+  }
+
+  int_instrumented_map_type::reset_counters();
+
+  while (map.pop_front()) {
+  }
+
+  int_instrumented_map_type::snapshot(c);
+
+  if ((c[util::btree::kRebalanceOrMergeAttempts] == 0) ||
+      (c[util::btree::kMerges] == 0)) {
+    printf("[test_instrumentation] Unexpected number of rebalance or merge "
+           "attempts (%lu) while popping keys.\n",
+           c[util::btree::kRebalanceOrMergeAttempts]);
+
+    return false;
+  }
+
+  int_instrumented_map_type::reset_counters();
+  int_instrumented_map_type::snapshot(c);
+
+  for (unsigned i = 0; i < util::btree::kNumberEvents; i++) {
+    if (c.events[i] != 0) {
+      printf("[test_instrumentation] Counters not reset.\n");
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool test_slot_construction()
 {
-  printf("\nPerforming int map tests...\n");
-  int_map_type int_map;
-  if (!perform_tests<int_map_type, int_map_iterator_type>(int_map, 1)) {
+  printf("\nPerforming slot construction tests...\n");
+
+  int_counted_multimap_type tree;
+
+  // Only the occupied slots hold live values.
+  for (int i = 1; i <= kNumberKeys; i++) {
+    for (int j = 0; j < kNumberRepetitions; j++) {
+      if (!tree.insert(i, counted_value(i))) {
+        printf("[test_slot_construction] Couldn't insert key: (%d, %d).\n",
+               i,
+               i);
+
+        return false;
+      }
+    }
+
+    if (counted_value::live != static_cast<long>(tree.count())) {
+      printf("Unexpected number of live values (%ld), %lu expected.\n",
+             counted_value::live,
+             tree.count());
+
+      return false;
+    }
+  }
+
+  printf("[test_slot_construction] Erasing %d keys...\n", kNumberKeys / 2);
+  for (int i = 1; i <= kNumberKeys; i += 2) {
+    for (int j = 0; j < kNumberRepetitions; j++) {
+      if (!tree.erase(i)) {
+        printf("[test_slot_construction] Key (%d) not found.\n", i);
+        return false;
+      }
+    }
+
+    if (counted_value::live != static_cast<long>(tree.count())) {
+      printf("Unexpected number of live values (%ld), %lu expected.\n",
+             counted_value::live,
+             tree.count());
+
+      return false;
+    }
+  }
+
+  int_counted_multimap_type::const_iterator it;
+  if (!tree.begin(it)) {
+    printf("[test_slot_construction] Couldn't get first key.\n");
     return false;
   }
 
-  printf("\nPerforming int multimap tests...\n");
-  int_multimap_type int_multimap;
-  if (!perform_tests<int_multimap_type,
-                     int_multimap_iterator_type>(int_multimap,
-                                                 kNumberRepetitions)) {
+  int key = 2;
+  int n = 0;
+  do {
+    if ((it.key() != key) || (it.value().value != key)) {
+      printf("Invalid (key, value) (%d, %d), expected (%d, %d).\n",
+             it.key(),
+             it.value().value,
+             key,
+             key);
+
+      return false;
+    }
+
+    if (++n == kNumberRepetitions) {
+      key += 2;
+      n = 0;
+    }
+  } while (tree.next(it));
+
+  tree.clear();
+
+  if (counted_value::live != 0) {
+    printf("Unexpected number of live values (%ld), 0 expected.\n",
+           counted_value::live);
+
     return false;
   }
 
@@ -187,6 +2911,14 @@ bool perform_tests(tree_type& tree, int number_repetitions)
     return false;
   }
 
+  if (!test_bulk_load<tree_type, iterator_type>(tree, number_repetitions)) {
+    return false;
+  }
+
+  if (!test_multi_get<tree_type, iterator_type>(tree, number_repetitions)) {
+    return false;
+  }
+
   if (!test_mix<tree_type, iterator_type>(tree, number_repetitions)) {
     return false;
   }
@@ -492,6 +3224,130 @@ bool test_random(tree_type& tree)
   return true;
 }
 
+template<typename tree_type, typename iterator_type>
+bool test_bulk_load(tree_type& tree, int number_repetitions)
+{
+  // Fill factors out of the range are clamped (NaN is taken for 1.0).
+  static const float kFillFactors[] = {
+    1.0f,
+    0.75f,
+    0.5f,
+    0.0f,
+    -1.0f,
+    2.0f,
+    std::numeric_limits<float>::quiet_NaN()
+  };
+
+  std::vector<std::pair<int, int>> pairs;
+
+  int count = 1;
+  for (int i = 1; i <= kNumberKeys; i++) {
+    for (int j = 1; j <= number_repetitions; j++) {
+      pairs.push_back(std::make_pair(i, count++));
+    }
+  }
+
+  for (size_t f = 0; f < sizeof(kFillFactors) / sizeof(float); f++) {
+    printf("[test_bulk_load] Loading %d (key, value) pairs "
+           "(fill factor: %.2f)...\n",
+           kNumberKeys * number_repetitions,
+           kFillFactors[f]);
+
+    if (!tree.bulk_load(pairs.begin(), pairs.end(), kFillFactors[f])) {
+      printf("[test_bulk_load] Couldn't load the (key, value) pairs.\n");
+      return false;
+    }
+
+    if (tree.count() != pairs.size()) {
+      printf("Unexpected number of keys (%lu), %lu keys expected.\n",
+             tree.count(),
+             pairs.size());
+
+      return false;
+    }
+
+    if ((!iterate<tree_type, iterator_type>(tree, number_repetitions)) ||
+        (!reverse_iterate<tree_type, iterator_type>(tree,
+                                                    number_repetitions)) ||
+        (!find<tree_type, iterator_type>(tree, number_repetitions))) {
+      return false;
+    }
+
+    // The loaded tree must support the usual operations.
+    if (!middle_erase<tree_type, iterator_type>(tree, number_repetitions)) {
+      return false;
+    }
+
+    if (tree.count() != 0) {
+      printf("Unexpected number of keys (%lu), %d keys expected.\n",
+             tree.count(),
+             0);
+
+      return false;
+    }
+  }
+
+  // Unsorted input must be rejected.
+  std::pair<int, int> first = pairs[0];
+  pairs[0] = pairs[pairs.size() - 1];
+  pairs[pairs.size() - 1] = first;
+
+  if ((tree.bulk_load(pairs.begin(), pairs.end())) || (tree.count() != 0)) {
+    printf("[test_bulk_load] Unsorted (key, value) pairs were loaded.\n");
+    return false;
+  }
+
+  printf("[test_bulk_load] Loading %d random numbers...\n", kNumberKeys);
+
+  util::random_generator random_generator;
+  if (!random_generator.init(kNumberKeys)) {
+    printf("[test_bulk_load] Couldn't initialize random generator.\n");
+    return false;
+  }
+
+  std::vector<int> keys;
+  for (int i = 0; i < kNumberKeys; i++) {
+    long rnd;
+    if (!random_generator.ordered(i, rnd)) {
+      printf("[test_bulk_load] Couldn't get random number.\n");
+      return false;
+    }
+
+    keys.push_back(static_cast<int>(rnd));
+  }
+
+  const int* k = &keys[0];
+  if (!tree.bulk_load(k, k, keys.size())) {
+    printf("[test_bulk_load] Couldn't load the random numbers.\n");
+    return false;
+  }
+
+  for (int i = 0; i < kNumberKeys; i++) {
+    iterator_type it;
+    if ((!tree.find(keys[i], it)) ||
+        (it.key() != keys[i]) ||
+        (it.value() != keys[i])) {
+      printf("Key (%d) not found.\n", keys[i]);
+      return false;
+    }
+
+    if (!tree.erase(keys[i])) {
+      printf("Key (%d) not found.\n", keys[i]);
+      return false;
+    }
+  }
+
+  if (tree.count() != 0) {
+    printf("Unexpected number of keys (%lu), %d keys expected.\n",
+           tree.count(),
+           0);
+
+    return false;
+  }
+
+  return true;
+}
+
 template<typename tree_type, typename iterator_type>
 bool equal(const tree_type& tree, const std::list<std::pair<int, int>>& list)
 {
@@ -558,6 +3414,104 @@ bool equal(const tree_type& tree, const std::list<std::pair<int, int>>& list)
   return true;
 }
 
+template<typename tree_type, typename iterator_type>
+bool test_multi_get(tree_type& tree, int number_repetitions)
+{
+  // Insert the even keys.
+  int count = 1;
+  for (int i = 2; i <= kNumberKeys; i += 2) {
+    for (int j = 1; j <= number_repetitions; j++) {
+      if (!tree.insert(i, count)) {
+        printf("[test_multi_get] Couldn't insert key: (%d, %d).\n",
+               i,
+               count);
+
+        return false;
+      }
+
+      count++;
+    }
+  }
+
+  // Sorted keys, unsorted keys (with repeated keys) and a single key.
+  std::vector<int> sorted;
+  for (int i = 0; i <= kNumberKeys + 1; i += 3) {
+    sorted.push_back(i);
+  }
+
+  std::vector<int> unsorted;
+  for (int i = 0; i < kNumberKeys; i++) {
+    unsorted.push_back((i * 7919) % (kNumberKeys + 2));
+  }
+
+  std::vector<int> single(1, kNumberKeys / 2);
+
+  const std::vector<int>* batches[] = {&sorted, &unsorted, &single};
+
+  for (size_t b = 0; b < sizeof(batches) / sizeof(batches[0]); b++) {
+    const std::vector<int>& keys = *batches[b];
+
+    printf("[test_multi_get] Looking up %lu keys...\n", keys.size());
+
+    std::vector<int> values(keys.size());
+    std::unique_ptr<bool[]> found(new bool[keys.size()]);
+
+    size_t n = tree.multi_get(keys.data(),
+                              keys.size(),
+                              values.data(),
+                              found.get());
+
+    size_t expected = 0;
+    for (size_t i = 0; i < keys.size(); i++) {
+      int value;
+      if (tree.get(keys[i], value)) {
+        if ((!found[i]) || (values[i] != value)) {
+          printf("[test_multi_get] Invalid value for key %d.\n", keys[i]);
+          return false;
+        }
+
+        expected++;
+      } else if (found[i]) {
+        printf("[test_multi_get] Key %d shouldn't have been found.\n",
+               keys[i]);
+
+        return false;
+      }
+    }
+
+    if (n != expected) {
+      printf("[test_multi_get] %lu keys found, %lu expected.\n", n, expected);
+      return false;
+    }
+
+    std::vector<iterator_type> its(keys.size());
+    if (tree.multi_find(keys.data(),
+                        keys.size(),
+                        its.data(),
+                        found.get()) != expected) {
+      printf("[test_multi_get] Unexpected number of keys found.\n");
+      return false;
+    }
+
+    for (size_t i = 0; i < keys.size(); i++) {
+      iterator_type it;
+      if (found[i] != tree.find(keys[i], it)) {
+        printf("[test_multi_get] Key %d not found.\n", keys[i]);
+        return false;
+      }
+
+      if ((found[i]) && (its[i] != it)) {
+        printf("[test_multi_get] Invalid iterator for key %d.\n", keys[i]);
+        return false;
+      }
+    }
+  }
+
+  tree.clear();
+
+  return true;
+}
+
 template<typename tree_type, typename iterator_type>
 bool test_mix(tree_type& tree, int number_repetitions)
 {
@@ -1,6 +1,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <algorithm>
+#include <iterator>
+#include <vector>
 #include "util/btree/btree_set.h"
 #include "util/minus.h"
 #include "util/random_generator.h"
@@ -41,6 +44,9 @@ static bool middle_erase(tree_type& tree);
 template<typename tree_type, typename iterator_type>
 static bool test_random(tree_type& tree);
 
+template<typename tree_type, typename iterator_type>
+static bool test_bulk_load(tree_type& tree);
+
 template<typename tree_type, typename iterator_type>
 static bool iterate(const tree_type& tree);
 
@@ -50,6 +56,12 @@ static bool reverse_iterate(const tree_type& tree);
 template<typename tree_type, typename iterator_type>
 static bool find(const tree_type& tree);
 
+static bool test_pop();
+
+static bool test_hint();
+
+static bool test_set_operations();
+
 bool int_set_tests()
 {
   printf("\nPerforming int set tests...\n");
@@ -58,6 +70,18 @@ bool int_set_tests()
     return false;
   }
 
+  if (!test_pop()) {
+    return false;
+  }
+
+  if (!test_hint()) {
+    return false;
+  }
+
+  if (!test_set_operations()) {
+    return false;
+  }
+
   return true;
 }
 
@@ -151,6 +175,10 @@ bool perform_tests(tree_type& tree)
     return false;
   }
 
+  if (!test_bulk_load<tree_type, iterator_type>(tree)) {
+    return false;
+  }
+
   return true;
 }
 
@@ -411,6 +439,64 @@ bool test_random(tree_type& tree)
   return true;
 }
 
+template<typename tree_type, typename iterator_type>
+bool test_bulk_load(tree_type& tree)
+{
+  std::vector<int> keys;
+  for (int i = 1; i <= kNumberKeys; i++) {
+    keys.push_back(i);
+  }
+
+  printf("[test_bulk_load] Loading %d keys...\n", kNumberKeys);
+
+  if (!tree.bulk_load(keys.begin(), keys.end())) {
+    printf("[test_bulk_load] Couldn't load the keys.\n");
+    return false;
+  }
+
+  if (tree.count() != static_cast<size_t>(kNumberKeys)) {
+    printf("Unexpected number of keys (%lu), %d keys expected.\n",
+           tree.count(),
+           kNumberKeys);
+
+    return false;
+  }
+
+  if ((!iterate<tree_type, iterator_type>(tree)) ||
+      (!reverse_iterate<tree_type, iterator_type>(tree)) ||
+      (!find<tree_type, iterator_type>(tree))) {
+    return false;
+  }
+
+  if (!backward_erase<tree_type, iterator_type>(tree)) {
+    return false;
+  }
+
+  printf("[test_bulk_load] Loading %d keys (fill factor: 0.5)...\n",
+         kNumberKeys);
+
+  if (!tree.bulk_load(&keys[0], keys.size(), 0.5f)) {
+    printf("[test_bulk_load] Couldn't load the keys.\n");
+    return false;
+  }
+
+  if ((!iterate<tree_type, iterator_type>(tree)) ||
+      (!find<tree_type, iterator_type>(tree))) {
+    return false;
+  }
+
+  // Duplicated keys must be rejected.
+  tree.clear();
+  keys[1] = keys[0];
+
+  if ((tree.bulk_load(keys.begin(), keys.end())) || (tree.count() != 0)) {
+    printf("[test_bulk_load] Duplicated keys were loaded.\n");
+    return false;
+  }
+
+  return true;
+}
+
 template<typename tree_type, typename iterator_type>
 bool iterate(const tree_type& tree)
 {
@@ -505,3 +591,179 @@ bool find(const tree_type& tree)
 
   return true;
 }
+
+bool test_pop()
+{
+  printf("Testing pop_front() and pop_back()...\n");
+
+  int_set_type set;
+  for (int i = kNumberKeys - 1; i >= 0; i--) {
+    if (!set.insert(i)) {
+      printf("[test_pop] Couldn't insert key %d.\n", i);
+      return false;
+    }
+  }
+
+  for (int i = 0; i < kNumberKeys / 2; i++) {
+    int key;
+    if ((!set.pop_front(key)) || (key != i)) {
+      printf("[test_pop] Unexpected first key (%d).\n", i);
+      return false;
+    }
+
+    int_set_iterator_type it;
+    if ((!set.pop_back()) ||
+        ((set.end(it)) && (it.key() != kNumberKeys - 2 - i))) {
+      printf("[test_pop] Couldn't pop last key (%d).\n", i);
+      return false;
+    }
+  }
+
+  if ((set.count() != 0) || (set.pop_front())) {
+    printf("[test_pop] Unexpected number of keys (%lu).\n", set.count());
+    return false;
+  }
+
+  return true;
+}
+
+bool test_hint()
+{
+  printf("Testing hinted insertions...\n");
+
+  int_set_type set;
+  int_set_type::iterator hint;
+
+  // Descending order: each key goes before the previous one.
+  for (int i = kNumberKeys - 1; i >= 0; i--) {
+    if ((!set.insert(hint, i)) || (hint.key() != i)) {
+      printf("[test_hint] Couldn't insert key %d.\n", i);
+      return false;
+    }
+  }
+
+  int_set_iterator_type it;
+  if (!set.begin(it)) {
+    printf("[test_hint] Empty tree.\n");
+    return false;
+  }
+
+  int i = 0;
+  do {
+    if (it.key() != i) {
+      printf("[test_hint] Unexpected key %d (%d expected).\n", it.key(), i);
+      return false;
+    }
+
+    i++;
+  } while (set.next(it));
+
+  if (i != kNumberKeys) {
+    printf("[test_hint] Unexpected number of keys (%d).\n", i);
+    return false;
+  }
+
+  return true;
+}
+
+bool test_set_operations()
+{
+  printf("Testing set operations...\n");
+
+  // A small set against a large one: the large one is skipped over when
+  // intersecting.
+  int_set_type x;
+  int_set_type y;
+  std::vector<int> xv;
+  std::vector<int> yv;
+
+  for (int i = 0; i < kNumberKeys; i += 2) {
+    y.insert(i);
+    yv.push_back(i);
+  }
+
+  for (int i = 0; i < kNumberKeys; i += 997) {
+    x.insert(i);
+    xv.push_back(i);
+  }
+
+  for (int op = 0; op < 4; op++) {
+    int_set_type result;
+    std::vector<int> expected;
+    bool ret = false;
+
+    switch (op) {
+      case 0:
+        ret = result.set_union(x, y);
+        std::set_union(xv.begin(),
+                       xv.end(),
+                       yv.begin(),
+                       yv.end(),
+                       std::back_inserter(expected));
+
+        break;
+      case 1:
+        ret = result.set_intersection(x, y);
+        std::set_intersection(xv.begin(),
+                              xv.end(),
+                              yv.begin(),
+                              yv.end(),
+                              std::back_inserter(expected));
+
+        break;
+      case 2:
+        ret = result.set_difference(y, x);
+        std::set_difference(yv.begin(),
+                            yv.end(),
+                            xv.begin(),
+                            xv.end(),
+                            std::back_inserter(expected));
+
+        break;
+      default:
+        ret = result.set_symmetric_difference(x, y);
+        std::set_symmetric_difference(xv.begin(),
+                                      xv.end(),
+                                      yv.begin(),
+                                      yv.end(),
+                                      std::back_inserter(expected));
+    }
+
+    if ((!ret) || (result.count() != expected.size())) {
+      printf("[test_set_operations] Unexpected number of keys (%lu, %lu "
+             "expected).\n",
+             result.count(),
+             expected.size());
+
+      return false;
+    }
+
+    int_set_iterator_type it;
+    if (result.begin(it)) {
+      size_t i = 0;
+      do {
+        if (it.key() != expected[i]) {
+          printf("[test_set_operations] Unexpected key %d (%d expected).\n",
+                 it.key(),
+                 expected[i]);
+
+          return false;
+        }
+
+        i++;
+      } while (result.next(it));
+    }
+
+    // The result is built bottom-up: its leaf nodes are full.
+    int_set_type::statistics stats = result.stats();
+    if ((result.count() > 1000) &&
+        (stats.levels[stats.height - 1].average_fill < 0.9)) {
+      printf("[test_set_operations] Leaf fill too low (%.2f).\n",
+             stats.levels[stats.height - 1].average_fill);
+
+      return false;
+    }
+  }
+
+  return true;
+}
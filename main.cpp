@@ -3,6 +3,8 @@
 #include "int_set_tests.h"
 #include "string_map_tests.h"
 #include "string_set_tests.h"
+#include "concurrent_map_tests.h"
+#include "string_btree_tests.h"
 
 int main()
 {
@@ -22,5 +24,13 @@ int main()
     return -1;
   }
 
+  if (!concurrent_map_tests()) {
+    return -1;
+  }
+
+  if (!string_btree_tests()) {
+    return -1;
+  }
+
   return 0;
 }
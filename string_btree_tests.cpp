@@ -0,0 +1,274 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "util/btree/string_btree.h"
+#include "string_btree_tests.h"
+
+static const int kNumberKeys = 20 * 1000;
+
+typedef util::btree::string_btree_map<int> string_btree_type;
+
+// Small nodes: deep trees with many splits and merges.
+typedef util::btree::string_btree_map<int, 1024> string_small_btree_type;
+
+template<typename tree_type>
+static bool perform_tests(tree_type& tree, const char* name);
+
+template<typename tree_type>
+static bool iterate(const tree_type& tree,
+                    const std::vector<std::string>& keys,
+                    size_t step);
+
+static void generate_keys(std::vector<std::string>& keys);
+
+bool string_btree_tests()
+{
+  printf("\nPerforming string B-tree tests...\n");
+  string_btree_type tree;
+  if (!perform_tests<string_btree_type>(tree, "4096")) {
+    return false;
+  }
+
+  printf("\nPerforming string B-tree tests (small nodes)...\n");
+  string_small_btree_type small_tree;
+  if (!perform_tests<string_small_btree_type>(small_tree, "1024")) {
+    return false;
+  }
+
+  return true;
+}
+
+void generate_keys(std::vector<std::string>& keys)
+{
+  // URL-like keys (long shared prefixes), keys which are prefixes of other
+  // keys and keys with bytes which sort after ASCII.
+  char buf[128];
+  for (int i = 0; i < kNumberKeys; i++) {
+    switch (i % 4) {
+      case 0:
+        snprintf(buf,
+                 sizeof(buf),
+                 "https://www.example.com/users/%d/profile",
+                 i);
+
+        break;
+      case 1:
+        snprintf(buf, sizeof(buf), "https://www.example.com/users/%d", i);
+        break;
+      case 2:
+        snprintf(buf, sizeof(buf), "http://example.org/%08d?q=\xff", i);
+        break;
+      default:
+        snprintf(buf, sizeof(buf), "%d", i);
+    }
+
+    keys.push_back(buf);
+  }
+
+  keys.push_back("");
+  keys.push_back(std::string(1, '\0'));
+  keys.push_back(std::string("a\0b", 3));
+}
+
+template<typename tree_type>
+bool perform_tests(tree_type& tree, const char* name)
+{
+  std::vector<std::string> keys;
+  generate_keys(keys);
+
+  // Insert the keys in random order.
+  std::vector<size_t> order;
+  for (size_t i = 0; i < keys.size(); i++) {
+    order.push_back(i);
+  }
+
+  srand(0);
+  for (size_t i = order.size() - 1; i > 0; i--) {
+    std::swap(order[i], order[rand() % (i + 1)]);
+  }
+
+  printf("[perform_tests] Inserting %lu keys (%s)...\n", keys.size(), name);
+  for (size_t i = 0; i < order.size(); i++) {
+    if (!tree.insert(keys[order[i]], static_cast<int>(order[i]))) {
+      printf("[perform_tests] Couldn't insert key '%s'.\n",
+             keys[order[i]].c_str());
+
+      return false;
+    }
+  }
+
+  if (tree.count() != keys.size()) {
+    printf("Unexpected number of keys (%lu), %lu keys expected.\n",
+           tree.count(),
+           keys.size());
+
+    return false;
+  }
+
+  // Values are replaced.
+  for (size_t i = 0; i < keys.size(); i++) {
+    if (!tree.insert(keys[i], static_cast<int>(i) + 1)) {
+      printf("[perform_tests] Couldn't insert key '%s'.\n", keys[i].c_str());
+      return false;
+    }
+  }
+
+  if (tree.count() != keys.size()) {
+    printf("Unexpected number of keys (%lu), %lu keys expected.\n",
+           tree.count(),
+           keys.size());
+
+    return false;
+  }
+
+  // Too long keys are rejected.
+  if (tree.insert(std::string(tree_type::kMaxKeyLength + 1, 'x'), 0)) {
+    printf("[perform_tests] Too long key was inserted.\n");
+    return false;
+  }
+
+  if (!tree.insert(std::string(tree_type::kMaxKeyLength, 'x'), 0)) {
+    printf("[perform_tests] Couldn't insert key of maximum length.\n");
+    return false;
+  }
+
+  if (!tree.erase(std::string(tree_type::kMaxKeyLength, 'x'))) {
+    printf("[perform_tests] Key of maximum length not found.\n");
+    return false;
+  }
+
+  printf("[perform_tests] Finding (%s)...\n", name);
+
+  for (size_t i = 0; i < keys.size(); i++) {
+    int value;
+    if ((!tree.get(keys[i], value)) || (value != static_cast<int>(i) + 1)) {
+      printf("[perform_tests] Key '%s' not found.\n", keys[i].c_str());
+      return false;
+    }
+  }
+
+  typename tree_type::const_iterator it;
+  if ((tree.find("https://www.example.com/users/", it)) ||
+      (tree.find("https://www.example.com/users/1/profilex", it)) ||
+      (tree.find("zzz", it))) {
+    printf("[perform_tests] Found key which is not in the tree.\n");
+    return false;
+  }
+
+  std::vector<std::string> sorted(keys);
+  std::sort(sorted.begin(), sorted.end());
+
+  printf("[perform_tests] Iterating (%s)...\n", name);
+
+  if (!iterate<tree_type>(tree, sorted, 1)) {
+    return false;
+  }
+
+  // Lower bound.
+  if ((!tree.lower_bound("https://www.example.com/users/", it)) ||
+      (it.key() != *std::lower_bound(sorted.begin(),
+                                     sorted.end(),
+                                     "https://www.example.com/users/"))) {
+    printf("[perform_tests] Invalid lower bound.\n");
+    return false;
+  }
+
+  if (tree.lower_bound(sorted.back() + "x", it)) {
+    printf("[perform_tests] Invalid lower bound.\n");
+    return false;
+  }
+
+  printf("[perform_tests] Erasing half of the keys (%s)...\n", name);
+
+  for (size_t i = 1; i < sorted.size(); i += 2) {
+    if (!tree.erase(sorted[i])) {
+      printf("[perform_tests] Key '%s' not found.\n", sorted[i].c_str());
+      return false;
+    }
+
+    if (tree.erase(sorted[i])) {
+      printf("[perform_tests] Key '%s' erased twice.\n", sorted[i].c_str());
+      return false;
+    }
+  }
+
+  if (!iterate<tree_type>(tree, sorted, 2)) {
+    return false;
+  }
+
+  printf("[perform_tests] Erasing the rest of the keys (%s)...\n", name);
+
+  for (size_t i = 0; i < order.size(); i++) {
+    if ((order[i] % 2) == 0) {
+      // sorted[order[i]] hasn't been erased yet.
+      if (!tree.erase(sorted[order[i]])) {
+        printf("[perform_tests] Key '%s' not found.\n",
+               sorted[order[i]].c_str());
+
+        return false;
+      }
+    }
+  }
+
+  if ((tree.count() != 0) || (tree.begin(it))) {
+    printf("Unexpected number of keys (%lu), %d keys expected.\n",
+           tree.count(),
+           0);
+
+    return false;
+  }
+
+  return true;
+}
+
+template<typename tree_type>
+bool iterate(const tree_type& tree,
+             const std::vector<std::string>& keys,
+             size_t step)
+{
+  typename tree_type::const_iterator it;
+  if (!tree.begin(it)) {
+    printf("[iterate] Couldn't get first key.\n");
+    return false;
+  }
+
+  size_t i = 0;
+  do {
+    if ((i >= keys.size()) || (it.key() != keys[i])) {
+      printf("[iterate] Invalid key at position %lu.\n", i);
+      return false;
+    }
+
+    i += step;
+  } while (tree.next(it));
+
+  if (i < keys.size()) {
+    printf("[iterate] Not all the keys were iterated.\n");
+    return false;
+  }
+
+  // Backward.
+  if (!tree.end(it)) {
+    printf("[iterate] Couldn't get last key.\n");
+    return false;
+  }
+
+  do {
+    i -= step;
+
+    if (it.key() != keys[i]) {
+      printf("[iterate] Invalid key at position %lu.\n", i);
+      return false;
+    }
+  } while (tree.prev(it));
+
+  if (i != 0) {
+    printf("[iterate] Not all the keys were iterated backward.\n");
+    return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,6 @@
+#ifndef STRING_BTREE_TESTS_H
+#define STRING_BTREE_TESTS_H
+
+bool string_btree_tests();
+
+#endif // STRING_BTREE_TESTS_H
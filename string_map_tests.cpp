@@ -65,6 +65,9 @@ static bool middle_erase(tree_type& tree, int number_repetitions);
 template<typename tree_type, typename iterator_type>
 static bool test_random(tree_type& tree);
 
+template<typename tree_type, typename iterator_type>
+static bool test_emplace(tree_type& tree, int number_repetitions);
+
 template<typename tree_type, typename iterator_type>
 static bool iterate(const tree_type& tree, int number_repetitions);
 
@@ -190,6 +193,10 @@ bool perform_tests(tree_type& tree, int number_repetitions)
     return false;
   }
 
+  if (!test_emplace<tree_type, iterator_type>(tree, number_repetitions)) {
+    return false;
+  }
+
   return true;
 }
 
@@ -598,6 +605,101 @@ bool test_random(tree_type& tree)
   return true;
 }
 
+template<typename tree_type, typename iterator_type>
+bool test_emplace(tree_type& tree, int number_repetitions)
+{
+  printf("[test_emplace] Inserting %d (key, value) pairs...\n",
+         kNumberKeys * number_repetitions);
+
+  int count = 1;
+
+  for (int i = 1; i <= kNumberKeys; i++) {
+    for (int j = 1; j <= number_repetitions; j++) {
+      std::stringstream ss;
+      ss << i;
+      std::string key(ss.str());
+
+      ss.str(std::string());
+      ss << count;
+      std::string value(ss.str());
+
+      bool ret;
+      switch (count % 3) {
+        case 0:
+          ret = tree.insert(std::move(key), std::move(value));
+          break;
+        case 1:
+          ret = tree.emplace(std::move(key), value.c_str());
+          break;
+        default:
+          ret = tree.try_emplace(key, std::move(value));
+      }
+
+      if (!ret) {
+        printf("[test_emplace] Couldn't insert key: (%d, %d).\n", i, count);
+        return false;
+      }
+
+      count++;
+    }
+  }
+
+  if ((!iterate<tree_type, iterator_type>(tree, number_repetitions)) ||
+      (!find<tree_type, iterator_type>(tree, number_repetitions))) {
+    return false;
+  }
+
+  // If duplicates are not allowed...
+  if (number_repetitions == 1) {
+    printf("[test_emplace] Replacing value...\n");
+
+    std::string key("1");
+    std::string value("x");
+
+    // The key has been already inserted: try_emplace() must not touch the
+    // arguments.
+    if ((tree.try_emplace(std::move(key), std::move(value))) ||
+        (key != "1") ||
+        (value != "x")) {
+      printf("[test_emplace] Key (%s) inserted twice.\n", key.c_str());
+      return false;
+    }
+
+    iterator_type it;
+    if ((!tree.emplace(std::move(key), 3, 'x')) ||
+        (tree.count() != static_cast<size_t>(kNumberKeys)) ||
+        (!tree.find("1", it)) ||
+        (it.value() != "xxx")) {
+      printf("[test_emplace] Couldn't replace value.\n");
+      return false;
+    }
+
+    // Restore value.
+    if ((!tree.insert(std::string("1"), std::string("1"))) ||
+        (!tree.find("1", it)) ||
+        (it.value() != "1") ||
+        (!find<tree_type, iterator_type>(tree, number_repetitions))) {
+      printf("[test_emplace] Couldn't restore value.\n");
+      return false;
+    }
+  }
+
+  printf("[test_emplace] Erasing %d keys...\n", kNumberKeys);
+  if (!forward_erase<tree_type, iterator_type>(tree, number_repetitions)) {
+    return false;
+  }
+
+  if (tree.count() != 0) {
+    printf("Unexpected number of keys (%lu), %d keys expected.\n",
+           tree.count(),
+           0);
+
+    return false;
+  }
+
+  return true;
+}
+
 template<typename tree_type, typename iterator_type>
 bool iterate(const tree_type& tree, int number_repetitions)
 {
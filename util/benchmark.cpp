@@ -0,0 +1,147 @@
+#include <math.h>
+#include <algorithm>
+#include "util/benchmark.h"
+
+bool util::benchmark::init(size_t max_operations)
+{
+  uint64_t* samples;
+  if ((samples = reinterpret_cast<uint64_t*>(
+                   realloc(_M_samples, max_operations * sizeof(uint64_t))
+                 )) == NULL) {
+    return false;
+  }
+
+  _M_samples = samples;
+  _M_size = max_operations;
+  _M_nsamples = 0;
+
+  return true;
+}
+
+double util::benchmark::percentile(double p)
+{
+  if (_M_nsamples == 0) {
+    return 0;
+  }
+
+  if (!_M_sorted) {
+    std::sort(_M_samples, _M_samples + _M_nsamples);
+    _M_sorted = true;
+  }
+
+  // Nearest rank.
+  size_t rank = static_cast<size_t>(ceil((p / 100.0) * _M_nsamples));
+  if (rank == 0) {
+    rank = 1;
+  } else if (rank > _M_nsamples) {
+    rank = _M_nsamples;
+  }
+
+  return _M_samples[rank - 1] / ticks_per_nanosecond();
+}
+
+double util::benchmark::ticks_per_nanosecond()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  // Calibrate the TSC against the steady clock (once).
+  static double ratio = 0;
+
+  if (ratio == 0) {
+    std::chrono::steady_clock::time_point begin =
+                                             std::chrono::steady_clock::now();
+    uint64_t begin_ticks = ticks();
+
+    std::chrono::steady_clock::time_point end;
+    do {
+      end = std::chrono::steady_clock::now();
+    } while (end - begin < std::chrono::milliseconds(20));
+
+    uint64_t end_ticks = ticks();
+
+    ratio = (end_ticks - begin_ticks) /
+            std::chrono::duration<double, std::nano>(end - begin).count();
+  }
+
+  return ratio;
+#else
+  return 1.0;
+#endif
+}
+
+void util::benchmark_report::add(const char* suite,
+                                 const char* name,
+                                 benchmark& b)
+{
+  result r;
+  r.suite = suite;
+  r.name = name;
+  r.operations = b.operations();
+  r.seconds = b.seconds();
+  r.cycles = b.cycles();
+  r.throughput = b.throughput();
+  r.p50 = b.percentile(50);
+  r.p99 = b.percentile(99);
+  r.p999 = b.percentile(99.9);
+
+  _M_results.push_back(r);
+}
+
+void util::benchmark_report::print_table(FILE* file) const
+{
+  fprintf(file,
+          "%-16s %-24s %10s %10s %14s %14s %10s %10s %10s\n",
+          "suite",
+          "benchmark",
+          "ops",
+          "time (s)",
+          "cycles",
+          "ops/s",
+          "p50 (ns)",
+          "p99 (ns)",
+          "p999 (ns)");
+
+  for (size_t i = 0; i < _M_results.size(); i++) {
+    const result& r = _M_results[i];
+
+    fprintf(file,
+            "%-16s %-24s %10lu %10.3f %14llu %14.0f %10.0f %10.0f %10.0f\n",
+            r.suite.c_str(),
+            r.name.c_str(),
+            r.operations,
+            r.seconds,
+            static_cast<unsigned long long>(r.cycles),
+            r.throughput,
+            r.p50,
+            r.p99,
+            r.p999);
+  }
+}
+
+void util::benchmark_report::print_json(FILE* file) const
+{
+  fprintf(file, "{\n  \"benchmarks\": [");
+
+  for (size_t i = 0; i < _M_results.size(); i++) {
+    const result& r = _M_results[i];
+
+    // The suite and benchmark names are plain identifiers: no escaping is
+    // needed.
+    fprintf(file,
+            "%s\n    {\"suite\": \"%s\", \"name\": \"%s\", "
+            "\"operations\": %lu, \"seconds\": %.6f, \"cycles\": %llu, "
+            "\"ops_per_sec\": %.1f, "
+            "\"latency_ns\": {\"p50\": %.1f, \"p99\": %.1f, \"p999\": %.1f}}",
+            (i > 0) ? "," : "",
+            r.suite.c_str(),
+            r.name.c_str(),
+            r.operations,
+            r.seconds,
+            static_cast<unsigned long long>(r.cycles),
+            r.throughput,
+            r.p50,
+            r.p99,
+            r.p999);
+  }
+
+  fprintf(file, "\n  ]\n}\n");
+}
@@ -0,0 +1,185 @@
+#ifndef UTIL_BENCHMARK_H
+#define UTIL_BENCHMARK_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+  #include <x86intrin.h>
+#endif
+
+namespace util {
+  // Benchmark.
+  //
+  // Measures a run of operations: the wall-clock time and the cycles of the
+  // whole run and the latency of each operation. Latencies are recorded in
+  // ticks (TSC cycles on x86, nanoseconds otherwise) and converted to
+  // nanoseconds when they are reported.
+  class benchmark {
+    public:
+      // Constructor.
+      benchmark();
+
+      // Destructor.
+      ~benchmark();
+
+      // Initialize.
+      // Reserves room for the latencies of 'max_operations' operations.
+      bool init(size_t max_operations);
+
+      // Start run.
+      void start();
+
+      // Stop run.
+      void stop();
+
+      // Get timestamp (ticks).
+      static uint64_t ticks();
+
+      // Record the latency of an operation started at 'begin' (ticks).
+      void record(uint64_t begin);
+
+      // Get number of operations.
+      size_t operations() const;
+
+      // Get elapsed time (seconds).
+      double seconds() const;
+
+      // Get elapsed cycles (ticks).
+      uint64_t cycles() const;
+
+      // Get throughput (operations per second).
+      double throughput() const;
+
+      // Get latency percentile (nanoseconds), 0 < p <= 100.
+      double percentile(double p);
+
+    private:
+      uint64_t* _M_samples;
+      size_t _M_nsamples;
+      size_t _M_size;
+
+      bool _M_sorted;
+
+      std::chrono::steady_clock::time_point _M_begin;
+      std::chrono::steady_clock::time_point _M_end;
+
+      uint64_t _M_begin_ticks;
+      uint64_t _M_end_ticks;
+
+      // Get number of ticks per nanosecond.
+      static double ticks_per_nanosecond();
+
+      // Disable copy constructor and assignment operator.
+      benchmark(const benchmark&) = delete;
+      benchmark& operator=(const benchmark&) = delete;
+  };
+
+  // Benchmark report.
+  // Collects the results of several benchmarks and prints them as a table
+  // or as JSON.
+  class benchmark_report {
+    public:
+      // Add benchmark.
+      void add(const char* suite, const char* name, benchmark& b);
+
+      // Print table.
+      void print_table(FILE* file) const;
+
+      // Print JSON.
+      void print_json(FILE* file) const;
+
+    private:
+      struct result {
+        std::string suite;
+        std::string name;
+        size_t operations;
+        double seconds;
+        uint64_t cycles;
+        double throughput;
+        double p50;
+        double p99;
+        double p999;
+      };
+
+      std::vector<result> _M_results;
+  };
+
+  inline benchmark::benchmark()
+    : _M_samples(NULL),
+      _M_nsamples(0),
+      _M_size(0),
+      _M_sorted(false),
+      _M_begin_ticks(0),
+      _M_end_ticks(0)
+  {
+  }
+
+  inline benchmark::~benchmark()
+  {
+    if (_M_samples) {
+      free(_M_samples);
+    }
+  }
+
+  inline void benchmark::start()
+  {
+    _M_nsamples = 0;
+    _M_sorted = false;
+
+    _M_begin = std::chrono::steady_clock::now();
+    _M_begin_ticks = ticks();
+  }
+
+  inline void benchmark::stop()
+  {
+    _M_end_ticks = ticks();
+    _M_end = std::chrono::steady_clock::now();
+  }
+
+  inline uint64_t benchmark::ticks()
+  {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch()
+           ).count();
+#endif
+  }
+
+  inline void benchmark::record(uint64_t begin)
+  {
+    uint64_t end = ticks();
+
+    if (_M_nsamples < _M_size) {
+      _M_samples[_M_nsamples++] = end - begin;
+    }
+  }
+
+  inline size_t benchmark::operations() const
+  {
+    return _M_nsamples;
+  }
+
+  inline double benchmark::seconds() const
+  {
+    return std::chrono::duration<double>(_M_end - _M_begin).count();
+  }
+
+  inline uint64_t benchmark::cycles() const
+  {
+    return _M_end_ticks - _M_begin_ticks;
+  }
+
+  inline double benchmark::throughput() const
+  {
+    double s = seconds();
+    return (s > 0) ? (_M_nsamples / s) : 0;
+  }
+}
+
+#endif // UTIL_BENCHMARK_H
@@ -0,0 +1,142 @@
+#ifndef UTIL_BTREE_AGGREGATE_H
+#define UTIL_BTREE_AGGREGATE_H
+
+#include <stdint.h>
+#include <limits>
+
+namespace util {
+  namespace btree {
+    // Aggregate policies.
+    //
+    // An aggregate policy is a monoid over the values of a map. It provides:
+    //   - static const bool kEnabled: true if the tree keeps summaries.
+    //   - summary_type: the set of the monoid (trivially copyable).
+    //   - static summary_type identity(): the identity element.
+    //   - static summary_type summarize(const value_type& value): the
+    //     summary of a single value.
+    //   - static summary_type combine(const summary_type& x,
+    //                                 const summary_type& y): the
+    //     (associative) operation of the monoid.
+    //
+    // The internal nodes keep the summary of the subtree of each child, so
+    // a range of keys can be reduced by combining O(log n) summaries (see
+    // btree::reduce()).
+
+    // No aggregate.
+    // The tree never calls its functions: they exist so the code guarded by
+    // kEnabled compiles.
+    class no_aggregate {
+      public:
+        static const bool kEnabled = false;
+
+        typedef uint8_t summary_type;
+
+        // Get identity element.
+        static summary_type identity()
+        {
+          return 0;
+        }
+
+        // Summarize value.
+        template<typename _Tp>
+        static summary_type summarize(const _Tp& value)
+        {
+          return 0;
+        }
+
+        // Combine summaries.
+        static summary_type combine(const summary_type& x,
+                                    const summary_type& y)
+        {
+          return 0;
+        }
+    };
+
+    // Sum of the values.
+    // The sum might be of a wider type than the values ('_Sum').
+    template<typename _Tp, typename _Sum = _Tp>
+    class sum_aggregate {
+      public:
+        static const bool kEnabled = true;
+
+        typedef _Sum summary_type;
+
+        // Get identity element.
+        static summary_type identity()
+        {
+          return summary_type();
+        }
+
+        // Summarize value.
+        static summary_type summarize(const _Tp& value)
+        {
+          return static_cast<summary_type>(value);
+        }
+
+        // Combine summaries.
+        static summary_type combine(const summary_type& x,
+                                    const summary_type& y)
+        {
+          return x + y;
+        }
+    };
+
+    // Minimum of the values.
+    template<typename _Tp>
+    class min_aggregate {
+      public:
+        static const bool kEnabled = true;
+
+        typedef _Tp summary_type;
+
+        // Get identity element.
+        static summary_type identity()
+        {
+          return std::numeric_limits<_Tp>::max();
+        }
+
+        // Summarize value.
+        static summary_type summarize(const _Tp& value)
+        {
+          return value;
+        }
+
+        // Combine summaries.
+        static summary_type combine(const summary_type& x,
+                                    const summary_type& y)
+        {
+          return (y < x) ? y : x;
+        }
+    };
+
+    // Maximum of the values.
+    template<typename _Tp>
+    class max_aggregate {
+      public:
+        static const bool kEnabled = true;
+
+        typedef _Tp summary_type;
+
+        // Get identity element.
+        static summary_type identity()
+        {
+          return std::numeric_limits<_Tp>::lowest();
+        }
+
+        // Summarize value.
+        static summary_type summarize(const _Tp& value)
+        {
+          return value;
+        }
+
+        // Combine summaries.
+        static summary_type combine(const summary_type& x,
+                                    const summary_type& y)
+        {
+          return (x < y) ? y : x;
+        }
+    };
+  }
+}
+
+#endif // UTIL_BTREE_AGGREGATE_H
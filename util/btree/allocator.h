@@ -0,0 +1,274 @@
+#ifndef UTIL_BTREE_ALLOCATOR_H
+#define UTIL_BTREE_ALLOCATOR_H
+
+#include <stdlib.h>
+#include <stdint.h>
+
+namespace util {
+  namespace btree {
+    // Node allocators.
+    //
+    // A node allocator provides:
+    //   - void* allocate(size_t size): returns a block of 'size' bytes
+    //     aligned to kAlignment bytes or NULL.
+    //   - void deallocate(void* p, size_t size): releases a block.
+    //   - void reset(): releases all the blocks at once (only required if
+    //     kArena is true).
+    //   - static const bool kArena: if true, the tree doesn't release its
+    //     nodes one by one when it is cleared, it calls reset() instead.
+    //   - static const bool kThreadSafe: true if allocate() and deallocate()
+    //     can be called concurrently (required by the concurrent trees).
+    //   - static const bool kShared: true if a block allocated by an
+    //     instance can be released by any other instance (required to move
+    //     nodes between trees, see btree::split() and btree::join()).
+
+    // Allocator which uses the heap.
+    class malloc_allocator {
+      public:
+        static const size_t kAlignment = 64;
+        static const bool kArena = false;
+        static const bool kThreadSafe = true;
+        static const bool kShared = true;
+
+        // Allocate.
+        void* allocate(size_t size);
+
+        // Deallocate.
+        void deallocate(void* p, size_t size);
+
+        // Reset.
+        void reset();
+    };
+
+    // Slab allocator.
+    // Nodes are carved out of slabs of _SlabSize bytes. Each size class
+    // (typically one for internal nodes and another one for leaf nodes) has
+    // its own slabs and a free list where the released nodes are kept for
+    // recycling.
+    // In arena mode (_Arena = true), clearing the tree releases the slabs
+    // directly: O(number of slabs) instead of O(number of nodes).
+    template<size_t _SlabSize = 64 * 1024, bool _Arena = false>
+    class slab_allocator {
+      public:
+        static const size_t kAlignment = 64;
+        static const bool kArena = _Arena;
+        static const bool kThreadSafe = false;
+        static const bool kShared = false;
+
+        // Constructor.
+        slab_allocator();
+
+        // Destructor.
+        ~slab_allocator();
+
+        // Allocate.
+        void* allocate(size_t size);
+
+        // Deallocate.
+        void deallocate(void* p, size_t size);
+
+        // Reset.
+        void reset();
+
+        // Get number of slabs.
+        size_t slabs() const;
+
+      private:
+        static const size_t kMaxSizeClasses = 4;
+
+        struct free_block {
+          free_block* next;
+        };
+
+        struct slab {
+          slab* next;
+        };
+
+        // The slab header takes a whole aligned block, so the nodes carved
+        // out of the slab are aligned as well.
+        static const size_t kSlabHeaderSize = kAlignment;
+
+        struct size_class {
+          size_t size;
+          free_block* free;
+          uint8_t* cur;
+          uint8_t* end;
+        };
+
+        size_class _M_classes[kMaxSizeClasses];
+        size_t _M_nclasses;
+
+        slab* _M_slabs;
+        size_t _M_nslabs;
+
+        // Get size class.
+        size_class* get_size_class(size_t size);
+
+        // Allocate slab.
+        bool allocate_slab(size_class* c);
+
+        // Disable copy constructor and assignment operator.
+        slab_allocator(const slab_allocator&) = delete;
+        slab_allocator& operator=(const slab_allocator&) = delete;
+    };
+
+    // Arena allocator.
+    template<size_t _SlabSize = 64 * 1024>
+    using arena_allocator = slab_allocator<_SlabSize, true>;
+
+    inline void* malloc_allocator::allocate(size_t size)
+    {
+      void* p;
+      if (posix_memalign(&p, kAlignment, size) != 0) {
+        return NULL;
+      }
+
+      return p;
+    }
+
+    inline void malloc_allocator::deallocate(void* p, size_t size)
+    {
+      free(p);
+    }
+
+    inline void malloc_allocator::reset()
+    {
+    }
+
+    template<size_t _SlabSize, bool _Arena>
+    inline slab_allocator<_SlabSize, _Arena>::slab_allocator()
+      : _M_nclasses(0),
+        _M_slabs(NULL),
+        _M_nslabs(0)
+    {
+    }
+
+    template<size_t _SlabSize, bool _Arena>
+    inline slab_allocator<_SlabSize, _Arena>::~slab_allocator()
+    {
+      reset();
+    }
+
+    template<size_t _SlabSize, bool _Arena>
+    inline void* slab_allocator<_SlabSize, _Arena>::allocate(size_t size)
+    {
+      size_class* c;
+      if ((c = get_size_class(size)) == NULL) {
+        return NULL;
+      }
+
+      // If there is a recycled block...
+      if (c->free) {
+        free_block* b = c->free;
+        c->free = b->next;
+
+        return b;
+      }
+
+      // If the current slab is exhausted...
+      if (static_cast<size_t>(c->end - c->cur) < c->size) {
+        if (!allocate_slab(c)) {
+          return NULL;
+        }
+      }
+
+      void* p = c->cur;
+      c->cur += c->size;
+
+      return p;
+    }
+
+    template<size_t _SlabSize, bool _Arena>
+    inline void slab_allocator<_SlabSize, _Arena>::deallocate(void* p,
+                                                              size_t size)
+    {
+      size_class* c;
+      if ((c = get_size_class(size)) != NULL) {
+        // Add block to the free list.
+        free_block* b = static_cast<free_block*>(p);
+        b->next = c->free;
+        c->free = b;
+      }
+    }
+
+    template<size_t _SlabSize, bool _Arena>
+    void slab_allocator<_SlabSize, _Arena>::reset()
+    {
+      while (_M_slabs) {
+        slab* next = _M_slabs->next;
+        free(_M_slabs);
+        _M_slabs = next;
+      }
+
+      _M_nslabs = 0;
+
+      // Keep the size classes, but forget their blocks.
+      for (size_t i = 0; i < _M_nclasses; i++) {
+        _M_classes[i].free = NULL;
+        _M_classes[i].cur = NULL;
+        _M_classes[i].end = NULL;
+      }
+    }
+
+    template<size_t _SlabSize, bool _Arena>
+    inline size_t slab_allocator<_SlabSize, _Arena>::slabs() const
+    {
+      return _M_nslabs;
+    }
+
+    template<size_t _SlabSize, bool _Arena>
+    inline typename slab_allocator<_SlabSize, _Arena>::size_class*
+    slab_allocator<_SlabSize, _Arena>::get_size_class(size_t size)
+    {
+      // Round size up to the alignment.
+      size = (size + kAlignment - 1) & ~(kAlignment - 1);
+
+      for (size_t i = 0; i < _M_nclasses; i++) {
+        if (_M_classes[i].size == size) {
+          return &_M_classes[i];
+        }
+      }
+
+      // If there are no more size classes available...
+      if (_M_nclasses == kMaxSizeClasses) {
+        return NULL;
+      }
+
+      size_class* c = &_M_classes[_M_nclasses++];
+      c->size = size;
+      c->free = NULL;
+      c->cur = NULL;
+      c->end = NULL;
+
+      return c;
+    }
+
+    template<size_t _SlabSize, bool _Arena>
+    bool slab_allocator<_SlabSize, _Arena>::allocate_slab(size_class* c)
+    {
+      // Make sure that the slab can hold at least one block.
+      size_t size = kSlabHeaderSize + c->size;
+      if (size < _SlabSize) {
+        size = _SlabSize;
+      }
+
+      void* p;
+      if (posix_memalign(&p, kAlignment, size) != 0) {
+        return false;
+      }
+
+      slab* s = static_cast<slab*>(p);
+      s->next = _M_slabs;
+      _M_slabs = s;
+
+      _M_nslabs++;
+
+      c->cur = static_cast<uint8_t*>(p) + kSlabHeaderSize;
+      c->end = static_cast<uint8_t*>(p) + size;
+
+      return true;
+    }
+  }
+}
+
+#endif // UTIL_BTREE_ALLOCATOR_H
@@ -1,17 +1,39 @@
 #ifndef UTIL_BTREE_H
 #define UTIL_BTREE_H
 
+#include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include <algorithm>
 #include <memory>
+#include <type_traits>
+#include <vector>
 #include "util/move.h"
+#include "util/btree/aggregate.h"
+#include "util/btree/allocator.h"
+#include "util/btree/instrumentation.h"
+#include "util/btree/search.h"
 
 namespace util {
   namespace btree {
     // Common B-tree parameters.
-    template<typename _Key, typename _Compare, size_t _NodeSize>
+    // If '_Counted' is true, the internal nodes keep the number of keys of
+    // the subtree of each child (see btree::rank() and btree::select()).
+    // If '_Aggregate' is enabled, they keep the summary of the values of
+    // the subtree of each child as well (see aggregate.h).
+    template<typename _Key,
+             typename _Compare,
+             size_t _NodeSize,
+             typename _Allocator,
+             typename _Instrumentation,
+             bool _Counted,
+             typename _Aggregate>
     struct common_parameters {
       typedef _Key key_type;
       typedef _Compare key_compare;
+      typedef _Allocator allocator_type;
+      typedef _Instrumentation instrumentation_type;
+      typedef _Aggregate aggregate_type;
 
       typedef struct {
         uint32_t type:1;
@@ -19,12 +41,35 @@ namespace util {
       } node_header;
 
       static const size_t kNodeSize = _NodeSize;
+
+      static const bool kCounted = _Counted;
+
+      // Size of a child of an internal node: the pointer and, if the tree
+      // is counted (aggregated), the number of keys (the summary) of its
+      // subtree.
+      static const size_t kChildSize =
+                          sizeof(void*) +
+                          ((_Counted) ? sizeof(size_t) : 0) +
+                          ((_Aggregate::kEnabled) ?
+                             sizeof(typename _Aggregate::summary_type) :
+                             0);
     };
 
     // Set parameters.
-    template<typename _Key, typename _Compare, size_t _NodeSize>
+    template<typename _Key,
+             typename _Compare,
+             size_t _NodeSize,
+             typename _Allocator = malloc_allocator,
+             typename _Instrumentation = no_instrumentation,
+             bool _Counted = false>
     struct set_parameters
-      : public common_parameters<_Key, _Compare, _NodeSize> {
+      : public common_parameters<_Key,
+                                 _Compare,
+                                 _NodeSize,
+                                 _Allocator,
+                                 _Instrumentation,
+                                 _Counted,
+                                 no_aggregate> {
       typedef _Key value_type;
 
       static const size_t kValueSize = 0;
@@ -56,14 +101,41 @@ namespace util {
       // kNodeSize - sizeof(node_header) - sizeof(void*)
       // ----------------------------------------------- >= kInternalNodeMaxKeys
       //           sizeof(_Key) + sizeof(void*)
+      //
+      // Counted (aggregated) trees store the number of keys (the summary) of
+      // each subtree next to the pointer to the child: sizeof(void*)
+      // becomes kChildSize.
 
       static const size_t kInternalNodeMaxKeys =
-           (common_parameters<_Key, _Compare, _NodeSize>::kNodeSize -
+           (common_parameters<_Key,
+                              _Compare,
+                              _NodeSize,
+                              _Allocator,
+                              _Instrumentation,
+                              _Counted,
+                              no_aggregate>::kNodeSize -
             sizeof(typename common_parameters<_Key,
                                               _Compare,
-                                              _NodeSize>::node_header) -
-            sizeof(void*)) /
-           (sizeof(_Key) + sizeof(void*));
+                                              _NodeSize,
+                                              _Allocator,
+                                              _Instrumentation,
+                                              _Counted,
+                                              no_aggregate>::node_header) -
+            common_parameters<_Key,
+                              _Compare,
+                              _NodeSize,
+                              _Allocator,
+                              _Instrumentation,
+                              _Counted,
+                              no_aggregate>::kChildSize) /
+           (sizeof(_Key) +
+            common_parameters<_Key,
+                              _Compare,
+                              _NodeSize,
+                              _Allocator,
+                              _Instrumentation,
+                              _Counted,
+                              no_aggregate>::kChildSize);
 
       // Leaf nodes need two pointers, one to point to the previous node and
       // the other one to point to the next node.
@@ -80,18 +152,41 @@ namespace util {
       //                      sizeof(_Key)
 
       static const size_t kLeafNodeMaxKeys =
-           (common_parameters<_Key, _Compare, _NodeSize>::kNodeSize -
+           (common_parameters<_Key,
+                              _Compare,
+                              _NodeSize,
+                              _Allocator,
+                              _Instrumentation,
+                              _Counted,
+                              no_aggregate>::kNodeSize -
             sizeof(typename common_parameters<_Key,
                                               _Compare,
-                                              _NodeSize>::node_header) -
+                                              _NodeSize,
+                                              _Allocator,
+                                              _Instrumentation,
+                                              _Counted,
+                                              no_aggregate>::node_header) -
             (2 * sizeof(void*))) /
            sizeof(_Key);
     };
 
     // Common map parameters.
-    template<typename _Key, typename _Tp, typename _Compare, size_t _NodeSize>
+    template<typename _Key,
+             typename _Tp,
+             typename _Compare,
+             size_t _NodeSize,
+             typename _Allocator,
+             typename _Instrumentation,
+             bool _Counted,
+             typename _Aggregate>
     struct common_map_parameters
-      : public common_parameters<_Key, _Compare, _NodeSize> {
+      : public common_parameters<_Key,
+                                 _Compare,
+                                 _NodeSize,
+                                 _Allocator,
+                                 _Instrumentation,
+                                 _Counted,
+                                 _Aggregate> {
       typedef _Tp value_type;
 
       static const size_t kValueSize = sizeof(_Tp);
@@ -121,14 +216,41 @@ namespace util {
       // _NodeSize - sizeof(node_header) - sizeof(void*)
       // ----------------------------------------------- >= kInternalNodeMaxKeys
       //           sizeof(_Key) + sizeof(void*)
+      //
+      // Counted (aggregated) trees store the number of keys (the summary) of
+      // each subtree next to the pointer to the child: sizeof(void*)
+      // becomes kChildSize.
 
       static const size_t kInternalNodeMaxKeys =
-           (common_parameters<_Key, _Compare, _NodeSize>::kNodeSize -
+           (common_parameters<_Key,
+                              _Compare,
+                              _NodeSize,
+                              _Allocator,
+                              _Instrumentation,
+                              _Counted,
+                              _Aggregate>::kNodeSize -
             sizeof(typename common_parameters<_Key,
                                               _Compare,
-                                              _NodeSize>::node_header) -
-            sizeof(void*)) /
-           (sizeof(_Key) + sizeof(void*));
+                                              _NodeSize,
+                                              _Allocator,
+                                              _Instrumentation,
+                                              _Counted,
+                                              _Aggregate>::node_header) -
+            common_parameters<_Key,
+                              _Compare,
+                              _NodeSize,
+                              _Allocator,
+                              _Instrumentation,
+                              _Counted,
+                              _Aggregate>::kChildSize) /
+           (sizeof(_Key) +
+            common_parameters<_Key,
+                              _Compare,
+                              _NodeSize,
+                              _Allocator,
+                              _Instrumentation,
+                              _Counted,
+                              _Aggregate>::kChildSize);
 
       // Leaf nodes need two pointers, one to point to the previous node and
       // the other one to point to the next node.
@@ -150,25 +272,63 @@ namespace util {
       //               sizeof(_Key) + sizeof(_Tp)
 
       static const size_t kLeafNodeMaxKeys =
-           (common_parameters<_Key, _Compare, _NodeSize>::kNodeSize -
+           (common_parameters<_Key,
+                              _Compare,
+                              _NodeSize,
+                              _Allocator,
+                              _Instrumentation,
+                              _Counted,
+                              _Aggregate>::kNodeSize -
             sizeof(typename common_parameters<_Key,
                                               _Compare,
-                                              _NodeSize>::node_header) -
+                                              _NodeSize,
+                                              _Allocator,
+                                              _Instrumentation,
+                                              _Counted,
+                                              _Aggregate>::node_header) -
             (2 * sizeof(void*))) /
            (sizeof(_Key) + sizeof(_Tp));
     };
 
     // Map parameters.
-    template<typename _Key, typename _Tp, typename _Compare, size_t _NodeSize>
+    template<typename _Key,
+             typename _Tp,
+             typename _Compare,
+             size_t _NodeSize,
+             typename _Allocator = malloc_allocator,
+             typename _Instrumentation = no_instrumentation,
+             bool _Counted = false,
+             typename _Aggregate = no_aggregate>
     struct map_parameters
-      : public common_map_parameters<_Key, _Tp, _Compare, _NodeSize> {
+      : public common_map_parameters<_Key,
+                                     _Tp,
+                                     _Compare,
+                                     _NodeSize,
+                                     _Allocator,
+                                     _Instrumentation,
+                                     _Counted,
+                                     _Aggregate> {
       static const bool kDuplicates = false;
     };
 
     // Multimap parameters.
-    template<typename _Key, typename _Tp, typename _Compare, size_t _NodeSize>
+    template<typename _Key,
+             typename _Tp,
+             typename _Compare,
+             size_t _NodeSize,
+             typename _Allocator = malloc_allocator,
+             typename _Instrumentation = no_instrumentation,
+             bool _Counted = false,
+             typename _Aggregate = no_aggregate>
     struct multimap_parameters
-      : public common_map_parameters<_Key, _Tp, _Compare, _NodeSize> {
+      : public common_map_parameters<_Key,
+                                     _Tp,
+                                     _Compare,
+                                     _NodeSize,
+                                     _Allocator,
+                                     _Instrumentation,
+                                     _Counted,
+                                     _Aggregate> {
       static const bool kDuplicates = true;
     };
 
@@ -183,27 +343,66 @@ namespace util {
             typedef typename btree::key_type key_type;
             typedef typename btree::value_type value_type;
             typedef typename btree::key_compare key_compare;
+            typedef typename btree::allocator_type allocator_type;
+            typedef typename btree::instrumentation_type instrumentation_type;
+            typedef typename btree::aggregate_type aggregate_type;
+            typedef typename btree::summary_type summary_type;
 
             enum type {
               kInternal,
               kLeaf
             };
 
-            // Constructor.
-            node(uint8_t* data);
+            // Create node.
+            static node* create(type type, allocator_type& allocator);
 
-            // Destructor.
-            ~node();
+            // Destroy node (and its subtree).
+            static void destroy(node* n, allocator_type& allocator);
 
-            // Create node.
-            static node* create(type type);
+            // Free node (but not its children).
+            static void free_node(node* n, allocator_type& allocator);
+
+            // Get keys.
+            const key_type* keys() const;
+            key_type* keys();
+
+            // Get children (internal nodes).
+            node* const* children() const;
+            node** children();
+
+            // Get the number of keys of the subtree of each child (internal
+            // nodes of counted trees).
+            const size_t* counts() const;
+            size_t* counts();
+
+            // Get the summary of the values of the subtree of each child
+            // (internal nodes of aggregated trees).
+            const summary_type* summaries() const;
+            summary_type* summaries();
+
+            // Get values (leaf nodes).
+            const value_type* values() const;
+            value_type* values();
 
             // Node full?
             bool full() const;
 
-            // Minimum number of keys?
+            // Minimum number of keys (or less)?
             bool minkeys() const;
 
+            // Prefetch the header and the keys.
+            void prefetch() const;
+
+            // Compare keys.
+            static int compare(const key_compare& comp,
+                               const key_type& x,
+                               const key_type& y);
+
+            // x < y?
+            static bool less(const key_compare& comp,
+                             const key_type& x,
+                             const key_type& y);
+
             // Find.
             bool find(const key_type& key,
                       const key_compare& comp,
@@ -220,19 +419,144 @@ namespace util {
                              uint16_t& pos) const;
 
             // Insert key in non-full node.
+            // The value is constructed from 'args'. If the key has been
+            // already inserted and duplicates are not allowed, the value is
+            // replaced only if 'assign' is true. 'append' tells that the key
+            // goes after all the keys of the tree (see split_child()).
+            // 'leaf' and 'pos' receive the position of the key.
+            template<typename _K, typename... _Args>
             static bool insert_non_full(node* x,
-                                        const key_type& key,
-                                        const value_type& value,
                                         const key_compare& comp,
-                                        size_t& nkeys);
+                                        bool assign,
+                                        bool append,
+                                        size_t& nkeys,
+                                        allocator_type& allocator,
+                                        node*& leaf,
+                                        uint16_t& pos,
+                                        _K&& key,
+                                        _Args&&... args);
+
+            // Insert key at position 'pos' of the non-full leaf node 'x'.
+            // The value is constructed from 'args'.
+            template<typename _K, typename... _Args>
+            static void insert(node* x,
+                               uint16_t pos,
+                               _K&& key,
+                               _Args&&... args);
 
             // Split child.
-            bool split_child(uint16_t i);
+            // If 'append' is true, the keys are being appended: the child
+            // is split unevenly, keeping all but one (leaf) or two (internal
+            // node) keys, so ascending inserts leave full nodes behind.
+            bool split_child(uint16_t i,
+                             allocator_type& allocator,
+                             bool append = false);
 
             // Erase key.
             static bool erase(node*& root,
                               const key_type& key,
-                              const key_compare& comp);
+                              const key_compare& comp,
+                              allocator_type& allocator);
+
+            // Erase the key at position 'pos' of the leaf node 'x'.
+            static void erase(node* x, uint16_t pos);
+
+            // Rightmost leaf node of the subtree rooted at 'x'.
+            static const node* last_leaf(const node* x);
+
+            // Rebalance or merge the nodes on the way down to the leftmost
+            // (or the rightmost) leaf node, so a key can be erased from it.
+            static void descend_edge(node*& root,
+                                     bool rightmost,
+                                     allocator_type& allocator);
+
+            // Erase the keys of 'range' (a key_range or a position_range)
+            // from the subtree rooted at 'x'.
+            // The subtrees holding only keys of the range are deleted whole
+            // and only the nodes on the paths to its first and last keys are
+            // repaired.
+            // 'x' itself might be left with fewer keys than the minimum (no
+            // keys at all if it is an internal node); 'empty' tells whether
+            // it has no keys (leaf node) or children (internal node) left.
+            // Returns the number of keys erased.
+            template<typename _Range>
+            static size_t erase_range(node* x,
+                                      const _Range& range,
+                                      allocator_type& allocator,
+                                      bool& empty);
+
+            // Move the keys greater than or equal to 'key' of the subtree
+            // rooted at 'x' to a new subtree of the same height ('y'),
+            // built from the nodes of 'spare' (an internal node per level
+            // and a leaf node). Only the nodes on the path to 'key' are cut
+            // and repaired.
+            // Like erase_range(), 'x' and 'y' might be left with fewer keys
+            // than the minimum; 'xempty' and 'yempty' tell whether they are
+            // empty.
+            static void split(node* x,
+                              const key_type& key,
+                              const key_compare& comp,
+                              node** spare,
+                              allocator_type& allocator,
+                              bool& xempty,
+                              node*& y,
+                              bool& yempty);
+
+            // Attach the subtree rooted at 'y' (of height 'hy') to the
+            // rightmost edge (the leftmost one if 'front') of the tree
+            // rooted at 'root' (of height 'h', not less than 'hy'), 'sep'
+            // separating their keys. The full nodes on the edge are split
+            // first; then the leaf nodes at the seam ('l' and 'r') are
+            // linked. Returns false if a node couldn't be allocated ('y' is
+            // not attached then).
+            static bool attach(node*& root,
+                               size_t h,
+                               node* y,
+                               size_t hy,
+                               const key_type& sep,
+                               bool front,
+                               node* l,
+                               node* r,
+                               allocator_type& allocator);
+
+            // Get the height of the subtree rooted at 'x' (0 if 'x' is a
+            // leaf node).
+            static size_t height(const node* x);
+
+            // Get the number of keys of the subtree rooted at 'x' (counted
+            // trees).
+            static size_t subtree_count(const node* x);
+
+            // Add 'n' to the counts of the children on the way down to the
+            // leftmost (or the rightmost) leaf node (counted trees).
+            static void add_edge_count(node* root, bool rightmost, ptrdiff_t n);
+
+            // Get the summary of the values of the subtree rooted at 'x'
+            // (aggregated trees).
+            static summary_type summarize(const node* x);
+
+            // Update the summaries of the children on the way down to the
+            // leftmost (or the rightmost) leaf node (aggregated trees).
+            static void update_edge(node* root, bool rightmost);
+
+            // Reduce the values of the keys in ['lo', 'hi') of the subtree
+            // rooted at 'x' (aggregated trees). A NULL bound means no bound.
+            // The subtrees inside the range contribute their summaries.
+            static summary_type reduce(const node* x,
+                                       const key_type* lo,
+                                       const key_type* hi,
+                                       const key_compare& comp);
+
+            // Get the number of keys less than 'key' (less than or equal to
+            // 'key' if 'upper') in the subtree rooted at 'x' (counted
+            // trees). 'leaf' and 'pos' receive the position where the
+            // descent ends.
+            static size_t rank(const node* x,
+                               const key_type& key,
+                               const key_compare& comp,
+                               bool upper,
+                               const node*& leaf,
+                               uint16_t& pos);
 
             // Get previous.
             const node* prev() const;
@@ -261,11 +585,6 @@ namespace util {
 
             static const size_t kInternalNodeMedian = kInternalNodeMaxKeys >> 1;
 
-            static const size_t kInternalNodeSize =
-                                sizeof(typename parameters_type::node_header) +
-                                (kInternalNodeMaxKeys * sizeof(key_type)) +
-                                ((kInternalNodeMaxKeys + 1) * sizeof(node*));
-
             static const size_t kLeafNodeMaxKeys =
                                 (parameters_type::kLeafNodeMaxKeys >= 3) ?
                                        parameters_type::kLeafNodeMaxKeys :
@@ -276,27 +595,195 @@ namespace util {
             static const size_t kLeafNodeMedian =
                                 (kLeafNodeMaxKeys + 1) >> 1;
 
-            static const size_t kLeafNodeSize =
-                                sizeof(typename parameters_type::node_header) +
-                                (kLeafNodeMaxKeys * sizeof(key_type)) +
-                                (kLeafNodeMaxKeys * kValueSize) +
-                                (2 * sizeof(node*));
-
             static const bool kDuplicates = parameters_type::kDuplicates;
 
-            uint8_t* _M_data;
+            static const bool kCounted = parameters_type::kCounted;
+
+            static const bool kAggregated = aggregate_type::kEnabled;
+
+            // Do the internal nodes keep information about the subtrees?
+            static const bool kAugmented = (kCounted) || (kAggregated);
+
+            // Maximum height of the tree (internal nodes have two children
+            // at least).
+            static const size_t kMaxHeight = 64;
+
+            // Children followed on the way down from the root to a leaf node
+            // (counted and aggregated trees).
+            struct path {
+              node* nodes[kMaxHeight];
+              uint16_t pos[kMaxHeight];
+              size_t height;
+            };
+
+            // Add 'n' to the counts of the children of 'p'.
+            static void add_path_count(const path& p, ptrdiff_t n);
+
+            // Make 'p' the path to the key at position 'pos' of the leaf
+            // node 'leaf' (its position in the leaf node is 'p.pos[p.height]').
+            // If duplicates are allowed, the leaf node is told apart from the
+            // other ones holding the same key by walking the linked leaves,
+            // so the cost grows with the number of duplicates.
+            static void find_path(node* root,
+                                  const node* leaf,
+                                  uint16_t pos,
+                                  const key_compare& comp,
+                                  path& p);
+
+            // Keys erased by erase_range(): from 'lo' to 'hi' ('hi' included
+            // if 'inclusive')...
+            struct key_range {
+              const key_type& lo;
+              const key_type& hi;
+              bool inclusive;
+              const key_compare& comp;
+
+              // Positions of the first key of the range in the leaf node 'x'
+              // and of the key after its last one.
+              void keys(const node* x, uint16_t& first, uint16_t& last) const;
+
+              // Children of the internal node 'x' holding the first ('i')
+              // and the last ('j') keys of the range.
+              void children(const node* x, uint16_t& i, uint16_t& j) const;
+
+              // Range of the child holding the first key (and the last one
+              // as well if 'single') and of the child holding the last key.
+              const key_range& first_child(bool single) const;
+              const key_range& last_child() const;
+            };
+
+            // ... or from the key at the end of the path 'from' to the one at
+            // the end of the path 'to' (included if 'inclusive'). A NULL path
+            // stands for the leftmost (or the rightmost) key of the subtree,
+            // which is 'depth' levels below the root.
+            struct position_range {
+              const path* from;
+              const path* to;
+              size_t depth;
+              bool inclusive;
+
+              void keys(const node* x, uint16_t& first, uint16_t& last) const;
+              void children(const node* x, uint16_t& i, uint16_t& j) const;
+              position_range first_child(bool single) const;
+              position_range last_child() const;
+            };
+
+            // Update the summaries of the children of 'p' (bottom-up).
+            static void update_path(const path& p);
+
+            // Erase the first key of the leftmost leaf node of the child
+            // 'j' of 'y' (the leaf node after 'x') if it is equal to 'key'.
+            // 'p' is the path to 'x', which goes through the child 'j - 1'
+            // of 'y' at the level 'depth' (counted and aggregated trees).
+            static bool erase_next(node* x,
+                                   node* y,
+                                   uint16_t j,
+                                   const path& p,
+                                   size_t depth,
+                                   const key_type& key,
+                                   const key_compare& comp);
+
+            typedef key_search<key_type, key_compare> search_type;
+
+            // The header, the keys and the children (internal nodes) or the
+            // values and the links to the sibling leaves (leaf nodes) live in
+            // a single cache-line-aligned block. The offsets are compile-time
+            // constants, so the lookup path touches the node only once per
+            // level.
+            //
+            // The slots are raw storage: only the first 'count' keys (and
+            // values) are constructed.
+            //
+            // Internal node:
+            // +--------+----------------+------------------------+
+            // | header | keys[kMaxKeys] | children[kMaxKeys + 1] |
+            // +--------+----------------+------------------------+
+            //
+            // Counted trees append counts[kMaxKeys + 1] to the internal
+            // nodes: the number of keys of the subtree of each child.
+            // Aggregated trees append summaries[kMaxKeys + 1] after them:
+            // the summary of the values of the subtree of each child.
+            //
+            // Leaf node:
+            // +--------+----------------+------------------+------+------+
+            // | header | keys[kMaxKeys] | values[kMaxKeys] | prev | next |
+            // +--------+----------------+------------------+------+------+
+            static const size_t kCacheLineSize = 64;
+
+            static constexpr size_t align(size_t offset, size_t alignment)
+            {
+              return (offset + alignment - 1) & ~(alignment - 1);
+            }
+
+            typedef typename parameters_type::node_header node_header;
 
-            typename parameters_type::node_header* _M_header;
-            key_type* _M_keys;
+            static const size_t kKeysOffset = align(sizeof(node_header),
+                                                    alignof(key_type));
 
-            // For internal nodes.
-            node** _M_children;
+            static const size_t kChildrenOffset =
+                                align(kKeysOffset +
+                                      (kInternalNodeMaxKeys * sizeof(key_type)),
+                                      alignof(node*));
 
-            // For leaf nodes.
-            value_type* _M_values;
+            static const size_t kCountsOffset =
+                                align(kChildrenOffset +
+                                      ((kInternalNodeMaxKeys + 1) *
+                                       sizeof(node*)),
+                                      alignof(size_t));
 
-            node** _M_prev;
-            node** _M_next;
+            static const size_t kSummariesOffset =
+                                align(kCountsOffset +
+                                      ((kCounted) ?
+                                         (kInternalNodeMaxKeys + 1) *
+                                         sizeof(size_t) :
+                                         0),
+                                      alignof(summary_type));
+
+            static const size_t kInternalNodeSize =
+                                align(kSummariesOffset +
+                                      ((kAggregated) ?
+                                         (kInternalNodeMaxKeys + 1) *
+                                         sizeof(summary_type) :
+                                         0),
+                                      kCacheLineSize);
+
+            static const size_t kValuesOffset =
+                                (kValueSize > 0) ?
+                                  align(kKeysOffset +
+                                        (kLeafNodeMaxKeys * sizeof(key_type)),
+                                        alignof(value_type)) :
+                                  kKeysOffset;
+
+            static const size_t kPrevOffset =
+                                align(kValuesOffset +
+                                      (kLeafNodeMaxKeys *
+                                       ((kValueSize > 0) ? kValueSize :
+                                                           sizeof(key_type))),
+                                      alignof(node*));
+
+            static const size_t kNextOffset = kPrevOffset + sizeof(node*);
+
+            static const size_t kLeafNodeSize =
+                                align(kNextOffset + sizeof(node*),
+                                      kCacheLineSize);
+
+            node_header _M_header;
+
+            // Constructor.
+            node(type type);
+
+            // Relocate 'n' objects from 'src' to 'dst'.
+            // The objects are move-constructed into the uninitialized slots
+            // of 'dst' and destroyed in 'src'. The ranges may overlap.
+            template<typename _T>
+            static void relocate(_T* dst, _T* src, size_t n);
+
+            // Assign value.
+            template<typename _V>
+            static void assign_value(value_type& slot, _V&& value);
+
+            template<typename... _Args>
+            static void assign_value(value_type& slot, _Args&&... args);
 
             // Rebalance left to right.
             static void rebalance_left_to_right(node* x, uint16_t i);
@@ -305,7 +792,16 @@ namespace util {
             static void rebalance_right_to_left(node* x, uint16_t i);
 
             // Merge.
-            static void merge(node* x, node* y, node* z, uint16_t i);
+            // The right node is deleted, unless it is the rightmost leaf
+            // node and the left one is not the leftmost leaf node: then the
+            // left node is deleted. So the leftmost and the rightmost leaf
+            // nodes stay put, unless they are merged together (the root
+            // becomes a leaf node then).
+            static void merge(node* x,
+                              node* y,
+                              node* z,
+                              uint16_t i,
+                              allocator_type& allocator);
 
             enum operation_result {
               kNoop,
@@ -315,15 +811,39 @@ namespace util {
               kShrinked
             };
 
-            // Try to rebalance or merge subtree.
-            static operation_result try_rebalance_or_merge_subtree(node* x,
-                                                                   node*& root,
-                                                                   uint16_t i);
-
-            // Try to rebalance or merge.
-            static operation_result try_rebalance_or_merge(node* x,
-                                                           node*& root,
-                                                           uint16_t& i);
+            // Try to rebalance or merge the child 'i' of 'x' if it has the
+            // minimum number of keys (or less), before descending into it
+            // to erase a key. A child below the minimum still has a key, so
+            // it is left with two keys at least (enough to lose one further
+            // down) and 'x' loses one key at most.
+            static operation_result
+            try_rebalance_or_merge(node* x,
+                                   node*& root,
+                                   uint16_t& i,
+                                   allocator_type& allocator);
+
+            // Delete the empty child 'i' of 'x'.
+            // Returns false if it was the only child of 'x'.
+            static bool remove_child(node* x,
+                                     uint16_t i,
+                                     allocator_type& allocator);
+
+            // Delete the subtrees rooted at the children 'first' to 'last'
+            // (first > 0) of 'x'. Returns the number of keys deleted.
+            static size_t remove_children(node* x,
+                                          uint16_t first,
+                                          uint16_t last,
+                                          allocator_type& allocator);
+
+            // Repair child 'i' of 'x' (with the minimum number of keys or
+            // less), by rebalancing or merging it with a sibling ('x' must
+            // have more than one child). 'i' receives the position of the
+            // repaired child. An internal node without keys left in the
+            // repaired child is repaired as well (the whole chain, if the
+            // nodes below have no keys either).
+            static void repair_child(node* x,
+                                     uint16_t& i,
+                                     allocator_type& allocator);
 
             // Disable copy constructor and assignment operator.
             node(const node&) = delete;
@@ -335,6 +855,10 @@ namespace util {
         typedef typename _Parameters::key_type key_type;
         typedef typename _Parameters::value_type value_type;
         typedef typename _Parameters::key_compare key_compare;
+        typedef typename _Parameters::allocator_type allocator_type;
+        typedef typename _Parameters::instrumentation_type instrumentation_type;
+        typedef typename _Parameters::aggregate_type aggregate_type;
+        typedef typename aggregate_type::summary_type summary_type;
 
         class iterator {
           friend class btree;
@@ -380,6 +904,41 @@ namespace util {
             uint16_t _M_pos;
         };
 
+        // Statistics of a level of the tree (level 0 is the root).
+        struct level_statistics {
+          size_t nodes;
+          size_t keys;
+
+          // Fill of a node: number of keys / maximum number of keys.
+          double average_fill;
+          double min_fill;
+        };
+
+        // Tree statistics.
+        // The allocated bytes are split into key storage (the keys of the
+        // leaves and the separators of the internal nodes), value storage
+        // and node overhead (headers, children, sibling links, padding and
+        // free slots). Memory owned by the keys and the values themselves
+        // (e.g. the buffer of a string) is not included.
+        struct statistics {
+          size_t height;
+          size_t internal_nodes;
+          size_t leaf_nodes;
+          size_t keys;
+
+          std::vector<level_statistics> levels;
+
+          size_t internal_node_size;
+          size_t leaf_node_size;
+
+          size_t allocated_bytes;
+          size_t key_bytes;
+          size_t value_bytes;
+          size_t overhead_bytes;
+
+          double bytes_per_key;
+        };
+
         // Constructor.
         btree(const key_compare& comp = key_compare());
 
@@ -389,23 +948,195 @@ namespace util {
         // Clear.
         void clear();
 
+        // Is the tree empty? O(1).
+        bool empty() const;
+
         // Get number of keys.
+        // O(1), unless the tree is not counted and has been split (see
+        // split()): then the leaf nodes are walked, until the tree is
+        // cleared, loaded or emptied.
         size_t count() const;
 
+        // Get number of keys equal to 'key'.
+        // The tree is descended once; then the leaf nodes holding the equal
+        // keys are scanned. Counted trees are descended twice instead (see
+        // count_range()).
+        size_t count(const key_type& key) const;
+
+        // Get number of keys in ['lo', 'hi') (counted trees).
+        // The tree is descended twice, whatever the number of keys.
+        size_t count_range(const key_type& lo, const key_type& hi) const;
+
+        // Get number of keys less than 'key' (counted trees).
+        size_t rank(const key_type& key) const;
+
+        // Reduce the values of the keys in ['lo', 'hi') (aggregated trees).
+        // The summaries of the subtrees inside the range are combined, so
+        // only the paths to 'lo' and 'hi' are descended.
+        summary_type reduce(const key_type& lo, const key_type& hi) const;
+
+        // Get position of the key pointed to by 'it' (counted trees).
+        // If duplicates are allowed, the leaf nodes holding the keys equal
+        // to it are scanned up to 'it'.
+        size_t rank(const iterator& it) const;
+        size_t rank(const const_iterator& it) const;
+
+        // Select the key at position 'k' (counted trees).
+        // Returns false if 'k' is out of range.
+        bool select(size_t k, iterator& it);
+        bool select(size_t k, const_iterator& it) const;
+
+        // Move 'it' 'n' positions forward (backward if 'n' is negative).
+        // Moves within the leaf node of 'it' don't touch the rest of the
+        // tree; otherwise counted trees select the new position, while the
+        // other trees walk the leaf nodes. Returns false (and leaves 'it'
+        // untouched) if the new position is out of range.
+        bool advance(iterator& it, ptrdiff_t n);
+        bool advance(const_iterator& it, ptrdiff_t n) const;
+
+        // Get allocator.
+        allocator_type& allocator();
+
+        // Get statistics.
+        // Visits the internal nodes and the headers of the leaves.
+        statistics stats() const;
+
+        // Get instrumentation counters (see instrumentation.h).
+        static void snapshot(counters& c);
+
+        // Reset instrumentation counters.
+        static void reset_counters();
+
         // Insert key.
+        // If the key has been already inserted and duplicates are not
+        // allowed, the value is replaced.
         bool insert(const key_type& key, const value_type& value);
+        bool insert(key_type&& key, value_type&& value);
+
+        // Insert key with a value constructed in place from 'args'.
+        // If the key has been already inserted and duplicates are not
+        // allowed, the value is replaced.
+        template<typename... _Args>
+        bool emplace(const key_type& key, _Args&&... args);
+
+        template<typename... _Args>
+        bool emplace(key_type&& key, _Args&&... args);
+
+        // Insert key with a value constructed in place from 'args' if the
+        // key has not been inserted yet.
+        // Returns false if the key has been already inserted (and duplicates
+        // are not allowed); 'key' and 'args' are left untouched then.
+        template<typename... _Args>
+        bool try_emplace(const key_type& key, _Args&&... args);
+
+        template<typename... _Args>
+        bool try_emplace(key_type&& key, _Args&&... args);
+
+        // Insert key close to 'hint'.
+        // 'hint' must point to a key of the tree and be valid (the tree
+        // not modified since, except through 'hint'). If the key goes into
+        // the leaf node of 'hint' (or one of its neighbours) and the leaf
+        // node is not full, the key is inserted there without descending
+        // the tree (unless the tree is counted). 'hint' is updated to point
+        // to the key, so it can be passed to the next call.
+        // If the key has been already inserted and duplicates are not
+        // allowed, the value is replaced.
+        bool insert(iterator& hint,
+                    const key_type& key,
+                    const value_type& value);
+
+        bool insert(iterator& hint, key_type&& key, value_type&& value);
+
+        // Insert key close to 'hint' with a value constructed in place from
+        // 'args' (see insert(hint, key, value)).
+        template<typename... _Args>
+        bool emplace_hint(iterator& hint,
+                          const key_type& key,
+                          _Args&&... args);
+
+        template<typename... _Args>
+        bool emplace_hint(iterator& hint, key_type&& key, _Args&&... args);
 
         // Erase key.
         bool erase(const key_type& key);
 
+        // Erase the keys in ['lo', 'hi').
+        // The subtrees holding only keys of the range are deleted whole,
+        // so the cost depends on the number of leaf nodes of the range,
+        // not on the number of keys. Returns the number of keys erased.
+        size_t erase_range(const key_type& lo, const key_type& hi);
+
+        // Erase the keys from 'first' to 'last' ('last' included if
+        // 'inclusive'; 'first' must not be after 'last'). The range is
+        // defined by the positions: the duplicates of their keys outside
+        // of it are kept. Like erase_range(), whole subtrees are deleted,
+        // but telling the leaf nodes of the iterators apart from the other
+        // ones holding the same keys walks them. Returns the number of
+        // keys erased.
+        size_t erase(const iterator& first,
+                     const iterator& last,
+                     bool inclusive = false);
+
+        // Erase all the keys equal to 'key' (see erase_range()).
+        size_t erase_all(const key_type& key);
+
+        // Move the keys greater than or equal to 'key' to 'right' (which
+        // must be empty). Only the nodes on the path to 'key' are cut:
+        // O(log n). If the tree is not counted, the number of keys of both
+        // parts is not known: count() becomes O(n) on both trees (see
+        // count()). Returns false if 'right' is not empty or a node couldn't
+        // be allocated.
+        bool split(const key_type& key, btree& right);
+
+        // Move the keys of 'right' to the end of the tree (they must go
+        // after the keys of the tree). The shorter tree is attached to the
+        // edge of the taller one: O(log n). Returns false if the keys
+        // overlap or a node couldn't be allocated ('right' keeps its keys).
+        bool join(btree& right);
+
+        // Erase the first key.
+        // If 'key' (and 'value') are given, the key (and its value) are
+        // moved into them. Unless the first leaf node has the minimum number
+        // of keys, the tree is not descended.
+        bool pop_front();
+        bool pop_front(key_type& key);
+        bool pop_front(key_type& key, value_type& value);
+
+        // Erase the last key (see pop_front()).
+        bool pop_back();
+        bool pop_back(key_type& key);
+        bool pop_back(key_type& key, value_type& value);
+
         // Get value.
         bool get(const key_type& key, value_type& value) const;
 
-        // Begin.
+        // Get several values.
+        // 'values[i]' receives the value of 'keys[i]' (if found) and
+        // 'found[i]' whether it was found. Unsorted keys are sorted first.
+        // Returns the number of keys found.
+        size_t multi_get(const key_type* keys,
+                         size_t count,
+                         value_type* values,
+                         bool* found) const;
+
+        // Find several keys.
+        // 'its[i]' points to 'keys[i]' (if found) and 'found[i]' tells
+        // whether it was found. Returns the number of keys found.
+        size_t multi_find(const key_type* keys,
+                          size_t count,
+                          iterator* its,
+                          bool* found);
+
+        size_t multi_find(const key_type* keys,
+                          size_t count,
+                          const_iterator* its,
+                          bool* found) const;
+
+        // Begin (first key).
         bool begin(iterator& it);
         bool begin(const_iterator& it) const;
 
-        // End.
+        // End (last key).
         bool end(iterator& it);
         bool end(const_iterator& it) const;
 
@@ -425,23 +1156,266 @@ namespace util {
         bool lower_bound(const key_type& key, iterator& it);
         bool lower_bound(const key_type& key, const_iterator& it) const;
 
+        // Find close to 'hint'.
+        // 'hint' must be valid (see insert(hint, key, value)). The leaf
+        // node of 'hint' and its neighbours are checked first; the tree is
+        // descended only if the key is not around them.
+        bool find(const iterator& hint, const key_type& key, iterator& it);
+        bool find(const const_iterator& hint,
+                  const key_type& key,
+                  const_iterator& it) const;
+
+        // Lower bound close to 'hint' (see find(hint, key, it)).
+        bool lower_bound(const iterator& hint,
+                         const key_type& key,
+                         iterator& it);
+
+        bool lower_bound(const const_iterator& hint,
+                         const key_type& key,
+                         const_iterator& it) const;
+
         // Upper bound.
         bool upper_bound(const key_type& key, iterator& it);
         bool upper_bound(const key_type& key, const_iterator& it) const;
 
         // Equal range.
+        // 'begin' points to the first key equal to 'key' and 'end' to the
+        // key after the last one. The tree is descended once; then the leaf
+        // nodes holding the equal keys are scanned.
         bool equal_range(const key_type& key, iterator& begin, iterator& end);
         bool equal_range(const key_type& key,
                          const_iterator& begin,
                          const_iterator& end) const;
 
+        // Bulk load.
+        // The tree must be empty and the (key, value) pairs sorted by key.
+        // The leaves are filled up to 'fill_factor' (0.0 - 1.0, values out
+        // of the range are clamped) of their capacity.
+        template<typename _InputIterator>
+        bool bulk_load(_InputIterator first,
+                       _InputIterator last,
+                       float fill_factor = 1.0f);
+
+        bool bulk_load(const key_type* keys,
+                       const value_type* values,
+                       size_t count,
+                       float fill_factor = 1.0f);
+
+        // Set operations.
+        // The tree (which must be empty) is built from the keys (and the
+        // values) of 'x' and 'y': both lists of leaf nodes are walked at
+        // once and the result is built bottom-up (see bulk_load()), so it
+        // takes O(n + m) and leaves a compact tree. On equal keys, the key
+        // (and the value) of 'x' is kept. With duplicates, the equal keys
+        // are paired one to one, as in std::set_union() and the like.
+        bool set_union(const btree& x,
+                       const btree& y,
+                       float fill_factor = 1.0f);
+
+        // Keys in both trees. If a tree is much larger than the other one,
+        // the walk skips over it with finger searches (see lower_bound()
+        // with a hint): O(m log n).
+        bool set_intersection(const btree& x,
+                              const btree& y,
+                              float fill_factor = 1.0f);
+
+        // Keys of 'x' not in 'y' (skipping over 'y' if it is much larger).
+        bool set_difference(const btree& x,
+                            const btree& y,
+                            float fill_factor = 1.0f);
+
+        // Keys in one of the trees only.
+        bool set_symmetric_difference(const btree& x,
+                                      const btree& y,
+                                      float fill_factor = 1.0f);
+
+        // All the keys of both trees (as set_union() if there are no
+        // duplicates).
+        bool merge(const btree& x, const btree& y, float fill_factor = 1.0f);
+
+      protected:
+        // Bottom-up tree builder.
+        // The keys are appended in order to the leaves, which are filled from
+        // left to right; finish() builds the internal levels bottom-up and
+        // hands the nodes over to the (empty) tree.
+        class builder {
+          public:
+            // Constructor.
+            builder(btree& tree, float fill_factor);
+
+            // Destructor.
+            ~builder();
+
+            // Append key.
+            bool append(const key_type& key, const value_type& value);
+
+            // Finish.
+            bool finish();
+
+          private:
+            btree& _M_tree;
+
+            float _M_fill_factor;
+
+            // Number of keys per leaf node.
+            uint16_t _M_leaf_keys;
+
+            node* _M_first;
+            node* _M_last;
+
+            size_t _M_nkeys;
+            size_t _M_nleaves;
+
+            // Get the number of nodes of the next level.
+            static size_t parents(size_t nchildren,
+                                  size_t target,
+                                  size_t min_children);
+
+            // Free leaf nodes.
+            void free_leaves();
+
+            // Disable copy constructor and assignment operator.
+            builder(const builder&) = delete;
+            builder& operator=(const builder&) = delete;
+        };
+
       private:
         static const bool kDuplicates = parameters_type::kDuplicates;
 
+        // The summaries are stored in raw slots.
+        static_assert(std::is_trivially_copyable<summary_type>::value,
+                      "summary_type must be trivially copyable");
+
         key_compare _M_comp;
 
         node* _M_root;
+
+        // Number of keys. After splitting a tree which is not counted, the
+        // number of keys of both parts is not known ('_M_nkeys_valid' is
+        // false) and count() walks the leaf nodes. '_M_nkeys' is still
+        // incremented and decremented (modulo 2^64), but it is only used to
+        // tell whether a key has been inserted.
         size_t _M_nkeys;
+        bool _M_nkeys_valid;
+
+        // Leftmost and rightmost leaf nodes (NULL if the tree is empty).
+        node* _M_head;
+        node* _M_tail;
+
+        allocator_type _M_allocator;
+
+        // Insert key (splitting the root node if it is full).
+        // Keys greater than all the keys of the tree are appended to the
+        // rightmost leaf node directly.
+        // 'it' (if not NULL) receives the position of the key.
+        template<typename _K, typename... _Args>
+        bool insert_key(bool assign, iterator* it, _K&& key, _Args&&... args);
+
+        // Insert key close to 'hint'.
+        template<typename _K, typename... _Args>
+        bool insert_hint(iterator& hint,
+                         bool assign,
+                         _K&& key,
+                         _Args&&... args);
+
+        // Get the leaf node where 'key' has to be inserted, looking only at
+        // the leaf node 'x' and its neighbours (NULL if not there).
+        node* insert_leaf(node* x, const key_type& key) const;
+
+        // Get the leaf node holding the lower bound of 'key', looking only
+        // at the leaf node 'x' and its neighbours (NULL if not there).
+        template<typename _Node>
+        _Node* lower_bound_leaf(_Node* x, const key_type& key) const;
+
+        // Key after the last key of the leaf node 'x' (where it would be
+        // inserted)?
+        bool after_last(const node* x, const key_type& key) const;
+
+        // Erase the keys in ['lo', 'hi') (['lo', 'hi'] if 'inclusive').
+        size_t erase_range(const key_type& lo,
+                           const key_type& hi,
+                           bool inclusive);
+
+        enum set_operation {
+          kUnion,
+          kIntersection,
+          kDifference,
+          kSymmetricDifference,
+          kMerge
+        };
+
+        // A tree is skipped over (set_intersection() and set_difference())
+        // if it has this many times the keys of the other one.
+        static const size_t kSkipRatio = 16;
+
+        // Build the tree from the keys of 'x' and 'y' (see set_union()).
+        bool combine(const btree& x,
+                     const btree& y,
+                     set_operation op,
+                     float fill_factor);
+
+        // Move the position ('x', 'pos') to the next key ('x' is NULL
+        // after the last one).
+        static void step(const node*& x, uint16_t& pos);
+
+        // Move the position ('x', 'pos') forward to the first key not less
+        // than 'key' ('x' is NULL if there is none).
+        void skip(const key_type& key, const node*& x, uint16_t& pos) const;
+
+        // Delete the root node if it is empty ('empty') and while it has a
+        // single child, then find the leftmost and the rightmost leaf
+        // nodes.
+        void repair_root(bool empty);
+
+        // Prepare the leftmost (or the rightmost) leaf node for erasing
+        // one of its keys: if it has the minimum number of keys, the nodes
+        // on the way down to it are rebalanced or merged.
+        void prepare_pop(bool back);
+
+        // Erase the key at position 'pos' of the leaf node 'x'.
+        void pop(node* x, uint16_t pos);
+
+        // Move the position ('x', 'pos') of the first key equal to 'key'
+        // after the last one. Returns the number of equal keys.
+        template<typename _Node>
+        size_t skip_equal(const key_type& key, _Node*& x, uint16_t& pos) const;
+
+        // Get the number of keys less than 'key' (less than or equal to
+        // 'key' if 'upper').
+        size_t rank(const key_type& key, bool upper) const;
+
+        // Get the position of the key at position 'pos' of the leaf node
+        // 'x'.
+        size_t rank(const node* x, uint16_t pos) const;
+
+        // Select the key at position 'k'.
+        template<typename _Node>
+        bool select(size_t k, _Node*& x, uint16_t& pos) const;
+
+        // Move the position ('x', 'pos') 'n' positions.
+        template<typename _Node>
+        bool advance(_Node*& x, uint16_t& pos, ptrdiff_t n) const;
+
+        // Collect statistics of the subtree rooted at 'x'.
+        static void stats(const node* x, size_t level, statistics& s);
+
+        // Look up several keys. 'callback(i, leaf, pos)' is invoked for each
+        // key found.
+        // The keys are sorted (through 'order' if not NULL), so each subtree
+        // is descended once for all its keys and the children to be visited
+        // are prefetched together.
+        template<typename _Callback>
+        size_t multi_lookup(const key_type* keys,
+                            size_t count,
+                            _Callback& callback) const;
+
+        template<typename _Callback>
+        size_t multi_lookup(const node* x,
+                            const key_type* keys,
+                            const size_t* order,
+                            size_t first,
+                            size_t last,
+                            _Callback& callback) const;
 
         // Disable copy constructor and assignment operator.
         btree(const btree&) = delete;
@@ -449,39 +1423,15 @@ namespace util {
     };
 
     template<typename _Parameters>
-    inline btree<_Parameters>::node::node(uint8_t* data)
-      : _M_data(data)
-    {
-    }
-
-    template<typename _Parameters>
-    inline btree<_Parameters>::node::~node()
+    inline btree<_Parameters>::node::node(type type)
     {
-      if (_M_data) {
-        // Invoke the destructors.
-        uint16_t count = _M_header->count;
-        for (uint16_t i = 0; i < count; i++) {
-          _M_keys[i].key_type::~key_type();
-        }
-
-        // Internal node?
-        if (_M_header->type == kInternal) {
-          for (uint16_t i = 0; i <= count; i++) {
-            delete _M_children[i];
-          }
-        } else if (kValueSize > 0) {
-          for (uint16_t i = 0; i < count; i++) {
-            _M_values[i].value_type::~value_type();
-          }
-        }
-
-        free(_M_data);
-      }
+      _M_header.type = type;
+      _M_header.count = 0;
     }
 
     template<typename _Parameters>
     inline typename btree<_Parameters>::node*
-    btree<_Parameters>::node::create(type type)
+    btree<_Parameters>::node::create(type type, allocator_type& allocator)
     {
       size_t node_size;
       if (type == kInternal) {
@@ -490,87 +1440,202 @@ namespace util {
         node_size = kLeafNodeSize;
       }
 
-      uint8_t* data;
-      if ((data = reinterpret_cast<uint8_t*>(calloc(node_size, 1))) == NULL) {
-        return NULL;
-      }
-
-      node* n;
-      if ((n = new (std::nothrow) node(data)) == NULL) {
-        free(data);
+      void* data;
+      if ((data = allocator.allocate(node_size)) == NULL) {
         return NULL;
       }
 
-      // Initialize header.
-      n->_M_header = reinterpret_cast<typename parameters_type::node_header*>(
-                       data
-                     );
+      node* n = new (data) node(type);
 
-      n->_M_header->type = type;
+      // Leaf node?
+      if (type == kLeaf) {
+        n->prev(NULL);
+        n->next(NULL);
+      }
 
-      // Initialize pointer to keys.
-      data += sizeof(typename parameters_type::node_header);
-      n->_M_keys = reinterpret_cast<key_type*>(data);
-      key_type* keys = n->_M_keys;
+      return n;
+    }
 
+    template<typename _Parameters>
+    void btree<_Parameters>::node::destroy(node* n, allocator_type& allocator)
+    {
       // Internal node?
-      if (type == kInternal) {
-        // Invoke constructors.
-        for (uint16_t i = 0; i < kInternalNodeMaxKeys; i++) {
-          new (&keys[i]) key_type();
+      if (n->_M_header.type == kInternal) {
+        node** children = n->children();
+        uint16_t count = n->_M_header.count;
+        for (uint16_t i = 0; i <= count; i++) {
+          destroy(children[i], allocator);
         }
+      }
 
-        // Initialize pointer to childen nodes.
-        data += (kInternalNodeMaxKeys * sizeof(key_type));
-        n->_M_children = reinterpret_cast<node**>(data);
-      } else {
-        // Initialize pointer to values.
-        data += (kLeafNodeMaxKeys * sizeof(key_type));
+      free_node(n, allocator);
+    }
 
-        if (kValueSize > 0) {
-          n->_M_values = reinterpret_cast<value_type*>(data);
+    template<typename _Parameters>
+    void btree<_Parameters>::node::free_node(node* n,
+                                             allocator_type& allocator)
+    {
+      key_type* keys = n->keys();
+      uint16_t count = n->_M_header.count;
 
-          // Invoke constructors.
-          value_type* values = n->_M_values;
-          for (uint16_t i = 0; i < kLeafNodeMaxKeys; i++) {
-            new (&keys[i]) key_type();
-            new (&values[i]) value_type();
-          }
-        } else {
-          n->_M_values = reinterpret_cast<value_type*>(keys);
+      // Invoke the destructors of the occupied slots.
+      for (uint16_t i = 0; i < count; i++) {
+        keys[i].key_type::~key_type();
+      }
 
-          // Invoke constructors.
-          for (uint16_t i = 0; i < kLeafNodeMaxKeys; i++) {
-            new (&keys[i]) key_type();
+      // Internal node?
+      if (n->_M_header.type == kInternal) {
+        allocator.deallocate(n, kInternalNodeSize);
+      } else {
+        if (kValueSize > 0) {
+          value_type* values = n->values();
+          for (uint16_t i = 0; i < count; i++) {
+            values[i].value_type::~value_type();
           }
         }
 
-        // Initialize pointer to previous node.
-        data += (kLeafNodeMaxKeys * node::kValueSize);
-        n->_M_prev = reinterpret_cast<node**>(data);
-
-        // Initialize pointer to next node.
-        data += sizeof(node*);
-        n->_M_next = reinterpret_cast<node**>(data);
+        allocator.deallocate(n, kLeafNodeSize);
       }
+    }
 
-      return n;
+    template<typename _Parameters>
+    inline const typename btree<_Parameters>::node::key_type*
+    btree<_Parameters>::node::keys() const
+    {
+      return reinterpret_cast<const key_type*>(
+               reinterpret_cast<const uint8_t*>(this) + kKeysOffset
+             );
+    }
+
+    template<typename _Parameters>
+    inline typename btree<_Parameters>::node::key_type*
+    btree<_Parameters>::node::keys()
+    {
+      return reinterpret_cast<key_type*>(
+               reinterpret_cast<uint8_t*>(this) + kKeysOffset
+             );
+    }
+
+    template<typename _Parameters>
+    inline typename btree<_Parameters>::node* const*
+    btree<_Parameters>::node::children() const
+    {
+      return reinterpret_cast<node* const*>(
+               reinterpret_cast<const uint8_t*>(this) + kChildrenOffset
+             );
+    }
+
+    template<typename _Parameters>
+    inline typename btree<_Parameters>::node**
+    btree<_Parameters>::node::children()
+    {
+      return reinterpret_cast<node**>(
+               reinterpret_cast<uint8_t*>(this) + kChildrenOffset
+             );
+    }
+
+    template<typename _Parameters>
+    inline const size_t* btree<_Parameters>::node::counts() const
+    {
+      return reinterpret_cast<const size_t*>(
+               reinterpret_cast<const uint8_t*>(this) + kCountsOffset
+             );
+    }
+
+    template<typename _Parameters>
+    inline size_t* btree<_Parameters>::node::counts()
+    {
+      return reinterpret_cast<size_t*>(
+               reinterpret_cast<uint8_t*>(this) + kCountsOffset
+             );
+    }
+
+    template<typename _Parameters>
+    inline const typename btree<_Parameters>::node::summary_type*
+    btree<_Parameters>::node::summaries() const
+    {
+      return reinterpret_cast<const summary_type*>(
+               reinterpret_cast<const uint8_t*>(this) + kSummariesOffset
+             );
+    }
+
+    template<typename _Parameters>
+    inline typename btree<_Parameters>::node::summary_type*
+    btree<_Parameters>::node::summaries()
+    {
+      return reinterpret_cast<summary_type*>(
+               reinterpret_cast<uint8_t*>(this) + kSummariesOffset
+             );
+    }
+
+    template<typename _Parameters>
+    inline const typename btree<_Parameters>::node::value_type*
+    btree<_Parameters>::node::values() const
+    {
+      return reinterpret_cast<const value_type*>(
+               reinterpret_cast<const uint8_t*>(this) + kValuesOffset
+             );
+    }
+
+    template<typename _Parameters>
+    inline typename btree<_Parameters>::node::value_type*
+    btree<_Parameters>::node::values()
+    {
+      return reinterpret_cast<value_type*>(
+               reinterpret_cast<uint8_t*>(this) + kValuesOffset
+             );
     }
 
     template<typename _Parameters>
     inline bool btree<_Parameters>::node::full() const
     {
-      return (_M_header->type == kInternal) ?
-                              (_M_header->count == kInternalNodeMaxKeys) :
-                              (_M_header->count == kLeafNodeMaxKeys);
+      return (_M_header.type == kInternal) ?
+                              (_M_header.count == kInternalNodeMaxKeys) :
+                              (_M_header.count == kLeafNodeMaxKeys);
     }
 
     template<typename _Parameters>
     inline bool btree<_Parameters>::node::minkeys() const
     {
-      return (_M_header->type == kInternal) ?
-                              (_M_header->count == kInternalNodeMinKeys) :
-                              (_M_header->count == kLeafNodeMinKeys);
+      // Appends, range erases, splits and joins might leave nodes with
+      // less than the minimum number of keys. The invariant kept is weaker:
+      // the nodes other than the root have one key at least.
+      return (_M_header.type == kInternal) ?
+                              (_M_header.count <= kInternalNodeMinKeys) :
+                              (_M_header.count <= kLeafNodeMinKeys);
+    }
+
+    template<typename _Parameters>
+    inline void btree<_Parameters>::node::prefetch() const
+    {
+      // The type of the node is not known before it is read: prefetch the
+      // largest keys array.
+      static const size_t kPrefetchSize =
+                          kKeysOffset +
+                          (((kInternalNodeMaxKeys > kLeafNodeMaxKeys) ?
+                              kInternalNodeMaxKeys :
+                              kLeafNodeMaxKeys) * sizeof(key_type));
+
+      const char* p = reinterpret_cast<const char*>(this);
+      for (size_t offset = 0; offset < kPrefetchSize; offset += kCacheLineSize) {
+        __builtin_prefetch(p + offset);
+      }
+    }
+
+    template<typename _Parameters>
+    inline int btree<_Parameters>::node::compare(const key_compare& comp,
+                                                 const key_type& x,
+                                                 const key_type& y)
+    {
+      return search_type::compare(comp, x, y);
+    }
+
+    template<typename _Parameters>
+    inline bool btree<_Parameters>::node::less(const key_compare& comp,
+                                               const key_type& x,
+                                               const key_type& y)
+    {
+      return search_type::less(comp, x, y);
     }
 
     ////////////////////////////////////////////////////////////////////////////
@@ -595,41 +1660,8 @@ namespace util {
                                         const key_compare& comp,
                                         uint16_t& pos) const
     {
-      // Pre-condition: _M_keys is sorted.
-
-      int left = 0;
-      int right = _M_header->count - 1;
-
-      while (left <= right) {
-        // Loop invariant:
-        // {(_M_keys[left - 1] < key) && (_M_keys[right + 1] > key)}
-
-        int mid = (left + right) / 2;
-
-        int r;
-        if ((r = comp(_M_keys[mid], key)) < 0) {
-          // _M_keys[mid] < key
-          left = mid + 1;
-          // _M_keys[left - 1] < key
-        } else if (r > 0) {
-          // _M_keys[mid] > key
-          right = mid - 1;
-          // _M_keys[right + 1] > key
-        } else {
-          // _M_keys[mid] == key
-          pos = mid;
-          return true;
-        }
-      }
-
-      pos = left;
-
-      // Post-condition:
-      // (left > right) &&
-      // (_M_keys[left - 1] < key) &&
-      // (_M_keys[right + 1] > key)
-
-      return false;
+      // The position of the key (if found) is the lower bound.
+      return lower_bound(key, comp, pos);
     }
 
     ////////////////////////////////////////////////////////////////////////////
@@ -654,42 +1686,40 @@ namespace util {
                                                const key_compare& comp,
                                                uint16_t& pos) const
     {
-      // Pre-condition: _M_keys is sorted.
-
-      int left = 0;
-      int right = _M_header->count;
+      // Pre-condition: keys is sorted.
 
-      bool ret = false;
+      // If the keys can be searched with the branch-free search...
+      if (search_type::kVectorized) {
+        pos = search_type::count_less(keys(), _M_header.count, key);
+      } else {
+        int left = 0;
+        int right = _M_header.count;
 
-      while (left != right) {
-        // Loop invariant:
-        // {(_M_keys[left - 1] < key) && (_M_keys[right] >= key)}
+        while (left != right) {
+          // Loop invariant:
+          // {(keys[left - 1] < key) && (keys[right] >= key)}
 
-        int mid = (left + right) / 2;
+          int mid = (left + right) / 2;
 
-        int r;
-        if ((r = comp(_M_keys[mid], key)) < 0) {
-          // _M_keys[mid] < key
-          left = mid + 1;
-          // _M_keys[left - 1] < key
-        } else if (r > 0) {
-          // _M_keys[mid] > key
-          right = mid;
-          // _M_keys[right] >= key
-        } else {
-          // _M_keys[mid] == key
-          right = mid;
-          ret = true;
-          // _M_keys[right] >= key
+          if (less(comp, keys()[mid], key)) {
+            // keys[mid] < key
+            left = mid + 1;
+            // keys[left - 1] < key
+          } else {
+            // keys[mid] >= key
+            right = mid;
+            // keys[right] >= key
+          }
         }
-      }
 
-      pos = left;
+        pos = left;
 
-      // Post-condition:
-      // (left == right) && (_M_keys[left - 1] < key) && (_M_keys[right] >= key)
+        // Post-condition:
+        // (left == right) && (keys[left - 1] < key) && (keys[right] >= key)
+      }
 
-      return ret;
+      // keys[pos] >= key, so the key was found if !(key < keys[pos]).
+      return ((pos < _M_header.count) && (!less(comp, key, keys()[pos])));
     }
 
     ////////////////////////////////////////////////////////////////////////////
@@ -714,137 +1744,214 @@ namespace util {
                                                const key_compare& comp,
                                                uint16_t& pos) const
     {
-      // Pre-condition: _M_keys is sorted.
-
-      int left = 0;
-      int right = _M_header->count;
+      // Pre-condition: keys is sorted.
 
-      bool ret = false;
+      // If the keys can be searched with the branch-free search...
+      if (search_type::kVectorized) {
+        pos = search_type::count_less_equal(keys(), _M_header.count, key);
+      } else {
+        int left = 0;
+        int right = _M_header.count;
 
-      while (left != right) {
-        // Loop invariant:
-        // {(_M_keys[left - 1] <= key) && (_M_keys[right] > key)}
+        while (left != right) {
+          // Loop invariant:
+          // {(keys[left - 1] <= key) && (keys[right] > key)}
 
-        int mid = (left + right) / 2;
+          int mid = (left + right) / 2;
 
-        int r;
-        if ((r = comp(_M_keys[mid], key)) < 0) {
-          // _M_keys[mid] < key
-          left = mid + 1;
-          // _M_keys[left - 1] <= key
-        } else if (r > 0) {
-          // _M_keys[mid] > key
-          right = mid;
-          // _M_keys[right] > key
-        } else {
-          // _M_keys[mid] == key
-          left = mid + 1;
-          ret = true;
-          // _M_keys[left - 1] <= key
+          if (!less(comp, key, keys()[mid])) {
+            // keys[mid] <= key
+            left = mid + 1;
+            // keys[left - 1] <= key
+          } else {
+            // keys[mid] > key
+            right = mid;
+            // keys[right] > key
+          }
         }
+
+        pos = left;
+
+        // Post-condition:
+        // (left == right) && (keys[left - 1] <= key) && (keys[right] > key)
       }
 
-      pos = left;
+      // keys[pos - 1] <= key, so the key was found if !(keys[pos - 1] < key).
+      return ((pos > 0) && (!less(comp, keys()[pos - 1], key)));
+    }
+
+    template<typename _Parameters>
+    template<typename _T>
+    inline void btree<_Parameters>::node::relocate(_T* dst, _T* src, size_t n)
+    {
+      // If the objects can be copied bitwise...
+      if (std::is_trivially_copyable<_T>::value) {
+        memmove(static_cast<void*>(dst), src, n * sizeof(_T));
+      } else if (dst < src) {
+        for (size_t j = 0; j < n; j++) {
+          new (&dst[j]) _T(util::move(src[j]));
+          src[j].~_T();
+        }
+      } else {
+        for (size_t j = n; j > 0; j--) {
+          new (&dst[j - 1]) _T(util::move(src[j - 1]));
+          src[j - 1].~_T();
+        }
+      }
+    }
 
-      // Post-condition:
-      // (left == right) && (_M_keys[left - 1] <= key) && (_M_keys[right] > key)
+    template<typename _Parameters>
+    template<typename _V>
+    inline void btree<_Parameters>::node::assign_value(value_type& slot,
+                                                       _V&& value)
+    {
+      slot = util::forward<_V>(value);
+    }
 
-      return ret;
+    template<typename _Parameters>
+    template<typename... _Args>
+    inline void btree<_Parameters>::node::assign_value(value_type& slot,
+                                                       _Args&&... args)
+    {
+      slot = value_type(util::forward<_Args>(args)...);
     }
 
     template<typename _Parameters>
+    template<typename _K, typename... _Args>
     bool btree<_Parameters>::node::insert_non_full(node* x,
-                                                   const key_type& key,
-                                                   const value_type& value,
                                                    const key_compare& comp,
-                                                   size_t& nkeys)
+                                                   bool assign,
+                                                   bool append,
+                                                   size_t& nkeys,
+                                                   allocator_type& allocator,
+                                                   node*& leaf,
+                                                   uint16_t& pos,
+                                                   _K&& key,
+                                                   _Args&&... args)
     {
+      path p;
+      p.height = 0;
+
       // While 'x' is an internal node...
-      while (x->_M_header->type == kInternal) {
+      while (x->_M_header.type == kInternal) {
         uint16_t i;
         x->upper_bound(key, comp, i);
 
         // If the child is full...
-        if (x->_M_children[i]->full()) {
-          if (!x->split_child(i)) {
+        if (x->children()[i]->full()) {
+          if (!x->split_child(i, allocator, append)) {
             return false;
           }
 
-          if (comp(x->_M_keys[i], key) <= 0) {
+          if (!less(comp, key, x->keys()[i])) {
             i++;
           }
         }
 
-        x = x->_M_children[i];
+        if (kAugmented) {
+          p.nodes[p.height] = x;
+          p.pos[p.height++] = i;
+        }
+
+        x = x->children()[i];
       }
 
       // Leaf node.
-      // Pre-condition: _M_keys is sorted.
+      // Pre-condition: keys is sorted.
+
+      leaf = x;
 
       // If the key has been already inserted and duplicates are not allowed...
       uint16_t i;
       if ((x->upper_bound(key, comp, i)) && (!kDuplicates)) {
         // If the tree might have values...
-        if (kValueSize > 0) {
+        if ((kValueSize > 0) && (assign)) {
           // Update value.
-          x->_M_values[i] = value;
+          assign_value(x->values()[i - 1], util::forward<_Args>(args)...);
+
+          if (kAggregated) {
+            update_path(p);
+          }
         }
 
+        pos = i - 1;
+
         return true;
       }
 
-      key_type* keys = x->_M_keys;
+      insert(x, i, util::forward<_K>(key), util::forward<_Args>(args)...);
+
+      pos = i;
+
+      // Increment number of keys.
+      nkeys++;
+
+      if (kCounted) {
+        add_path_count(p, 1);
+      }
+
+      if (kAggregated) {
+        update_path(p);
+      }
+
+      return true;
+    }
+
+    template<typename _Parameters>
+    template<typename _K, typename... _Args>
+    inline void btree<_Parameters>::node::insert(node* x,
+                                                 uint16_t pos,
+                                                 _K&& key,
+                                                 _Args&&... args)
+    {
+      key_type* keys = x->keys();
+      uint16_t count = x->_M_header.count;
+
+      // Move bigger keys one position to the right.
+      relocate(&keys[pos + 1], &keys[pos], count - pos);
 
       // If the tree might have values...
       if (kValueSize > 0) {
-        // Move bigger keys with their values one position to the right.
-        value_type* values = x->_M_values;
-        for (uint16_t j = x->_M_header->count; j > i; j--) {
-          keys[j] = util::move(keys[j - 1]);
-          values[j] = util::move(values[j - 1]);
-        }
+        // Move bigger values one position to the right.
+        value_type* values = x->values();
+        relocate(&values[pos + 1], &values[pos], count - pos);
 
-        // Save value.
-        values[i] = value;
-      } else {
-        // Move bigger keys one position to the right.
-        for (uint16_t j = x->_M_header->count; j > i; j--) {
-          keys[j] = util::move(keys[j - 1]);
-        }
+        // Construct value in place.
+        new (&values[pos]) value_type(util::forward<_Args>(args)...);
       }
 
-      // Save key.
-      keys[i] = key;
+      // Construct key in place.
+      new (&keys[pos]) key_type(util::forward<_K>(key));
 
       // Increment number of elements.
-      x->_M_header->count++;
-
-      // Increment number of keys.
-      nkeys++;
-
-      return true;
+      x->_M_header.count++;
     }
 
     template<typename _Parameters>
-    bool btree<_Parameters>::node::split_child(uint16_t i)
+    bool btree<_Parameters>::node::split_child(uint16_t i,
+                                               allocator_type& allocator,
+                                               bool append)
     {
-      node* y = _M_children[i];
+      node* y = children()[i];
 
       // Create child node.
       node* z;
-      if ((z = create(static_cast<type>(y->_M_header->type))) == NULL) {
+      if ((z = create(static_cast<type>(y->_M_header.type),
+                      allocator)) == NULL) {
         return false;
       }
 
-      key_type* ykeys = y->_M_keys;
-      key_type* zkeys = z->_M_keys;
+      instrumentation_type::count(kSplits);
 
-      uint16_t median;
+      key_type* ykeys = y->keys();
+      key_type* zkeys = z->keys();
+
+      uint16_t median = 0;
       uint16_t ycount;
       uint16_t zcount;
 
       // If 'y' is an internal node...
-      if (y->_M_header->type == kInternal) {
+      if (y->_M_header.type == kInternal) {
         // The median key of 'y' moves up into its parent.
         // The median is calculated as: median = floor(kMaxKeys / 2).
 
@@ -912,21 +2019,24 @@ namespace util {
         //
 
         // median = floor(kMaxKeys / 2).
-        median = kInternalNodeMedian;
+        // When appending, only the last key moves to 'z' (the one before
+        // moves up).
+        median = (append) ? kInternalNodeMaxKeys - 2 : kInternalNodeMedian;
 
         ycount = median;
         zcount = kInternalNodeMaxKeys - ycount - 1;
 
-        node** ychildren = y->_M_children;
-        node** zchildren = z->_M_children;
+        // Move keys and pointers from node 'y' to node 'z'.
+        relocate(zkeys, &ykeys[ycount + 1], zcount);
+        relocate(z->children(), &y->children()[ycount + 1], zcount + 1);
 
-        // Copy keys and pointers from node 'y' to node 'z'.
-        for (uint16_t j = 0; j < zcount; j++) {
-          zkeys[j] = util::move(ykeys[ycount + 1 + j]);
-          zchildren[j] = ychildren[ycount + 1 + j];
+        if (kCounted) {
+          relocate(z->counts(), &y->counts()[ycount + 1], zcount + 1);
         }
 
-        zchildren[zcount] = ychildren[kInternalNodeMaxKeys];
+        if (kAggregated) {
+          relocate(z->summaries(), &y->summaries()[ycount + 1], zcount + 1);
+        }
       } else {
         // The first key of 'z' is copied into its parent.
         // The median is calculated as: median = ceiling(kMaxKeys / 2).
@@ -987,24 +2097,17 @@ namespace util {
         //
 
         // median = ceiling(kMaxKeys / 2).
-        ycount = kLeafNodeMedian;
+        // When appending, only the last key moves to 'z'.
+        ycount = (append) ? kLeafNodeMaxKeys - 1 : kLeafNodeMedian;
         zcount = kLeafNodeMaxKeys - ycount;
 
+        // Move keys from node 'y' to node 'z'.
+        relocate(zkeys, &ykeys[ycount], zcount);
+
         // If the tree might have values...
         if (kValueSize > 0) {
-          value_type* yvalues = y->_M_values;
-          value_type* zvalues = z->_M_values;
-
-          // Copy keys and values from node 'y' to node 'z'.
-          for (uint16_t j = 0; j < zcount; j++) {
-            zkeys[j] = util::move(ykeys[ycount + j]);
-            zvalues[j] = util::move(yvalues[ycount + j]);
-          }
-        } else {
-          // Copy keys from node 'y' to node 'z'.
-          for (uint16_t j = 0; j < zcount; j++) {
-            zkeys[j] = util::move(ykeys[ycount + j]);
-          }
+          // Move values from node 'y' to node 'z'.
+          relocate(z->values(), &y->values()[ycount], zcount);
         }
 
         z->prev(y);
@@ -1017,8 +2120,7 @@ namespace util {
         y->next(z);
       }
 
-      y->_M_header->count = ycount;
-      z->_M_header->count = zcount;
+      z->_M_header.count = zcount;
 
       // If i = 2, median key = 300 and the node 'x' looks like:
       //
@@ -1046,21 +2148,39 @@ namespace util {
       //
 
       // Shift keys and pointers one position to the right.
-      for (uint16_t j = _M_header->count; j > i; j--) {
-        _M_keys[j] = util::move(_M_keys[j - 1]);
-        _M_children[j + 1] = _M_children[j];
-      }
+      relocate(&keys()[i + 1], &keys()[i], _M_header.count - i);
+      relocate(&children()[i + 2], &children()[i + 1], _M_header.count - i);
 
-      _M_children[i + 1] = z;
+      children()[i + 1] = z;
+
+      if (kCounted) {
+        relocate(&counts()[i + 2], &counts()[i + 1], _M_header.count - i);
+
+        size_t n = subtree_count(z);
+        counts()[i + 1] = n;
+        counts()[i] -= n;
+      }
 
       // If 'y' is an internal node...
-      if (y->_M_header->type == kInternal) {
-        _M_keys[i] = util::move(y->_M_keys[median]);
+      if (y->_M_header.type == kInternal) {
+        new (&keys()[i]) key_type(util::move(ykeys[median]));
+        ykeys[median].key_type::~key_type();
       } else {
-        _M_keys[i] = z->_M_keys[0];
+        new (&keys()[i]) key_type(zkeys[0]);
+      }
+
+      y->_M_header.count = ycount;
+
+      if (kAggregated) {
+        relocate(&summaries()[i + 2],
+                 &summaries()[i + 1],
+                 _M_header.count - i);
+
+        summaries()[i] = summarize(y);
+        summaries()[i + 1] = summarize(z);
       }
 
-      _M_header->count++;
+      _M_header.count++;
 
       return true;
     }
@@ -1068,47 +2188,51 @@ namespace util {
     template<typename _Parameters>
     bool btree<_Parameters>::node::erase(node*& root,
                                          const key_type& key,
-                                         const key_compare& comp)
+                                         const key_compare& comp,
+                                         allocator_type& allocator)
     {
-      bool search_in_next_node = false;
+      path p;
+      p.height = 0;
+
+      // Deepest node whose rightmost child hasn't been followed, and the
+      // child followed (duplicates).
+      node* y = NULL;
+      uint16_t j = 0;
+      size_t depth = 0;
 
       // While 'x' is an internal node...
       node* x = root;
-      while (x->_M_header->type == kInternal) {
+      while (x->_M_header.type == kInternal) {
+        // If the key is a separator, it is in the right subtree, unless
+        // duplicates are allowed: then the left subtree is followed, and if
+        // it doesn't end with the key, the first key equal to it is the
+        // first key of the next leaf node. Only the child followed is
+        // repaired, so 'x' loses one key at most.
         uint16_t i;
-        if (x->lower_bound(key, comp, i)) {
-          if (!kDuplicates) {
-            i++;
-          } else {
-            switch (try_rebalance_or_merge_subtree(x, root, i + 1)) {
-              case kRebalancedLeftToRight:
-                if (comp(key, x->_M_keys[i]) > 0) {
-                  i++;
-                  search_in_next_node = false;
-                } else {
-                  search_in_next_node = true;
-                }
-
-                break;
-              case kShrinked:
-                x = root;
-                search_in_next_node = false;
-
-                continue;
-              default:
-                search_in_next_node = true;
-            }
-          }
+        if ((x->lower_bound(key, comp, i)) && (!kDuplicates)) {
+          i++;
         }
 
-        if (try_rebalance_or_merge(x, root, i) == kShrinked) {
+        if (try_rebalance_or_merge(x, root, i, allocator) == kShrinked) {
           x = root;
-          search_in_next_node = false;
+          p.height = 0;
+          y = NULL;
 
           continue;
         }
 
-        x = x->_M_children[i];
+        if ((kDuplicates) && (i < x->_M_header.count)) {
+          y = x;
+          j = i;
+          depth = p.height;
+        }
+
+        if (kAugmented) {
+          p.nodes[p.height] = x;
+          p.pos[p.height++] = i;
+        }
+
+        x = x->children()[i];
       }
 
       // Leaf node.
@@ -1116,523 +2240,1000 @@ namespace util {
       // Search key in leaf node.
       uint16_t i;
       if (!x->lower_bound(key, comp, i)) {
-        if ((!kDuplicates) || (!search_in_next_node)) {
-          // Key not found.
-          return false;
+        // If the key might be in the next leaf node...
+        if ((kDuplicates) && (i == x->_M_header.count) && (y)) {
+          return erase_next(x, y, j + 1, p, depth, key, comp);
         }
 
-        x = x->next();
+        // Key not found.
+        return false;
+      }
 
-        if (comp(key, x->_M_keys[0]) != 0) {
-          // Key not found.
-          return false;
-        }
+      erase(x, i);
 
-        i = 0;
+      if (kCounted) {
+        add_path_count(p, -1);
+      }
+
+      if (kAggregated) {
+        update_path(p);
       }
 
-      key_type* keys = x->_M_keys;
+      return true;
+    }
+
+    template<typename _Parameters>
+    inline void btree<_Parameters>::node::erase(node* x, uint16_t pos)
+    {
+      key_type* keys = x->keys();
+      uint16_t count = x->_M_header.count;
 
       // Invoke key's destructor.
-      keys[i].key_type::~key_type();
+      keys[pos].key_type::~key_type();
 
-      // Invoke key's constructor.
-      new (&keys[i]) key_type();
+      // Shift keys one position to the left.
+      relocate(&keys[pos], &keys[pos + 1], count - pos - 1);
 
-      uint16_t count = x->_M_header->count;
       if (kValueSize > 0) {
-        value_type* values = x->_M_values;
+        value_type* values = x->values();
 
         // Invoke value's destructor.
-        values[i].value_type::~value_type();
+        values[pos].value_type::~value_type();
+
+        // Shift values one position to the left.
+        relocate(&values[pos], &values[pos + 1], count - pos - 1);
+      }
+
+      // Decrement number of elements.
+      x->_M_header.count--;
+    }
+
+    template<typename _Parameters>
+    bool btree<_Parameters>::node::erase_next(node* x,
+                                              node* y,
+                                              uint16_t j,
+                                              const path& p,
+                                              size_t depth,
+                                              const key_type& key,
+                                              const key_compare& comp)
+    {
+      // Path to the leaf node after 'x'.
+      path q;
+      q.height = 0;
+
+      if (kAugmented) {
+        for (; q.height < depth; q.height++) {
+          q.nodes[q.height] = p.nodes[q.height];
+          q.pos[q.height] = p.pos[q.height];
+        }
 
-        // Invoke value's constructor.
-        new (&values[i]) value_type();
+        q.nodes[q.height] = y;
+        q.pos[q.height++] = j;
+      }
 
-        // Shift keys and values one position to the left.
-        for (++i; i < count; i++) {
-          keys[i - 1] = util::move(keys[i]);
-          values[i - 1] = util::move(values[i]);
+      // Follow the leftmost children.
+      node* z = y->children()[j];
+      while (z->_M_header.type == kInternal) {
+        if (kAugmented) {
+          q.nodes[q.height] = z;
+          q.pos[q.height++] = 0;
         }
-      } else {
-        // Shift keys one position to the left.
-        for (++i; i < count; i++) {
-          keys[i - 1] = util::move(keys[i]);
+
+        z = z->children()[0];
+      }
+
+      if (less(comp, key, z->keys()[0])) {
+        // Key not found.
+        return false;
+      }
+
+      erase(z, 0);
+
+      // If the leaf node still has keys...
+      if (z->_M_header.count > 0) {
+        if (kCounted) {
+          add_path_count(q, -1);
+        }
+
+        if (kAggregated) {
+          update_path(q);
         }
+
+        return true;
       }
 
-      // Decrement number of elements.
-      x->_M_header->count--;
+      // The leaf node after 'x' hasn't been rebalanced: move the last key
+      // of 'x' (which has two keys at least) into it and make it the
+      // separator of both leaf nodes.
+      uint16_t count = x->_M_header.count;
+
+      relocate(z->keys(), &x->keys()[count - 1], 1);
+
+      if (kValueSize > 0) {
+        relocate(z->values(), &x->values()[count - 1], 1);
+      }
+
+      x->_M_header.count--;
+      z->_M_header.count = 1;
+
+      y->keys()[j - 1] = z->keys()[0];
+
+      if (kCounted) {
+        add_path_count(p, -1);
+      }
+
+      if (kAggregated) {
+        update_path(p);
+        update_path(q);
+      }
 
       return true;
     }
 
     template<typename _Parameters>
     inline const typename btree<_Parameters>::node*
-    btree<_Parameters>::node::prev() const
+    btree<_Parameters>::node::last_leaf(const node* x)
     {
-      return *_M_prev;
-    }
+      // Follow the rightmost children.
+      while (x->_M_header.type == kInternal) {
+        x = x->children()[x->_M_header.count];
+      }
 
-    template<typename _Parameters>
-    inline typename btree<_Parameters>::node* btree<_Parameters>::node::prev()
-    {
-      return *_M_prev;
+      return x;
     }
 
     template<typename _Parameters>
-    inline void btree<_Parameters>::node::prev(node* n)
+    void btree<_Parameters>::node::descend_edge(node*& root,
+                                                bool rightmost,
+                                                allocator_type& allocator)
     {
-      *_M_prev = n;
-    }
+      // While 'x' is an internal node...
+      node* x = root;
+      while (x->_M_header.type == kInternal) {
+        uint16_t i = (rightmost) ? x->_M_header.count : 0;
 
-    template<typename _Parameters>
-    inline const typename btree<_Parameters>::node*
-    btree<_Parameters>::node::next() const
-    {
-      return *_M_next;
-    }
+        if (try_rebalance_or_merge(x, root, i, allocator) == kShrinked) {
+          x = root;
+          continue;
+        }
 
-    template<typename _Parameters>
-    inline typename btree<_Parameters>::node* btree<_Parameters>::node::next()
-    {
-      return *_M_next;
+        x = x->children()[i];
+      }
     }
 
     template<typename _Parameters>
-    inline void btree<_Parameters>::node::next(node* n)
+    template<typename _Range>
+    size_t btree<_Parameters>::node::erase_range(node* x,
+                                                 const _Range& range,
+                                                 allocator_type& allocator,
+                                                 bool& empty)
     {
-      *_M_next = n;
-    }
+      empty = false;
 
-    template<typename _Parameters>
-    void btree<_Parameters>::node::rebalance_left_to_right(node* x, uint16_t i)
-    {
-      node* y = x->_M_children[--i]; // Left sibling.
-      node* z = x->_M_children[i + 1];
+      // If 'x' is a leaf node...
+      if (x->_M_header.type == kLeaf) {
+        uint16_t first, last;
+        range.keys(x, first, last);
 
-      uint16_t ycount = y->_M_header->count;
+        // If there are no keys in the range...
+        if (last <= first) {
+          return 0;
+        }
 
-      key_type* xkeys = x->_M_keys;
-      key_type* ykeys = y->_M_keys;
-      key_type* zkeys = z->_M_keys;
+        key_type* keys = x->keys();
+        uint16_t count = x->_M_header.count;
 
-      // If 'z' is an internal node...
-      if (z->_M_header->type == kInternal) {
-        // - Before the rebalance:
-        //
-        // Index:                           0
-        //                              +-------+
-        //                              |  400  |
-        //                          +---+---+---+---+
-        //                          |       |       |
-        //                          +-------+-------+
-        //                              |       |
-        //                   +----------+       +----------+
-        //                   |                             |
-        //                   v                             v
-        //
-        // Index:    0       1       2                     0
-        //       +-------+-------+-------+             +-------+
-        //       |  100  |  200  |  300  |             |  500  |
-        //   +---+---+---+---+---+---+---+---+     +---+---+---+---+
-        //   |       |       |       |       |     |       |       |
-        //   +-------+-------+-------+-------+     +-------+-------+
-        //       |       |       |       |             |       |
-        //      <100    <200    <300    <400          <500   >=500
-        //
-        //
-        // - After the rebalance:
-        //   Parent's key (400) is moved down into the right sibling.
-        //   Left sibling's rightmost key (300) is moved up into its parent.
-        //   Left sibling's rightmost child pointer is moved into the
-        //   right sibling.
-        //
-        // Index:                           0
-        //                              +-------+
-        //                              |  300  |
-        //                          +---+---+---+---+
-        //                          |       |       |
-        //                          +-------+-------+
-        //                              |       |
-        //                   +----------+       +----------+
-        //                   |                             |
-        //                   v                             v
-        //
-        // Index:        0       1                     0       1
-        //           +-------+-------+             +-------+-------+
-        //           |  100  |  200  |             |  400  |  500  |
-        //       +---+---+---+---+---+---+     +---+---+---+---+---+---+
-        //       |       |       |       |     |       |       |       |
-        //       +-------+-------+-------+     +-------+-------+-------+
-        //           |       |       |             |       |       |
-        //          <100    <200    <300          <400    <500   >=500
-        //
+        for (uint16_t i = first; i < last; i++) {
+          keys[i].key_type::~key_type();
+        }
 
-        node** zchildren = z->_M_children;
+        relocate(&keys[first], &keys[last], count - last);
 
-        // Shift keys and pointers one position to the right.
-        for (uint16_t j = z->_M_header->count; j > 0; j--) {
-          zkeys[j] = util::move(zkeys[j - 1]);
-          zchildren[j + 1] = zchildren[j];
+        if (kValueSize > 0) {
+          value_type* values = x->values();
+
+          for (uint16_t i = first; i < last; i++) {
+            values[i].value_type::~value_type();
+          }
+
+          relocate(&values[first], &values[last], count - last);
         }
 
-        zchildren[1] = zchildren[0];
+        x->_M_header.count -= last - first;
 
-        // Move key from 'x' down into 'z'.
-        zkeys[0] = util::move(xkeys[i]);
+        empty = (x->_M_header.count == 0);
 
-        // Move rightmost key from left sibling up into 'x'.
-        xkeys[i] = util::move(ykeys[ycount - 1]);
+        return last - first;
+      }
 
-        // Move rightmost child pointer from left sibling into 'z'.
-        zchildren[0] = y->_M_children[ycount];
-      } else {
-        // 'z' is a leaf node.
+      // Children holding the first ('i') and the last ('j') keys of the
+      // range. The children between them hold only keys of the range.
+      uint16_t i, j;
+      range.children(x, i, j);
 
-        // - Before the rebalance:
-        //
-        // Index:                           0
-        //                              +-------+
-        //                              |  400  |
-        //                          +---+---+---+---+
-        //                          |       |       |
-        //                          +-------+-------+
-        //                              |       |
-        //                   +----------+       +----------+
-        //                   |                             |
-        //                   v                             v
-        //
-        // Index:    0       1       2                     0
-        //       +-------+-------+-------+             +-------+
-        //       |  100  |  200  |  300  |             |  400  |
-        //       +-------+-------+-------+-------+     +-------+-------+
-        //       |   a   |   b   |   c   |    ---|---->|   d   |    ---|---->
-        //       +-------+-------+-------+-------+     +-------+-------+
-        //
-        //
-        // - After the rebalance:
-        //   Left sibling's rightmost key (300) is moved into the right sibling.
-        //   Right sibling's new leftmost key (300) is copied into its parent.
-        //   Left sibling's rightmost value is moved into the right sibling.
-        //
-        // Index:                           0
-        //                              +-------+
-        //                              |  300  |
-        //                          +---+---+---+---+
-        //                          |       |       |
-        //                          +-------+-------+
-        //                              |       |
-        //                   +----------+       +----------+
-        //                   |                             |
-        //                   v                             v
-        //
-        // Index:        0       1                     0       1
-        //           +-------+-------+             +-------+-------+
-        //           |  100  |  200  |             |  300  |  400  |
-        //           +-------+-------+-------+     +-------+-------+-------+
-        //           |   a   |   b   |    ---|---->|   c   |   d   |    ---|---->
-        //           +-------+-------+-------+     +-------+-------+-------+
-        //
+      // If the range is empty...
+      if (j < i) {
+        return 0;
+      }
 
-        if (kValueSize > 0) {
-          // Shift keys and values one position to the right.
-          value_type* zvalues = z->_M_values;
+      size_t n = 0;
+      bool e;
 
-          for (uint16_t j = z->_M_header->count; j > 0; j--) {
-            zkeys[j] = util::move(zkeys[j - 1]);
-            zvalues[j] = util::move(zvalues[j - 1]);
-          }
+      // The children are processed from right to left, so the positions
+      // of the ones still to be processed don't change.
+      if (j > i) {
+        size_t m = erase_range(x->children()[j],
+                               range.last_child(),
+                               allocator,
+                               e);
 
-          // Move rightmost value from left sibling into 'z'.
-          zvalues[0] = util::move(y->_M_values[ycount - 1]);
-        } else {
-          // Shift keys one position to the right.
-          for (uint16_t j = z->_M_header->count; j > 0; j--) {
-            zkeys[j] = util::move(zkeys[j - 1]);
-          }
+        if (kCounted) {
+          x->counts()[j] -= m;
         }
 
-        // Move rightmost key from left sibling into 'z'.
-        zkeys[0] = util::move(ykeys[ycount - 1]);
+        if (kAggregated) {
+          x->summaries()[j] = summarize(x->children()[j]);
+        }
 
-        xkeys[i].key_type::~key_type();
-        new (&xkeys[i]) key_type();
+        n += m;
 
-        // Copy new leftmost key from right sibling up into 'x'.
-        xkeys[i] = zkeys[0];
+        if (e) {
+          remove_child(x, j, allocator);
+        }
+
+        if (j > i + 1) {
+          n += remove_children(x, i + 1, j - 1, allocator);
+        }
+      }
+
+      size_t m = erase_range(x->children()[i],
+                             range.first_child(j == i),
+                             allocator,
+                             e);
+
+      if (kCounted) {
+        x->counts()[i] -= m;
+      }
+
+      if (kAggregated) {
+        x->summaries()[i] = summarize(x->children()[i]);
+      }
+
+      n += m;
+
+      if ((e) && (!remove_child(x, i, allocator))) {
+        empty = true;
+        return n;
+      }
+
+      // Repair the children which have been left with too few keys (the
+      // ones at 'i' and 'i + 1' at most).
+      uint16_t c = i;
+      while ((x->_M_header.count > 0) &&
+             (c <= x->_M_header.count) &&
+             (c <= i + 1)) {
+        if (x->children()[c]->minkeys()) {
+          repair_child(x, c, allocator);
+        }
+
+        c++;
       }
 
-      y->_M_header->count--;
-      z->_M_header->count++;
+      return n;
     }
 
     template<typename _Parameters>
-    void btree<_Parameters>::node::rebalance_right_to_left(node* x, uint16_t i)
+    void btree<_Parameters>::node::split(node* x,
+                                         const key_type& key,
+                                         const key_compare& comp,
+                                         node** spare,
+                                         allocator_type& allocator,
+                                         bool& xempty,
+                                         node*& y,
+                                         bool& yempty)
     {
-      node* y = x->_M_children[i];
-      node* z = x->_M_children[i + 1]; // Right sibling.
+      y = spare[0];
 
-      uint16_t ycount = y->_M_header->count;
-      uint16_t zcount = z->_M_header->count;
+      uint16_t count = x->_M_header.count;
 
-      key_type* xkeys = x->_M_keys;
-      key_type* ykeys = y->_M_keys;
-      key_type* zkeys = z->_M_keys;
+      // If 'x' is a leaf node...
+      if (x->_M_header.type == kLeaf) {
+        uint16_t pos;
+        x->lower_bound(key, comp, pos);
 
-      // If 'y' is an internal node...
-      if (y->_M_header->type == kInternal) {
-        // - Before the rebalance:
-        //
-        // Index:                           0
-        //                              +-------+
-        //                              |  200  |
-        //                          +---+---+---+---+
-        //                          |       |       |
-        //                          +-------+-------+
-        //                              |       |
-        //                   +----------+       +----------+
-        //                   |                             |
-        //                   v                             v
-        //
-        // Index:            0                     0       1       2
-        //               +-------+             +-------+-------+-------+
-        //               |  100  |             |  300  |  400  |  500  |
-        //           +---+---+---+---+     +---+---+---+---+---+---+---+---+
-        //           |       |       |     |       |       |       |       |
-        //           +-------+-------+     +-------+-------+-------+-------+
-        //               |       |             |       |       |       |
-        //              <100    <200          <300    <400    <500   >=500
-        //
-        //
-        // - After the rebalance:
-        //   Parent's key (200) is moved down into the left sibling.
-        //   Right sibling's leftmost key (300) is moved up into its parent.
-        //   Right sibling's leftmost child pointer is moved into the
-        //   left sibling.
-        //
-        // Index:                           0
-        //                              +-------+
-        //                              |  300  |
-        //                          +---+---+---+---+
-        //                          |       |       |
-        //                          +-------+-------+
-        //                              |       |
-        //                   +----------+       +----------+
-        //                   |                             |
-        //                   v                             v
-        //
-        // Index:        0       1                     0       1
-        //           +-------+-------+             +-------+-------+
-        //           |  100  |  200  |             |  400  |  500  |
-        //       +---+---+---+---+---+---+     +---+---+---+---+---+---+
-        //       |       |       |       |     |       |       |       |
-        //       +-------+-------+-------+     +-------+-------+-------+
-        //           |       |       |             |       |       |
-        //          <100    <200    <300          <400    <500   >=500
-        //
-
-        // Move key from 'x' down into 'y'.
-        ykeys[ycount] = util::move(xkeys[i]);
+        relocate(y->keys(), &x->keys()[pos], count - pos);
 
-        // Move leftmost key from right sibling up into 'x'.
-        xkeys[i] = util::move(zkeys[0]);
+        if (kValueSize > 0) {
+          relocate(y->values(), &x->values()[pos], count - pos);
+        }
 
-        node** zchildren = z->_M_children;
+        x->_M_header.count = pos;
+        y->_M_header.count = count - pos;
 
-        // Move leftmost child pointer from right sibling into 'y'.
-        y->_M_children[ycount + 1] = zchildren[0];
+        // Cut the list of leaf nodes between 'x' and 'y'.
+        y->next(x->next());
 
-        // Shift keys and pointers one position to the left.
-        for (uint16_t j = 1; j < zcount; j++) {
-          zkeys[j - 1] = util::move(zkeys[j]);
-          zchildren[j - 1] = zchildren[j];
+        if (y->next()) {
+          y->next()->prev(y);
         }
 
-        zchildren[zcount - 1] = zchildren[zcount];
+        x->next(NULL);
+
+        xempty = (x->_M_header.count == 0);
+        yempty = (y->_M_header.count == 0);
+
+        return;
+      }
+
+      // Child holding the first key greater than or equal to 'key'.
+      uint16_t i;
+      if (kDuplicates) {
+        x->lower_bound(key, comp, i);
       } else {
-        // 'y' is a leaf node.
+        x->upper_bound(key, comp, i);
+      }
 
-        // - Before the rebalance:
-        //
-        // Index:                           0
-        //                              +-------+
-        //                              |  200  |
-        //                          +---+---+---+---+
-        //                          |       |       |
-        //                          +-------+-------+
-        //                              |       |
-        //                   +----------+       +----------+
-        //                   |                             |
-        //                   v                             v
-        //
-        // Index:            0                     0       1       2
-        //               +-------+             +-------+-------+-------+
-        //               |  100  |             |  200  |  300  |  400  |
-        //               +-------+-------+     +-------+-------+-------+-------+
-        //               |   a   |    ---|---->|   b   |   c   |   d   |    ---|---->
-        //               +-------+-------+     +-------+-------+-------+-------+
-        //
-        //
-        // - After the rebalance:
-        //   Right sibling's leftmost key (200) is moved into the left sibling.
-        //   Right sibling's new leftmost key (300) is copied into its parent.
-        //   Right sibling's leftmost value is moved into the left sibling.
-        //
-        // Index:                           0
-        //                              +-------+
-        //                              |  300  |
-        //                          +---+---+---+---+
-        //                          |       |       |
-        //                          +-------+-------+
-        //                              |       |
-        //                   +----------+       +----------+
-        //                   |                             |
-        //                   v                             v
-        //
-        // Index:        0       1                     0       1
-        //           +-------+-------+             +-------+-------+
-        //           |  100  |  200  |             |  300  |  400  |
-        //           +-------+-------+-------+     +-------+-------+-------+
-        //           |   a   |   b   |    ---|---->|   c   |   d   |    ---|---->
-        //           +-------+-------+-------+     +-------+-------+-------+
-        //
+      node* c;
+      bool e;
+      bool ce;
+      split(x->children()[i], key, comp, spare + 1, allocator, e, c, ce);
 
-        // Move lefmost key from right sibling into 'y'.
-        ykeys[ycount] = util::move(zkeys[0]);
+      // The children on the right of child 'i' move to 'y', after 'c' (the
+      // right part of child 'i'), and so do the keys separating them.
+      uint16_t n = count - i;
 
-        if (kValueSize > 0) {
-          value_type* zvalues = z->_M_values;
+      relocate(y->keys(), &x->keys()[i], n);
 
-          // Move leftmost value from right sibling into 'y'.
-          y->_M_values[ycount] = util::move(zvalues[0]);
+      y->children()[0] = c;
+      relocate(&y->children()[1], &x->children()[i + 1], n);
+
+      if (kCounted) {
+        y->counts()[0] = subtree_count(c);
+        relocate(&y->counts()[1], &x->counts()[i + 1], n);
+
+        x->counts()[i] -= y->counts()[0];
+      }
+
+      if (kAggregated) {
+        y->summaries()[0] = summarize(c);
+        relocate(&y->summaries()[1], &x->summaries()[i + 1], n);
+
+        x->summaries()[i] = summarize(x->children()[i]);
+      }
 
-          // Shift keys and values one position to the left.
-          for (uint16_t j = 1; j < zcount; j++) {
-            zkeys[j - 1] = util::move(zkeys[j]);
-            zvalues[j - 1] = util::move(zvalues[j]);
+      x->_M_header.count = i;
+      y->_M_header.count = n;
+
+      xempty = false;
+      yempty = false;
+
+      // Delete the empty parts of child 'i' and repair the ones which have
+      // been left with too few keys (the last child of 'x' and the first
+      // one of 'y').
+      if (e) {
+        xempty = !remove_child(x, i, allocator);
+      } else if ((i > 0) && (x->children()[i]->minkeys())) {
+        repair_child(x, i, allocator);
+      }
+
+      uint16_t k = 0;
+      if (ce) {
+        yempty = !remove_child(y, k, allocator);
+      } else if ((n > 0) && (c->minkeys())) {
+        repair_child(y, k, allocator);
+      }
+    }
+
+    template<typename _Parameters>
+    bool btree<_Parameters>::node::attach(node*& root,
+                                          size_t h,
+                                          node* y,
+                                          size_t hy,
+                                          const key_type& sep,
+                                          bool front,
+                                          node* l,
+                                          node* r,
+                                          allocator_type& allocator)
+    {
+      // If the trees have the same height, a new root node holds both.
+      if (h == hy) {
+        node* s;
+        if ((s = create(kInternal, allocator)) == NULL) {
+          return false;
+        }
+
+        l->next(r);
+        r->prev(l);
+
+        node* a = (front) ? y : root;
+        node* b = (front) ? root : y;
+
+        new (s->keys()) key_type(sep);
+
+        s->children()[0] = a;
+        s->children()[1] = b;
+
+        if (kCounted) {
+          s->counts()[0] = subtree_count(a);
+          s->counts()[1] = subtree_count(b);
+        }
+
+        if (kAggregated) {
+          s->summaries()[0] = summarize(a);
+          s->summaries()[1] = summarize(b);
+        }
+
+        s->_M_header.count = 1;
+
+        root = s;
+
+        // The old root nodes might have fewer keys than the minimum.
+        uint16_t i = (a->minkeys()) ? 0 : 1;
+        if (s->children()[i]->minkeys()) {
+          repair_child(s, i, allocator);
+
+          // If they have been merged...
+          if (s->_M_header.count == 0) {
+            root = s->children()[0];
+            free_node(s, allocator);
           }
-        } else {
-          // Shift keys one position to the left.
-          for (uint16_t j = 1; j < zcount; j++) {
-            zkeys[j - 1] = util::move(zkeys[j]);
+        }
+
+        return true;
+      }
+
+      // If the root node is full...
+      if (root->full()) {
+        node* s;
+        if ((s = create(kInternal, allocator)) == NULL) {
+          return false;
+        }
+
+        s->children()[0] = root;
+
+        if (kCounted) {
+          s->counts()[0] = subtree_count(root);
+        }
+
+        if (kAggregated) {
+          s->summaries()[0] = summarize(root);
+        }
+
+        if (!s->split_child(0, allocator)) {
+          free_node(s, allocator);
+          return false;
+        }
+
+        root = s;
+        h++;
+      }
+
+      path p;
+      p.height = 0;
+
+      // Go down the edge to the parent of the subtrees of the height of
+      // 'y', splitting the full nodes on the way.
+      node* x = root;
+      for (; h > hy + 1; h--) {
+        uint16_t i = (front) ? 0 : x->_M_header.count;
+
+        if (x->children()[i]->full()) {
+          if (!x->split_child(i, allocator)) {
+            return false;
           }
+
+          if (!front) {
+            i++;
+          }
+        }
+
+        if (kAugmented) {
+          p.nodes[p.height] = x;
+          p.pos[p.height] = i;
+          p.height++;
         }
 
-        xkeys[i].key_type::~key_type();
-        new (&xkeys[i]) key_type();
+        x = x->children()[i];
+      }
 
-        // Copy new leftmost key from right sibling up into 'x'.
-        xkeys[i] = zkeys[0];
+      l->next(r);
+      r->prev(l);
+
+      uint16_t count = x->_M_header.count;
+      uint16_t i;
+
+      if (front) {
+        relocate(&x->keys()[1], x->keys(), count);
+        relocate(&x->children()[1], x->children(), count + 1);
+
+        if (kCounted) {
+          relocate(&x->counts()[1], x->counts(), count + 1);
+        }
+
+        if (kAggregated) {
+          relocate(&x->summaries()[1], x->summaries(), count + 1);
+        }
+
+        new (x->keys()) key_type(sep);
+
+        i = 0;
+      } else {
+        new (&x->keys()[count]) key_type(sep);
+
+        i = count + 1;
+      }
+
+      x->children()[i] = y;
+
+      if (kCounted) {
+        x->counts()[i] = subtree_count(y);
+        add_path_count(p, x->counts()[i]);
+      }
+
+      if (kAggregated) {
+        x->summaries()[i] = summarize(y);
+      }
+
+      x->_M_header.count++;
+
+      // 'y' might have fewer keys than the minimum (it was a root node).
+      if (y->minkeys()) {
+        repair_child(x, i, allocator);
       }
 
-      y->_M_header->count++;
-      z->_M_header->count--;
+      if (kAggregated) {
+        update_path(p);
+      }
+
+      return true;
     }
 
     template<typename _Parameters>
-    void btree<_Parameters>::node::merge(node* x, node* y, node* z, uint16_t i)
+    size_t btree<_Parameters>::node::height(const node* x)
     {
-      uint16_t ycount = y->_M_header->count;
-      uint16_t zcount = z->_M_header->count;
+      size_t h = 0;
+      while (x->_M_header.type == kInternal) {
+        x = x->children()[0];
+        h++;
+      }
 
-      key_type* xkeys = x->_M_keys;
-      key_type* ykeys = y->_M_keys;
-      key_type* zkeys = z->_M_keys;
+      return h;
+    }
 
-      // If 'y' is an internal node...
-      if (y->_M_header->type == kInternal) {
-        // - Before the merge:
-        //
-        // Index:                           0       1
-        //                              +-------+-------+
-        //                              |  200  |  400  |
-        //                          +---+---+---+---+---+---+
-        //                          |       |       |       |
-        //                          +-------+-------+-------+
-        //                              |       |       |
-        //               +--------------+       |       +--------------+
-        //               |                      |                      |
-        //               v                      v                      v
-        //
-        // Index:        0                      0                  0       1
-        //           +-------+              +-------+          +-------+-------+
-        //           |  100  |              |  300  |          |  500  |  600  |
-        //       +---+---+---+---+      +---+---+---+---+  +---+---+---+---+---+---+
-        //       |       |       |      |       |       |  |       |       |       |
-        //       +-------+-------+      +-------+-------+  +-------+-------+-------+
-        //           |       |              |       |          |       |       |
-        //          <100    <200           <300    <400       <500    <600   >=600
-        //
-        //
-        // - After the merge:
-        //   Parent's key (200) is moved down into the left sibling.
-        //   Right sibling's keys (300) are moved into the left sibling.
-        //   Right sibling's children pointers are moved into the
-        //   left sibling.
-        //
-        // Index:                             0
-        //                                +-------+
-        //                                |  400  |
-        //                            +---+---+---+---+
-        //                            |       |       |
-        //                            +-------+-------+
-        //                                |       |
-        //                     +----------+       +-----------+
-        //                     |                              |
-        //                     v                              v
-        //
-        // Index:      0       1       2                  0       1
-        //         +-------+-------+-------+          +-------+-------+
-        //         |  100  |  200  |  300  |          |  500  |  600  |
-        //     +---+---+---+---+---+---+---+---+  +---+---+---+---+---+---+
-        //     |       |       |       |       |  |       |       |       |
-        //     +-------+-------+-------+-------+  +-------+-------+-------+
-        //         |       |       |       |          |       |       |
-        //        <100    <200    <300    <400       <500    <600   >=600
-        //
+    template<typename _Parameters>
+    size_t btree<_Parameters>::node::subtree_count(const node* x)
+    {
+      // If 'x' is a leaf node...
+      if (x->_M_header.type == kLeaf) {
+        return x->_M_header.count;
+      }
 
-        // Move key from 'x' down into 'y'.
-        ykeys[ycount++] = util::move(xkeys[i]);
+      const size_t* counts = x->counts();
+      uint16_t count = x->_M_header.count;
 
-        // Move keys and pointers from right sibling into 'y'.
-        node** ychildren = y->_M_children;
-        node** zchildren = z->_M_children;
-        for (uint16_t j = 0; j < zcount; j++) {
-          ykeys[ycount] = util::move(zkeys[j]);
-          ychildren[ycount] = zchildren[j];
+      size_t n = 0;
+      for (uint16_t i = 0; i <= count; i++) {
+        n += counts[i];
+      }
 
-          ycount++;
-        }
+      return n;
+    }
+
+    template<typename _Parameters>
+    inline void btree<_Parameters>::node::add_edge_count(node* root,
+                                                         bool rightmost,
+                                                         ptrdiff_t n)
+    {
+      // While 'x' is an internal node...
+      node* x = root;
+      while (x->_M_header.type == kInternal) {
+        uint16_t i = (rightmost) ? x->_M_header.count : 0;
+
+        x->counts()[i] += n;
+        x = x->children()[i];
+      }
+    }
 
-        ychildren[ycount] = zchildren[zcount];
+    template<typename _Parameters>
+    typename btree<_Parameters>::node::summary_type
+    btree<_Parameters>::node::summarize(const node* x)
+    {
+      summary_type s = aggregate_type::identity();
+      uint16_t count = x->_M_header.count;
+
+      // If 'x' is a leaf node...
+      if (x->_M_header.type == kLeaf) {
+        const value_type* values = x->values();
+        for (uint16_t i = 0; i < count; i++) {
+          s = aggregate_type::combine(s, aggregate_type::summarize(values[i]));
+        }
       } else {
-        // 'y' is a leaf node.
+        const summary_type* summaries = x->summaries();
+        for (uint16_t i = 0; i <= count; i++) {
+          s = aggregate_type::combine(s, summaries[i]);
+        }
+      }
 
-        // - Before the merge:
-        //
-        // Index:                     0       1
-        //                        +-------+-------+
-        //                        |  200  |  300  |
-        //                    +---+---+---+---+---+---+
-        //                    |       |       |       |
-        //                    +-------+-------+-------+
-        //                        |       |       |
-        //          +-------------+       |       +-----------------+
-        //          |                     |                         |
-        //          v                     v                         v
+      return s;
+    }
+
+    template<typename _Parameters>
+    void btree<_Parameters>::node::update_edge(node* root, bool rightmost)
+    {
+      path p;
+      p.height = 0;
+
+      // While 'x' is an internal node...
+      node* x = root;
+      while (x->_M_header.type == kInternal) {
+        uint16_t i = (rightmost) ? x->_M_header.count : 0;
+
+        p.nodes[p.height] = x;
+        p.pos[p.height++] = i;
+
+        x = x->children()[i];
+      }
+
+      update_path(p);
+    }
+
+    template<typename _Parameters>
+    typename btree<_Parameters>::node::summary_type
+    btree<_Parameters>::node::reduce(const node* x,
+                                     const key_type* lo,
+                                     const key_type* hi,
+                                     const key_compare& comp)
+    {
+      // Positions of the bounds (see rank()).
+      uint16_t first = 0;
+      if (lo) {
+        x->lower_bound(*lo, comp, first);
+      }
+
+      uint16_t last = x->_M_header.count;
+      if (hi) {
+        x->lower_bound(*hi, comp, last);
+      }
+
+      summary_type s = aggregate_type::identity();
+
+      // If 'x' is a leaf node...
+      if (x->_M_header.type == kLeaf) {
+        const value_type* values = x->values();
+        for (uint16_t i = first; i < last; i++) {
+          s = aggregate_type::combine(s, aggregate_type::summarize(values[i]));
+        }
+
+        return s;
+      }
+
+      node* const* children = x->children();
+
+      // If both bounds are in the same subtree...
+      if (first == last) {
+        return reduce(children[first], lo, hi, comp);
+      }
+
+      // The subtrees between the bounds are inside the range.
+      s = reduce(children[first], lo, NULL, comp);
+
+      const summary_type* summaries = x->summaries();
+      for (uint16_t i = first + 1; i < last; i++) {
+        s = aggregate_type::combine(s, summaries[i]);
+      }
+
+      return aggregate_type::combine(s,
+                                     reduce(children[last], NULL, hi, comp));
+    }
+
+    template<typename _Parameters>
+    size_t btree<_Parameters>::node::rank(const node* x,
+                                          const key_type& key,
+                                          const key_compare& comp,
+                                          bool upper,
+                                          const node*& leaf,
+                                          uint16_t& pos)
+    {
+      size_t r = 0;
+
+      // While 'x' is an internal node...
+      while (x->_M_header.type == kInternal) {
+        // The keys of the children on the left of the lower (upper) bound
+        // are less than (or equal to) the separator on their right, so
+        // less than (or equal to) 'key'; the keys of the children on the
+        // right of it are not.
+        if (upper) {
+          x->upper_bound(key, comp, pos);
+        } else {
+          x->lower_bound(key, comp, pos);
+        }
+
+        const size_t* counts = x->counts();
+        for (uint16_t i = 0; i < pos; i++) {
+          r += counts[i];
+        }
+
+        x = x->children()[pos];
+      }
+
+      // Leaf node.
+      if (upper) {
+        x->upper_bound(key, comp, pos);
+      } else {
+        x->lower_bound(key, comp, pos);
+      }
+
+      leaf = x;
+
+      return r + pos;
+    }
+
+    template<typename _Parameters>
+    inline void btree<_Parameters>::node::add_path_count(const path& p,
+                                                         ptrdiff_t n)
+    {
+      for (size_t k = 0; k < p.height; k++) {
+        p.nodes[k]->counts()[p.pos[k]] += n;
+      }
+    }
+
+    template<typename _Parameters>
+    void btree<_Parameters>::node::find_path(node* root,
+                                             const node* leaf,
+                                             uint16_t pos,
+                                             const key_compare& comp,
+                                             path& p)
+    {
+      const key_type& key = leaf->keys()[pos];
+
+      p.height = 0;
+
+      // While 'x' is an internal node...
+      node* x = root;
+      while (x->_M_header.type == kInternal) {
+        uint16_t i;
+        if (!kDuplicates) {
+          x->upper_bound(key, comp, i);
+        } else {
+          // The children from 'i' to 'j' might hold the key.
+          uint16_t j;
+          x->lower_bound(key, comp, i);
+          x->upper_bound(key, comp, j);
+
+          if (i < j) {
+            // If the leaf node is in the child 'i', the leaf nodes after it
+            // up to the rightmost one of the child start with the key.
+            const node* last = last_leaf(x->children()[i]);
+
+            const node* y = leaf;
+            while (y != last) {
+              y = y->next();
+
+              if ((y == NULL) || (less(comp, key, y->keys()[0]))) {
+                break;
+              }
+            }
+
+            // Otherwise, walk the leaf nodes of the next children until
+            // the leaf node is found.
+            if (y != last) {
+              y = last->next();
+              last = last_leaf(x->children()[++i]);
+
+              while (y != leaf) {
+                if (y == last) {
+                  last = last_leaf(x->children()[++i]);
+                }
+
+                y = y->next();
+              }
+            }
+          }
+        }
+
+        p.nodes[p.height] = x;
+        p.pos[p.height++] = i;
+
+        x = x->children()[i];
+      }
+
+      p.pos[p.height] = pos;
+    }
+
+    template<typename _Parameters>
+    inline void btree<_Parameters>::node::key_range::keys(const node* x,
+                                                          uint16_t& first,
+                                                          uint16_t& last)
+                                                          const
+    {
+      x->lower_bound(lo, comp, first);
+
+      if (inclusive) {
+        x->upper_bound(hi, comp, last);
+      } else {
+        x->lower_bound(hi, comp, last);
+      }
+    }
+
+    template<typename _Parameters>
+    inline void btree<_Parameters>::node::key_range::children(const node* x,
+                                                              uint16_t& i,
+                                                              uint16_t& j)
+                                                              const
+    {
+      if (kDuplicates) {
+        x->lower_bound(lo, comp, i);
+      } else {
+        x->upper_bound(lo, comp, i);
+      }
+
+      if (inclusive) {
+        x->upper_bound(hi, comp, j);
+      } else {
+        x->lower_bound(hi, comp, j);
+      }
+    }
+
+    template<typename _Parameters>
+    inline const typename btree<_Parameters>::node::key_range&
+    btree<_Parameters>::node::key_range::first_child(bool single) const
+    {
+      return *this;
+    }
+
+    template<typename _Parameters>
+    inline const typename btree<_Parameters>::node::key_range&
+    btree<_Parameters>::node::key_range::last_child() const
+    {
+      return *this;
+    }
+
+    template<typename _Parameters>
+    inline void
+    btree<_Parameters>::node::position_range::keys(const node* x,
+                                                   uint16_t& first,
+                                                   uint16_t& last) const
+    {
+      first = (from) ? from->pos[depth] : 0;
+      last = (to) ? to->pos[depth] + inclusive : x->_M_header.count;
+    }
+
+    template<typename _Parameters>
+    inline void
+    btree<_Parameters>::node::position_range::children(const node* x,
+                                                       uint16_t& i,
+                                                       uint16_t& j) const
+    {
+      i = (from) ? from->pos[depth] : 0;
+      j = (to) ? to->pos[depth] : x->_M_header.count;
+    }
+
+    template<typename _Parameters>
+    inline typename btree<_Parameters>::node::position_range
+    btree<_Parameters>::node::position_range::first_child(bool single) const
+    {
+      position_range range = {from,
+                              (single) ? to : NULL,
+                              depth + 1,
+                              inclusive};
+
+      return range;
+    }
+
+    template<typename _Parameters>
+    inline typename btree<_Parameters>::node::position_range
+    btree<_Parameters>::node::position_range::last_child() const
+    {
+      position_range range = {NULL, to, depth + 1, inclusive};
+
+      return range;
+    }
+
+    template<typename _Parameters>
+    void btree<_Parameters>::node::update_path(const path& p)
+    {
+      for (size_t k = p.height; k > 0; k--) {
+        node* x = p.nodes[k - 1];
+        uint16_t i = p.pos[k - 1];
+
+        x->summaries()[i] = summarize(x->children()[i]);
+      }
+    }
+
+    template<typename _Parameters>
+    inline const typename btree<_Parameters>::node*
+    btree<_Parameters>::node::prev() const
+    {
+      return *reinterpret_cast<node* const*>(
+                reinterpret_cast<const uint8_t*>(this) + kPrevOffset
+              );
+    }
+
+    template<typename _Parameters>
+    inline typename btree<_Parameters>::node* btree<_Parameters>::node::prev()
+    {
+      return *reinterpret_cast<node* const*>(
+                reinterpret_cast<const uint8_t*>(this) + kPrevOffset
+              );
+    }
+
+    template<typename _Parameters>
+    inline void btree<_Parameters>::node::prev(node* n)
+    {
+      *reinterpret_cast<node**>(
+         reinterpret_cast<uint8_t*>(this) + kPrevOffset
+       ) = n;
+    }
+
+    template<typename _Parameters>
+    inline const typename btree<_Parameters>::node*
+    btree<_Parameters>::node::next() const
+    {
+      return *reinterpret_cast<node* const*>(
+                reinterpret_cast<const uint8_t*>(this) + kNextOffset
+              );
+    }
+
+    template<typename _Parameters>
+    inline typename btree<_Parameters>::node* btree<_Parameters>::node::next()
+    {
+      return *reinterpret_cast<node* const*>(
+                reinterpret_cast<const uint8_t*>(this) + kNextOffset
+              );
+    }
+
+    template<typename _Parameters>
+    inline void btree<_Parameters>::node::next(node* n)
+    {
+      *reinterpret_cast<node**>(
+         reinterpret_cast<uint8_t*>(this) + kNextOffset
+       ) = n;
+    }
+
+    template<typename _Parameters>
+    void btree<_Parameters>::node::rebalance_left_to_right(node* x, uint16_t i)
+    {
+      instrumentation_type::count(kRebalancesLeftToRight);
+
+      node* y = x->children()[--i]; // Left sibling.
+      node* z = x->children()[i + 1];
+
+      uint16_t ycount = y->_M_header.count;
+
+      key_type* xkeys = x->keys();
+      key_type* ykeys = y->keys();
+      key_type* zkeys = z->keys();
+
+      // If 'z' is an internal node...
+      if (z->_M_header.type == kInternal) {
+        // - Before the rebalance:
         //
-        // Index:   0                     0                     0       1
-        //      +-------+             +-------+             +-------+-------+
-        //      |  100  |             |  200  |             |  300  |  400  |
-        //      +-------+-------+     +-------+-------+     +-------+-------+-------+
-        //      |   a   |    ---|---->|   b   |    ---|---->|   c   |   d   |    ---|---->
-        //      +-------+-------+     +-------+-------+     +-------+-------+-------+
+        // Index:                           0
+        //                              +-------+
+        //                              |  400  |
+        //                          +---+---+---+---+
+        //                          |       |       |
+        //                          +-------+-------+
+        //                              |       |
+        //                   +----------+       +----------+
+        //                   |                             |
+        //                   v                             v
+        //
+        // Index:    0       1       2                     0
+        //       +-------+-------+-------+             +-------+
+        //       |  100  |  200  |  300  |             |  500  |
+        //   +---+---+---+---+---+---+---+---+     +---+---+---+---+
+        //   |       |       |       |       |     |       |       |
+        //   +-------+-------+-------+-------+     +-------+-------+
+        //       |       |       |       |             |       |
+        //      <100    <200    <300    <400          <500   >=500
         //
         //
-        // - After the merge:
-        //   Right sibling's keys (200) are moved into the left sibling.
-        //   Right sibling's values are moved into the left sibling.
+        // - After the rebalance:
+        //   Parent's key (400) is moved down into the right sibling.
+        //   Left sibling's rightmost key (300) is moved up into its parent.
+        //   Left sibling's rightmost child pointer is moved into the
+        //   right sibling.
         //
         // Index:                           0
         //                              +-------+
@@ -1647,592 +3248,3106 @@ namespace util {
         //
         // Index:        0       1                     0       1
         //           +-------+-------+             +-------+-------+
-        //           |  100  |  200  |             |  300  |  400  |
-        //           +-------+-------+-------+     +-------+-------+-------+
-        //           |   a   |   b   |    ---|---->|   c   |   d   |    ---|---->
-        //           +-------+-------+-------+     +-------+-------+-------+
+        //           |  100  |  200  |             |  400  |  500  |
+        //       +---+---+---+---+---+---+     +---+---+---+---+---+---+
+        //       |       |       |       |     |       |       |       |
+        //       +-------+-------+-------+     +-------+-------+-------+
+        //           |       |       |             |       |       |
+        //          <100    <200    <300          <400    <500   >=500
+        //
+
+        node** zchildren = z->children();
+
+        // Shift keys and pointers one position to the right.
+        relocate(&zkeys[1], zkeys, z->_M_header.count);
+        relocate(&zchildren[1], zchildren, z->_M_header.count + 1);
+
+        // Move key from 'x' down into 'z'.
+        new (&zkeys[0]) key_type(util::move(xkeys[i]));
+
+        // Move rightmost key from left sibling up into 'x'.
+        xkeys[i] = util::move(ykeys[ycount - 1]);
+        ykeys[ycount - 1].key_type::~key_type();
+
+        // Move rightmost child pointer from left sibling into 'z'.
+        zchildren[0] = y->children()[ycount];
+
+        if (kCounted) {
+          size_t* zcounts = z->counts();
+          relocate(&zcounts[1], zcounts, z->_M_header.count + 1);
+
+          size_t n = y->counts()[ycount];
+          zcounts[0] = n;
+
+          x->counts()[i] -= n;
+          x->counts()[i + 1] += n;
+        }
+
+        if (kAggregated) {
+          summary_type* zsummaries = z->summaries();
+          relocate(&zsummaries[1], zsummaries, z->_M_header.count + 1);
+          zsummaries[0] = y->summaries()[ycount];
+        }
+      } else {
+        // 'z' is a leaf node.
+
+        // - Before the rebalance:
+        //
+        // Index:                           0
+        //                              +-------+
+        //                              |  400  |
+        //                          +---+---+---+---+
+        //                          |       |       |
+        //                          +-------+-------+
+        //                              |       |
+        //                   +----------+       +----------+
+        //                   |                             |
+        //                   v                             v
         //
+        // Index:    0       1       2                     0
+        //       +-------+-------+-------+             +-------+
+        //       |  100  |  200  |  300  |             |  400  |
+        //       +-------+-------+-------+-------+     +-------+-------+
+        //       |   a   |   b   |   c   |    ---|---->|   d   |    ---|---->
+        //       +-------+-------+-------+-------+     +-------+-------+
+        //
+        //
+        // - After the rebalance:
+        //   Left sibling's rightmost key (300) is moved into the right sibling.
+        //   Right sibling's new leftmost key (300) is copied into its parent.
+        //   Left sibling's rightmost value is moved into the right sibling.
+        //
+        // Index:                           0
+        //                              +-------+
+        //                              |  300  |
+        //                          +---+---+---+---+
+        //                          |       |       |
+        //                          +-------+-------+
+        //                              |       |
+        //                   +----------+       +----------+
+        //                   |                             |
+        //                   v                             v
+        //
+        // Index:        0       1                     0       1
+        //           +-------+-------+             +-------+-------+
+        //           |  100  |  200  |             |  300  |  400  |
+        //           +-------+-------+-------+     +-------+-------+-------+
+        //           |   a   |   b   |    ---|---->|   c   |   d   |    ---|---->
+        //           +-------+-------+-------+     +-------+-------+-------+
+        //
+
+        // Shift keys one position to the right.
+        relocate(&zkeys[1], zkeys, z->_M_header.count);
+
+        // Move rightmost key from left sibling into 'z'.
+        relocate(zkeys, &ykeys[ycount - 1], 1);
+
+        if (kValueSize > 0) {
+          // Shift values one position to the right.
+          value_type* zvalues = z->values();
+          relocate(&zvalues[1], zvalues, z->_M_header.count);
+
+          // Move rightmost value from left sibling into 'z'.
+          relocate(zvalues, &y->values()[ycount - 1], 1);
+        }
+
+        // Copy new leftmost key from right sibling up into 'x'.
+        xkeys[i] = zkeys[0];
+
+        if (kCounted) {
+          x->counts()[i]--;
+          x->counts()[i + 1]++;
+        }
+      }
+
+      y->_M_header.count--;
+      z->_M_header.count++;
+
+      if (kAggregated) {
+        x->summaries()[i] = summarize(y);
+        x->summaries()[i + 1] = summarize(z);
+      }
+    }
+
+    template<typename _Parameters>
+    void btree<_Parameters>::node::rebalance_right_to_left(node* x, uint16_t i)
+    {
+      instrumentation_type::count(kRebalancesRightToLeft);
+
+      node* y = x->children()[i];
+      node* z = x->children()[i + 1]; // Right sibling.
+
+      uint16_t ycount = y->_M_header.count;
+      uint16_t zcount = z->_M_header.count;
+
+      key_type* xkeys = x->keys();
+      key_type* ykeys = y->keys();
+      key_type* zkeys = z->keys();
+
+      // If 'y' is an internal node...
+      if (y->_M_header.type == kInternal) {
+        // - Before the rebalance:
+        //
+        // Index:                           0
+        //                              +-------+
+        //                              |  200  |
+        //                          +---+---+---+---+
+        //                          |       |       |
+        //                          +-------+-------+
+        //                              |       |
+        //                   +----------+       +----------+
+        //                   |                             |
+        //                   v                             v
+        //
+        // Index:            0                     0       1       2
+        //               +-------+             +-------+-------+-------+
+        //               |  100  |             |  300  |  400  |  500  |
+        //           +---+---+---+---+     +---+---+---+---+---+---+---+---+
+        //           |       |       |     |       |       |       |       |
+        //           +-------+-------+     +-------+-------+-------+-------+
+        //               |       |             |       |       |       |
+        //              <100    <200          <300    <400    <500   >=500
+        //
+        //
+        // - After the rebalance:
+        //   Parent's key (200) is moved down into the left sibling.
+        //   Right sibling's leftmost key (300) is moved up into its parent.
+        //   Right sibling's leftmost child pointer is moved into the
+        //   left sibling.
+        //
+        // Index:                           0
+        //                              +-------+
+        //                              |  300  |
+        //                          +---+---+---+---+
+        //                          |       |       |
+        //                          +-------+-------+
+        //                              |       |
+        //                   +----------+       +----------+
+        //                   |                             |
+        //                   v                             v
+        //
+        // Index:        0       1                     0       1
+        //           +-------+-------+             +-------+-------+
+        //           |  100  |  200  |             |  400  |  500  |
+        //       +---+---+---+---+---+---+     +---+---+---+---+---+---+
+        //       |       |       |       |     |       |       |       |
+        //       +-------+-------+-------+     +-------+-------+-------+
+        //           |       |       |             |       |       |
+        //          <100    <200    <300          <400    <500   >=500
+        //
+
+        // Move key from 'x' down into 'y'.
+        new (&ykeys[ycount]) key_type(util::move(xkeys[i]));
+
+        // Move leftmost key from right sibling up into 'x'.
+        xkeys[i] = util::move(zkeys[0]);
+        zkeys[0].key_type::~key_type();
+
+        node** zchildren = z->children();
+
+        // Move leftmost child pointer from right sibling into 'y'.
+        y->children()[ycount + 1] = zchildren[0];
+
+        // Shift keys and pointers one position to the left.
+        relocate(zkeys, &zkeys[1], zcount - 1);
+        relocate(zchildren, &zchildren[1], zcount);
+
+        if (kCounted) {
+          size_t* zcounts = z->counts();
+
+          size_t n = zcounts[0];
+          y->counts()[ycount + 1] = n;
+
+          relocate(zcounts, &zcounts[1], zcount);
+
+          x->counts()[i] += n;
+          x->counts()[i + 1] -= n;
+        }
+
+        if (kAggregated) {
+          summary_type* zsummaries = z->summaries();
+          y->summaries()[ycount + 1] = zsummaries[0];
+          relocate(zsummaries, &zsummaries[1], zcount);
+        }
+      } else {
+        // 'y' is a leaf node.
+
+        // - Before the rebalance:
+        //
+        // Index:                           0
+        //                              +-------+
+        //                              |  200  |
+        //                          +---+---+---+---+
+        //                          |       |       |
+        //                          +-------+-------+
+        //                              |       |
+        //                   +----------+       +----------+
+        //                   |                             |
+        //                   v                             v
+        //
+        // Index:            0                     0       1       2
+        //               +-------+             +-------+-------+-------+
+        //               |  100  |             |  200  |  300  |  400  |
+        //               +-------+-------+     +-------+-------+-------+-------+
+        //               |   a   |    ---|---->|   b   |   c   |   d   |    ---|---->
+        //               +-------+-------+     +-------+-------+-------+-------+
+        //
+        //
+        // - After the rebalance:
+        //   Right sibling's leftmost key (200) is moved into the left sibling.
+        //   Right sibling's new leftmost key (300) is copied into its parent.
+        //   Right sibling's leftmost value is moved into the left sibling.
+        //
+        // Index:                           0
+        //                              +-------+
+        //                              |  300  |
+        //                          +---+---+---+---+
+        //                          |       |       |
+        //                          +-------+-------+
+        //                              |       |
+        //                   +----------+       +----------+
+        //                   |                             |
+        //                   v                             v
+        //
+        // Index:        0       1                     0       1
+        //           +-------+-------+             +-------+-------+
+        //           |  100  |  200  |             |  300  |  400  |
+        //           +-------+-------+-------+     +-------+-------+-------+
+        //           |   a   |   b   |    ---|---->|   c   |   d   |    ---|---->
+        //           +-------+-------+-------+     +-------+-------+-------+
+        //
+
+        // Move lefmost key from right sibling into 'y'.
+        relocate(&ykeys[ycount], zkeys, 1);
+
+        // Shift keys one position to the left.
+        relocate(zkeys, &zkeys[1], zcount - 1);
+
+        if (kValueSize > 0) {
+          value_type* zvalues = z->values();
+
+          // Move leftmost value from right sibling into 'y'.
+          relocate(&y->values()[ycount], zvalues, 1);
+
+          // Shift values one position to the left.
+          relocate(zvalues, &zvalues[1], zcount - 1);
+        }
+
+        // Copy new leftmost key from right sibling up into 'x'.
+        xkeys[i] = zkeys[0];
+
+        if (kCounted) {
+          x->counts()[i]++;
+          x->counts()[i + 1]--;
+        }
+      }
+
+      y->_M_header.count++;
+      z->_M_header.count--;
+
+      if (kAggregated) {
+        x->summaries()[i] = summarize(y);
+        x->summaries()[i + 1] = summarize(z);
+      }
+    }
+
+    template<typename _Parameters>
+    void btree<_Parameters>::node::merge(node* x,
+                                         node* y,
+                                         node* z,
+                                         uint16_t i,
+                                         allocator_type& allocator)
+    {
+      instrumentation_type::count(kMerges);
+
+      uint16_t ycount = y->_M_header.count;
+      uint16_t zcount = z->_M_header.count;
+
+      key_type* xkeys = x->keys();
+      key_type* ykeys = y->keys();
+      key_type* zkeys = z->keys();
+
+      // If 'y' is an internal node...
+      if (y->_M_header.type == kInternal) {
+        // - Before the merge:
+        //
+        // Index:                           0       1
+        //                              +-------+-------+
+        //                              |  200  |  400  |
+        //                          +---+---+---+---+---+---+
+        //                          |       |       |       |
+        //                          +-------+-------+-------+
+        //                              |       |       |
+        //               +--------------+       |       +--------------+
+        //               |                      |                      |
+        //               v                      v                      v
+        //
+        // Index:        0                      0                  0       1
+        //           +-------+              +-------+          +-------+-------+
+        //           |  100  |              |  300  |          |  500  |  600  |
+        //       +---+---+---+---+      +---+---+---+---+  +---+---+---+---+---+---+
+        //       |       |       |      |       |       |  |       |       |       |
+        //       +-------+-------+      +-------+-------+  +-------+-------+-------+
+        //           |       |              |       |          |       |       |
+        //          <100    <200           <300    <400       <500    <600   >=600
+        //
+        //
+        // - After the merge:
+        //   Parent's key (200) is moved down into the left sibling.
+        //   Right sibling's keys (300) are moved into the left sibling.
+        //   Right sibling's children pointers are moved into the
+        //   left sibling.
+        //
+        // Index:                             0
+        //                                +-------+
+        //                                |  400  |
+        //                            +---+---+---+---+
+        //                            |       |       |
+        //                            +-------+-------+
+        //                                |       |
+        //                     +----------+       +-----------+
+        //                     |                              |
+        //                     v                              v
+        //
+        // Index:      0       1       2                  0       1
+        //         +-------+-------+-------+          +-------+-------+
+        //         |  100  |  200  |  300  |          |  500  |  600  |
+        //     +---+---+---+---+---+---+---+---+  +---+---+---+---+---+---+
+        //     |       |       |       |       |  |       |       |       |
+        //     +-------+-------+-------+-------+  +-------+-------+-------+
+        //         |       |       |       |          |       |       |
+        //        <100    <200    <300    <400       <500    <600   >=600
+        //
+
+        // Move key from 'x' down into 'y'.
+        new (&ykeys[ycount++]) key_type(util::move(xkeys[i]));
+
+        // Move keys and pointers from right sibling into 'y'.
+        relocate(&ykeys[ycount], zkeys, zcount);
+        relocate(&y->children()[ycount], z->children(), zcount + 1);
+
+        if (kCounted) {
+          relocate(&y->counts()[ycount], z->counts(), zcount + 1);
+        }
+
+        if (kAggregated) {
+          relocate(&y->summaries()[ycount], z->summaries(), zcount + 1);
+        }
+
+        ycount += zcount;
+      } else {
+        // 'y' is a leaf node.
+
+        // - Before the merge:
+        //
+        // Index:                     0       1
+        //                        +-------+-------+
+        //                        |  200  |  300  |
+        //                    +---+---+---+---+---+---+
+        //                    |       |       |       |
+        //                    +-------+-------+-------+
+        //                        |       |       |
+        //          +-------------+       |       +-----------------+
+        //          |                     |                         |
+        //          v                     v                         v
+        //
+        // Index:   0                     0                     0       1
+        //      +-------+             +-------+             +-------+-------+
+        //      |  100  |             |  200  |             |  300  |  400  |
+        //      +-------+-------+     +-------+-------+     +-------+-------+-------+
+        //      |   a   |    ---|---->|   b   |    ---|---->|   c   |   d   |    ---|---->
+        //      +-------+-------+     +-------+-------+     +-------+-------+-------+
+        //
+        //
+        // - After the merge:
+        //   Right sibling's keys (200) are moved into the left sibling.
+        //   Right sibling's values are moved into the left sibling.
+        //
+        // Index:                           0
+        //                              +-------+
+        //                              |  300  |
+        //                          +---+---+---+---+
+        //                          |       |       |
+        //                          +-------+-------+
+        //                              |       |
+        //                   +----------+       +----------+
+        //                   |                             |
+        //                   v                             v
+        //
+        // Index:        0       1                     0       1
+        //           +-------+-------+             +-------+-------+
+        //           |  100  |  200  |             |  300  |  400  |
+        //           +-------+-------+-------+     +-------+-------+-------+
+        //           |   a   |   b   |    ---|---->|   c   |   d   |    ---|---->
+        //           +-------+-------+-------+     +-------+-------+-------+
+        //
+
+        // If 'z' is the rightmost leaf node and 'y' is not the leftmost
+        // one...
+        if ((!z->next()) && (y->prev())) {
+          // Keep 'z' (the tree points to it) and delete 'y' instead:
+          // move left sibling's keys (and values) to the front of 'z'.
+          relocate(&zkeys[ycount], zkeys, zcount);
+          relocate(zkeys, ykeys, ycount);
+
+          if (kValueSize > 0) {
+            value_type* zvalues = z->values();
+            relocate(&zvalues[ycount], zvalues, zcount);
+            relocate(zvalues, y->values(), ycount);
+          }
+
+          z->prev(y->prev());
+
+          if (z->prev()) {
+            z->prev()->next(z);
+          }
+
+          x->children()[i] = z;
+
+          // From now on, 'y' is the merged node and 'z' the one to delete.
+          node* n = y;
+          y = z;
+          z = n;
+        } else {
+          // Move right sibling's keys to 'y'.
+          relocate(&ykeys[ycount], zkeys, zcount);
+
+          if (kValueSize > 0) {
+            // Move right sibling's values to 'y'.
+            relocate(&y->values()[ycount], z->values(), zcount);
+          }
+
+          if (z->next()) {
+            z->next()->prev(y);
+          }
+
+          y->next(z->next());
+        }
+
+        ycount += zcount;
+      }
+
+      // The key of 'x' has been moved down into 'y' (internal nodes) or it
+      // is not needed anymore (leaf nodes).
+      xkeys[i].key_type::~key_type();
+
+      // Shift keys and pointers in 'x' one position to the left.
+      uint16_t xcount = x->_M_header.count;
+      node** xchildren = x->children();
+      relocate(&xkeys[i], &xkeys[i + 1], xcount - i - 1);
+      relocate(&xchildren[i + 1], &xchildren[i + 2], xcount - i - 1);
+
+      if (kCounted) {
+        size_t* xcounts = x->counts();
+        xcounts[i] += xcounts[i + 1];
+        relocate(&xcounts[i + 1], &xcounts[i + 2], xcount - i - 1);
+      }
+
+      if (kAggregated) {
+        summary_type* xsummaries = x->summaries();
+        relocate(&xsummaries[i + 1], &xsummaries[i + 2], xcount - i - 1);
+      }
+
+      x->_M_header.count--;
+      y->_M_header.count = ycount;
+      z->_M_header.count = 0;
+
+      if (kAggregated) {
+        x->summaries()[i] = summarize(y);
+      }
+
+      // Delete 'z'.
+      free_node(z, allocator);
+    }
+
+    template<typename _Parameters>
+    typename btree<_Parameters>::node::operation_result
+    btree<_Parameters>::node::try_rebalance_or_merge(node* x,
+                                                     node*& root,
+                                                     uint16_t& i,
+                                                     allocator_type& allocator)
+    {
+      instrumentation_type::count(kRebalanceOrMergeAttempts);
+
+      // If the child has the minimum number of keys...
+      if (x->children()[i]->minkeys()) {
+        // If not the leftmost child...
+        if (i > 0) {
+          // If we can borrow a key from the left sibling...
+          if (!x->children()[i - 1]->minkeys()) {
+            rebalance_left_to_right(x, i);
+
+            return kRebalancedLeftToRight;
+          } else if ((i < x->_M_header.count) &&
+                     (!x->children()[i + 1]->minkeys())) {
+            // We can borrow a key from the right sibling.
+            rebalance_right_to_left(x, i);
+
+            return kRebalancedRightToLeft;
+          } else {
+            i--;
+            merge(x, x->children()[i], x->children()[i + 1], i, allocator);
+
+            // If the root node is empty...
+            if ((x == root) && (x->_M_header.count == 0)) {
+              // Set new root.
+              root = x->children()[0];
+
+              free_node(x, allocator);
+
+              return kShrinked;
+            }
+
+            return kMerged;
+          }
+        } else {
+          // If we can borrow a key from the right sibling...
+          if (!x->children()[i + 1]->minkeys()) {
+            rebalance_right_to_left(x, i);
+
+            return kRebalancedRightToLeft;
+          } else {
+            merge(x, x->children()[i], x->children()[i + 1], i, allocator);
+
+            // If the root node is empty...
+            if ((x == root) && (x->_M_header.count == 0)) {
+              // Set new root.
+              root = x->children()[0];
+
+              free_node(x, allocator);
+
+              return kShrinked;
+            }
+
+            return kMerged;
+          }
+        }
+      }
+
+      return kNoop;
+    }
+
+    template<typename _Parameters>
+    bool btree<_Parameters>::node::remove_child(node* x,
+                                                uint16_t i,
+                                                allocator_type& allocator)
+    {
+      node* y = x->children()[i];
+
+      // If 'y' is a leaf node, unlink it.
+      if (y->_M_header.type == kLeaf) {
+        if (y->prev()) {
+          y->prev()->next(y->next());
+        }
+
+        if (y->next()) {
+          y->next()->prev(y->prev());
+        }
+      }
+
+      free_node(y, allocator);
+
+      uint16_t count = x->_M_header.count;
+
+      // If 'y' was the only child...
+      if (count == 0) {
+        return false;
+      }
+
+      // Remove the key on the left of 'y' (on the right if 'y' is the
+      // first child).
+      uint16_t k = (i > 0) ? i - 1 : 0;
+
+      key_type* keys = x->keys();
+      keys[k].key_type::~key_type();
+      relocate(&keys[k], &keys[k + 1], count - k - 1);
+
+      node** children = x->children();
+      relocate(&children[i], &children[i + 1], count - i);
+
+      if (kCounted) {
+        relocate(&x->counts()[i], &x->counts()[i + 1], count - i);
+      }
+
+      if (kAggregated) {
+        relocate(&x->summaries()[i], &x->summaries()[i + 1], count - i);
+      }
+
+      x->_M_header.count--;
+
+      return true;
+    }
+
+    template<typename _Parameters>
+    size_t btree<_Parameters>::node::remove_children(node* x,
+                                                     uint16_t first,
+                                                     uint16_t last,
+                                                     allocator_type& allocator)
+    {
+      node** children = x->children();
+
+      // Leftmost and rightmost leaf nodes of the subtrees.
+      node* l = children[first];
+      while (l->_M_header.type == kInternal) {
+        l = l->children()[0];
+      }
+
+      node* r = children[last];
+      while (r->_M_header.type == kInternal) {
+        r = r->children()[r->_M_header.count];
+      }
+
+      size_t n = 0;
+      for (node* y = l; ; y = y->next()) {
+        n += y->_M_header.count;
+
+        if (y == r) {
+          break;
+        }
+      }
+
+      // Unlink the leaf nodes.
+      if (l->prev()) {
+        l->prev()->next(r->next());
+      }
+
+      if (r->next()) {
+        r->next()->prev(l->prev());
+      }
+
+      for (uint16_t i = first; i <= last; i++) {
+        destroy(children[i], allocator);
+      }
+
+      // Remove the keys on the left of the subtrees.
+      key_type* keys = x->keys();
+      for (uint16_t i = first - 1; i < last; i++) {
+        keys[i].key_type::~key_type();
+      }
+
+      uint16_t count = x->_M_header.count;
+
+      relocate(&keys[first - 1], &keys[last], count - last);
+      relocate(&children[first], &children[last + 1], count - last);
+
+      if (kCounted) {
+        relocate(&x->counts()[first], &x->counts()[last + 1], count - last);
+      }
+
+      if (kAggregated) {
+        relocate(&x->summaries()[first],
+                 &x->summaries()[last + 1],
+                 count - last);
+      }
+
+      x->_M_header.count -= last - first + 1;
+
+      return n;
+    }
+
+    template<typename _Parameters>
+    void btree<_Parameters>::node::repair_child(node* x,
+                                                uint16_t& i,
+                                                allocator_type& allocator)
+    {
+      node** children = x->children();
+
+      // If we can borrow a key from the left sibling...
+      if ((i > 0) && (!children[i - 1]->minkeys())) {
+        rebalance_left_to_right(x, i);
+      } else if ((i < x->_M_header.count) && (!children[i + 1]->minkeys())) {
+        // We can borrow a key from the right sibling.
+        rebalance_right_to_left(x, i);
+      } else {
+        // Merge with a sibling (both have the minimum number of keys or
+        // less, so they fit in a node).
+        if (i > 0) {
+          i--;
+        }
+
+        merge(x, children[i], children[i + 1], i, allocator);
+      }
+
+      node* y = children[i];
+
+      // If 'y' is an internal node...
+      if (y->_M_header.type == kInternal) {
+        // An internal child of 'y' might have no keys (its only child
+        // being the rest of a range erase).
+        for (uint16_t k = 0; k <= y->_M_header.count; k++) {
+          node* z = y->children()[k];
+          if ((z->_M_header.type == kInternal) &&
+              (z->_M_header.count == 0)) {
+            repair_child(y, k, allocator);
+            break;
+          }
+        }
+
+        // If the repair took back the key 'y' borrowed (a chain of
+        // internal nodes without keys), repair 'y' again.
+        if ((y->_M_header.count == 0) && (x->_M_header.count > 0)) {
+          repair_child(x, i, allocator);
+        }
+      }
+    }
+
+    template<typename _Parameters>
+    inline const typename btree<_Parameters>::iterator::key_type&
+    btree<_Parameters>::iterator::key() const
+    {
+      return _M_node->keys()[_M_pos];
+    }
+
+    template<typename _Parameters>
+    inline typename btree<_Parameters>::iterator::value_type&
+    btree<_Parameters>::iterator::value()
+    {
+      static_assert(!node::kAggregated,
+                    "the values of aggregated trees are updated by insert()");
+
+      return _M_node->values()[_M_pos];
+    }
+
+    template<typename _Parameters>
+    inline
+    bool btree<_Parameters>::iterator::operator==(const iterator& other) const
+    {
+      return ((_M_node == other._M_node) && (_M_pos == other._M_pos));
+    }
+
+    template<typename _Parameters>
+    inline
+    bool btree<_Parameters>::iterator::operator!=(const iterator& other) const
+    {
+      return ((_M_node != other._M_node) || (_M_pos != other._M_pos));
+    }
+
+    template<typename _Parameters>
+    inline const typename btree<_Parameters>::const_iterator::key_type&
+    btree<_Parameters>::const_iterator::key() const
+    {
+      return _M_node->keys()[_M_pos];
+    }
+
+    template<typename _Parameters>
+    inline const typename btree<_Parameters>::const_iterator::value_type&
+    btree<_Parameters>::const_iterator::value() const
+    {
+      return _M_node->values()[_M_pos];
+    }
+
+    template<typename _Parameters>
+    inline bool btree<_Parameters>::const_iterator::
+    operator==(const const_iterator& other) const
+    {
+      return ((_M_node == other._M_node) && (_M_pos == other._M_pos));
+    }
+
+    template<typename _Parameters>
+    inline bool btree<_Parameters>::const_iterator::
+    operator!=(const const_iterator& other) const
+    {
+      return ((_M_node != other._M_node) || (_M_pos != other._M_pos));
+    }
+
+    template<typename _Parameters>
+    inline btree<_Parameters>::btree(const key_compare& comp)
+      : _M_comp(comp),
+        _M_root(NULL),
+        _M_nkeys(0),
+        _M_nkeys_valid(true),
+        _M_head(NULL),
+        _M_tail(NULL)
+    {
+    }
+
+    template<typename _Parameters>
+    inline btree<_Parameters>::~btree()
+    {
+      clear();
+    }
+
+    template<typename _Parameters>
+    inline void btree<_Parameters>::clear()
+    {
+      if (_M_root) {
+        // If the allocator is an arena and neither the keys nor the values
+        // need their destructors to be invoked, drop all the nodes at once.
+        if ((allocator_type::kArena) &&
+            (std::is_trivially_destructible<key_type>::value) &&
+            (std::is_trivially_destructible<value_type>::value)) {
+          _M_allocator.reset();
+        } else {
+          node::destroy(_M_root, _M_allocator);
+
+          if (allocator_type::kArena) {
+            _M_allocator.reset();
+          }
+        }
+
+        _M_root = NULL;
+      }
+
+      _M_nkeys = 0;
+      _M_nkeys_valid = true;
+      _M_head = NULL;
+      _M_tail = NULL;
+    }
+
+    template<typename _Parameters>
+    inline bool btree<_Parameters>::empty() const
+    {
+      return !_M_root;
+    }
+
+    template<typename _Parameters>
+    inline size_t btree<_Parameters>::count() const
+    {
+      if (_M_nkeys_valid) {
+        return _M_nkeys;
+      }
+
+      // The number of keys is not known (see split()): walk the leaf nodes
+      // (the tree is left untouched, so concurrent readers don't race).
+      size_t nkeys = 0;
+      for (const node* x = _M_head; x; x = x->next()) {
+        nkeys += x->_M_header.count;
+      }
+
+      return nkeys;
+    }
+
+    template<typename _Parameters>
+    inline void btree<_Parameters>::snapshot(counters& c)
+    {
+      instrumentation_type::snapshot(c);
+    }
+
+    template<typename _Parameters>
+    inline void btree<_Parameters>::reset_counters()
+    {
+      instrumentation_type::reset();
+    }
+
+    template<typename _Parameters>
+    typename btree<_Parameters>::statistics btree<_Parameters>::stats() const
+    {
+      statistics s;
+      s.height = 0;
+      s.internal_nodes = 0;
+      s.leaf_nodes = 0;
+      s.keys = count();
+      s.internal_node_size = node::kInternalNodeSize;
+      s.leaf_node_size = node::kLeafNodeSize;
+      s.allocated_bytes = 0;
+      s.key_bytes = 0;
+      s.value_bytes = s.keys * node::kValueSize;
+      s.overhead_bytes = 0;
+      s.bytes_per_key = 0;
+
+      if (!_M_root) {
+        return s;
+      }
+
+      stats(_M_root, 0, s);
+
+      s.height = s.levels.size();
+
+      size_t nkeys = 0;
+      for (size_t i = 0; i < s.levels.size(); i++) {
+        level_statistics& l = s.levels[i];
+
+        size_t max_keys = (i + 1 < s.levels.size()) ?
+                            node::kInternalNodeMaxKeys :
+                            node::kLeafNodeMaxKeys;
+
+        l.average_fill = static_cast<double>(l.keys) / (l.nodes * max_keys);
+
+        nkeys += l.keys;
+      }
+
+      s.allocated_bytes = (s.internal_nodes * node::kInternalNodeSize) +
+                          (s.leaf_nodes * node::kLeafNodeSize);
+
+      s.key_bytes = nkeys * sizeof(key_type);
+      s.overhead_bytes = s.allocated_bytes - s.key_bytes - s.value_bytes;
+
+      if (s.keys > 0) {
+        s.bytes_per_key = static_cast<double>(s.allocated_bytes) / s.keys;
+      }
+
+      return s;
+    }
+
+    template<typename _Parameters>
+    void btree<_Parameters>::stats(const node* x,
+                                   size_t level,
+                                   statistics& s)
+    {
+      size_t max_keys;
+
+      if (x->_M_header.type == node::kInternal) {
+        s.internal_nodes++;
+        max_keys = node::kInternalNodeMaxKeys;
+      } else {
+        s.leaf_nodes++;
+        max_keys = node::kLeafNodeMaxKeys;
+      }
+
+      double fill = static_cast<double>(x->_M_header.count) / max_keys;
+
+      if (level == s.levels.size()) {
+        level_statistics l;
+        l.nodes = 0;
+        l.keys = 0;
+        l.average_fill = 0;
+        l.min_fill = fill;
+
+        s.levels.push_back(l);
+      }
+
+      level_statistics& l = s.levels[level];
+      l.nodes++;
+      l.keys += x->_M_header.count;
+
+      if (fill < l.min_fill) {
+        l.min_fill = fill;
+      }
+
+      if (x->_M_header.type == node::kInternal) {
+        node* const* children = x->children();
+
+        for (uint16_t i = 0; i <= x->_M_header.count; i++) {
+          stats(children[i], level + 1, s);
+        }
+      }
+    }
+
+    template<typename _Parameters>
+    inline typename btree<_Parameters>::allocator_type&
+    btree<_Parameters>::allocator()
+    {
+      return _M_allocator;
+    }
+
+    template<typename _Parameters>
+    inline bool btree<_Parameters>::insert(const key_type& key,
+                                           const value_type& value)
+    {
+      return insert_key(true, NULL, key, value);
+    }
+
+    template<typename _Parameters>
+    inline bool btree<_Parameters>::insert(key_type&& key, value_type&& value)
+    {
+      return insert_key(true, NULL, util::move(key), util::move(value));
+    }
+
+    template<typename _Parameters>
+    template<typename... _Args>
+    inline bool btree<_Parameters>::emplace(const key_type& key,
+                                            _Args&&... args)
+    {
+      return insert_key(true, NULL, key, util::forward<_Args>(args)...);
+    }
+
+    template<typename _Parameters>
+    template<typename... _Args>
+    inline bool btree<_Parameters>::emplace(key_type&& key, _Args&&... args)
+    {
+      return insert_key(true,
+                        NULL,
+                        util::move(key),
+                        util::forward<_Args>(args)...);
+    }
+
+    template<typename _Parameters>
+    template<typename... _Args>
+    inline bool btree<_Parameters>::try_emplace(const key_type& key,
+                                                _Args&&... args)
+    {
+      size_t nkeys = _M_nkeys;
+      return ((insert_key(false,
+                          NULL,
+                          key,
+                          util::forward<_Args>(args)...)) &&
+              (_M_nkeys != nkeys));
+    }
+
+    template<typename _Parameters>
+    template<typename... _Args>
+    inline bool btree<_Parameters>::try_emplace(key_type&& key,
+                                                _Args&&... args)
+    {
+      size_t nkeys = _M_nkeys;
+      return ((insert_key(false,
+                          NULL,
+                          util::move(key),
+                          util::forward<_Args>(args)...)) &&
+              (_M_nkeys != nkeys));
+    }
+
+    template<typename _Parameters>
+    template<typename _K, typename... _Args>
+    bool btree<_Parameters>::insert_key(bool assign,
+                                        iterator* it,
+                                        _K&& key,
+                                        _Args&&... args)
+    {
+      bool append = false;
+
+      // If the tree is empty...
+      if (!_M_root) {
+        if ((_M_root = node::create(node::kLeaf, _M_allocator)) == NULL) {
+          return false;
+        }
+
+        _M_head = _M_root;
+        _M_tail = _M_root;
+      } else {
+        node* x = _M_tail;
+        uint16_t count = x->_M_header.count;
+
+        // If the key goes after the last key of the tree...
+        if ((kDuplicates) ? !node::less(_M_comp, key, x->keys()[count - 1]) :
+                            node::less(_M_comp, x->keys()[count - 1], key)) {
+          // If the rightmost leaf node is not full...
+          if (!x->full()) {
+            node::insert(x,
+                         count,
+                         util::forward<_K>(key),
+                         util::forward<_Args>(args)...);
+
+            _M_nkeys++;
+
+            if (node::kCounted) {
+              node::add_edge_count(_M_root, true, 1);
+            }
+
+            if (node::kAggregated) {
+              node::update_edge(_M_root, true);
+            }
+
+            if (it) {
+              it->_M_node = x;
+              it->_M_pos = count;
+            }
+
+            return true;
+          }
+
+          append = true;
+        }
+
+        // If the root node is full...
+        if (_M_root->full()) {
+          node* s;
+          if ((s = node::create(node::kInternal, _M_allocator)) == NULL) {
+            return false;
+          }
+
+          s->children()[0] = _M_root;
+
+          if (node::kCounted) {
+            s->counts()[0] = _M_nkeys;
+          }
+
+          if (node::kAggregated) {
+            s->summaries()[0] = node::summarize(_M_root);
+          }
+
+          if (!s->split_child(0, _M_allocator, append)) {
+            node::free_node(s, _M_allocator);
+            return false;
+          }
+
+          _M_root = s;
+        }
+      }
+
+      node* leaf;
+      uint16_t pos;
+      if (!node::insert_non_full(_M_root,
+                                 _M_comp,
+                                 assign,
+                                 append,
+                                 _M_nkeys,
+                                 _M_allocator,
+                                 leaf,
+                                 pos,
+                                 util::forward<_K>(key),
+                                 util::forward<_Args>(args)...)) {
+        return false;
+      }
+
+      // If the rightmost leaf node has been split...
+      if (_M_tail->next()) {
+        _M_tail = _M_tail->next();
+      }
+
+      if (it) {
+        it->_M_node = leaf;
+        it->_M_pos = pos;
+      }
+
+      return true;
+    }
+
+    template<typename _Parameters>
+    inline bool btree<_Parameters>::insert(iterator& hint,
+                                           const key_type& key,
+                                           const value_type& value)
+    {
+      return insert_hint(hint, true, key, value);
+    }
+
+    template<typename _Parameters>
+    inline bool btree<_Parameters>::insert(iterator& hint,
+                                           key_type&& key,
+                                           value_type&& value)
+    {
+      return insert_hint(hint, true, util::move(key), util::move(value));
+    }
+
+    template<typename _Parameters>
+    template<typename... _Args>
+    inline bool btree<_Parameters>::emplace_hint(iterator& hint,
+                                                 const key_type& key,
+                                                 _Args&&... args)
+    {
+      return insert_hint(hint, true, key, util::forward<_Args>(args)...);
+    }
+
+    template<typename _Parameters>
+    template<typename... _Args>
+    inline bool btree<_Parameters>::emplace_hint(iterator& hint,
+                                                 key_type&& key,
+                                                 _Args&&... args)
+    {
+      return insert_hint(hint,
+                         true,
+                         util::move(key),
+                         util::forward<_Args>(args)...);
+    }
+
+    template<typename _Parameters>
+    template<typename _K, typename... _Args>
+    bool btree<_Parameters>::insert_hint(iterator& hint,
+                                         bool assign,
+                                         _K&& key,
+                                         _Args&&... args)
+    {
+      node* x;
+
+      // If the key goes into the leaf node of the hint (or one of its
+      // neighbours) and the leaf node is not full...
+      // The counts (summaries) of counted (aggregated) trees can only be
+      // updated on the way down.
+      if ((!node::kAugmented) &&
+          (!empty()) &&
+          ((x = insert_leaf(hint._M_node, key)) != NULL) &&
+          (!x->full())) {
+        uint16_t pos;
+
+        // If the key has been already inserted and duplicates are not
+        // allowed...
+        if ((x->upper_bound(key, _M_comp, pos)) && (!kDuplicates)) {
+          // If the tree might have values...
+          if ((node::kValueSize > 0) && (assign)) {
+            // Update value.
+            node::assign_value(x->values()[pos - 1],
+                               util::forward<_Args>(args)...);
+          }
+
+          hint._M_node = x;
+          hint._M_pos = pos - 1;
+
+          return true;
+        }
+
+        node::insert(x,
+                     pos,
+                     util::forward<_K>(key),
+                     util::forward<_Args>(args)...);
+
+        _M_nkeys++;
+
+        hint._M_node = x;
+        hint._M_pos = pos;
+
+        return true;
+      }
+
+      return insert_key(assign,
+                        &hint,
+                        util::forward<_K>(key),
+                        util::forward<_Args>(args)...);
+    }
+
+    template<typename _Parameters>
+    typename btree<_Parameters>::node*
+    btree<_Parameters>::insert_leaf(node* x, const key_type& key) const
+    {
+      // If the key goes after 'x'...
+      if ((x->next()) && (after_last(x, key))) {
+        x = x->next();
+
+        return ((!node::less(_M_comp, key, x->keys()[0])) &&
+                ((!x->next()) || (!after_last(x, key)))) ? x : NULL;
+      }
+
+      // If the key goes before 'x'...
+      if ((x->prev()) && (node::less(_M_comp, key, x->keys()[0]))) {
+        x = x->prev();
+
+        return ((!after_last(x, key)) &&
+                ((!x->prev()) ||
+                 (!node::less(_M_comp, key, x->keys()[0])))) ? x : NULL;
+      }
+
+      return x;
+    }
+
+    template<typename _Parameters>
+    template<typename _Node>
+    _Node* btree<_Parameters>::lower_bound_leaf(_Node* x,
+                                                const key_type& key) const
+    {
+      // If the lower bound is after 'x'...
+      if (node::less(_M_comp, x->keys()[x->_M_header.count - 1], key)) {
+        if (!x->next()) {
+          return x;
+        }
+
+        x = x->next();
+
+        // The keys of the previous leaf node are less than the key.
+        return ((!x->next()) ||
+                (!node::less(_M_comp,
+                             x->keys()[x->_M_header.count - 1],
+                             key))) ? x : NULL;
+      }
+
+      // If there are no smaller keys (nor duplicates) before 'x'...
+      if ((!x->prev()) ||
+          ((kDuplicates) ? node::less(_M_comp, x->keys()[0], key) :
+                           !node::less(_M_comp, key, x->keys()[0]))) {
+        return x;
+      }
+
+      _Node* y = x->prev();
+
+      // If the keys of the previous leaf node are less than the key...
+      if (node::less(_M_comp, y->keys()[y->_M_header.count - 1], key)) {
+        return x;
+      }
+
+      return ((!y->prev()) ||
+              ((kDuplicates) ? node::less(_M_comp, y->keys()[0], key) :
+                               !node::less(_M_comp, key, y->keys()[0]))) ?
+             y :
+             NULL;
+    }
+
+    template<typename _Parameters>
+    inline bool btree<_Parameters>::after_last(const node* x,
+                                               const key_type& key) const
+    {
+      const key_type& last = x->keys()[x->_M_header.count - 1];
+
+      // Duplicates are inserted after the equal keys.
+      return (kDuplicates) ? !node::less(_M_comp, key, last) :
+                             node::less(_M_comp, last, key);
+    }
+
+    template<typename _Parameters>
+    inline bool btree<_Parameters>::erase(const key_type& key)
+    {
+      // If the tree is empty...
+      if (empty()) {
+        return false;
+      }
+
+      if (!node::erase(_M_root, key, _M_comp, _M_allocator)) {
+        // The leftmost and the rightmost leaf nodes might have been merged
+        // anyway.
+        if (_M_root->_M_header.type == node::kLeaf) {
+          _M_head = _M_root;
+          _M_tail = _M_root;
+        }
+
+        return false;
+      }
+
+      _M_nkeys--;
+
+      // If the tree is empty...
+      if ((_M_root->_M_header.type == node::kLeaf) &&
+          (_M_root->_M_header.count == 0)) {
+        node::destroy(_M_root, _M_allocator);
+        _M_root = NULL;
+        _M_nkeys = 0;
+        _M_nkeys_valid = true;
+        _M_head = NULL;
+        _M_tail = NULL;
+      } else if (_M_root->_M_header.type == node::kLeaf) {
+        // The leftmost and the rightmost leaf nodes might have been merged.
+        _M_head = _M_root;
+        _M_tail = _M_root;
+      }
+
+      return true;
+    }
+
+    template<typename _Parameters>
+    inline size_t btree<_Parameters>::erase_range(const key_type& lo,
+                                                  const key_type& hi)
+    {
+      // If the range is empty...
+      if (!node::less(_M_comp, lo, hi)) {
+        return 0;
+      }
+
+      return erase_range(lo, hi, false);
+    }
+
+    template<typename _Parameters>
+    size_t btree<_Parameters>::erase(const iterator& first,
+                                     const iterator& last,
+                                     bool inclusive)
+    {
+      // The positions of the iterators are turned into paths from the
+      // root before anything is erased.
+      typename node::path from, to;
+      node::find_path(_M_root, first._M_node, first._M_pos, _M_comp, from);
+      node::find_path(_M_root, last._M_node, last._M_pos, _M_comp, to);
+
+      typename node::position_range range = {&from, &to, 0, inclusive};
+
+      bool empty;
+      size_t n = node::erase_range(_M_root, range, _M_allocator, empty);
+
+      _M_nkeys -= n;
+
+      repair_root(empty);
+
+      return n;
+    }
+
+    template<typename _Parameters>
+    inline size_t btree<_Parameters>::erase_all(const key_type& key)
+    {
+      return erase_range(key, key, true);
+    }
+
+    template<typename _Parameters>
+    size_t btree<_Parameters>::erase_range(const key_type& lo,
+                                           const key_type& hi,
+                                           bool inclusive)
+    {
+      // If the tree is empty...
+      if (empty()) {
+        return 0;
+      }
+
+      typename node::key_range range = {lo, hi, inclusive, _M_comp};
+
+      bool empty;
+      size_t n = node::erase_range(_M_root, range, _M_allocator, empty);
+
+      _M_nkeys -= n;
+
+      repair_root(empty);
+
+      return n;
+    }
+
+    template<typename _Parameters>
+    bool btree<_Parameters>::split(const key_type& key, btree& right)
+    {
+      static_assert(allocator_type::kShared,
+                    "the nodes are moved to the other tree");
+
+      // If 'right' is not empty...
+      if (!right.empty()) {
+        return false;
+      }
+
+      // If the tree is empty...
+      if (empty()) {
+        return true;
+      }
+
+      // Nodes of 'right' on the path to 'key' (one per level).
+      size_t h = node::height(_M_root);
+
+      node* spare[node::kMaxHeight + 1];
+      for (size_t i = 0; i <= h; i++) {
+        if ((spare[i] = node::create((i < h) ? node::kInternal :
+                                               node::kLeaf,
+                                     _M_allocator)) == NULL) {
+          while (i > 0) {
+            node::free_node(spare[--i], _M_allocator);
+          }
+
+          return false;
+        }
+      }
+
+      // Number of keys before the split.
+      size_t n = _M_nkeys;
+      bool valid = _M_nkeys_valid;
+
+      bool empty;
+      bool rempty;
+      node::split(_M_root,
+                  key,
+                  _M_comp,
+                  spare,
+                  _M_allocator,
+                  empty,
+                  right._M_root,
+                  rempty);
+
+      repair_root(empty);
+      right.repair_root(rempty);
+
+      // Count the keys moved.
+      if (node::kCounted) {
+        size_t moved = (rempty) ? 0 : node::subtree_count(right._M_root);
+
+        _M_nkeys = n - moved;
+        right._M_nkeys = moved;
+      } else if (rempty) {
+        // No key has been moved.
+      } else if (empty) {
+        // All the keys have been moved ('repair_root()' has reset the
+        // number of keys of the tree).
+        right._M_nkeys = n;
+        right._M_nkeys_valid = valid;
+      } else {
+        // The number of keys of the subtrees moved whole is not known:
+        // counting them would walk them, so count() walks the leaf nodes
+        // of both trees from now on.
+        _M_nkeys_valid = false;
+        right._M_nkeys_valid = false;
+      }
+
+      return true;
+    }
+
+    template<typename _Parameters>
+    bool btree<_Parameters>::join(btree& right)
+    {
+      static_assert(allocator_type::kShared,
+                    "the nodes are moved to the other tree");
+
+      // If 'right' is empty...
+      if (right.empty()) {
+        return true;
+      }
+
+      // If the tree is empty...
+      if (empty()) {
+        _M_root = right._M_root;
+        _M_nkeys = right._M_nkeys;
+        _M_nkeys_valid = right._M_nkeys_valid;
+        _M_head = right._M_head;
+        _M_tail = right._M_tail;
+      } else {
+        // The first key of 'right' separates the trees.
+        key_type sep(right._M_head->keys()[0]);
+
+        const key_type& last = _M_tail->keys()[_M_tail->_M_header.count - 1];
+
+        // If the keys overlap...
+        if ((kDuplicates) ? node::less(_M_comp, sep, last) :
+                            !node::less(_M_comp, last, sep)) {
+          return false;
+        }
+
+        size_t h = node::height(_M_root);
+        size_t hr = node::height(right._M_root);
+
+        // Attach the shorter tree to the taller one.
+        if (h >= hr) {
+          if (!node::attach(_M_root,
+                            h,
+                            right._M_root,
+                            hr,
+                            sep,
+                            false,
+                            _M_tail,
+                            right._M_head,
+                            _M_allocator)) {
+            return false;
+          }
+        } else {
+          if (!node::attach(right._M_root,
+                            hr,
+                            _M_root,
+                            h,
+                            sep,
+                            true,
+                            _M_tail,
+                            right._M_head,
+                            _M_allocator)) {
+            return false;
+          }
+
+          _M_root = right._M_root;
+        }
+
+        _M_nkeys += right._M_nkeys;
+        _M_nkeys_valid = (_M_nkeys_valid) && (right._M_nkeys_valid);
+
+        // The leaf nodes at the seam might have been merged.
+        repair_root(false);
+      }
+
+      right._M_root = NULL;
+      right._M_nkeys = 0;
+      right._M_nkeys_valid = true;
+      right._M_head = NULL;
+      right._M_tail = NULL;
+
+      return true;
+    }
+
+    template<typename _Parameters>
+    void btree<_Parameters>::repair_root(bool empty)
+    {
+      // If the tree is empty...
+      if (empty) {
+        node::free_node(_M_root, _M_allocator);
+        _M_root = NULL;
+        _M_nkeys = 0;
+        _M_nkeys_valid = true;
+        _M_head = NULL;
+        _M_tail = NULL;
+
+        return;
+      }
+
+      // While the root node has a single child...
+      while ((_M_root->_M_header.type == node::kInternal) &&
+             (_M_root->_M_header.count == 0)) {
+        node* x = _M_root;
+        _M_root = x->children()[0];
+
+        node::free_node(x, _M_allocator);
+      }
+
+      // The leftmost and the rightmost leaf nodes might have been deleted.
+      _M_head = _M_root;
+      while (_M_head->_M_header.type == node::kInternal) {
+        _M_head = _M_head->children()[0];
+      }
+
+      _M_tail = _M_root;
+      while (_M_tail->_M_header.type == node::kInternal) {
+        _M_tail = _M_tail->children()[_M_tail->_M_header.count];
+      }
+    }
+
+    template<typename _Parameters>
+    inline bool btree<_Parameters>::pop_front()
+    {
+      // If the tree is empty...
+      if (empty()) {
+        return false;
+      }
+
+      prepare_pop(false);
+      pop(_M_head, 0);
+
+      return true;
+    }
+
+    template<typename _Parameters>
+    inline bool btree<_Parameters>::pop_front(key_type& key)
+    {
+      // If the tree is empty...
+      if (empty()) {
+        return false;
+      }
+
+      prepare_pop(false);
+
+      key = util::move(_M_head->keys()[0]);
+      pop(_M_head, 0);
+
+      return true;
+    }
+
+    template<typename _Parameters>
+    inline bool btree<_Parameters>::pop_front(key_type& key,
+                                              value_type& value)
+    {
+      // If the tree is empty...
+      if (empty()) {
+        return false;
+      }
+
+      prepare_pop(false);
+
+      key = util::move(_M_head->keys()[0]);
+      value = util::move(_M_head->values()[0]);
+      pop(_M_head, 0);
+
+      return true;
+    }
+
+    template<typename _Parameters>
+    inline bool btree<_Parameters>::pop_back()
+    {
+      // If the tree is empty...
+      if (empty()) {
+        return false;
+      }
+
+      prepare_pop(true);
+      pop(_M_tail, _M_tail->_M_header.count - 1);
+
+      return true;
+    }
+
+    template<typename _Parameters>
+    inline bool btree<_Parameters>::pop_back(key_type& key)
+    {
+      // If the tree is empty...
+      if (empty()) {
+        return false;
+      }
+
+      prepare_pop(true);
+
+      uint16_t pos = _M_tail->_M_header.count - 1;
+      key = util::move(_M_tail->keys()[pos]);
+      pop(_M_tail, pos);
+
+      return true;
+    }
+
+    template<typename _Parameters>
+    inline bool btree<_Parameters>::pop_back(key_type& key,
+                                             value_type& value)
+    {
+      // If the tree is empty...
+      if (empty()) {
+        return false;
+      }
+
+      prepare_pop(true);
+
+      uint16_t pos = _M_tail->_M_header.count - 1;
+      key = util::move(_M_tail->keys()[pos]);
+      value = util::move(_M_tail->values()[pos]);
+      pop(_M_tail, pos);
+
+      return true;
+    }
+
+    template<typename _Parameters>
+    inline void btree<_Parameters>::prepare_pop(bool back)
+    {
+      node* x = (back) ? _M_tail : _M_head;
+
+      // If the leaf node is not the root and has the minimum number of
+      // keys...
+      if ((x != _M_root) && (x->minkeys())) {
+        node::descend_edge(_M_root, back, _M_allocator);
+
+        // If the leftmost and the rightmost leaf nodes have been merged...
+        if (_M_root->_M_header.type == node::kLeaf) {
+          _M_head = _M_root;
+          _M_tail = _M_root;
+        }
+      }
+    }
+
+    template<typename _Parameters>
+    inline void btree<_Parameters>::pop(node* x, uint16_t pos)
+    {
+      node::erase(x, pos);
+
+      if (node::kCounted) {
+        node::add_edge_count(_M_root, x == _M_tail, -1);
+      }
+
+      if (node::kAggregated) {
+        node::update_edge(_M_root, x == _M_tail);
+      }
+
+      _M_nkeys--;
+
+      // If the tree is empty...
+      if ((_M_root->_M_header.type == node::kLeaf) &&
+          (_M_root->_M_header.count == 0)) {
+        node::destroy(_M_root, _M_allocator);
+        _M_root = NULL;
+        _M_nkeys = 0;
+        _M_nkeys_valid = true;
+        _M_head = NULL;
+        _M_tail = NULL;
+      }
+    }
+
+    template<typename _Parameters>
+    inline bool btree<_Parameters>::get(const key_type& key,
+                                        value_type& value) const
+    {
+      const_iterator it;
+      if (!lower_bound(key, it)) {
+        return false;
+      }
+
+      value = it._M_node->values()[it._M_pos];
+
+      return true;
+    }
+
+    template<typename _Parameters>
+    size_t btree<_Parameters>::multi_get(const key_type* keys,
+                                         size_t count,
+                                         value_type* values,
+                                         bool* found) const
+    {
+      for (size_t i = 0; i < count; i++) {
+        found[i] = false;
+      }
+
+      auto callback = [values, found](size_t i, const node* x, uint16_t pos) {
+        values[i] = x->values()[pos];
+        found[i] = true;
+      };
+
+      return multi_lookup(keys, count, callback);
+    }
+
+    template<typename _Parameters>
+    size_t btree<_Parameters>::multi_find(const key_type* keys,
+                                          size_t count,
+                                          iterator* its,
+                                          bool* found)
+    {
+      for (size_t i = 0; i < count; i++) {
+        found[i] = false;
+      }
+
+      auto callback = [its, found](size_t i, const node* x, uint16_t pos) {
+        its[i]._M_node = const_cast<node*>(x);
+        its[i]._M_pos = pos;
+        found[i] = true;
+      };
+
+      return multi_lookup(keys, count, callback);
+    }
+
+    template<typename _Parameters>
+    size_t btree<_Parameters>::multi_find(const key_type* keys,
+                                          size_t count,
+                                          const_iterator* its,
+                                          bool* found) const
+    {
+      for (size_t i = 0; i < count; i++) {
+        found[i] = false;
+      }
+
+      auto callback = [its, found](size_t i, const node* x, uint16_t pos) {
+        its[i]._M_node = x;
+        its[i]._M_pos = pos;
+        found[i] = true;
+      };
+
+      return multi_lookup(keys, count, callback);
+    }
+
+    template<typename _Parameters>
+    template<typename _Callback>
+    size_t btree<_Parameters>::multi_lookup(const key_type* keys,
+                                            size_t count,
+                                            _Callback& callback) const
+    {
+      // If the tree is empty...
+      if ((empty()) || (count == 0)) {
+        return 0;
+      }
+
+      // Check whether the keys are already sorted.
+      size_t i;
+      for (i = 1; i < count; i++) {
+        if (node::less(_M_comp, keys[i], keys[i - 1])) {
+          break;
+        }
+      }
+
+      if (i == count) {
+        return multi_lookup(_M_root, keys, NULL, 0, count, callback);
+      }
+
+      // Sort the positions of the keys.
+      size_t* order;
+      if ((order = static_cast<size_t*>(
+                     malloc(count * sizeof(size_t))
+                   )) == NULL) {
+        // Fall back to one descent per key.
+        size_t n = 0;
+        for (i = 0; i < count; i++) {
+          const_iterator it;
+          if (lower_bound(keys[i], it)) {
+            callback(i, it._M_node, it._M_pos);
+            n++;
+          }
+        }
+
+        return n;
+      }
+
+      for (i = 0; i < count; i++) {
+        order[i] = i;
+      }
+
+      const key_compare& comp = _M_comp;
+      std::sort(order,
+                order + count,
+                [keys, &comp](size_t x, size_t y) {
+                  return node::less(comp, keys[x], keys[y]);
+                });
+
+      size_t n = multi_lookup(_M_root, keys, order, 0, count, callback);
+
+      free(order);
+
+      return n;
+    }
+
+    template<typename _Parameters>
+    template<typename _Callback>
+    size_t btree<_Parameters>::multi_lookup(const node* x,
+                                            const key_type* keys,
+                                            const size_t* order,
+                                            size_t first,
+                                            size_t last,
+                                            _Callback& callback) const
+    {
+      size_t n = 0;
+
+      // Leaf node?
+      if (x->_M_header.type == node::kLeaf) {
+        for (size_t i = first; i < last; i++) {
+          size_t k = order ? order[i] : i;
+
+          uint16_t pos;
+          if (x->lower_bound(keys[k], _M_comp, pos)) {
+            callback(k, x, pos);
+            n++;
+          } else if ((kDuplicates) &&
+                     (pos == x->_M_header.count) &&
+                     (x->next()) &&
+                     (!node::less(_M_comp, keys[k], x->next()->keys()[0]))) {
+            // The duplicates of the separator might start in the next leaf
+            // node.
+            callback(k, x->next(), 0);
+            n++;
+          }
+        }
+
+        return n;
+      }
+
+      // Split the keys among the children. The keys which reach the same
+      // child are contiguous.
+      uint16_t children[node::kInternalNodeMaxKeys + 1];
+      size_t bounds[node::kInternalNodeMaxKeys + 2];
+      uint16_t nchildren = 0;
+
+      size_t i = first;
+      while (i < last) {
+        uint16_t pos;
+        if ((x->lower_bound(keys[order ? order[i] : i], _M_comp, pos)) &&
+            (!kDuplicates)) {
+          pos++;
+        }
+
+        size_t j = i + 1;
+
+        if (pos < x->_M_header.count) {
+          // The keys less than the separator (less or equal if duplicates
+          // are allowed) go to the same child.
+          const key_type& separator = x->keys()[pos];
+
+          while (j < last) {
+            const key_type& key = keys[order ? order[j] : j];
+
+            if ((kDuplicates) ? node::less(_M_comp, separator, key) :
+                                !node::less(_M_comp, key, separator)) {
+              break;
+            }
+
+            j++;
+          }
+        } else {
+          j = last;
+        }
+
+        children[nchildren] = pos;
+        bounds[nchildren++] = i;
+
+        // Issue the loads of the children before descending.
+        x->children()[pos]->prefetch();
+
+        i = j;
+      }
+
+      bounds[nchildren] = last;
+
+      for (uint16_t c = 0; c < nchildren; c++) {
+        n += multi_lookup(x->children()[children[c]],
+                          keys,
+                          order,
+                          bounds[c],
+                          bounds[c + 1],
+                          callback);
+      }
+
+      return n;
+    }
+
+    template<typename _Parameters>
+    inline bool btree<_Parameters>::begin(iterator& it)
+    {
+      // If the tree is empty...
+      if (empty()) {
+        return false;
+      }
+
+      it._M_node = _M_head;
+      it._M_pos = 0;
+
+      return true;
+    }
+
+    template<typename _Parameters>
+    inline bool btree<_Parameters>::begin(const_iterator& it) const
+    {
+      // If the tree is empty...
+      if (empty()) {
+        return false;
+      }
+
+      it._M_node = _M_head;
+      it._M_pos = 0;
+
+      return true;
+    }
+
+    template<typename _Parameters>
+    inline bool btree<_Parameters>::end(iterator& it)
+    {
+      // If the tree is empty...
+      if (empty()) {
+        return false;
+      }
+
+      it._M_node = _M_tail;
+      it._M_pos = it._M_node->_M_header.count - 1;
+
+      return true;
+    }
+
+    template<typename _Parameters>
+    inline bool btree<_Parameters>::end(const_iterator& it) const
+    {
+      // If the tree is empty...
+      if (empty()) {
+        return false;
+      }
+
+      it._M_node = _M_tail;
+      it._M_pos = it._M_node->_M_header.count - 1;
+
+      return true;
+    }
+
+    template<typename _Parameters>
+    inline bool btree<_Parameters>::prev(iterator& it)
+    {
+      if (it._M_pos > 0) {
+        it._M_pos--;
+      } else if (it._M_node->prev()) {
+        it._M_node = it._M_node->prev();
+        it._M_pos = it._M_node->_M_header.count - 1;
+      } else {
+        return false;
+      }
+
+      return true;
+    }
+
+    template<typename _Parameters>
+    inline bool btree<_Parameters>::prev(const_iterator& it) const
+    {
+      if (it._M_pos > 0) {
+        it._M_pos--;
+      } else if (it._M_node->prev()) {
+        it._M_node = it._M_node->prev();
+        it._M_pos = it._M_node->_M_header.count - 1;
+      } else {
+        return false;
+      }
+
+      return true;
+    }
+
+    template<typename _Parameters>
+    inline bool btree<_Parameters>::next(iterator& it)
+    {
+      if (it._M_pos < it._M_node->_M_header.count - 1) {
+        it._M_pos++;
+      } else if (it._M_node->next()) {
+        it._M_node = it._M_node->next();
+        it._M_pos = 0;
+      } else {
+        return false;
+      }
+
+      return true;
+    }
+
+    template<typename _Parameters>
+    inline bool btree<_Parameters>::next(const_iterator& it) const
+    {
+      if (it._M_pos < it._M_node->_M_header.count - 1) {
+        it._M_pos++;
+      } else if (it._M_node->next()) {
+        it._M_node = it._M_node->next();
+        it._M_pos = 0;
+      } else {
+        return false;
+      }
+
+      return true;
+    }
+
+    template<typename _Parameters>
+    inline bool btree<_Parameters>::find(const key_type& key, iterator& it)
+    {
+      return lower_bound(key, it);
+    }
+
+    template<typename _Parameters>
+    inline bool btree<_Parameters>::find(const key_type& key,
+                                         const_iterator& it) const
+    {
+      return lower_bound(key, it);
+    }
+
+    template<typename _Parameters>
+    bool btree<_Parameters>::lower_bound(const key_type& key, iterator& it)
+    {
+      // If the tree is empty...
+      if (empty()) {
+        return false;
+      }
 
-        if (kValueSize > 0) {
-          value_type* yvalues = y->_M_values;
-          value_type* zvalues = z->_M_values;
+      bool search_in_next_node = false;
 
-          // Move right sibling's keys and values to 'y'.
-          for (uint16_t j = 0; j < zcount; j++) {
-            ykeys[ycount] = util::move(zkeys[j]);
-            yvalues[ycount] = util::move(zvalues[j]);
+      it._M_node = _M_root;
 
-            ycount++;
-          }
-        } else {
-          // Move right sibling's keys to 'y'.
-          for (uint16_t j = 0; j < zcount; j++) {
-            ykeys[ycount] = util::move(zkeys[j]);
-            ycount++;
+      uint64_t visits = 1;
+
+      while (it._M_node->_M_header.type == node::kInternal) {
+        if (it._M_node->lower_bound(key, _M_comp, it._M_pos)) {
+          if (!kDuplicates) {
+            it._M_pos++;
+          } else {
+            search_in_next_node = true;
           }
         }
 
-        xkeys[i].key_type::~key_type();
-        new (&xkeys[i]) key_type();
+        it._M_node = it._M_node->children()[it._M_pos];
+        visits++;
+      }
 
-        if (z->next()) {
-          z->next()->prev(y);
-        }
+      instrumentation_type::count(kLookups);
 
-        y->next(z->next());
+      if (it._M_node->lower_bound(key, _M_comp, it._M_pos)) {
+        instrumentation_type::count(kLookupNodeVisits, visits);
+        return true;
       }
 
-      // Shift keys and pointers in 'x' one position to the left.
-      uint16_t xcount = x->_M_header->count;
-      node** xchildren = x->_M_children;
-      for (++i; i < xcount; i++) {
-        xkeys[i - 1] = util::move(xkeys[i]);
-        xchildren[i] = xchildren[i + 1];
+      if ((!kDuplicates) || (!search_in_next_node)) {
+        instrumentation_type::count(kLookupNodeVisits, visits);
+        return false;
       }
 
-      x->_M_header->count--;
-      y->_M_header->count = ycount;
-
-      // Delete 'z'.
-      z->_M_header->type = kLeaf;
-      z->_M_header->count = 0;
+      instrumentation_type::count(kLookupNodeVisits, visits + 1);
 
-      delete z;
-    }
+      it._M_node = it._M_node->next();
 
-    template<typename _Parameters>
-    typename btree<_Parameters>::node::operation_result
-    btree<_Parameters>::node::try_rebalance_or_merge_subtree(node* x,
-                                                             node*& root,
-                                                             uint16_t i)
-    {
-      operation_result opres;
-      switch ((opres = try_rebalance_or_merge(x, root, i))) {
-        case kMerged:
-        case kShrinked:
-          return opres;
-        default:
-          ;
+      if (node::less(_M_comp, key, it._M_node->keys()[0])) {
+        return false;
       }
 
-      x = x->_M_children[i];
-      i = 0;
-
-      while (x->_M_header->type == kInternal) {
-        try_rebalance_or_merge(x, root, i);
-        x = x->_M_children[0];
-      }
+      it._M_pos = 0;
 
-      return opres;
+      return true;
     }
 
     template<typename _Parameters>
-    typename btree<_Parameters>::node::operation_result
-    btree<_Parameters>::node::try_rebalance_or_merge(node* x,
-                                                     node*& root,
-                                                     uint16_t& i)
+    bool btree<_Parameters>::lower_bound(const key_type& key,
+                                         const_iterator& it) const
     {
-      // If the child has the minimum number of keys...
-      if (x->_M_children[i]->minkeys()) {
-        // If not the leftmost child...
-        if (i > 0) {
-          // If we can borrow a key from the left sibling...
-          if (!x->_M_children[i - 1]->minkeys()) {
-            rebalance_left_to_right(x, i);
+      // If the tree is empty...
+      if (empty()) {
+        return false;
+      }
 
-            return kRebalancedLeftToRight;
-          } else if ((i < x->_M_header->count) &&
-                     (!x->_M_children[i + 1]->minkeys())) {
-            // We can borrow a key from the right sibling.
-            rebalance_right_to_left(x, i);
+      bool search_in_next_node = false;
 
-            return kRebalancedRightToLeft;
-          } else {
-            i--;
-            merge(x, x->_M_children[i], x->_M_children[i + 1], i);
+      it._M_node = _M_root;
 
-            // If the node is empty...
-            if (x->_M_header->count == 0) {
-              // Set new root.
-              root = x->_M_children[0];
+      uint64_t visits = 1;
 
-              x->_M_header->type = kLeaf;
-              delete x;
+      while (it._M_node->_M_header.type == node::kInternal) {
+        if (it._M_node->lower_bound(key, _M_comp, it._M_pos)) {
+          if (!kDuplicates) {
+            it._M_pos++;
+          } else {
+            search_in_next_node = true;
+          }
+        }
 
-              return kShrinked;
-            }
+        it._M_node = it._M_node->children()[it._M_pos];
+        visits++;
+      }
 
-            return kMerged;
-          }
-        } else {
-          // If we can borrow a key from the right sibling...
-          if (!x->_M_children[i + 1]->minkeys()) {
-            rebalance_right_to_left(x, i);
+      instrumentation_type::count(kLookups);
 
-            return kRebalancedRightToLeft;
-          } else {
-            merge(x, x->_M_children[i], x->_M_children[i + 1], i);
+      if (it._M_node->lower_bound(key, _M_comp, it._M_pos)) {
+        instrumentation_type::count(kLookupNodeVisits, visits);
+        return true;
+      }
 
-            // If the node is empty...
-            if (x->_M_header->count == 0) {
-              // Set new root.
-              root = x->_M_children[0];
+      if ((!kDuplicates) || (!search_in_next_node)) {
+        instrumentation_type::count(kLookupNodeVisits, visits);
+        return false;
+      }
 
-              x->_M_header->type = kLeaf;
-              delete x;
+      instrumentation_type::count(kLookupNodeVisits, visits + 1);
 
-              return kShrinked;
-            }
+      it._M_node = it._M_node->next();
 
-            return kMerged;
-          }
-        }
+      if (node::less(_M_comp, key, it._M_node->keys()[0])) {
+        return false;
       }
 
-      return kNoop;
+      it._M_pos = 0;
+
+      return true;
     }
 
     template<typename _Parameters>
-    inline const typename btree<_Parameters>::iterator::key_type&
-    btree<_Parameters>::iterator::key() const
+    inline bool btree<_Parameters>::find(const iterator& hint,
+                                         const key_type& key,
+                                         iterator& it)
     {
-      return _M_node->_M_keys[_M_pos];
+      return lower_bound(hint, key, it);
     }
 
     template<typename _Parameters>
-    inline typename btree<_Parameters>::iterator::value_type&
-    btree<_Parameters>::iterator::value()
+    inline bool btree<_Parameters>::find(const const_iterator& hint,
+                                         const key_type& key,
+                                         const_iterator& it) const
     {
-      return _M_node->_M_values[_M_pos];
+      return lower_bound(hint, key, it);
     }
 
     template<typename _Parameters>
-    inline
-    bool btree<_Parameters>::iterator::operator==(const iterator& other) const
+    bool btree<_Parameters>::lower_bound(const iterator& hint,
+                                         const key_type& key,
+                                         iterator& it)
     {
-      return ((_M_node == other._M_node) && (_M_pos == other._M_pos));
+      // If the tree is empty...
+      if (empty()) {
+        return false;
+      }
+
+      node* x;
+      if ((x = lower_bound_leaf(hint._M_node, key)) == NULL) {
+        return lower_bound(key, it);
+      }
+
+      instrumentation_type::count(kLookups);
+      instrumentation_type::count(kLookupNodeVisits,
+                                  (x == hint._M_node) ? 1 : 2);
+
+      it._M_node = x;
+
+      return x->lower_bound(key, _M_comp, it._M_pos);
     }
 
     template<typename _Parameters>
-    inline
-    bool btree<_Parameters>::iterator::operator!=(const iterator& other) const
+    bool btree<_Parameters>::lower_bound(const const_iterator& hint,
+                                         const key_type& key,
+                                         const_iterator& it) const
     {
-      return ((_M_node != other._M_node) || (_M_pos != other._M_pos));
+      // If the tree is empty...
+      if (empty()) {
+        return false;
+      }
+
+      const node* x;
+      if ((x = lower_bound_leaf(hint._M_node, key)) == NULL) {
+        return lower_bound(key, it);
+      }
+
+      instrumentation_type::count(kLookups);
+      instrumentation_type::count(kLookupNodeVisits,
+                                  (x == hint._M_node) ? 1 : 2);
+
+      it._M_node = x;
+
+      return x->lower_bound(key, _M_comp, it._M_pos);
     }
 
     template<typename _Parameters>
-    inline const typename btree<_Parameters>::const_iterator::key_type&
-    btree<_Parameters>::const_iterator::key() const
+    bool btree<_Parameters>::upper_bound(const key_type& key, iterator& it)
     {
-      return _M_node->_M_keys[_M_pos];
+      // If the tree is empty...
+      if (empty()) {
+        return false;
+      }
+
+      it._M_node = _M_root;
+
+      uint64_t visits = 1;
+
+      while (it._M_node->_M_header.type == node::kInternal) {
+        it._M_node->upper_bound(key, _M_comp, it._M_pos);
+        it._M_node = it._M_node->children()[it._M_pos];
+        visits++;
+      }
+
+      instrumentation_type::count(kLookups);
+      instrumentation_type::count(kLookupNodeVisits, visits);
+
+      return it._M_node->upper_bound(key, _M_comp, it._M_pos);
     }
 
     template<typename _Parameters>
-    inline const typename btree<_Parameters>::const_iterator::value_type&
-    btree<_Parameters>::const_iterator::value() const
+    bool btree<_Parameters>::upper_bound(const key_type& key,
+                                         const_iterator& it) const
     {
-      return _M_node->_M_values[_M_pos];
+      // If the tree is empty...
+      if (empty()) {
+        return false;
+      }
+
+      it._M_node = _M_root;
+
+      uint64_t visits = 1;
+
+      while (it._M_node->_M_header.type == node::kInternal) {
+        it._M_node->upper_bound(key, _M_comp, it._M_pos);
+        it._M_node = it._M_node->children()[it._M_pos];
+        visits++;
+      }
+
+      instrumentation_type::count(kLookups);
+      instrumentation_type::count(kLookupNodeVisits, visits);
+
+      return it._M_node->upper_bound(key, _M_comp, it._M_pos);
     }
 
     template<typename _Parameters>
-    inline bool btree<_Parameters>::const_iterator::
-    operator==(const const_iterator& other) const
+    inline bool btree<_Parameters>::equal_range(const key_type& key,
+                                                iterator& begin,
+                                                iterator& end)
     {
-      return ((_M_node == other._M_node) && (_M_pos == other._M_pos));
+      if (!lower_bound(key, begin)) {
+        return false;
+      }
+
+      end = begin;
+      skip_equal(key, end._M_node, end._M_pos);
+
+      return true;
     }
 
     template<typename _Parameters>
-    inline bool btree<_Parameters>::const_iterator::
-    operator!=(const const_iterator& other) const
+    inline bool btree<_Parameters>::equal_range(const key_type& key,
+                                                const_iterator& begin,
+                                                const_iterator& end) const
     {
-      return ((_M_node != other._M_node) || (_M_pos != other._M_pos));
+      if (!lower_bound(key, begin)) {
+        return false;
+      }
+
+      end = begin;
+      skip_equal(key, end._M_node, end._M_pos);
+
+      return true;
     }
 
     template<typename _Parameters>
-    inline btree<_Parameters>::btree(const key_compare& comp)
-      : _M_comp(comp),
-        _M_root(NULL),
-        _M_nkeys(0)
+    size_t btree<_Parameters>::count(const key_type& key) const
     {
+      if (node::kCounted) {
+        return rank(key, true) - rank(key, false);
+      }
+
+      const_iterator it;
+      if (!lower_bound(key, it)) {
+        return 0;
+      }
+
+      // If duplicates are not allowed...
+      if (!kDuplicates) {
+        return 1;
+      }
+
+      return skip_equal(key, it._M_node, it._M_pos);
     }
 
     template<typename _Parameters>
-    inline btree<_Parameters>::~btree()
+    template<typename _Node>
+    size_t btree<_Parameters>::skip_equal(const key_type& key,
+                                          _Node*& x,
+                                          uint16_t& pos) const
     {
-      clear();
+      size_t n = 0;
+
+      for (;;) {
+        uint16_t end;
+        x->upper_bound(key, _M_comp, end);
+
+        n += end - pos;
+        pos = end;
+
+        // If the equal keys end in 'x'...
+        if (pos < x->_M_header.count) {
+          return n;
+        }
+
+        // If 'x' is the last leaf node...
+        if (!x->next()) {
+          return n;
+        }
+
+        x = x->next();
+        pos = 0;
+
+        // If the next leaf node doesn't start with an equal key...
+        if (node::less(_M_comp, key, x->keys()[0])) {
+          return n;
+        }
+      }
     }
 
     template<typename _Parameters>
-    inline void btree<_Parameters>::clear()
+    inline size_t btree<_Parameters>::count_range(const key_type& lo,
+                                                  const key_type& hi) const
     {
-      if (_M_root) {
-        delete _M_root;
-        _M_root = NULL;
+      static_assert(node::kCounted, "count_range() requires a counted tree");
+
+      // If the range is empty...
+      if (!node::less(_M_comp, lo, hi)) {
+        return 0;
       }
 
-      _M_nkeys = 0;
+      return rank(hi, false) - rank(lo, false);
     }
 
     template<typename _Parameters>
-    inline size_t btree<_Parameters>::count() const
+    inline typename btree<_Parameters>::summary_type
+    btree<_Parameters>::reduce(const key_type& lo, const key_type& hi) const
     {
-      return _M_nkeys;
+      static_assert(node::kAggregated, "reduce() requires an aggregate");
+
+      // If the tree or the range are empty...
+      if ((!_M_root) || (!node::less(_M_comp, lo, hi))) {
+        return aggregate_type::identity();
+      }
+
+      return node::reduce(_M_root, &lo, &hi, _M_comp);
     }
 
     template<typename _Parameters>
-    inline bool btree<_Parameters>::insert(const key_type& key,
-                                           const value_type& value)
+    inline size_t btree<_Parameters>::rank(const key_type& key) const
     {
-      // If the tree is empty...
-      if (!_M_root) {
-        if ((_M_root = node::create(node::kLeaf)) == NULL) {
-          return false;
-        }
-      } else if (_M_root->full()) {
-        // The root node is full.
-        node* s;
-        if ((s = node::create(node::kInternal)) == NULL) {
-          return false;
-        }
+      static_assert(node::kCounted, "rank() requires a counted tree");
 
-        s->_M_children[0] = _M_root;
+      return rank(key, false);
+    }
 
-        if (!s->split_child(0)) {
-          delete s;
-          return false;
-        }
+    template<typename _Parameters>
+    inline size_t btree<_Parameters>::rank(const iterator& it) const
+    {
+      static_assert(node::kCounted, "rank() requires a counted tree");
 
-        _M_root = s;
-      }
+      return rank(it._M_node, it._M_pos);
+    }
 
-      if (!node::insert_non_full(_M_root, key, value, _M_comp, _M_nkeys)) {
-        return false;
-      }
+    template<typename _Parameters>
+    inline size_t btree<_Parameters>::rank(const const_iterator& it) const
+    {
+      static_assert(node::kCounted, "rank() requires a counted tree");
 
-      return true;
+      return rank(it._M_node, it._M_pos);
     }
 
     template<typename _Parameters>
-    inline bool btree<_Parameters>::erase(const key_type& key)
+    inline bool btree<_Parameters>::select(size_t k, iterator& it)
     {
-      // If the tree is empty...
-      if (!_M_root) {
-        return false;
-      }
+      static_assert(node::kCounted, "select() requires a counted tree");
 
-      if (!node::erase(_M_root, key, _M_comp)) {
-        return false;
-      }
+      return select(k, it._M_node, it._M_pos);
+    }
 
-      if (--_M_nkeys == 0) {
-        delete _M_root;
-        _M_root = NULL;
-      }
+    template<typename _Parameters>
+    inline bool btree<_Parameters>::select(size_t k, const_iterator& it) const
+    {
+      static_assert(node::kCounted, "select() requires a counted tree");
 
-      return true;
+      return select(k, it._M_node, it._M_pos);
     }
 
     template<typename _Parameters>
-    inline bool btree<_Parameters>::get(const key_type& key,
-                                        value_type& value) const
+    inline bool btree<_Parameters>::advance(iterator& it, ptrdiff_t n)
     {
-      const_iterator it;
-      if (!lower_bound(key, it)) {
-        return false;
-      }
-
-      value = it._M_node->_M_values[it._M_pos];
+      return advance(it._M_node, it._M_pos, n);
+    }
 
-      return true;
+    template<typename _Parameters>
+    inline bool btree<_Parameters>::advance(const_iterator& it,
+                                            ptrdiff_t n) const
+    {
+      return advance(it._M_node, it._M_pos, n);
     }
 
     template<typename _Parameters>
-    inline bool btree<_Parameters>::begin(iterator& it)
+    size_t btree<_Parameters>::rank(const key_type& key, bool upper) const
     {
       // If the tree is empty...
-      if (_M_nkeys == 0) {
-        return false;
+      if (empty()) {
+        return 0;
       }
 
-      it._M_node = _M_root;
+      const node* leaf;
+      uint16_t pos;
+      return node::rank(_M_root, key, _M_comp, upper, leaf, pos);
+    }
 
-      while (it._M_node->_M_header->type == node::kInternal) {
-        it._M_node = it._M_node->_M_children[0];
-      }
+    template<typename _Parameters>
+    size_t btree<_Parameters>::rank(const node* x, uint16_t pos) const
+    {
+      const node* leaf;
+      uint16_t p;
+      size_t r = node::rank(_M_root, x->keys()[pos], _M_comp, false, leaf, p);
 
-      it._M_pos = 0;
+      // The descent ends on the first key equal to the key of 'x' (or just
+      // before it): skip the keys up to 'x'.
+      while (leaf != x) {
+        r += leaf->_M_header.count - p;
 
-      return true;
+        leaf = leaf->next();
+        p = 0;
+      }
+
+      return r + pos - p;
     }
 
     template<typename _Parameters>
-    inline bool btree<_Parameters>::begin(const_iterator& it) const
+    template<typename _Node>
+    bool btree<_Parameters>::select(size_t k, _Node*& x, uint16_t& pos) const
     {
-      // If the tree is empty...
-      if (_M_nkeys == 0) {
+      // If 'k' is out of range...
+      if (k >= count()) {
         return false;
       }
 
-      it._M_node = _M_root;
+      x = _M_root;
 
-      while (it._M_node->_M_header->type == node::kInternal) {
-        it._M_node = it._M_node->_M_children[0];
+      // While 'x' is an internal node...
+      while (x->_M_header.type == node::kInternal) {
+        const size_t* counts = x->counts();
+
+        uint16_t i = 0;
+        while (k >= counts[i]) {
+          k -= counts[i++];
+        }
+
+        x = x->children()[i];
       }
 
-      it._M_pos = 0;
+      pos = k;
 
       return true;
     }
 
     template<typename _Parameters>
-    inline bool btree<_Parameters>::end(iterator& it)
+    template<typename _Node>
+    bool btree<_Parameters>::advance(_Node*& x,
+                                     uint16_t& pos,
+                                     ptrdiff_t n) const
     {
-      // If the tree is empty...
-      if (_M_nkeys == 0) {
-        return false;
+      ptrdiff_t p = pos + n;
+
+      // If the new position is in the same leaf node...
+      if ((p >= 0) && (p < x->_M_header.count)) {
+        pos = p;
+        return true;
       }
 
-      it._M_node = _M_root;
+      if (node::kCounted) {
+        ptrdiff_t r = rank(x, pos) + n;
 
-      while (it._M_node->_M_header->type == node::kInternal) {
-        it._M_node = it._M_node->_M_children[it._M_node->_M_header->count];
+        return ((r >= 0) && (select(r, x, pos)));
       }
 
-      it._M_pos = it._M_node->_M_header->count - 1;
+      _Node* y = x;
 
-      return true;
-    }
+      while (p < 0) {
+        if ((y = y->prev()) == NULL) {
+          return false;
+        }
 
-    template<typename _Parameters>
-    inline bool btree<_Parameters>::end(const_iterator& it) const
-    {
-      // If the tree is empty...
-      if (_M_nkeys == 0) {
-        return false;
+        p += y->_M_header.count;
       }
 
-      it._M_node = _M_root;
+      while (p >= y->_M_header.count) {
+        p -= y->_M_header.count;
 
-      while (it._M_node->_M_header->type == node::kInternal) {
-        it._M_node = it._M_node->_M_children[it._M_node->_M_header->count];
+        if ((y = y->next()) == NULL) {
+          return false;
+        }
       }
 
-      it._M_pos = it._M_node->_M_header->count - 1;
+      x = y;
+      pos = p;
 
       return true;
     }
 
     template<typename _Parameters>
-    inline bool btree<_Parameters>::prev(iterator& it)
+    template<typename _InputIterator>
+    bool btree<_Parameters>::bulk_load(_InputIterator first,
+                                       _InputIterator last,
+                                       float fill_factor)
     {
-      if (it._M_pos > 0) {
-        it._M_pos--;
-      } else if (it._M_node->prev()) {
-        it._M_node = it._M_node->prev();
-        it._M_pos = it._M_node->_M_header->count - 1;
-      } else {
+      // If the tree is not empty...
+      if (!empty()) {
         return false;
       }
 
-      return true;
+      builder b(*this, fill_factor);
+      for (; first != last; ++first) {
+        if (!b.append(first->first, first->second)) {
+          return false;
+        }
+      }
+
+      return b.finish();
     }
 
     template<typename _Parameters>
-    inline bool btree<_Parameters>::prev(const_iterator& it) const
+    bool btree<_Parameters>::bulk_load(const key_type* keys,
+                                       const value_type* values,
+                                       size_t count,
+                                       float fill_factor)
     {
-      if (it._M_pos > 0) {
-        it._M_pos--;
-      } else if (it._M_node->prev()) {
-        it._M_node = it._M_node->prev();
-        it._M_pos = it._M_node->_M_header->count - 1;
-      } else {
+      // If the tree is not empty...
+      if (!empty()) {
         return false;
       }
 
-      return true;
+      builder b(*this, fill_factor);
+      for (size_t i = 0; i < count; i++) {
+        if (!b.append(keys[i], values[i])) {
+          return false;
+        }
+      }
+
+      return b.finish();
     }
 
     template<typename _Parameters>
-    inline bool btree<_Parameters>::next(iterator& it)
+    inline bool btree<_Parameters>::set_union(const btree& x,
+                                              const btree& y,
+                                              float fill_factor)
     {
-      if (it._M_pos < it._M_node->_M_header->count - 1) {
-        it._M_pos++;
-      } else if (it._M_node->next()) {
-        it._M_node = it._M_node->next();
-        it._M_pos = 0;
-      } else {
-        return false;
-      }
-
-      return true;
+      return combine(x, y, kUnion, fill_factor);
     }
 
     template<typename _Parameters>
-    inline bool btree<_Parameters>::next(const_iterator& it) const
+    inline bool btree<_Parameters>::set_intersection(const btree& x,
+                                                     const btree& y,
+                                                     float fill_factor)
     {
-      if (it._M_pos < it._M_node->_M_header->count - 1) {
-        it._M_pos++;
-      } else if (it._M_node->next()) {
-        it._M_node = it._M_node->next();
-        it._M_pos = 0;
-      } else {
-        return false;
-      }
+      return combine(x, y, kIntersection, fill_factor);
+    }
 
-      return true;
+    template<typename _Parameters>
+    inline bool btree<_Parameters>::set_difference(const btree& x,
+                                                   const btree& y,
+                                                   float fill_factor)
+    {
+      return combine(x, y, kDifference, fill_factor);
     }
 
     template<typename _Parameters>
-    inline bool btree<_Parameters>::find(const key_type& key, iterator& it)
+    inline bool btree<_Parameters>::set_symmetric_difference(
+                                      const btree& x,
+                                      const btree& y,
+                                      float fill_factor
+                                    )
     {
-      return lower_bound(key, it);
+      return combine(x, y, kSymmetricDifference, fill_factor);
     }
 
     template<typename _Parameters>
-    inline bool btree<_Parameters>::find(const key_type& key,
-                                         const_iterator& it) const
+    inline bool btree<_Parameters>::merge(const btree& x,
+                                          const btree& y,
+                                          float fill_factor)
     {
-      return lower_bound(key, it);
+      return combine(x, y, kMerge, fill_factor);
     }
 
     template<typename _Parameters>
-    bool btree<_Parameters>::lower_bound(const key_type& key, iterator& it)
+    bool btree<_Parameters>::combine(const btree& x,
+                                     const btree& y,
+                                     set_operation op,
+                                     float fill_factor)
     {
-      // If the tree is empty...
-      if (_M_nkeys == 0) {
+      // If the tree is not empty or it is an operand...
+      if ((!empty()) || (this == &x) || (this == &y)) {
         return false;
       }
 
-      bool search_in_next_node = false;
+      // Which keys are kept?
+      bool keep_x = (op != kIntersection);
+      bool keep_y = (op == kUnion) ||
+                    (op == kSymmetricDifference) ||
+                    (op == kMerge);
 
-      it._M_node = _M_root;
+      // Skip over the keys which are not kept if the tree is much larger.
+      bool skip_x = (!keep_x) && (x.count() / kSkipRatio > y.count());
+      bool skip_y = (!keep_y) && (y.count() / kSkipRatio > x.count());
 
-      while (it._M_node->_M_header->type == node::kInternal) {
-        if (it._M_node->lower_bound(key, _M_comp, it._M_pos)) {
-          if (!kDuplicates) {
-            it._M_pos++;
-          } else {
-            search_in_next_node = true;
+      builder b(*this, fill_factor);
+
+      const node* a = x._M_head;
+      const node* c = y._M_head;
+      uint16_t i = 0;
+      uint16_t j = 0;
+
+      while ((a) && (c)) {
+        int r = node::compare(_M_comp, a->keys()[i], c->keys()[j]);
+
+        if (r < 0) {
+          if (keep_x) {
+            if (!b.append(a->keys()[i], a->values()[i])) {
+              return false;
+            }
+          } else if (skip_x) {
+            x.skip(c->keys()[j], a, i);
+            continue;
+          }
+
+          step(a, i);
+        } else if (r > 0) {
+          if (keep_y) {
+            if (!b.append(c->keys()[j], c->values()[j])) {
+              return false;
+            }
+          } else if (skip_y) {
+            y.skip(a->keys()[i], c, j);
+            continue;
+          }
+
+          step(c, j);
+        } else {
+          // Equal keys.
+          if ((op != kDifference) && (op != kSymmetricDifference)) {
+            if (!b.append(a->keys()[i], a->values()[i])) {
+              return false;
+            }
+          }
+
+          step(a, i);
+
+          // The key of 'y' is kept for the next round if both are.
+          if ((op != kMerge) || (!kDuplicates)) {
+            step(c, j);
           }
         }
+      }
 
-        it._M_node = it._M_node->_M_children[it._M_pos];
+      // The rest of the keys of one of the trees.
+      for (; (a) && (keep_x); step(a, i)) {
+        if (!b.append(a->keys()[i], a->values()[i])) {
+          return false;
+        }
       }
 
-      if (it._M_node->lower_bound(key, _M_comp, it._M_pos)) {
-        return true;
+      for (; (c) && (keep_y); step(c, j)) {
+        if (!b.append(c->keys()[j], c->values()[j])) {
+          return false;
+        }
       }
 
-      if ((!kDuplicates) || (!search_in_next_node)) {
-        return false;
+      return b.finish();
+    }
+
+    template<typename _Parameters>
+    inline void btree<_Parameters>::step(const node*& x, uint16_t& pos)
+    {
+      if (++pos == x->_M_header.count) {
+        x = x->next();
+        pos = 0;
       }
+    }
 
-      it._M_node = it._M_node->next();
+    template<typename _Parameters>
+    void btree<_Parameters>::skip(const key_type& key,
+                                  const node*& x,
+                                  uint16_t& pos) const
+    {
+      // Look at 'x' and its neighbours first (finger search).
+      const node* y;
+      if ((y = lower_bound_leaf(x, key)) == NULL) {
+        y = _M_root;
+
+        while (y->_M_header.type == node::kInternal) {
+          uint16_t i;
+          if (kDuplicates) {
+            y->lower_bound(key, _M_comp, i);
+          } else {
+            y->upper_bound(key, _M_comp, i);
+          }
 
-      if (_M_comp(key, it._M_node->_M_keys[0]) != 0) {
-        return false;
+          y = y->children()[i];
+        }
       }
 
-      it._M_pos = 0;
+      y->lower_bound(key, _M_comp, pos);
+      x = y;
 
-      return true;
+      // If the lower bound is the first key of the next leaf node...
+      if (pos == x->_M_header.count) {
+        x = x->next();
+        pos = 0;
+      }
     }
 
     template<typename _Parameters>
-    bool btree<_Parameters>::lower_bound(const key_type& key,
-                                         const_iterator& it) const
+    btree<_Parameters>::builder::builder(btree& tree, float fill_factor)
+      : _M_tree(tree),
+        _M_fill_factor(fill_factor),
+        _M_first(NULL),
+        _M_last(NULL),
+        _M_nkeys(0),
+        _M_nleaves(0)
     {
-      // If the tree is empty...
-      if (_M_nkeys == 0) {
-        return false;
+      // Clamp the fill factor to [0.0, 1.0] (NaN is taken for 1.0), so it
+      // can be converted to a number of keys.
+      if (!(_M_fill_factor <= 1.0f)) {
+        _M_fill_factor = 1.0f;
+      } else if (_M_fill_factor < 0.0f) {
+        _M_fill_factor = 0.0f;
       }
 
-      bool search_in_next_node = false;
+      size_t nkeys = static_cast<size_t>(_M_fill_factor *
+                                         node::kLeafNodeMaxKeys);
 
-      it._M_node = _M_root;
+      if (nkeys < node::kLeafNodeMinKeys + 1) {
+        nkeys = node::kLeafNodeMinKeys + 1;
+      } else if (nkeys > node::kLeafNodeMaxKeys) {
+        nkeys = node::kLeafNodeMaxKeys;
+      }
 
-      while (it._M_node->_M_header->type == node::kInternal) {
-        if (it._M_node->lower_bound(key, _M_comp, it._M_pos)) {
-          if (!kDuplicates) {
-            it._M_pos++;
-          } else {
-            search_in_next_node = true;
-          }
-        }
+      _M_leaf_keys = nkeys;
+    }
 
-        it._M_node = it._M_node->_M_children[it._M_pos];
-      }
+    template<typename _Parameters>
+    inline btree<_Parameters>::builder::~builder()
+    {
+      free_leaves();
+    }
 
-      if (it._M_node->lower_bound(key, _M_comp, it._M_pos)) {
-        return true;
+    template<typename _Parameters>
+    bool btree<_Parameters>::builder::append(const key_type& key,
+                                             const value_type& value)
+    {
+      node* x = _M_last;
+
+      if (x) {
+        // Check that the keys are sorted.
+        int r = node::compare(_M_tree._M_comp,
+                              x->keys()[x->_M_header.count - 1],
+                              key);
+
+        if ((r > 0) || ((r == 0) && (!kDuplicates))) {
+          return false;
+        }
       }
 
-      if ((!kDuplicates) || (!search_in_next_node)) {
-        return false;
+      // If there are no leaf nodes yet or the last one is full...
+      if ((!x) || (x->_M_header.count == _M_leaf_keys)) {
+        if ((x = node::create(node::kLeaf, _M_tree._M_allocator)) == NULL) {
+          return false;
+        }
+
+        if (_M_last) {
+          _M_last->next(x);
+          x->prev(_M_last);
+        } else {
+          _M_first = x;
+        }
+
+        _M_last = x;
+        _M_nleaves++;
       }
 
-      it._M_node = it._M_node->next();
+      uint16_t i = x->_M_header.count;
 
-      if (_M_comp(key, it._M_node->_M_keys[0]) != 0) {
-        return false;
+      new (&x->keys()[i]) key_type(key);
+
+      // If the tree might have values...
+      if (node::kValueSize > 0) {
+        new (&x->values()[i]) value_type(value);
       }
 
-      it._M_pos = 0;
+      x->_M_header.count++;
+      _M_nkeys++;
 
       return true;
     }
 
     template<typename _Parameters>
-    bool btree<_Parameters>::upper_bound(const key_type& key, iterator& it)
+    bool btree<_Parameters>::builder::finish()
     {
-      // If the tree is empty...
-      if (_M_nkeys == 0) {
-        return false;
+      // If no keys have been appended...
+      if (!_M_first) {
+        return true;
       }
 
-      it._M_node = _M_root;
+      // If the last leaf node doesn't have the minimum number of keys...
+      node* z = _M_last;
+      if ((z != _M_first) && (z->_M_header.count < node::kLeafNodeMinKeys)) {
+        node* y = z->prev();
 
-      while (it._M_node->_M_header->type == node::kInternal) {
-        it._M_node->upper_bound(key, _M_comp, it._M_pos);
-        it._M_node = it._M_node->_M_children[it._M_pos];
+        uint16_t ycount = y->_M_header.count;
+        uint16_t zcount = z->_M_header.count;
+
+        key_type* ykeys = y->keys();
+        key_type* zkeys = z->keys();
+
+        // If both nodes fit in one...
+        if (ycount + zcount <= node::kLeafNodeMaxKeys) {
+          // Move keys (and values) from 'z' to 'y'.
+          node::relocate(&ykeys[ycount], zkeys, zcount);
+
+          if (node::kValueSize > 0) {
+            node::relocate(&y->values()[ycount], z->values(), zcount);
+          }
+
+          y->_M_header.count = ycount + zcount;
+          y->next(NULL);
+
+          z->_M_header.count = 0;
+
+          node::free_node(z, _M_tree._M_allocator);
+
+          _M_last = y;
+          _M_nleaves--;
+        } else {
+          // Share the keys between both nodes.
+          uint16_t n = ((ycount + zcount) / 2) - zcount;
+
+          // Shift keys (and values) of 'z' 'n' positions to the right.
+          node::relocate(&zkeys[n], zkeys, zcount);
+
+          if (node::kValueSize > 0) {
+            node::relocate(&z->values()[n], z->values(), zcount);
+          }
+
+          // Move the last 'n' keys (and values) of 'y' to 'z'.
+          node::relocate(zkeys, &ykeys[ycount - n], n);
+
+          if (node::kValueSize > 0) {
+            node::relocate(z->values(), &y->values()[ycount - n], n);
+          }
+
+          y->_M_header.count = ycount - n;
+          z->_M_header.count = zcount + n;
+        }
       }
 
-      return it._M_node->upper_bound(key, _M_comp, it._M_pos);
-    }
+      // Build the list of nodes of the lowest level.
+      size_t nchildren = _M_nleaves;
 
-    template<typename _Parameters>
-    bool btree<_Parameters>::upper_bound(const key_type& key,
-                                         const_iterator& it) const
-    {
-      // If the tree is empty...
-      if (_M_nkeys == 0) {
+      node** children;
+      if ((children = reinterpret_cast<node**>(
+                        malloc(nchildren * sizeof(node*))
+                      )) == NULL) {
         return false;
       }
 
-      it._M_node = _M_root;
+      // Smallest key of each subtree.
+      const key_type** minkeys;
+      if ((minkeys = reinterpret_cast<const key_type**>(
+                       malloc(nchildren * sizeof(const key_type*))
+                     )) == NULL) {
+        free(children);
+        return false;
+      }
 
-      while (it._M_node->_M_header->type == node::kInternal) {
-        it._M_node->upper_bound(key, _M_comp, it._M_pos);
-        it._M_node = it._M_node->_M_children[it._M_pos];
+      size_t i = 0;
+      for (node* x = _M_first; x; x = x->next()) {
+        children[i] = x;
+        minkeys[i] = &x->keys()[0];
+
+        i++;
       }
 
-      return it._M_node->upper_bound(key, _M_comp, it._M_pos);
+      // Number of children per internal node.
+      size_t target = static_cast<size_t>(_M_fill_factor *
+                                          (node::kInternalNodeMaxKeys + 1));
+
+      if (target < node::kInternalNodeMinKeys + 2) {
+        target = node::kInternalNodeMinKeys + 2;
+      } else if (target > node::kInternalNodeMaxKeys + 1) {
+        target = node::kInternalNodeMaxKeys + 1;
+      }
+
+      bool leaves = true;
+
+      // Build the internal levels bottom-up.
+      while (nchildren > 1) {
+        size_t nparents = parents(nchildren,
+                                  target,
+                                  node::kInternalNodeMinKeys + 1);
+
+        size_t pos = 0;
+        for (size_t p = 0; p < nparents; p++) {
+          node* x;
+          if ((x = node::create(node::kInternal,
+                                _M_tree._M_allocator)) == NULL) {
+            if (leaves) {
+              // Free the internal nodes of the current level (the leaves
+              // are freed by the destructor).
+              for (size_t j = 0; j < p; j++) {
+                node::free_node(children[j], _M_tree._M_allocator);
+              }
+            } else {
+              // Free the subtrees of the current level and the subtrees of
+              // the previous level which haven't been attached yet.
+              for (size_t j = 0; j < p; j++) {
+                node::destroy(children[j], _M_tree._M_allocator);
+              }
+
+              for (size_t j = pos; j < nchildren; j++) {
+                node::destroy(children[j], _M_tree._M_allocator);
+              }
+
+              // The leaves have been already freed.
+              _M_first = NULL;
+              _M_last = NULL;
+            }
+
+            free(minkeys);
+            free(children);
+
+            return false;
+          }
+
+          // Distribute the children evenly.
+          size_t n = (nchildren / nparents) +
+                     ((p < (nchildren % nparents)) ? 1 : 0);
+
+          node** xchildren = x->children();
+          key_type* xkeys = x->keys();
+
+          for (size_t j = 0; j < n; j++) {
+            xchildren[j] = children[pos + j];
+
+            if (node::kCounted) {
+              x->counts()[j] = node::subtree_count(children[pos + j]);
+            }
+
+            if (node::kAggregated) {
+              x->summaries()[j] = node::summarize(children[pos + j]);
+            }
+
+            if (j > 0) {
+              new (&xkeys[j - 1]) key_type(*minkeys[pos + j]);
+            }
+          }
+
+          x->_M_header.count = n - 1;
+
+          const key_type* minkey = minkeys[pos];
+
+          pos += n;
+
+          // The parents are stored in the same arrays as their children
+          // ('p' < 'pos').
+          children[p] = x;
+          minkeys[p] = minkey;
+        }
+
+        nchildren = nparents;
+        leaves = false;
+      }
+
+      _M_tree._M_root = children[0];
+      _M_tree._M_nkeys = _M_nkeys;
+      _M_tree._M_nkeys_valid = true;
+      _M_tree._M_head = _M_first;
+      _M_tree._M_tail = _M_last;
+
+      free(minkeys);
+      free(children);
+
+      // The tree owns the nodes now.
+      _M_first = NULL;
+      _M_last = NULL;
+      _M_nkeys = 0;
+      _M_nleaves = 0;
+
+      return true;
     }
 
     template<typename _Parameters>
-    inline bool btree<_Parameters>::equal_range(const key_type& key,
-                                                iterator& begin,
-                                                iterator& end)
+    size_t btree<_Parameters>::builder::parents(size_t nchildren,
+                                                size_t target,
+                                                size_t min_children)
     {
-      return ((lower_bound(key, begin)) && (upper_bound(key, end)));
+      size_t nparents = (nchildren + target - 1) / target;
+
+      // Make sure that every node gets the minimum number of children.
+      while ((nparents > 1) && (nchildren / nparents < min_children)) {
+        nparents--;
+      }
+
+      return nparents;
     }
 
     template<typename _Parameters>
-    inline bool btree<_Parameters>::equal_range(const key_type& key,
-                                                const_iterator& begin,
-                                                const_iterator& end) const
+    void btree<_Parameters>::builder::free_leaves()
     {
-      return ((lower_bound(key, begin)) && (upper_bound(key, end)));
+      node* x = _M_first;
+      while (x) {
+        node* next = x->next();
+        node::free_node(x, _M_tree._M_allocator);
+        x = next;
+      }
+
+      _M_first = NULL;
+      _M_last = NULL;
     }
   }
 }
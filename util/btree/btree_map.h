@@ -2,20 +2,36 @@
 #define UTIL_BTREE_MAP_H
 
 #include "util/btree/btree.h"
-#include "util/minus.h"
+#include "util/less.h"
 
 namespace util {
   namespace btree {
     template<typename _Key,
              typename _Tp,
-             typename _Compare = util::minus<_Key>,
-             size_t _NodeSize = 256>
+             typename _Compare = util::less<_Key>,
+             size_t _NodeSize = 256,
+             typename _Allocator = malloc_allocator,
+             typename _Instrumentation = no_instrumentation,
+             bool _Counted = false,
+             typename _Aggregate = no_aggregate>
     class btree_map : public btree<map_parameters<_Key,
                                                   _Tp,
                                                   _Compare,
-                                                  _NodeSize> > {
+                                                  _NodeSize,
+                                                  _Allocator,
+                                                  _Instrumentation,
+                                                  _Counted,
+                                                  _Aggregate> > {
       private:
-        typedef map_parameters<_Key, _Tp, _Compare, _NodeSize> parameters_type;
+        typedef map_parameters<_Key,
+                               _Tp,
+                               _Compare,
+                               _NodeSize,
+                               _Allocator,
+                               _Instrumentation,
+                               _Counted,
+                               _Aggregate> parameters_type;
+
         typedef btree<parameters_type> btree_type;
 
       public:
@@ -32,17 +48,30 @@ namespace util {
 
     template<typename _Key,
              typename _Tp,
-             typename _Compare = util::minus<_Key>,
-             size_t _NodeSize = 256>
-    class btree_multimap : public btree<multimap_parameters<_Key,
-                                                            _Tp,
-                                                            _Compare,
-                                                            _NodeSize> > {
+             typename _Compare = util::less<_Key>,
+             size_t _NodeSize = 256,
+             typename _Allocator = malloc_allocator,
+             typename _Instrumentation = no_instrumentation,
+             bool _Counted = false,
+             typename _Aggregate = no_aggregate>
+    class btree_multimap
+      : public btree<multimap_parameters<_Key,
+                                         _Tp,
+                                         _Compare,
+                                         _NodeSize,
+                                         _Allocator,
+                                         _Instrumentation,
+                                         _Counted,
+                                         _Aggregate> > {
       private:
         typedef multimap_parameters<_Key,
                                     _Tp,
                                     _Compare,
-                                    _NodeSize> parameters_type;
+                                    _NodeSize,
+                                    _Allocator,
+                                    _Instrumentation,
+                                    _Counted,
+                                    _Aggregate> parameters_type;
 
         typedef btree<parameters_type> btree_type;
 
@@ -58,19 +87,43 @@ namespace util {
         btree_multimap& operator=(const btree_multimap&) = delete;
     };
 
-    template<typename _Key, typename _Tp, typename _Compare, size_t _NodeSize>
+    template<typename _Key,
+             typename _Tp,
+             typename _Compare,
+             size_t _NodeSize,
+             typename _Allocator,
+             typename _Instrumentation,
+             bool _Counted,
+             typename _Aggregate>
     inline btree_map<_Key,
                      _Tp,
                      _Compare,
-                     _NodeSize>::btree_map(const key_compare& comp)
+                     _NodeSize,
+                     _Allocator,
+                     _Instrumentation,
+                     _Counted,
+                     _Aggregate>::btree_map(const key_compare& comp)
+      : btree_type(comp)
     {
     }
 
-    template<typename _Key, typename _Tp, typename _Compare, size_t _NodeSize>
+    template<typename _Key,
+             typename _Tp,
+             typename _Compare,
+             size_t _NodeSize,
+             typename _Allocator,
+             typename _Instrumentation,
+             bool _Counted,
+             typename _Aggregate>
     inline btree_multimap<_Key,
                           _Tp,
                           _Compare,
-                          _NodeSize>::btree_multimap(const key_compare& comp)
+                          _NodeSize,
+                          _Allocator,
+                          _Instrumentation,
+                          _Counted,
+                          _Aggregate>::btree_multimap(const key_compare& comp)
+      : btree_type(comp)
     {
     }
   }
@@ -2,16 +2,30 @@
 #define UTIL_BTREE_SET_H
 
 #include "util/btree/btree.h"
-#include "util/minus.h"
+#include "util/less.h"
 
 namespace util {
   namespace btree {
     template<typename _Key,
-             typename _Compare = util::minus<_Key>,
-             size_t _NodeSize = 256>
-    class btree_set : public btree<set_parameters<_Key, _Compare, _NodeSize> > {
+             typename _Compare = util::less<_Key>,
+             size_t _NodeSize = 256,
+             typename _Allocator = malloc_allocator,
+             typename _Instrumentation = no_instrumentation,
+             bool _Counted = false>
+    class btree_set : public btree<set_parameters<_Key,
+                                                  _Compare,
+                                                  _NodeSize,
+                                                  _Allocator,
+                                                  _Instrumentation,
+                                                  _Counted> > {
       private:
-        typedef set_parameters<_Key, _Compare, _NodeSize> parameters_type;
+        typedef set_parameters<_Key,
+                               _Compare,
+                               _NodeSize,
+                               _Allocator,
+                               _Instrumentation,
+                               _Counted> parameters_type;
+
         typedef btree<parameters_type> btree_type;
 
       public:
@@ -24,32 +38,177 @@ namespace util {
 
         // Insert key.
         bool insert(const key_type& key);
+        bool insert(key_type&& key);
+
+        // Insert key close to 'hint' (see btree::insert(hint, key, value)).
+        bool insert(typename btree_type::iterator& hint, const key_type& key);
+        bool insert(typename btree_type::iterator& hint, key_type&& key);
+
+        // Bulk load.
+        // The set must be empty and the keys sorted.
+        template<typename _InputIterator>
+        bool bulk_load(_InputIterator first,
+                       _InputIterator last,
+                       float fill_factor = 1.0f);
+
+        bool bulk_load(const key_type* keys,
+                       size_t count,
+                       float fill_factor = 1.0f);
+
+        // Erase the first (or the last) key.
+        using btree_type::pop_front;
+        using btree_type::pop_back;
 
       private:
         // Insert key.
         bool insert(const key_type& key, const value_type& value);
+        bool insert(key_type&& key, value_type&& value);
 
         // Get value.
         bool get(const key_type& key, value_type& value) const = delete;
 
+        // Erase the first (or the last) key, moving its value.
+        bool pop_front(key_type& key, value_type& value) = delete;
+        bool pop_back(key_type& key, value_type& value) = delete;
+
         // Disable copy constructor and assignment operator.
         btree_set(const btree_set&) = delete;
         btree_set& operator=(const btree_set&) = delete;
     };
 
-    template<typename _Key, typename _Compare, size_t _NodeSize>
+    template<typename _Key,
+             typename _Compare,
+             size_t _NodeSize,
+             typename _Allocator,
+             typename _Instrumentation,
+             bool _Counted>
     inline btree_set<_Key,
                      _Compare,
-                     _NodeSize>::btree_set(const key_compare& comp)
+                     _NodeSize,
+                     _Allocator,
+                     _Instrumentation,
+                     _Counted>::btree_set(const key_compare& comp)
+      : btree_type(comp)
+    {
+    }
+
+    template<typename _Key,
+             typename _Compare,
+             size_t _NodeSize,
+             typename _Allocator,
+             typename _Instrumentation,
+             bool _Counted>
+    inline bool btree_set<_Key,
+                          _Compare,
+                          _NodeSize,
+                          _Allocator,
+                          _Instrumentation,
+                          _Counted>::insert(const key_type& key)
+    {
+      return btree<parameters_type>::emplace(key);
+    }
+
+    template<typename _Key,
+             typename _Compare,
+             size_t _NodeSize,
+             typename _Allocator,
+             typename _Instrumentation,
+             bool _Counted>
+    inline bool btree_set<_Key,
+                          _Compare,
+                          _NodeSize,
+                          _Allocator,
+                          _Instrumentation,
+                          _Counted>::insert(key_type&& key)
     {
+      return btree<parameters_type>::emplace(util::move(key));
     }
 
-    template<typename _Key, typename _Compare, size_t _NodeSize>
+    template<typename _Key,
+             typename _Compare,
+             size_t _NodeSize,
+             typename _Allocator,
+             typename _Instrumentation,
+             bool _Counted>
+    inline bool btree_set<_Key,
+                          _Compare,
+                          _NodeSize,
+                          _Allocator,
+                          _Instrumentation,
+                          _Counted>::insert(
+                            typename btree_type::iterator& hint,
+                            const key_type& key
+                          )
+    {
+      return btree<parameters_type>::emplace_hint(hint, key);
+    }
+
+    template<typename _Key,
+             typename _Compare,
+             size_t _NodeSize,
+             typename _Allocator,
+             typename _Instrumentation,
+             bool _Counted>
+    inline bool btree_set<_Key,
+                          _Compare,
+                          _NodeSize,
+                          _Allocator,
+                          _Instrumentation,
+                          _Counted>::insert(
+                            typename btree_type::iterator& hint,
+                            key_type&& key
+                          )
+    {
+      return btree<parameters_type>::emplace_hint(hint, util::move(key));
+    }
+
+    template<typename _Key,
+             typename _Compare,
+             size_t _NodeSize,
+             typename _Allocator,
+             typename _Instrumentation,
+             bool _Counted>
+    template<typename _InputIterator>
+    bool btree_set<_Key,
+                   _Compare,
+                   _NodeSize,
+                   _Allocator,
+                   _Instrumentation,
+                   _Counted>::bulk_load(_InputIterator first,
+                                        _InputIterator last,
+                                        float fill_factor)
+    {
+      // If the set is not empty...
+      if (!this->empty()) {
+        return false;
+      }
+
+      typename btree_type::builder b(*this, fill_factor);
+      for (; first != last; ++first) {
+        if (!b.append(*first, *first)) {
+          return false;
+        }
+      }
+
+      return b.finish();
+    }
+
+    template<typename _Key,
+             typename _Compare,
+             size_t _NodeSize,
+             typename _Allocator,
+             typename _Instrumentation,
+             bool _Counted>
     inline bool btree_set<_Key,
                           _Compare,
-                          _NodeSize>::insert(const key_type& key)
+                          _NodeSize,
+                          _Allocator,
+                          _Instrumentation,
+                          _Counted>::bulk_load(const key_type* keys,
+                                               size_t count,
+                                               float fill_factor)
     {
-      return btree<parameters_type>::insert(key, key);
+      return btree<parameters_type>::bulk_load(keys, keys, count, fill_factor);
     }
   }
 }
@@ -0,0 +1,1823 @@
+#ifndef UTIL_BTREE_CONCURRENT_BTREE_H
+#define UTIL_BTREE_CONCURRENT_BTREE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <type_traits>
+#include "util/btree/btree.h"
+#include "util/btree/version_lock.h"
+#include "util/btree/epoch.h"
+
+namespace util {
+  namespace btree {
+    // Concurrent B+ tree (optimistic lock coupling).
+    //
+    // Each node has a version lock (see version_lock.h). Readers traverse
+    // the tree without writing to the nodes: they validate the version of
+    // each node after reading it and restart from the root if it has been
+    // modified in the meantime. Writers lock only the nodes they modify:
+    // the leaf for a plain insert or erase, or the parent, the child and
+    // (rebalance/merge) its sibling for a structure modification, which
+    // is performed preemptively on the way down as in btree.h.
+    //
+    // As the readers might read a node while it is being modified, the keys
+    // and the values must be trivially copyable. The nodes which are
+    // unlinked from the tree are reclaimed with epoch-based reclamation
+    // (see epoch.h).
+    //
+    // Snapshots (see take_snapshot()) share the nodes of the tree. A node is
+    // referenced by its parent and/or by the views of the snapshots whose
+    // root it is, and it is freed with its last reference. Each snapshot
+    // starts a new generation; the nodes of older generations might be
+    // shared, so the writers copy them (and only them: path copying) before
+    // modifying them.
+    //
+    // Duplicated keys are not supported.
+    template<typename _Parameters>
+    class concurrent_btree {
+      public:
+        typedef _Parameters parameters_type;
+        typedef typename _Parameters::key_type key_type;
+        typedef typename _Parameters::value_type value_type;
+        typedef typename _Parameters::key_compare key_compare;
+        typedef typename _Parameters::allocator_type allocator_type;
+        typedef typename _Parameters::instrumentation_type instrumentation_type;
+
+        static_assert(std::is_trivially_copyable<key_type>::value,
+                      "key type must be trivially copyable");
+
+        static_assert(std::is_trivially_copyable<value_type>::value,
+                      "value type must be trivially copyable");
+
+        static_assert(!_Parameters::kDuplicates,
+                      "duplicated keys are not supported");
+
+        static_assert(allocator_type::kThreadSafe,
+                      "allocator must be thread-safe");
+
+        // Constructor.
+        concurrent_btree(const key_compare& comp = key_compare());
+
+        // Destructor.
+        ~concurrent_btree();
+
+        // Clear.
+        // Must not be called concurrently with other operations.
+        void clear();
+
+        // Get number of keys.
+        size_t count() const;
+
+        // Get instrumentation counters (see instrumentation.h).
+        static void snapshot(counters& c);
+
+        // Reset instrumentation counters.
+        static void reset_counters();
+
+        // Insert key.
+        // If the key has been already inserted, the value is replaced.
+        bool insert(const key_type& key, const value_type& value);
+
+        // Erase key.
+        bool erase(const key_type& key);
+
+        // Get value.
+        bool get(const key_type& key, value_type& value) const;
+
+        // Contains key?
+        bool contains(const key_type& key) const;
+
+        class snapshot_view;
+
+        // Take snapshot.
+        // 'view' becomes a read-only view of the tree at this point in
+        // time, in O(1): the nodes are shared until the writers modify
+        // them.
+        void take_snapshot(snapshot_view& view);
+
+      private:
+        class node {
+          public:
+            enum type {
+              kInternal,
+              kLeaf
+            };
+
+            version_lock _M_lock;
+
+            const uint16_t _M_type;
+            std::atomic<uint16_t> _M_count;
+
+            // Number of references (parent and snapshot views).
+            std::atomic<uint32_t> _M_refs;
+
+            // Generation in which the node has been created.
+            const uint64_t _M_generation;
+
+            // Create node.
+            static node* create(type type,
+                                uint64_t generation,
+                                allocator_type& allocator);
+
+            // Copy node (but not its children).
+            // The node might be modified concurrently: the copy has to be
+            // validated.
+            static node* copy(const node* n,
+                              uint64_t generation,
+                              allocator_type& allocator);
+
+            // Free node (but not its children).
+            static void free_node(node* n, allocator_type& allocator);
+
+            // Get node size.
+            size_t size() const;
+
+            // Get number of keys.
+            uint16_t count() const;
+
+            // Get keys.
+            const key_type* keys() const;
+            key_type* keys();
+
+            // Get children (internal nodes).
+            node* const* children() const;
+            node** children();
+
+            // Get values (leaf nodes).
+            const value_type* values() const;
+            value_type* values();
+
+            // Node full?
+            bool full() const;
+
+            // Minimum number of keys?
+            bool minkeys() const;
+
+            // Find.
+            // The node might be modified concurrently: the result has to be
+            // validated.
+            bool find(const key_type& key,
+                      const key_compare& comp,
+                      uint16_t& pos) const;
+
+            // Get the position of the child which might contain the key.
+            uint16_t child(const key_type& key, const key_compare& comp) const;
+
+            // Insert key in non-full leaf node.
+            // Returns true if the key has been inserted; false if the value
+            // has been replaced.
+            bool insert(const key_type& key,
+                        const value_type& value,
+                        const key_compare& comp);
+
+            // Erase key from leaf node.
+            void erase(uint16_t pos);
+
+            // Split child.
+            bool split_child(uint16_t i,
+                             uint64_t generation,
+                             allocator_type& allocator);
+
+            // Rebalance left to right.
+            static void rebalance_left_to_right(node* x, uint16_t i);
+
+            // Rebalance right to left.
+            static void rebalance_right_to_left(node* x, uint16_t i);
+
+            // Merge the child 'i + 1' into the child 'i'.
+            static void merge(node* x, uint16_t i);
+
+          private:
+            typedef key_search<key_type, key_compare> search_type;
+
+            static const size_t kValueSize = parameters_type::kValueSize;
+
+            static constexpr size_t align(size_t offset, size_t alignment)
+            {
+              return (offset + alignment - 1) & ~(alignment - 1);
+            }
+
+            static const size_t kCacheLineSize = 64;
+
+            static const size_t kHeaderSize = sizeof(version_lock) +
+                                              (2 * sizeof(uint16_t)) +
+                                              sizeof(uint32_t) +
+                                              sizeof(uint64_t);
+
+            static const size_t kKeysOffset = align(kHeaderSize,
+                                                    alignof(key_type));
+
+            // Internal node:
+            // +--------+----------------+------------------------+
+            // | header | keys[kMaxKeys] | children[kMaxKeys + 1] |
+            // +--------+----------------+------------------------+
+            static const size_t kMaxInternalKeys =
+                                (parameters_type::kNodeSize -
+                                 kKeysOffset -
+                                 sizeof(node*)) /
+                                (sizeof(key_type) + sizeof(node*));
+
+            // Leaf node:
+            // +--------+----------------+------------------+
+            // | header | keys[kMaxKeys] | values[kMaxKeys] |
+            // +--------+----------------+------------------+
+            static const size_t kMaxLeafKeys =
+                                (parameters_type::kNodeSize - kKeysOffset) /
+                                (sizeof(key_type) + kValueSize);
+
+          public:
+            static const size_t kInternalNodeMaxKeys =
+                                (kMaxInternalKeys >= 3) ? kMaxInternalKeys : 3;
+
+            static const size_t kInternalNodeMinKeys =
+                                ((kInternalNodeMaxKeys + 1) / 2) - 1;
+
+            static const size_t kInternalNodeMedian = kInternalNodeMaxKeys >> 1;
+
+            static const size_t kLeafNodeMaxKeys =
+                                (kMaxLeafKeys >= 3) ? kMaxLeafKeys : 3;
+
+            static const size_t kLeafNodeMinKeys = kLeafNodeMaxKeys >> 1;
+
+            static const size_t kLeafNodeMedian = (kLeafNodeMaxKeys + 1) >> 1;
+
+          private:
+            static const size_t kChildrenOffset =
+                                align(kKeysOffset +
+                                      (kInternalNodeMaxKeys * sizeof(key_type)),
+                                      alignof(node*));
+
+            static const size_t kInternalNodeSize =
+                                align(kChildrenOffset +
+                                      ((kInternalNodeMaxKeys + 1) *
+                                       sizeof(node*)),
+                                      kCacheLineSize);
+
+            static const size_t kValuesOffset =
+                                (kValueSize > 0) ?
+                                  align(kKeysOffset +
+                                        (kLeafNodeMaxKeys * sizeof(key_type)),
+                                        alignof(value_type)) :
+                                  kKeysOffset;
+
+            static const size_t kLeafNodeSize =
+                                align(kValuesOffset +
+                                      (kLeafNodeMaxKeys *
+                                       ((kValueSize > 0) ? kValueSize :
+                                                           sizeof(key_type))),
+                                      kCacheLineSize);
+
+            // Constructor.
+            node(type type, uint64_t generation);
+
+            // Disable copy constructor and assignment operator.
+            node(const node&) = delete;
+            node& operator=(const node&) = delete;
+        };
+
+        typedef epoch_manager<allocator_type> epoch_type;
+
+        typedef key_search<key_type, key_compare> search_type;
+
+        enum status {
+          kSuccess,
+          kFailure,
+          kRestart
+        };
+
+        key_compare _M_comp;
+
+        // The root pointer is protected by its own version lock.
+        version_lock _M_root_lock;
+        std::atomic<node*> _M_root;
+
+        std::atomic<size_t> _M_nkeys;
+
+        // Current generation (incremented by each snapshot).
+        std::atomic<uint64_t> _M_generation;
+
+        allocator_type _M_allocator;
+
+        mutable epoch_type _M_epochs;
+
+        // Get the current generation.
+        // Must be called after locking the nodes to be modified: a node can
+        // be modified in place only if it has been created in the current
+        // generation (it is not shared with any snapshot).
+        uint64_t generation() const;
+
+        // Copy the node 'x' (read with version 'vx'), which might be shared
+        // with a snapshot, and replace it by the copy in its parent
+        // 'parent' (read with version 'vparent'; NULL: 'x' is the root, the
+        // root pointer was read with version 'vparent') at position 'i'.
+        status copy_on_write(node* parent,
+                             uint64_t vparent,
+                             uint16_t i,
+                             node* x,
+                             uint64_t vx);
+
+        // Release reference to node.
+        // The node (and the children it references) is retired with its
+        // last reference.
+        void release(node* n);
+
+        // Try to insert key.
+        status try_insert(const key_type& key, const value_type& value);
+
+        // Try to erase key.
+        status try_erase(const key_type& key);
+
+        // Try to get value.
+        status try_get(const key_type& key, value_type* value) const;
+
+        // Try to get value from the subtree rooted at 'x' (read with
+        // version 'vx').
+        status try_get(const node* x,
+                       uint64_t vx,
+                       const key_type& key,
+                       value_type* value) const;
+
+        // Try to get the keys (and values) of the leaf of the subtree
+        // rooted at 'root' which might contain the smallest key not less
+        // than '*from' (NULL: the first leaf) which are not less than
+        // '*from' and less than '*hi' (NULL: no upper limit).
+        // 'next' is set to the separator of the leaf and the following one
+        // and 'more' to false if there are no more keys to get.
+        status try_scan(const node* root,
+                        const key_type* from,
+                        const key_type* hi,
+                        key_type* keys,
+                        value_type* values,
+                        uint16_t& count,
+                        key_type& next,
+                        bool& more) const;
+
+        // Disable copy constructor and assignment operator.
+        concurrent_btree(const concurrent_btree&) = delete;
+        concurrent_btree& operator=(const concurrent_btree&) = delete;
+    };
+
+    // Snapshot view.
+    // The nodes of a snapshot are not modified anymore once the writers
+    // which were modifying them when it was taken have finished, so the
+    // readers of the view don't wait for the writers of the tree. Copying a
+    // view references the same snapshot; the snapshot is released with its
+    // last view, which must be released before the tree is destroyed.
+    template<typename _Parameters>
+    class concurrent_btree<_Parameters>::snapshot_view {
+      public:
+        // Constructor.
+        snapshot_view();
+        snapshot_view(const snapshot_view& other);
+
+        // Destructor.
+        ~snapshot_view();
+
+        // Assignment operator.
+        snapshot_view& operator=(const snapshot_view& other);
+
+        // Release snapshot.
+        void release();
+
+        // Get value.
+        bool get(const key_type& key, value_type& value) const;
+
+        // Contains key?
+        bool contains(const key_type& key) const;
+
+        // Scan.
+        // Invoke 'callback(key, value)' for each key, in order. Returns the
+        // number of keys.
+        template<typename _Callback>
+        size_t scan(_Callback& callback) const;
+
+        // Scan range of keys.
+        // Invoke 'callback(key, value)' for each key in ['lo', 'hi'), in
+        // order. Returns the number of keys.
+        template<typename _Callback>
+        size_t scan(const key_type& lo,
+                    const key_type& hi,
+                    _Callback& callback) const;
+
+      private:
+        friend class concurrent_btree;
+
+        concurrent_btree* _M_tree;
+        node* _M_root;
+
+        template<typename _Callback>
+        size_t scan(const key_type* lo,
+                    const key_type* hi,
+                    _Callback& callback) const;
+    };
+
+    template<typename _Parameters>
+    inline concurrent_btree<_Parameters>::snapshot_view::snapshot_view()
+      : _M_tree(NULL),
+        _M_root(NULL)
+    {
+    }
+
+    template<typename _Parameters>
+    inline concurrent_btree<_Parameters>::snapshot_view::snapshot_view(
+                                                     const snapshot_view& other
+                                                   )
+      : _M_tree(other._M_tree),
+        _M_root(other._M_root)
+    {
+      if (_M_root) {
+        _M_root->_M_refs.fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+
+    template<typename _Parameters>
+    inline concurrent_btree<_Parameters>::snapshot_view::~snapshot_view()
+    {
+      release();
+    }
+
+    template<typename _Parameters>
+    typename concurrent_btree<_Parameters>::snapshot_view&
+    concurrent_btree<_Parameters>::snapshot_view::operator=(
+                                                     const snapshot_view& other
+                                                   )
+    {
+      if (other._M_root) {
+        other._M_root->_M_refs.fetch_add(1, std::memory_order_relaxed);
+      }
+
+      release();
+
+      _M_tree = other._M_tree;
+      _M_root = other._M_root;
+
+      return *this;
+    }
+
+    template<typename _Parameters>
+    void concurrent_btree<_Parameters>::snapshot_view::release()
+    {
+      if (_M_root) {
+        typename epoch_type::guard guard(_M_tree->_M_epochs);
+
+        _M_tree->release(_M_root);
+        _M_root = NULL;
+      }
+
+      _M_tree = NULL;
+    }
+
+    template<typename _Parameters>
+    bool concurrent_btree<_Parameters>::snapshot_view::get(
+                                                     const key_type& key,
+                                                     value_type& value
+                                                   ) const
+    {
+      if (!_M_root) {
+        return false;
+      }
+
+      typename epoch_type::guard guard(_M_tree->_M_epochs);
+
+      instrumentation_type::count(kLookups);
+
+      status st;
+      uint64_t vroot;
+      do {
+        // The root of a snapshot cannot become obsolete.
+        _M_root->_M_lock.read_lock(vroot);
+      } while ((st = _M_tree->try_get(_M_root, vroot, key, &value)) ==
+               kRestart);
+
+      return (st == kSuccess);
+    }
+
+    template<typename _Parameters>
+    bool concurrent_btree<_Parameters>::snapshot_view::contains(
+                                                     const key_type& key
+                                                   ) const
+    {
+      if (!_M_root) {
+        return false;
+      }
+
+      typename epoch_type::guard guard(_M_tree->_M_epochs);
+
+      instrumentation_type::count(kLookups);
+
+      status st;
+      uint64_t vroot;
+      do {
+        _M_root->_M_lock.read_lock(vroot);
+      } while ((st = _M_tree->try_get(_M_root, vroot, key, NULL)) ==
+               kRestart);
+
+      return (st == kSuccess);
+    }
+
+    template<typename _Parameters>
+    template<typename _Callback>
+    inline size_t concurrent_btree<_Parameters>::snapshot_view::scan(
+                                                     _Callback& callback
+                                                   ) const
+    {
+      return scan(static_cast<const key_type*>(NULL),
+                  static_cast<const key_type*>(NULL),
+                  callback);
+    }
+
+    template<typename _Parameters>
+    template<typename _Callback>
+    inline size_t concurrent_btree<_Parameters>::snapshot_view::scan(
+                                                     const key_type& lo,
+                                                     const key_type& hi,
+                                                     _Callback& callback
+                                                   ) const
+    {
+      return scan(&lo, &hi, callback);
+    }
+
+    template<typename _Parameters>
+    template<typename _Callback>
+    size_t concurrent_btree<_Parameters>::snapshot_view::scan(
+                                                     const key_type* lo,
+                                                     const key_type* hi,
+                                                     _Callback& callback
+                                                   ) const
+    {
+      if (!_M_root) {
+        return 0;
+      }
+
+      // There are no links between the leaves: each leaf is reached from
+      // the root, with the separator of the previous leaf. The keys of the
+      // leaf are copied and validated before invoking the callback, so a
+      // restart doesn't invoke it twice for the same key.
+      key_type keys[node::kLeafNodeMaxKeys];
+      value_type values[node::kLeafNodeMaxKeys];
+
+      key_type from;
+      const key_type* pfrom = lo;
+
+      size_t n = 0;
+
+      bool more;
+      do {
+        uint16_t count;
+        key_type next;
+
+        {
+          typename epoch_type::guard guard(_M_tree->_M_epochs);
+
+          while (_M_tree->try_scan(_M_root,
+                                   pfrom,
+                                   hi,
+                                   keys,
+                                   values,
+                                   count,
+                                   next,
+                                   more) == kRestart);
+        }
+
+        for (uint16_t i = 0; i < count; i++) {
+          callback(keys[i], values[i]);
+        }
+
+        n += count;
+
+        from = next;
+        pfrom = &from;
+      } while (more);
+
+      return n;
+    }
+
+    template<typename _Parameters>
+    inline concurrent_btree<_Parameters>::node::node(type type,
+                                                     uint64_t generation)
+      : _M_type(type),
+        _M_count(0),
+        _M_refs(1),
+        _M_generation(generation)
+    {
+    }
+
+    template<typename _Parameters>
+    typename concurrent_btree<_Parameters>::node*
+    concurrent_btree<_Parameters>::node::create(type type,
+                                                uint64_t generation,
+                                                allocator_type& allocator)
+    {
+      void* data;
+      if ((data = allocator.allocate((type == kInternal) ?
+                                                       kInternalNodeSize :
+                                                       kLeafNodeSize)) ==
+          NULL) {
+        return NULL;
+      }
+
+      return new (data) node(type, generation);
+    }
+
+    template<typename _Parameters>
+    typename concurrent_btree<_Parameters>::node*
+    concurrent_btree<_Parameters>::node::copy(const node* n,
+                                              uint64_t generation,
+                                              allocator_type& allocator)
+    {
+      node* x;
+      if ((x = create(static_cast<type>(n->_M_type),
+                      generation,
+                      allocator)) == NULL) {
+        return NULL;
+      }
+
+      // Copy the whole node, so a count left out of range by a concurrent
+      // writer cannot make the copy overflow.
+      memcpy(x->keys(), n->keys(), n->size() - kKeysOffset);
+
+      x->_M_count.store(n->count(), std::memory_order_relaxed);
+
+      return x;
+    }
+
+    template<typename _Parameters>
+    inline void concurrent_btree<_Parameters>::node::free_node(
+                                                     node* n,
+                                                     allocator_type& allocator
+                                                   )
+    {
+      // Keys and values are trivially destructible.
+      size_t size = n->size();
+      n->~node();
+      allocator.deallocate(n, size);
+    }
+
+    template<typename _Parameters>
+    inline size_t concurrent_btree<_Parameters>::node::size() const
+    {
+      return (_M_type == kInternal) ? kInternalNodeSize : kLeafNodeSize;
+    }
+
+    template<typename _Parameters>
+    inline uint16_t concurrent_btree<_Parameters>::node::count() const
+    {
+      return _M_count.load(std::memory_order_relaxed);
+    }
+
+    template<typename _Parameters>
+    inline const typename concurrent_btree<_Parameters>::key_type*
+    concurrent_btree<_Parameters>::node::keys() const
+    {
+      return reinterpret_cast<const key_type*>(
+               reinterpret_cast<const uint8_t*>(this) + kKeysOffset
+             );
+    }
+
+    template<typename _Parameters>
+    inline typename concurrent_btree<_Parameters>::key_type*
+    concurrent_btree<_Parameters>::node::keys()
+    {
+      return reinterpret_cast<key_type*>(
+               reinterpret_cast<uint8_t*>(this) + kKeysOffset
+             );
+    }
+
+    template<typename _Parameters>
+    inline typename concurrent_btree<_Parameters>::node* const*
+    concurrent_btree<_Parameters>::node::children() const
+    {
+      return reinterpret_cast<node* const*>(
+               reinterpret_cast<const uint8_t*>(this) + kChildrenOffset
+             );
+    }
+
+    template<typename _Parameters>
+    inline typename concurrent_btree<_Parameters>::node**
+    concurrent_btree<_Parameters>::node::children()
+    {
+      return reinterpret_cast<node**>(
+               reinterpret_cast<uint8_t*>(this) + kChildrenOffset
+             );
+    }
+
+    template<typename _Parameters>
+    inline const typename concurrent_btree<_Parameters>::value_type*
+    concurrent_btree<_Parameters>::node::values() const
+    {
+      return reinterpret_cast<const value_type*>(
+               reinterpret_cast<const uint8_t*>(this) + kValuesOffset
+             );
+    }
+
+    template<typename _Parameters>
+    inline typename concurrent_btree<_Parameters>::value_type*
+    concurrent_btree<_Parameters>::node::values()
+    {
+      return reinterpret_cast<value_type*>(
+               reinterpret_cast<uint8_t*>(this) + kValuesOffset
+             );
+    }
+
+    template<typename _Parameters>
+    inline bool concurrent_btree<_Parameters>::node::full() const
+    {
+      return (_M_type == kInternal) ? (count() >= kInternalNodeMaxKeys) :
+                                      (count() >= kLeafNodeMaxKeys);
+    }
+
+    template<typename _Parameters>
+    inline bool concurrent_btree<_Parameters>::node::minkeys() const
+    {
+      return (_M_type == kInternal) ? (count() <= kInternalNodeMinKeys) :
+                                      (count() <= kLeafNodeMinKeys);
+    }
+
+    template<typename _Parameters>
+    bool concurrent_btree<_Parameters>::node::find(const key_type& key,
+                                                   const key_compare& comp,
+                                                   uint16_t& pos) const
+    {
+      // A concurrent writer might have left the count out of range.
+      uint16_t count = this->count();
+      if (count > kLeafNodeMaxKeys) {
+        count = kLeafNodeMaxKeys;
+      }
+
+      const key_type* keys = this->keys();
+
+      if (search_type::kVectorized) {
+        pos = search_type::count_less(keys, count, key);
+      } else {
+        // Lower bound.
+        uint16_t left = 0;
+        uint16_t right = count;
+
+        while (left != right) {
+          uint16_t mid = (left + right) / 2;
+
+          if (search_type::less(comp, keys[mid], key)) {
+            left = mid + 1;
+          } else {
+            right = mid;
+          }
+        }
+
+        pos = left;
+      }
+
+      return ((pos < count) && (!search_type::less(comp, key, keys[pos])));
+    }
+
+    template<typename _Parameters>
+    uint16_t concurrent_btree<_Parameters>::node::child(
+                                                     const key_type& key,
+                                                     const key_compare& comp
+                                                   ) const
+    {
+      // A concurrent writer might have left the count out of range.
+      uint16_t count = this->count();
+      if (count > kInternalNodeMaxKeys) {
+        count = kInternalNodeMaxKeys;
+      }
+
+      const key_type* keys = this->keys();
+
+      // The keys which are equal to a separator are in its right subtree:
+      // upper bound.
+      if (search_type::kVectorized) {
+        return search_type::count_less_equal(keys, count, key);
+      }
+
+      uint16_t left = 0;
+      uint16_t right = count;
+
+      while (left != right) {
+        uint16_t mid = (left + right) / 2;
+
+        if (!search_type::less(comp, key, keys[mid])) {
+          left = mid + 1;
+        } else {
+          right = mid;
+        }
+      }
+
+      return left;
+    }
+
+    template<typename _Parameters>
+    bool concurrent_btree<_Parameters>::node::insert(const key_type& key,
+                                                     const value_type& value,
+                                                     const key_compare& comp)
+    {
+      uint16_t pos;
+      if (find(key, comp, pos)) {
+        // If the tree might have values...
+        if (kValueSize > 0) {
+          // Update value.
+          values()[pos] = value;
+        }
+
+        return false;
+      }
+
+      uint16_t count = this->count();
+
+      // Move bigger keys (and values) one position to the right.
+      key_type* keys = this->keys();
+      memmove(&keys[pos + 1], &keys[pos], (count - pos) * sizeof(key_type));
+      keys[pos] = key;
+
+      // If the tree might have values...
+      if (kValueSize > 0) {
+        value_type* values = this->values();
+        memmove(&values[pos + 1],
+                &values[pos],
+                (count - pos) * sizeof(value_type));
+
+        values[pos] = value;
+      }
+
+      _M_count.store(count + 1, std::memory_order_relaxed);
+
+      return true;
+    }
+
+    template<typename _Parameters>
+    void concurrent_btree<_Parameters>::node::erase(uint16_t pos)
+    {
+      uint16_t count = this->count();
+
+      // Move bigger keys (and values) one position to the left.
+      key_type* keys = this->keys();
+      memmove(&keys[pos],
+              &keys[pos + 1],
+              (count - pos - 1) * sizeof(key_type));
+
+      // If the tree might have values...
+      if (kValueSize > 0) {
+        value_type* values = this->values();
+        memmove(&values[pos],
+                &values[pos + 1],
+                (count - pos - 1) * sizeof(value_type));
+      }
+
+      _M_count.store(count - 1, std::memory_order_relaxed);
+    }
+
+    template<typename _Parameters>
+    bool concurrent_btree<_Parameters>::node::split_child(
+                                                     uint16_t i,
+                                                     uint64_t generation,
+                                                     allocator_type& allocator
+                                                   )
+    {
+      // See btree<_Parameters>::node::split_child().
+      node* y = children()[i];
+
+      // Create child node.
+      node* z;
+      if ((z = create(static_cast<type>(y->_M_type),
+                      generation,
+                      allocator)) == NULL) {
+        return false;
+      }
+
+      instrumentation_type::count(kSplits);
+
+      key_type* ykeys = y->keys();
+      key_type* zkeys = z->keys();
+
+      uint16_t ycount;
+      uint16_t zcount;
+
+      // If 'y' is an internal node...
+      if (y->_M_type == kInternal) {
+        // The median key of 'y' moves up into its parent.
+        ycount = kInternalNodeMedian;
+        zcount = kInternalNodeMaxKeys - ycount - 1;
+
+        memcpy(zkeys, &ykeys[ycount + 1], zcount * sizeof(key_type));
+        memcpy(z->children(),
+               &y->children()[ycount + 1],
+               (zcount + 1) * sizeof(node*));
+      } else {
+        // The first key of 'z' is copied into its parent.
+        ycount = kLeafNodeMedian;
+        zcount = kLeafNodeMaxKeys - ycount;
+
+        memcpy(zkeys, &ykeys[ycount], zcount * sizeof(key_type));
+
+        // If the tree might have values...
+        if (kValueSize > 0) {
+          memcpy(z->values(),
+                 &y->values()[ycount],
+                 zcount * sizeof(value_type));
+        }
+      }
+
+      z->_M_count.store(zcount, std::memory_order_relaxed);
+
+      // Shift keys and pointers one position to the right.
+      uint16_t count = this->count();
+      memmove(&keys()[i + 1], &keys()[i], (count - i) * sizeof(key_type));
+      memmove(&children()[i + 2],
+              &children()[i + 1],
+              (count - i) * sizeof(node*));
+
+      keys()[i] = (y->_M_type == kInternal) ? ykeys[ycount] : zkeys[0];
+      children()[i + 1] = z;
+
+      y->_M_count.store(ycount, std::memory_order_relaxed);
+      _M_count.store(count + 1, std::memory_order_relaxed);
+
+      return true;
+    }
+
+    template<typename _Parameters>
+    void concurrent_btree<_Parameters>::node::rebalance_left_to_right(
+                                                                    node* x,
+                                                                    uint16_t i
+                                                                  )
+    {
+      // See btree<_Parameters>::node::rebalance_left_to_right().
+      instrumentation_type::count(kRebalancesLeftToRight);
+
+      node* y = x->children()[i - 1]; // Left sibling.
+      node* z = x->children()[i];
+
+      uint16_t ycount = y->count();
+      uint16_t zcount = z->count();
+
+      key_type* xkeys = x->keys();
+      key_type* ykeys = y->keys();
+      key_type* zkeys = z->keys();
+
+      memmove(&zkeys[1], zkeys, zcount * sizeof(key_type));
+
+      // If 'z' is an internal node...
+      if (z->_M_type == kInternal) {
+        node** zchildren = z->children();
+        memmove(&zchildren[1], zchildren, (zcount + 1) * sizeof(node*));
+
+        // Move key from 'x' down into 'z'.
+        zkeys[0] = xkeys[i - 1];
+
+        // Move rightmost key from left sibling up into 'x'.
+        xkeys[i - 1] = ykeys[ycount - 1];
+
+        // Move rightmost child pointer from left sibling into 'z'.
+        zchildren[0] = y->children()[ycount];
+      } else {
+        // Move rightmost key (and value) from left sibling into 'z'.
+        zkeys[0] = ykeys[ycount - 1];
+
+        if (kValueSize > 0) {
+          value_type* zvalues = z->values();
+          memmove(&zvalues[1], zvalues, zcount * sizeof(value_type));
+
+          zvalues[0] = y->values()[ycount - 1];
+        }
+
+        // Copy new leftmost key from right sibling up into 'x'.
+        xkeys[i - 1] = zkeys[0];
+      }
+
+      y->_M_count.store(ycount - 1, std::memory_order_relaxed);
+      z->_M_count.store(zcount + 1, std::memory_order_relaxed);
+    }
+
+    template<typename _Parameters>
+    void concurrent_btree<_Parameters>::node::rebalance_right_to_left(
+                                                                    node* x,
+                                                                    uint16_t i
+                                                                  )
+    {
+      // See btree<_Parameters>::node::rebalance_right_to_left().
+      instrumentation_type::count(kRebalancesRightToLeft);
+
+      node* y = x->children()[i];
+      node* z = x->children()[i + 1]; // Right sibling.
+
+      uint16_t ycount = y->count();
+      uint16_t zcount = z->count();
+
+      key_type* xkeys = x->keys();
+      key_type* ykeys = y->keys();
+      key_type* zkeys = z->keys();
+
+      // If 'y' is an internal node...
+      if (y->_M_type == kInternal) {
+        // Move key from 'x' down into 'y'.
+        ykeys[ycount] = xkeys[i];
+
+        // Move leftmost key from right sibling up into 'x'.
+        xkeys[i] = zkeys[0];
+
+        // Move leftmost child pointer from right sibling into 'y'.
+        node** zchildren = z->children();
+        y->children()[ycount + 1] = zchildren[0];
+
+        memmove(zkeys, &zkeys[1], (zcount - 1) * sizeof(key_type));
+        memmove(zchildren, &zchildren[1], zcount * sizeof(node*));
+      } else {
+        // Move leftmost key (and value) from right sibling into 'y'.
+        ykeys[ycount] = zkeys[0];
+        memmove(zkeys, &zkeys[1], (zcount - 1) * sizeof(key_type));
+
+        if (kValueSize > 0) {
+          value_type* zvalues = z->values();
+          y->values()[ycount] = zvalues[0];
+          memmove(zvalues, &zvalues[1], (zcount - 1) * sizeof(value_type));
+        }
+
+        // Copy new leftmost key from right sibling up into 'x'.
+        xkeys[i] = zkeys[0];
+      }
+
+      y->_M_count.store(ycount + 1, std::memory_order_relaxed);
+      z->_M_count.store(zcount - 1, std::memory_order_relaxed);
+    }
+
+    template<typename _Parameters>
+    void concurrent_btree<_Parameters>::node::merge(node* x, uint16_t i)
+    {
+      // See btree<_Parameters>::node::merge().
+      instrumentation_type::count(kMerges);
+
+      node* y = x->children()[i];
+      node* z = x->children()[i + 1];
+
+      uint16_t xcount = x->count();
+      uint16_t ycount = y->count();
+      uint16_t zcount = z->count();
+
+      key_type* xkeys = x->keys();
+      key_type* ykeys = y->keys();
+
+      // If 'y' is an internal node...
+      if (y->_M_type == kInternal) {
+        // Move key from 'x' down into 'y'.
+        ykeys[ycount++] = xkeys[i];
+
+        // Move keys and pointers from right sibling into 'y'.
+        memcpy(&ykeys[ycount], z->keys(), zcount * sizeof(key_type));
+        memcpy(&y->children()[ycount],
+               z->children(),
+               (zcount + 1) * sizeof(node*));
+      } else {
+        // Move right sibling's keys (and values) to 'y'.
+        memcpy(&ykeys[ycount], z->keys(), zcount * sizeof(key_type));
+
+        if (kValueSize > 0) {
+          memcpy(&y->values()[ycount],
+                 z->values(),
+                 zcount * sizeof(value_type));
+        }
+      }
+
+      // Shift keys and pointers in 'x' one position to the left.
+      node** xchildren = x->children();
+      memmove(&xkeys[i], &xkeys[i + 1], (xcount - i - 1) * sizeof(key_type));
+      memmove(&xchildren[i + 1],
+              &xchildren[i + 2],
+              (xcount - i - 1) * sizeof(node*));
+
+      x->_M_count.store(xcount - 1, std::memory_order_relaxed);
+      y->_M_count.store(ycount + zcount, std::memory_order_relaxed);
+    }
+
+    template<typename _Parameters>
+    inline concurrent_btree<_Parameters>::concurrent_btree(
+                                                     const key_compare& comp
+                                                   )
+      : _M_comp(comp),
+        _M_root(NULL),
+        _M_nkeys(0),
+        _M_generation(0),
+        _M_epochs(_M_allocator)
+    {
+    }
+
+    template<typename _Parameters>
+    inline concurrent_btree<_Parameters>::~concurrent_btree()
+    {
+      clear();
+    }
+
+    template<typename _Parameters>
+    void concurrent_btree<_Parameters>::clear()
+    {
+      node* root = _M_root.load(std::memory_order_relaxed);
+      if (root) {
+        {
+          // The nodes shared with snapshots are kept.
+          typename epoch_type::guard guard(_M_epochs);
+          release(root);
+        }
+
+        _M_root.store(NULL, std::memory_order_relaxed);
+      }
+
+      _M_epochs.reclaim_all();
+
+      _M_nkeys.store(0, std::memory_order_relaxed);
+    }
+
+    template<typename _Parameters>
+    inline size_t concurrent_btree<_Parameters>::count() const
+    {
+      return _M_nkeys.load(std::memory_order_relaxed);
+    }
+
+    template<typename _Parameters>
+    inline void concurrent_btree<_Parameters>::snapshot(counters& c)
+    {
+      instrumentation_type::snapshot(c);
+    }
+
+    template<typename _Parameters>
+    inline void concurrent_btree<_Parameters>::reset_counters()
+    {
+      instrumentation_type::reset();
+    }
+
+    template<typename _Parameters>
+    bool concurrent_btree<_Parameters>::insert(const key_type& key,
+                                               const value_type& value)
+    {
+      typename epoch_type::guard guard(_M_epochs);
+
+      status st;
+      while ((st = try_insert(key, value)) == kRestart);
+
+      return (st == kSuccess);
+    }
+
+    template<typename _Parameters>
+    bool concurrent_btree<_Parameters>::erase(const key_type& key)
+    {
+      typename epoch_type::guard guard(_M_epochs);
+
+      status st;
+      while ((st = try_erase(key)) == kRestart);
+
+      return (st == kSuccess);
+    }
+
+    template<typename _Parameters>
+    bool concurrent_btree<_Parameters>::get(const key_type& key,
+                                            value_type& value) const
+    {
+      typename epoch_type::guard guard(_M_epochs);
+
+      instrumentation_type::count(kLookups);
+
+      status st;
+      while ((st = try_get(key, &value)) == kRestart);
+
+      return (st == kSuccess);
+    }
+
+    template<typename _Parameters>
+    bool concurrent_btree<_Parameters>::contains(const key_type& key) const
+    {
+      typename epoch_type::guard guard(_M_epochs);
+
+      instrumentation_type::count(kLookups);
+
+      status st;
+      while ((st = try_get(key, NULL)) == kRestart);
+
+      return (st == kSuccess);
+    }
+
+    template<typename _Parameters>
+    void concurrent_btree<_Parameters>::take_snapshot(snapshot_view& view)
+    {
+      view.release();
+
+      // Lock the root pointer: it cannot be replaced while the generation
+      // is incremented.
+      uint64_t vroot;
+      do {
+        _M_root_lock.read_lock(vroot);
+      } while (!_M_root_lock.upgrade(vroot));
+
+      node* root = _M_root.load(std::memory_order_relaxed);
+      if (root) {
+        root->_M_refs.fetch_add(1, std::memory_order_relaxed);
+      }
+
+      // From now on, the nodes of the tree are shared with the snapshot.
+      // The writers which have checked the generation before are still
+      // modifying them: the readers of the view validate the nodes as the
+      // readers of the tree.
+      _M_generation.fetch_add(1, std::memory_order_seq_cst);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+
+      _M_root_lock.unlock();
+
+      view._M_tree = this;
+      view._M_root = root;
+    }
+
+    template<typename _Parameters>
+    inline uint64_t concurrent_btree<_Parameters>::generation() const
+    {
+      // The load must not be reordered before the lock of the nodes.
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+
+      return _M_generation.load(std::memory_order_seq_cst);
+    }
+
+    template<typename _Parameters>
+    typename concurrent_btree<_Parameters>::status
+    concurrent_btree<_Parameters>::copy_on_write(node* parent,
+                                                 uint64_t vparent,
+                                                 uint16_t i,
+                                                 node* x,
+                                                 uint64_t vx)
+    {
+      version_lock& lock = (parent) ? parent->_M_lock : _M_root_lock;
+      if (!lock.upgrade(vparent)) {
+        return kRestart;
+      }
+
+      uint64_t generation = this->generation();
+
+      // If the parent might be shared as well (a snapshot has been taken
+      // in the meantime), it has to be copied first.
+      if ((parent) && (parent->_M_generation != generation)) {
+        lock.unlock();
+        return kRestart;
+      }
+
+      node* y;
+      if ((y = node::copy(x, generation, _M_allocator)) == NULL) {
+        lock.unlock();
+        return kFailure;
+      }
+
+      // If 'x' has been modified while being copied...
+      if (!x->_M_lock.validate(vx)) {
+        node::free_node(y, _M_allocator);
+        lock.unlock();
+        return kRestart;
+      }
+
+      // The children are referenced by both nodes.
+      if (y->_M_type == node::kInternal) {
+        node** children = y->children();
+        uint16_t count = y->count();
+        for (uint16_t j = 0; j <= count; j++) {
+          children[j]->_M_refs.fetch_add(1, std::memory_order_relaxed);
+        }
+      }
+
+      if (parent) {
+        parent->children()[i] = y;
+      } else {
+        _M_root.store(y, std::memory_order_release);
+      }
+
+      lock.unlock();
+
+      // The snapshots keep referencing 'x'.
+      release(x);
+
+      return kRestart;
+    }
+
+    template<typename _Parameters>
+    void concurrent_btree<_Parameters>::release(node* n)
+    {
+      // If this was the last reference...
+      if (n->_M_refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        // Internal node?
+        if (n->_M_type == node::kInternal) {
+          node** children = n->children();
+          uint16_t count = n->count();
+          for (uint16_t i = 0; i <= count; i++) {
+            release(children[i]);
+          }
+        }
+
+        // The readers might still be reading it.
+        _M_epochs.retire(n, n->size());
+      }
+    }
+
+    template<typename _Parameters>
+    typename concurrent_btree<_Parameters>::status
+    concurrent_btree<_Parameters>::try_insert(const key_type& key,
+                                              const value_type& value)
+    {
+      uint64_t vroot;
+      if (!_M_root_lock.read_lock(vroot)) {
+        return kRestart;
+      }
+
+      node* x = _M_root.load(std::memory_order_acquire);
+
+      // If the tree is empty...
+      if (!x) {
+        if (!_M_root_lock.upgrade(vroot)) {
+          return kRestart;
+        }
+
+        if ((x = node::create(node::kLeaf,
+                              generation(),
+                              _M_allocator)) == NULL) {
+          _M_root_lock.unlock();
+          return kFailure;
+        }
+
+        _M_root.store(x, std::memory_order_release);
+        _M_root_lock.unlock();
+
+        return kRestart;
+      }
+
+      uint64_t vx;
+      if ((!x->_M_lock.read_lock(vx)) || (!_M_root_lock.validate(vroot))) {
+        return kRestart;
+      }
+
+      // If the root might be shared with a snapshot...
+      if (x->_M_generation !=
+          _M_generation.load(std::memory_order_relaxed)) {
+        return copy_on_write(NULL, vroot, 0, x, vx);
+      }
+
+      node* parent = NULL;
+      uint64_t vparent = 0;
+      uint16_t i = 0;
+
+      for (;;) {
+        // If the node is full...
+        if (x->full()) {
+          // Lock the parent (or the root pointer) and the node. The parent
+          // is not full: it would have been split before.
+          if (parent) {
+            if (!parent->_M_lock.upgrade(vparent)) {
+              return kRestart;
+            }
+          } else if (!_M_root_lock.upgrade(vroot)) {
+            return kRestart;
+          }
+
+          version_lock& lock = (parent) ? parent->_M_lock : _M_root_lock;
+
+          if (!x->_M_lock.upgrade(vx)) {
+            lock.unlock();
+            return kRestart;
+          }
+
+          uint64_t generation = this->generation();
+
+          status st = kRestart;
+
+          // If a snapshot has been taken in the meantime, the path is
+          // copied on the next attempt.
+          if ((x->_M_generation != generation) ||
+              ((parent) && (parent->_M_generation != generation))) {
+            st = kRestart;
+          } else if (parent) {
+            if (!parent->split_child(i, generation, _M_allocator)) {
+              st = kFailure;
+            }
+          } else {
+            // Split the root node.
+            node* s;
+            if ((s = node::create(node::kInternal,
+                                  generation,
+                                  _M_allocator)) == NULL) {
+              st = kFailure;
+            } else {
+              s->children()[0] = x;
+
+              if (!s->split_child(0, generation, _M_allocator)) {
+                node::free_node(s, _M_allocator);
+                st = kFailure;
+              } else {
+                _M_root.store(s, std::memory_order_release);
+              }
+            }
+          }
+
+          x->_M_lock.unlock();
+          lock.unlock();
+
+          return st;
+        }
+
+        // Leaf node?
+        if (x->_M_type == node::kLeaf) {
+          break;
+        }
+
+        i = x->child(key, _M_comp);
+
+        node* child = x->children()[i];
+        if (!x->_M_lock.validate(vx)) {
+          return kRestart;
+        }
+
+        // Lock coupling: validate the parent after reading the version of
+        // the child (the child might have been split in the meantime).
+        uint64_t vchild;
+        if ((!child->_M_lock.read_lock(vchild)) ||
+            (!x->_M_lock.validate(vx))) {
+          return kRestart;
+        }
+
+        // If the child might be shared with a snapshot...
+        if (child->_M_generation !=
+            _M_generation.load(std::memory_order_relaxed)) {
+          return copy_on_write(x, vx, i, child, vchild);
+        }
+
+        parent = x;
+        vparent = vx;
+
+        x = child;
+        vx = vchild;
+      }
+
+      // Leaf node.
+      if (!x->_M_lock.upgrade(vx)) {
+        return kRestart;
+      }
+
+      if (x->_M_generation != generation()) {
+        x->_M_lock.unlock();
+        return kRestart;
+      }
+
+      if (x->insert(key, value, _M_comp)) {
+        _M_nkeys.fetch_add(1, std::memory_order_relaxed);
+      }
+
+      x->_M_lock.unlock();
+
+      return kSuccess;
+    }
+
+    template<typename _Parameters>
+    typename concurrent_btree<_Parameters>::status
+    concurrent_btree<_Parameters>::try_erase(const key_type& key)
+    {
+      uint64_t vroot;
+      if (!_M_root_lock.read_lock(vroot)) {
+        return kRestart;
+      }
+
+      node* x = _M_root.load(std::memory_order_acquire);
+
+      // If the tree is empty...
+      if (!x) {
+        return (_M_root_lock.validate(vroot)) ? kFailure : kRestart;
+      }
+
+      uint64_t vx;
+      if ((!x->_M_lock.read_lock(vx)) || (!_M_root_lock.validate(vroot))) {
+        return kRestart;
+      }
+
+      // If the root might be shared with a snapshot...
+      if (x->_M_generation !=
+          _M_generation.load(std::memory_order_relaxed)) {
+        return copy_on_write(NULL, vroot, 0, x, vx);
+      }
+
+      bool root = true;
+
+      // While 'x' is an internal node...
+      while (x->_M_type == node::kInternal) {
+        uint16_t i = x->child(key, _M_comp);
+
+        node* child = x->children()[i];
+        if (!x->_M_lock.validate(vx)) {
+          return kRestart;
+        }
+
+        uint64_t vchild;
+        if ((!child->_M_lock.read_lock(vchild)) ||
+            (!x->_M_lock.validate(vx))) {
+          return kRestart;
+        }
+
+        // If the child might be shared with a snapshot...
+        if (child->_M_generation !=
+            _M_generation.load(std::memory_order_relaxed)) {
+          return copy_on_write(x, vx, i, child, vchild);
+        }
+
+        // If the child has the minimum number of keys...
+        if (child->minkeys()) {
+          // Borrow a key from a sibling or merge with it.
+          uint16_t j = (i > 0) ? i - 1 : i + 1;
+
+          node* sibling = x->children()[j];
+          if (!x->_M_lock.validate(vx)) {
+            return kRestart;
+          }
+
+          uint64_t vsibling;
+          if ((!sibling->_M_lock.read_lock(vsibling)) ||
+              (!x->_M_lock.validate(vx))) {
+            return kRestart;
+          }
+
+          if (sibling->_M_generation !=
+              _M_generation.load(std::memory_order_relaxed)) {
+            return copy_on_write(x, vx, j, sibling, vsibling);
+          }
+
+          bool merge = sibling->minkeys();
+
+          // If the root node might become empty, lock the root pointer.
+          bool shrink = ((root) && (merge) && (x->count() == 1));
+          if ((shrink) && (!_M_root_lock.upgrade(vroot))) {
+            return kRestart;
+          }
+
+          if (!x->_M_lock.upgrade(vx)) {
+            if (shrink) {
+              _M_root_lock.unlock();
+            }
+
+            return kRestart;
+          }
+
+          if (!child->_M_lock.upgrade(vchild)) {
+            x->_M_lock.unlock();
+
+            if (shrink) {
+              _M_root_lock.unlock();
+            }
+
+            return kRestart;
+          }
+
+          if (!sibling->_M_lock.upgrade(vsibling)) {
+            child->_M_lock.unlock();
+            x->_M_lock.unlock();
+
+            if (shrink) {
+              _M_root_lock.unlock();
+            }
+
+            return kRestart;
+          }
+
+          uint64_t generation = this->generation();
+
+          // If a snapshot has been taken in the meantime (the path is
+          // copied on the next attempt)...
+          if ((x->_M_generation != generation) ||
+              (child->_M_generation != generation) ||
+              (sibling->_M_generation != generation)) {
+            sibling->_M_lock.unlock();
+            child->_M_lock.unlock();
+            x->_M_lock.unlock();
+
+            if (shrink) {
+              _M_root_lock.unlock();
+            }
+
+            return kRestart;
+          }
+
+          if (!merge) {
+            if (j < i) {
+              node::rebalance_left_to_right(x, i);
+            } else {
+              node::rebalance_right_to_left(x, i);
+            }
+
+            sibling->_M_lock.unlock();
+            child->_M_lock.unlock();
+            x->_M_lock.unlock();
+          } else {
+            uint16_t k = (j < i) ? j : i;
+
+            node* y = x->children()[k];
+            node* z = x->children()[k + 1];
+
+            node::merge(x, k);
+
+            // 'z' is not reachable anymore.
+            z->_M_lock.unlock_obsolete();
+            _M_epochs.retire(z, z->size());
+
+            y->_M_lock.unlock();
+
+            if (shrink) {
+              // Set new root.
+              _M_root.store(y, std::memory_order_release);
+
+              x->_M_lock.unlock_obsolete();
+              _M_epochs.retire(x, x->size());
+
+              _M_root_lock.unlock();
+            } else {
+              x->_M_lock.unlock();
+            }
+          }
+
+          return kRestart;
+        }
+
+        x = child;
+        vx = vchild;
+
+        root = false;
+      }
+
+      // Leaf node.
+      uint16_t pos;
+      if (!x->find(key, _M_comp, pos)) {
+        return (x->_M_lock.validate(vx)) ? kFailure : kRestart;
+      }
+
+      if (!x->_M_lock.upgrade(vx)) {
+        return kRestart;
+      }
+
+      if (x->_M_generation != generation()) {
+        x->_M_lock.unlock();
+        return kRestart;
+      }
+
+      x->erase(pos);
+
+      x->_M_lock.unlock();
+
+      _M_nkeys.fetch_sub(1, std::memory_order_relaxed);
+
+      return kSuccess;
+    }
+
+    template<typename _Parameters>
+    typename concurrent_btree<_Parameters>::status
+    concurrent_btree<_Parameters>::try_get(const key_type& key,
+                                           value_type* value) const
+    {
+      uint64_t vroot;
+      if (!_M_root_lock.read_lock(vroot)) {
+        return kRestart;
+      }
+
+      const node* x = _M_root.load(std::memory_order_acquire);
+
+      // If the tree is empty...
+      if (!x) {
+        return (_M_root_lock.validate(vroot)) ? kFailure : kRestart;
+      }
+
+      uint64_t vx;
+      if ((!x->_M_lock.read_lock(vx)) || (!_M_root_lock.validate(vroot))) {
+        return kRestart;
+      }
+
+      return try_get(x, vx, key, value);
+    }
+
+    template<typename _Parameters>
+    typename concurrent_btree<_Parameters>::status
+    concurrent_btree<_Parameters>::try_get(const node* x,
+                                           uint64_t vx,
+                                           const key_type& key,
+                                           value_type* value) const
+    {
+      // While 'x' is an internal node...
+      while (x->_M_type == node::kInternal) {
+        instrumentation_type::count(kLookupNodeVisits);
+
+        const node* child = x->children()[x->child(key, _M_comp)];
+        if (!x->_M_lock.validate(vx)) {
+          return kRestart;
+        }
+
+        uint64_t vchild;
+        if ((!child->_M_lock.read_lock(vchild)) ||
+            (!x->_M_lock.validate(vx))) {
+          return kRestart;
+        }
+
+        x = child;
+        vx = vchild;
+      }
+
+      // Leaf node.
+      instrumentation_type::count(kLookupNodeVisits);
+
+      uint16_t pos;
+      bool found = x->find(key, _M_comp, pos);
+
+      if ((found) && (value) && (parameters_type::kValueSize > 0)) {
+        *value = x->values()[pos];
+      }
+
+      if (!x->_M_lock.validate(vx)) {
+        return kRestart;
+      }
+
+      return (found) ? kSuccess : kFailure;
+    }
+
+    template<typename _Parameters>
+    typename concurrent_btree<_Parameters>::status
+    concurrent_btree<_Parameters>::try_scan(const node* root,
+                                            const key_type* from,
+                                            const key_type* hi,
+                                            key_type* keys,
+                                            value_type* values,
+                                            uint16_t& count,
+                                            key_type& next,
+                                            bool& more) const
+    {
+      const node* x = root;
+
+      uint64_t vx;
+      if (!x->_M_lock.read_lock(vx)) {
+        return kRestart;
+      }
+
+      more = false;
+
+      // While 'x' is an internal node...
+      while (x->_M_type == node::kInternal) {
+        uint16_t i = (from) ? x->child(*from, _M_comp) : 0;
+
+        // The separator of the rightmost leaf of the child and the
+        // following one.
+        if (i < x->count()) {
+          next = x->keys()[i];
+          more = true;
+        }
+
+        const node* child = x->children()[i];
+        if (!x->_M_lock.validate(vx)) {
+          return kRestart;
+        }
+
+        uint64_t vchild;
+        if ((!child->_M_lock.read_lock(vchild)) ||
+            (!x->_M_lock.validate(vx))) {
+          return kRestart;
+        }
+
+        x = child;
+        vx = vchild;
+      }
+
+      // Leaf node.
+      uint16_t pos = 0;
+      if (from) {
+        x->find(*from, _M_comp, pos);
+      }
+
+      uint16_t n = x->count();
+      if (n > node::kLeafNodeMaxKeys) {
+        n = node::kLeafNodeMaxKeys;
+      }
+
+      const key_type* xkeys = x->keys();
+
+      count = 0;
+      for (; pos < n; pos++) {
+        if ((hi) && (!search_type::less(_M_comp, xkeys[pos], *hi))) {
+          more = false;
+          break;
+        }
+
+        keys[count] = xkeys[pos];
+
+        if (parameters_type::kValueSize > 0) {
+          values[count] = x->values()[pos];
+        } else {
+          values[count] = value_type();
+        }
+
+        count++;
+      }
+
+      if (!x->_M_lock.validate(vx)) {
+        return kRestart;
+      }
+
+      // If the following leaf has only keys not less than '*hi'...
+      if ((more) && (hi) && (!search_type::less(_M_comp, next, *hi))) {
+        more = false;
+      }
+
+      return kSuccess;
+    }
+  }
+}
+
+#endif // UTIL_BTREE_CONCURRENT_BTREE_H
@@ -0,0 +1,64 @@
+#ifndef UTIL_CONCURRENT_BTREE_MAP_H
+#define UTIL_CONCURRENT_BTREE_MAP_H
+
+#include "util/btree/concurrent_btree.h"
+#include "util/less.h"
+
+namespace util {
+  namespace btree {
+    template<typename _Key,
+             typename _Tp,
+             typename _Compare = util::less<_Key>,
+             size_t _NodeSize = 256,
+             typename _Allocator = malloc_allocator,
+             typename _Instrumentation = no_instrumentation>
+    class concurrent_btree_map
+      : public concurrent_btree<map_parameters<_Key,
+                                               _Tp,
+                                               _Compare,
+                                               _NodeSize,
+                                               _Allocator,
+                                               _Instrumentation> > {
+      private:
+        typedef map_parameters<_Key,
+                               _Tp,
+                               _Compare,
+                               _NodeSize,
+                               _Allocator,
+                               _Instrumentation> parameters_type;
+
+        typedef concurrent_btree<parameters_type> btree_type;
+
+      public:
+        typedef typename btree_type::key_compare key_compare;
+
+        // Constructor.
+        concurrent_btree_map(const key_compare& comp = key_compare());
+
+      private:
+        // Disable copy constructor and assignment operator.
+        concurrent_btree_map(const concurrent_btree_map&) = delete;
+        concurrent_btree_map& operator=(const concurrent_btree_map&) = delete;
+    };
+
+    template<typename _Key,
+             typename _Tp,
+             typename _Compare,
+             size_t _NodeSize,
+             typename _Allocator,
+             typename _Instrumentation>
+    inline concurrent_btree_map<_Key,
+                                _Tp,
+                                _Compare,
+                                _NodeSize,
+                                _Allocator,
+                                _Instrumentation>::concurrent_btree_map(
+                                                       const key_compare& comp
+                                                     )
+      : btree_type(comp)
+    {
+    }
+  }
+}
+
+#endif // UTIL_CONCURRENT_BTREE_MAP_H
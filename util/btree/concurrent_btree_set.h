@@ -0,0 +1,86 @@
+#ifndef UTIL_CONCURRENT_BTREE_SET_H
+#define UTIL_CONCURRENT_BTREE_SET_H
+
+#include "util/btree/concurrent_btree.h"
+#include "util/less.h"
+
+namespace util {
+  namespace btree {
+    template<typename _Key,
+             typename _Compare = util::less<_Key>,
+             size_t _NodeSize = 256,
+             typename _Allocator = malloc_allocator,
+             typename _Instrumentation = no_instrumentation>
+    class concurrent_btree_set
+      : public concurrent_btree<set_parameters<_Key,
+                                               _Compare,
+                                               _NodeSize,
+                                               _Allocator,
+                                               _Instrumentation> > {
+      private:
+        typedef set_parameters<_Key,
+                               _Compare,
+                               _NodeSize,
+                               _Allocator,
+                               _Instrumentation> parameters_type;
+
+        typedef concurrent_btree<parameters_type> btree_type;
+
+      public:
+        typedef typename btree_type::key_compare key_compare;
+        typedef typename btree_type::key_type key_type;
+        typedef typename btree_type::value_type value_type;
+
+        // Constructor.
+        concurrent_btree_set(const key_compare& comp = key_compare());
+
+        // Insert key.
+        bool insert(const key_type& key);
+
+      private:
+        // Insert key.
+        bool insert(const key_type& key, const value_type& value);
+
+        // Get value.
+        bool get(const key_type& key, value_type& value) const = delete;
+
+        // Disable copy constructor and assignment operator.
+        concurrent_btree_set(const concurrent_btree_set&) = delete;
+        concurrent_btree_set& operator=(const concurrent_btree_set&) = delete;
+    };
+
+    template<typename _Key,
+             typename _Compare,
+             size_t _NodeSize,
+             typename _Allocator,
+             typename _Instrumentation>
+    inline concurrent_btree_set<_Key,
+                                _Compare,
+                                _NodeSize,
+                                _Allocator,
+                                _Instrumentation>::concurrent_btree_set(
+                                                       const key_compare& comp
+                                                     )
+      : btree_type(comp)
+    {
+    }
+
+    template<typename _Key,
+             typename _Compare,
+             size_t _NodeSize,
+             typename _Allocator,
+             typename _Instrumentation>
+    inline bool concurrent_btree_set<_Key,
+                                     _Compare,
+                                     _NodeSize,
+                                     _Allocator,
+                                     _Instrumentation>::insert(
+                                                         const key_type& key
+                                                       )
+    {
+      return btree_type::insert(key, key);
+    }
+  }
+}
+
+#endif // UTIL_CONCURRENT_BTREE_SET_H
@@ -0,0 +1,248 @@
+#ifndef UTIL_BTREE_EPOCH_H
+#define UTIL_BTREE_EPOCH_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <atomic>
+#include <thread>
+
+namespace util {
+  namespace btree {
+    // Maximum number of threads which can access the concurrent trees at
+    // the same time.
+    static const size_t kMaxThreads = 256;
+
+    // Get the index of the calling thread (0 - kMaxThreads - 1).
+    // The index is released when the thread exits.
+    unsigned thread_index();
+
+    // Epoch-based memory reclamation.
+    //
+    // The operations run inside a guard, which announces the global epoch
+    // the calling thread has observed. The unlinked nodes are retired with
+    // the global epoch at retirement time and freed once every thread which
+    // might still be reading them (every thread which has announced an
+    // epoch less or equal than the node's one) has left its guard.
+    template<typename _Allocator>
+    class epoch_manager {
+      public:
+        typedef _Allocator allocator_type;
+
+        // Guard.
+        class guard {
+          public:
+            // Constructor.
+            guard(epoch_manager& manager);
+
+            // Destructor.
+            ~guard();
+
+          private:
+            epoch_manager& _M_manager;
+            unsigned _M_index;
+
+            // Disable copy constructor and assignment operator.
+            guard(const guard&) = delete;
+            guard& operator=(const guard&) = delete;
+        };
+
+        // Constructor.
+        epoch_manager(allocator_type& allocator);
+
+        // Destructor.
+        ~epoch_manager();
+
+        // Retire block (must be called inside a guard).
+        void retire(void* p, size_t size);
+
+        // Free all the retired blocks.
+        // There must not be any other thread inside a guard.
+        void reclaim_all();
+
+      private:
+        static const uint64_t kInactive = 0;
+        static const size_t kReclaimThreshold = 64;
+
+        struct retired {
+          void* p;
+          size_t size;
+          uint64_t epoch;
+        };
+
+        // Per-thread slot. The retired blocks are only accessed by the
+        // thread owning the slot.
+        struct alignas(64) slot {
+          std::atomic<uint64_t> epoch;
+
+          retired* blocks;
+          size_t nblocks;
+          size_t size;
+        };
+
+        allocator_type& _M_allocator;
+
+        std::atomic<uint64_t> _M_epoch;
+
+        slot _M_slots[kMaxThreads];
+
+        // Free the retired blocks of the slot which are not reachable
+        // anymore.
+        void reclaim(slot& s);
+
+        // Disable copy constructor and assignment operator.
+        epoch_manager(const epoch_manager&) = delete;
+        epoch_manager& operator=(const epoch_manager&) = delete;
+    };
+
+    inline unsigned thread_index()
+    {
+      static std::atomic<bool> used[kMaxThreads];
+
+      struct holder {
+        unsigned index;
+
+        holder()
+        {
+          // Wait for a free index if there are too many threads.
+          for (;;) {
+            for (index = 0; index < kMaxThreads; index++) {
+              if ((!used[index].load(std::memory_order_relaxed)) &&
+                  (!used[index].exchange(true, std::memory_order_acquire))) {
+                return;
+              }
+            }
+
+            std::this_thread::yield();
+          }
+        }
+
+        ~holder()
+        {
+          used[index].store(false, std::memory_order_release);
+        }
+      };
+
+      static thread_local holder h;
+
+      return h.index;
+    }
+
+    template<typename _Allocator>
+    inline epoch_manager<_Allocator>::guard::guard(epoch_manager& manager)
+      : _M_manager(manager),
+        _M_index(thread_index())
+    {
+      slot& s = _M_manager._M_slots[_M_index];
+
+      // Announce the epoch before reading any node.
+      s.epoch.store(_M_manager._M_epoch.load(std::memory_order_seq_cst),
+                    std::memory_order_seq_cst);
+    }
+
+    template<typename _Allocator>
+    inline epoch_manager<_Allocator>::guard::~guard()
+    {
+      slot& s = _M_manager._M_slots[_M_index];
+
+      s.epoch.store(kInactive, std::memory_order_release);
+
+      if (s.nblocks >= kReclaimThreshold) {
+        _M_manager.reclaim(s);
+      }
+    }
+
+    template<typename _Allocator>
+    epoch_manager<_Allocator>::epoch_manager(allocator_type& allocator)
+      : _M_allocator(allocator),
+        _M_epoch(1)
+    {
+      for (size_t i = 0; i < kMaxThreads; i++) {
+        _M_slots[i].epoch.store(kInactive, std::memory_order_relaxed);
+        _M_slots[i].blocks = NULL;
+        _M_slots[i].nblocks = 0;
+        _M_slots[i].size = 0;
+      }
+    }
+
+    template<typename _Allocator>
+    inline epoch_manager<_Allocator>::~epoch_manager()
+    {
+      reclaim_all();
+    }
+
+    template<typename _Allocator>
+    void epoch_manager<_Allocator>::retire(void* p, size_t size)
+    {
+      slot& s = _M_slots[thread_index()];
+
+      // If the array of retired blocks is full...
+      if (s.nblocks == s.size) {
+        size_t n = (s.size > 0) ? (s.size * 2) : kReclaimThreshold;
+
+        retired* blocks;
+        if ((blocks = static_cast<retired*>(
+                        realloc(s.blocks, n * sizeof(retired))
+                      )) == NULL) {
+          // Leak the block rather than freeing it while it might be read.
+          return;
+        }
+
+        s.blocks = blocks;
+        s.size = n;
+      }
+
+      retired* r = &s.blocks[s.nblocks++];
+      r->p = p;
+      r->size = size;
+      r->epoch = _M_epoch.load(std::memory_order_seq_cst);
+    }
+
+    template<typename _Allocator>
+    void epoch_manager<_Allocator>::reclaim_all()
+    {
+      for (size_t i = 0; i < kMaxThreads; i++) {
+        slot& s = _M_slots[i];
+
+        for (size_t j = 0; j < s.nblocks; j++) {
+          _M_allocator.deallocate(s.blocks[j].p, s.blocks[j].size);
+        }
+
+        free(s.blocks);
+
+        s.blocks = NULL;
+        s.nblocks = 0;
+        s.size = 0;
+      }
+    }
+
+    template<typename _Allocator>
+    void epoch_manager<_Allocator>::reclaim(slot& s)
+    {
+      // Advance the global epoch, so the threads entering from now on
+      // cannot reach the blocks retired so far.
+      uint64_t min = _M_epoch.fetch_add(1, std::memory_order_seq_cst) + 1;
+
+      // Get the oldest epoch announced by an active thread.
+      for (size_t i = 0; i < kMaxThreads; i++) {
+        uint64_t epoch = _M_slots[i].epoch.load(std::memory_order_seq_cst);
+        if ((epoch != kInactive) && (epoch < min)) {
+          min = epoch;
+        }
+      }
+
+      // Free the blocks retired before the oldest epoch.
+      size_t n = 0;
+      for (size_t j = 0; j < s.nblocks; j++) {
+        if (s.blocks[j].epoch < min) {
+          _M_allocator.deallocate(s.blocks[j].p, s.blocks[j].size);
+        } else {
+          s.blocks[n++] = s.blocks[j];
+        }
+      }
+
+      s.nblocks = n;
+    }
+  }
+}
+
+#endif // UTIL_BTREE_EPOCH_H
@@ -0,0 +1,248 @@
+#ifndef UTIL_BTREE_INSTRUMENTATION_H
+#define UTIL_BTREE_INSTRUMENTATION_H
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+
+namespace util {
+  namespace btree {
+    // Instrumentation policies.
+    //
+    // An instrumentation policy provides:
+    //   - static const bool kEnabled: true if the events are counted.
+    //   - static void count(event e, uint64_t n = 1): counts 'n' events.
+    //   - static void snapshot(counters& c): gets the counters.
+    //   - static void reset(): resets the counters.
+    //
+    // The tree calls count() in its hot paths, so a disabled policy must
+    // compile to nothing.
+
+    // Events.
+    enum event {
+      // Node splits.
+      kSplits,
+
+      // Node merges.
+      kMerges,
+
+      // Keys moved from a node to its right sibling.
+      kRebalancesLeftToRight,
+
+      // Keys moved from a node to its left sibling.
+      kRebalancesRightToLeft,
+
+      // Calls to try_rebalance_or_merge() (erase and pop), whether they
+      // rebalance, merge or leave the child as it is.
+      kRebalanceOrMergeAttempts,
+
+      // Lookups (find, get, lower_bound, upper_bound).
+      kLookups,
+
+      // Nodes visited by the lookups.
+      kLookupNodeVisits,
+
+      kNumberEvents
+    };
+
+    // Event counters.
+    struct counters {
+      uint64_t events[kNumberEvents];
+
+      // Get number of events.
+      uint64_t operator[](event e) const
+      {
+        return events[e];
+      }
+
+      // Get average number of nodes visited per lookup.
+      double nodes_per_lookup() const
+      {
+        return (events[kLookups] > 0) ?
+                 static_cast<double>(events[kLookupNodeVisits]) /
+                 events[kLookups] :
+                 0.0;
+      }
+    };
+
+    // No instrumentation.
+    class no_instrumentation {
+      public:
+        static const bool kEnabled = false;
+
+        // Count event.
+        static void count(event e, uint64_t n = 1)
+        {
+        }
+
+        // Get snapshot.
+        static void snapshot(counters& c)
+        {
+          for (unsigned i = 0; i < kNumberEvents; i++) {
+            c.events[i] = 0;
+          }
+        }
+
+        // Reset.
+        static void reset()
+        {
+        }
+    };
+
+    // Counting instrumentation.
+    // Each thread counts in its own (thread-local) counters, so counting
+    // doesn't add contention to concurrent runs; snapshot() adds up the
+    // counters of all the threads, including the ones which have exited.
+    // The counters are shared by all the trees instantiated with the same
+    // policy; use a different '_Tag' to count trees separately.
+    // reset() is meant to be called while the trees are not being used.
+    template<typename _Tag = void>
+    class counting_instrumentation {
+      public:
+        static const bool kEnabled = true;
+
+        // Count event.
+        static void count(event e, uint64_t n = 1);
+
+        // Get snapshot.
+        static void snapshot(counters& c);
+
+        // Reset.
+        static void reset();
+
+      private:
+        // Counters of a thread.
+        // Only the owner thread writes them, so a relaxed load and store
+        // (no atomic read-modify-write) are enough.
+        struct thread_counters {
+          std::atomic<uint64_t> events[kNumberEvents];
+
+          thread_counters* prev;
+          thread_counters* next;
+
+          // Constructor (registers the counters).
+          thread_counters();
+
+          // Destructor (unregisters the counters).
+          ~thread_counters();
+        };
+
+        // Registry of the counters of the live threads.
+        struct registry {
+          std::mutex mutex;
+          thread_counters* threads;
+
+          // Counters of the threads which have exited.
+          uint64_t retired[kNumberEvents];
+        };
+
+        // Get registry.
+        static registry& get_registry();
+
+        // Get counters of the calling thread.
+        static thread_counters& local();
+    };
+
+    template<typename _Tag>
+    inline void counting_instrumentation<_Tag>::count(event e, uint64_t n)
+    {
+      std::atomic<uint64_t>& counter = local().events[e];
+      counter.store(counter.load(std::memory_order_relaxed) + n,
+                    std::memory_order_relaxed);
+    }
+
+    template<typename _Tag>
+    void counting_instrumentation<_Tag>::snapshot(counters& c)
+    {
+      registry& r = get_registry();
+      std::lock_guard<std::mutex> lock(r.mutex);
+
+      for (unsigned i = 0; i < kNumberEvents; i++) {
+        c.events[i] = r.retired[i];
+      }
+
+      for (thread_counters* t = r.threads; t; t = t->next) {
+        for (unsigned i = 0; i < kNumberEvents; i++) {
+          c.events[i] += t->events[i].load(std::memory_order_relaxed);
+        }
+      }
+    }
+
+    template<typename _Tag>
+    void counting_instrumentation<_Tag>::reset()
+    {
+      registry& r = get_registry();
+      std::lock_guard<std::mutex> lock(r.mutex);
+
+      for (unsigned i = 0; i < kNumberEvents; i++) {
+        r.retired[i] = 0;
+      }
+
+      for (thread_counters* t = r.threads; t; t = t->next) {
+        for (unsigned i = 0; i < kNumberEvents; i++) {
+          t->events[i].store(0, std::memory_order_relaxed);
+        }
+      }
+    }
+
+    template<typename _Tag>
+    counting_instrumentation<_Tag>::thread_counters::thread_counters()
+      : prev(NULL)
+    {
+      for (unsigned i = 0; i < kNumberEvents; i++) {
+        events[i].store(0, std::memory_order_relaxed);
+      }
+
+      registry& r = get_registry();
+      std::lock_guard<std::mutex> lock(r.mutex);
+
+      next = r.threads;
+      if (next) {
+        next->prev = this;
+      }
+
+      r.threads = this;
+    }
+
+    template<typename _Tag>
+    counting_instrumentation<_Tag>::thread_counters::~thread_counters()
+    {
+      registry& r = get_registry();
+      std::lock_guard<std::mutex> lock(r.mutex);
+
+      for (unsigned i = 0; i < kNumberEvents; i++) {
+        r.retired[i] += events[i].load(std::memory_order_relaxed);
+      }
+
+      if (prev) {
+        prev->next = next;
+      } else {
+        r.threads = next;
+      }
+
+      if (next) {
+        next->prev = prev;
+      }
+    }
+
+    template<typename _Tag>
+    typename counting_instrumentation<_Tag>::registry&
+    counting_instrumentation<_Tag>::get_registry()
+    {
+      // Never destroyed: threads might exit after the static destructors
+      // have run.
+      static registry* r = new registry();
+      return *r;
+    }
+
+    template<typename _Tag>
+    inline typename counting_instrumentation<_Tag>::thread_counters&
+    counting_instrumentation<_Tag>::local()
+    {
+      static thread_local thread_counters counters;
+      return counters;
+    }
+  }
+}
+
+#endif // UTIL_BTREE_INSTRUMENTATION_H
@@ -0,0 +1,630 @@
+#ifndef UTIL_BTREE_SEARCH_H
+#define UTIL_BTREE_SEARCH_H
+
+#include <stdint.h>
+#include <functional>
+#include <type_traits>
+#include <utility>
+#if defined(__SSE2__)
+  #include <immintrin.h>
+#endif
+#include "util/less.h"
+#include "util/compare.h"
+#include "util/minus.h"
+
+namespace util {
+  namespace btree {
+    // Branch-free intra-node search for arithmetic keys.
+    //
+    // Instead of binary searching the keys, all the keys of the node are
+    // compared with the key being searched and the number of keys which are
+    // less (or less or equal) than the key is counted. The best kernel is
+    // chosen at compile time (AVX2, SSE4.2, SSE2 or a scalar loop).
+    //
+    // - count_less(): number of keys which are less than 'key' (position of
+    //                 the lower bound).
+    // - count_less_equal(): number of keys which are less or equal than
+    //                       'key' (position of the upper bound).
+    template<typename _Key,
+             size_t _Size = sizeof(_Key),
+             bool _Integral = std::is_integral<_Key>::value,
+             bool _Signed = std::is_signed<_Key>::value>
+    struct arithmetic_search {
+      static uint16_t count_less(const _Key* keys,
+                                 uint16_t count,
+                                 const _Key& key)
+      {
+        uint16_t n = 0;
+        for (uint16_t i = 0; i < count; i++) {
+          n += (keys[i] < key);
+        }
+
+        return n;
+      }
+
+      static uint16_t count_less_equal(const _Key* keys,
+                                       uint16_t count,
+                                       const _Key& key)
+      {
+        uint16_t n = 0;
+        for (uint16_t i = 0; i < count; i++) {
+          n += (keys[i] <= key);
+        }
+
+        return n;
+      }
+    };
+
+    // 32-bit signed integers.
+    template<typename _Key>
+    struct arithmetic_search<_Key, 4, true, true> {
+      static uint16_t count_less(const _Key* keys,
+                                 uint16_t count,
+                                 const _Key& key)
+      {
+        uint16_t n = 0;
+        uint16_t i = 0;
+
+#if defined(__AVX2__)
+        const __m256i k = _mm256_set1_epi32(key);
+        for (; i + 8 <= count; i += 8) {
+          __m256i v = _mm256_loadu_si256(
+                        reinterpret_cast<const __m256i*>(keys + i)
+                      );
+
+          // keys[i] < key <=> key > keys[i]
+          n += __builtin_popcount(
+                 _mm256_movemask_ps(
+                   _mm256_castsi256_ps(_mm256_cmpgt_epi32(k, v))
+                 )
+               );
+        }
+#elif defined(__SSE2__)
+        const __m128i k = _mm_set1_epi32(key);
+        for (; i + 4 <= count; i += 4) {
+          __m128i v = _mm_loadu_si128(
+                        reinterpret_cast<const __m128i*>(keys + i)
+                      );
+
+          // keys[i] < key <=> key > keys[i]
+          n += __builtin_popcount(
+                 _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(k, v)))
+               );
+        }
+#endif
+
+        for (; i < count; i++) {
+          n += (keys[i] < key);
+        }
+
+        return n;
+      }
+
+      static uint16_t count_less_equal(const _Key* keys,
+                                       uint16_t count,
+                                       const _Key& key)
+      {
+        uint16_t n = 0;
+        uint16_t i = 0;
+
+#if defined(__AVX2__)
+        const __m256i k = _mm256_set1_epi32(key);
+        for (; i + 8 <= count; i += 8) {
+          __m256i v = _mm256_loadu_si256(
+                        reinterpret_cast<const __m256i*>(keys + i)
+                      );
+
+          // keys[i] <= key <=> !(keys[i] > key)
+          n += 8 - __builtin_popcount(
+                     _mm256_movemask_ps(
+                       _mm256_castsi256_ps(_mm256_cmpgt_epi32(v, k))
+                     )
+                   );
+        }
+#elif defined(__SSE2__)
+        const __m128i k = _mm_set1_epi32(key);
+        for (; i + 4 <= count; i += 4) {
+          __m128i v = _mm_loadu_si128(
+                        reinterpret_cast<const __m128i*>(keys + i)
+                      );
+
+          // keys[i] <= key <=> !(keys[i] > key)
+          n += 4 - __builtin_popcount(
+                     _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(v, k)))
+                   );
+        }
+#endif
+
+        for (; i < count; i++) {
+          n += (keys[i] <= key);
+        }
+
+        return n;
+      }
+    };
+
+    // 64-bit signed integers.
+    template<typename _Key>
+    struct arithmetic_search<_Key, 8, true, true> {
+      static uint16_t count_less(const _Key* keys,
+                                 uint16_t count,
+                                 const _Key& key)
+      {
+        uint16_t n = 0;
+        uint16_t i = 0;
+
+#if defined(__AVX2__)
+        const __m256i k = _mm256_set1_epi64x(key);
+        for (; i + 4 <= count; i += 4) {
+          __m256i v = _mm256_loadu_si256(
+                        reinterpret_cast<const __m256i*>(keys + i)
+                      );
+
+          n += __builtin_popcount(
+                 _mm256_movemask_pd(
+                   _mm256_castsi256_pd(_mm256_cmpgt_epi64(k, v))
+                 )
+               );
+        }
+#elif defined(__SSE4_2__)
+        const __m128i k = _mm_set1_epi64x(key);
+        for (; i + 2 <= count; i += 2) {
+          __m128i v = _mm_loadu_si128(
+                        reinterpret_cast<const __m128i*>(keys + i)
+                      );
+
+          n += __builtin_popcount(
+                 _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(k, v)))
+               );
+        }
+#endif
+
+        for (; i < count; i++) {
+          n += (keys[i] < key);
+        }
+
+        return n;
+      }
+
+      static uint16_t count_less_equal(const _Key* keys,
+                                       uint16_t count,
+                                       const _Key& key)
+      {
+        uint16_t n = 0;
+        uint16_t i = 0;
+
+#if defined(__AVX2__)
+        const __m256i k = _mm256_set1_epi64x(key);
+        for (; i + 4 <= count; i += 4) {
+          __m256i v = _mm256_loadu_si256(
+                        reinterpret_cast<const __m256i*>(keys + i)
+                      );
+
+          n += 4 - __builtin_popcount(
+                     _mm256_movemask_pd(
+                       _mm256_castsi256_pd(_mm256_cmpgt_epi64(v, k))
+                     )
+                   );
+        }
+#elif defined(__SSE4_2__)
+        const __m128i k = _mm_set1_epi64x(key);
+        for (; i + 2 <= count; i += 2) {
+          __m128i v = _mm_loadu_si128(
+                        reinterpret_cast<const __m128i*>(keys + i)
+                      );
+
+          n += 2 - __builtin_popcount(
+                     _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(v, k)))
+                   );
+        }
+#endif
+
+        for (; i < count; i++) {
+          n += (keys[i] <= key);
+        }
+
+        return n;
+      }
+    };
+
+    // Unsigned integers: flipping the sign bit maps the unsigned order onto
+    // the signed order.
+    template<typename _Key, size_t _Size>
+    struct arithmetic_search<_Key, _Size, true, false> {
+      static const _Key kSignBit = static_cast<_Key>(1) << ((_Size * 8) - 1);
+
+      static uint16_t count_less(const _Key* keys,
+                                 uint16_t count,
+                                 const _Key& key)
+      {
+        uint16_t n = 0;
+        uint16_t i = 0;
+
+#if defined(__AVX2__)
+        if (_Size == 4) {
+          const __m256i bias = _mm256_set1_epi32(kSignBit);
+          const __m256i k = _mm256_xor_si256(_mm256_set1_epi32(key), bias);
+          for (; i + 8 <= count; i += 8) {
+            __m256i v = _mm256_xor_si256(
+                          _mm256_loadu_si256(
+                            reinterpret_cast<const __m256i*>(keys + i)
+                          ),
+                          bias
+                        );
+
+            n += __builtin_popcount(
+                   _mm256_movemask_ps(
+                     _mm256_castsi256_ps(_mm256_cmpgt_epi32(k, v))
+                   )
+                 );
+          }
+        } else if (_Size == 8) {
+          const __m256i bias = _mm256_set1_epi64x(kSignBit);
+          const __m256i k = _mm256_xor_si256(_mm256_set1_epi64x(key), bias);
+          for (; i + 4 <= count; i += 4) {
+            __m256i v = _mm256_xor_si256(
+                          _mm256_loadu_si256(
+                            reinterpret_cast<const __m256i*>(keys + i)
+                          ),
+                          bias
+                        );
+
+            n += __builtin_popcount(
+                   _mm256_movemask_pd(
+                     _mm256_castsi256_pd(_mm256_cmpgt_epi64(k, v))
+                   )
+                 );
+          }
+        }
+#elif defined(__SSE2__)
+        if (_Size == 4) {
+          const __m128i bias = _mm_set1_epi32(kSignBit);
+          const __m128i k = _mm_xor_si128(_mm_set1_epi32(key), bias);
+          for (; i + 4 <= count; i += 4) {
+            __m128i v = _mm_xor_si128(
+                          _mm_loadu_si128(
+                            reinterpret_cast<const __m128i*>(keys + i)
+                          ),
+                          bias
+                        );
+
+            n += __builtin_popcount(
+                   _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(k, v)))
+                 );
+          }
+        }
+#endif
+
+        for (; i < count; i++) {
+          n += (keys[i] < key);
+        }
+
+        return n;
+      }
+
+      static uint16_t count_less_equal(const _Key* keys,
+                                       uint16_t count,
+                                       const _Key& key)
+      {
+        uint16_t n = 0;
+        uint16_t i = 0;
+
+#if defined(__AVX2__)
+        if (_Size == 4) {
+          const __m256i bias = _mm256_set1_epi32(kSignBit);
+          const __m256i k = _mm256_xor_si256(_mm256_set1_epi32(key), bias);
+          for (; i + 8 <= count; i += 8) {
+            __m256i v = _mm256_xor_si256(
+                          _mm256_loadu_si256(
+                            reinterpret_cast<const __m256i*>(keys + i)
+                          ),
+                          bias
+                        );
+
+            n += 8 - __builtin_popcount(
+                       _mm256_movemask_ps(
+                         _mm256_castsi256_ps(_mm256_cmpgt_epi32(v, k))
+                       )
+                     );
+          }
+        } else if (_Size == 8) {
+          const __m256i bias = _mm256_set1_epi64x(kSignBit);
+          const __m256i k = _mm256_xor_si256(_mm256_set1_epi64x(key), bias);
+          for (; i + 4 <= count; i += 4) {
+            __m256i v = _mm256_xor_si256(
+                          _mm256_loadu_si256(
+                            reinterpret_cast<const __m256i*>(keys + i)
+                          ),
+                          bias
+                        );
+
+            n += 4 - __builtin_popcount(
+                       _mm256_movemask_pd(
+                         _mm256_castsi256_pd(_mm256_cmpgt_epi64(v, k))
+                       )
+                     );
+          }
+        }
+#elif defined(__SSE2__)
+        if (_Size == 4) {
+          const __m128i bias = _mm_set1_epi32(kSignBit);
+          const __m128i k = _mm_xor_si128(_mm_set1_epi32(key), bias);
+          for (; i + 4 <= count; i += 4) {
+            __m128i v = _mm_xor_si128(
+                          _mm_loadu_si128(
+                            reinterpret_cast<const __m128i*>(keys + i)
+                          ),
+                          bias
+                        );
+
+            n += 4 - __builtin_popcount(
+                       _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(v, k)))
+                     );
+          }
+        }
+#endif
+
+        for (; i < count; i++) {
+          n += (keys[i] <= key);
+        }
+
+        return n;
+      }
+    };
+
+    // Single precision floating point numbers.
+    template<>
+    struct arithmetic_search<float, 4, false, true> {
+      static uint16_t count_less(const float* keys,
+                                 uint16_t count,
+                                 const float& key)
+      {
+        uint16_t n = 0;
+        uint16_t i = 0;
+
+#if defined(__AVX2__)
+        const __m256 k = _mm256_set1_ps(key);
+        for (; i + 8 <= count; i += 8) {
+          n += __builtin_popcount(
+                 _mm256_movemask_ps(
+                   _mm256_cmp_ps(_mm256_loadu_ps(keys + i), k, _CMP_LT_OQ)
+                 )
+               );
+        }
+#elif defined(__SSE2__)
+        const __m128 k = _mm_set1_ps(key);
+        for (; i + 4 <= count; i += 4) {
+          n += __builtin_popcount(
+                 _mm_movemask_ps(_mm_cmplt_ps(_mm_loadu_ps(keys + i), k))
+               );
+        }
+#endif
+
+        for (; i < count; i++) {
+          n += (keys[i] < key);
+        }
+
+        return n;
+      }
+
+      static uint16_t count_less_equal(const float* keys,
+                                       uint16_t count,
+                                       const float& key)
+      {
+        uint16_t n = 0;
+        uint16_t i = 0;
+
+#if defined(__AVX2__)
+        const __m256 k = _mm256_set1_ps(key);
+        for (; i + 8 <= count; i += 8) {
+          n += __builtin_popcount(
+                 _mm256_movemask_ps(
+                   _mm256_cmp_ps(_mm256_loadu_ps(keys + i), k, _CMP_LE_OQ)
+                 )
+               );
+        }
+#elif defined(__SSE2__)
+        const __m128 k = _mm_set1_ps(key);
+        for (; i + 4 <= count; i += 4) {
+          n += __builtin_popcount(
+                 _mm_movemask_ps(_mm_cmple_ps(_mm_loadu_ps(keys + i), k))
+               );
+        }
+#endif
+
+        for (; i < count; i++) {
+          n += (keys[i] <= key);
+        }
+
+        return n;
+      }
+    };
+
+    // Double precision floating point numbers.
+    template<>
+    struct arithmetic_search<double, 8, false, true> {
+      static uint16_t count_less(const double* keys,
+                                 uint16_t count,
+                                 const double& key)
+      {
+        uint16_t n = 0;
+        uint16_t i = 0;
+
+#if defined(__AVX2__)
+        const __m256d k = _mm256_set1_pd(key);
+        for (; i + 4 <= count; i += 4) {
+          n += __builtin_popcount(
+                 _mm256_movemask_pd(
+                   _mm256_cmp_pd(_mm256_loadu_pd(keys + i), k, _CMP_LT_OQ)
+                 )
+               );
+        }
+#elif defined(__SSE2__)
+        const __m128d k = _mm_set1_pd(key);
+        for (; i + 2 <= count; i += 2) {
+          n += __builtin_popcount(
+                 _mm_movemask_pd(_mm_cmplt_pd(_mm_loadu_pd(keys + i), k))
+               );
+        }
+#endif
+
+        for (; i < count; i++) {
+          n += (keys[i] < key);
+        }
+
+        return n;
+      }
+
+      static uint16_t count_less_equal(const double* keys,
+                                       uint16_t count,
+                                       const double& key)
+      {
+        uint16_t n = 0;
+        uint16_t i = 0;
+
+#if defined(__AVX2__)
+        const __m256d k = _mm256_set1_pd(key);
+        for (; i + 4 <= count; i += 4) {
+          n += __builtin_popcount(
+                 _mm256_movemask_pd(
+                   _mm256_cmp_pd(_mm256_loadu_pd(keys + i), k, _CMP_LE_OQ)
+                 )
+               );
+        }
+#elif defined(__SSE2__)
+        const __m128d k = _mm_set1_pd(key);
+        for (; i + 2 <= count; i += 2) {
+          n += __builtin_popcount(
+                 _mm_movemask_pd(_mm_cmple_pd(_mm_loadu_pd(keys + i), k))
+               );
+        }
+#endif
+
+        for (; i < count; i++) {
+          n += (keys[i] <= key);
+        }
+
+        return n;
+      }
+    };
+
+    // Comparator traits.
+    // A comparator is either a strict weak ordering (std::less style: returns
+    // true if x < y) or a three-way comparator (returns a negative number if
+    // x < y, 0 if x == y and a positive number if x > y). The kind is
+    // detected at compile time from the return type.
+    template<typename _Key, typename _Compare>
+    struct comparator_traits {
+      static const bool kLess = std::is_same<
+                                  typename std::decay<
+                                    decltype(std::declval<const _Compare&>()(
+                                               std::declval<const _Key&>(),
+                                               std::declval<const _Key&>()
+                                             ))
+                                  >::type,
+                                  bool
+                                >::value;
+    };
+
+    // Comparator adapter.
+    // - less(): true if x < y.
+    // - compare(): three-way comparison.
+    template<typename _Key,
+             typename _Compare,
+             bool _Less = comparator_traits<_Key, _Compare>::kLess>
+    struct comparator {
+      static bool less(const _Compare& comp, const _Key& x, const _Key& y)
+      {
+        return comp(x, y);
+      }
+
+      static int compare(const _Compare& comp, const _Key& x, const _Key& y)
+      {
+        return comp(x, y) ? -1 : static_cast<int>(comp(y, x));
+      }
+    };
+
+    template<typename _Key, typename _Compare>
+    struct comparator<_Key, _Compare, false> {
+      static bool less(const _Compare& comp, const _Key& x, const _Key& y)
+      {
+        return (comp(x, y) < 0);
+      }
+
+      static int compare(const _Compare& comp, const _Key& x, const _Key& y)
+      {
+        return comp(x, y);
+      }
+    };
+
+    // Key search.
+    // By default, nodes are binary searched with the user comparator
+    // (kVectorized = false). Arithmetic keys compared with one of the
+    // standard comparators (util::less, util::compare, util::minus or
+    // std::less) use the branch-free search. Other key types always go
+    // through the comparator, so they only need what the comparator needs
+    // (operator< for util::less and std::less).
+    template<typename _Key,
+             typename _Compare,
+             bool _Arithmetic = std::is_arithmetic<_Key>::value>
+    struct key_search : public comparator<_Key, _Compare> {
+      static const bool kVectorized = false;
+
+      static uint16_t count_less(const _Key* keys,
+                                 uint16_t count,
+                                 const _Key& key)
+      {
+        return 0;
+      }
+
+      static uint16_t count_less_equal(const _Key* keys,
+                                       uint16_t count,
+                                       const _Key& key)
+      {
+        return 0;
+      }
+    };
+
+    // Key search for arithmetic keys and the standard comparators: the keys
+    // are compared with their own operators, which neither overflow (unlike
+    // x - y) nor branch.
+    template<typename _Key>
+    struct builtin_key_search : public arithmetic_search<_Key> {
+      static const bool kVectorized = true;
+
+      template<typename _Compare>
+      static bool less(const _Compare& comp, const _Key& x, const _Key& y)
+      {
+        return (x < y);
+      }
+
+      template<typename _Compare>
+      static int compare(const _Compare& comp, const _Key& x, const _Key& y)
+      {
+        return (x > y) - (x < y);
+      }
+    };
+
+    template<typename _Key>
+    struct key_search<_Key, util::less<_Key>, true>
+      : public builtin_key_search<_Key> {
+    };
+
+    template<typename _Key>
+    struct key_search<_Key, util::compare<_Key>, true>
+      : public builtin_key_search<_Key> {
+    };
+
+    template<typename _Key>
+    struct key_search<_Key, util::minus<_Key>, true>
+      : public builtin_key_search<_Key> {
+    };
+
+    template<typename _Key>
+    struct key_search<_Key, std::less<_Key>, true>
+      : public builtin_key_search<_Key> {
+    };
+  }
+}
+
+#endif // UTIL_BTREE_SEARCH_H
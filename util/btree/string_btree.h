@@ -0,0 +1,1460 @@
+#ifndef UTIL_BTREE_STRING_BTREE_H
+#define UTIL_BTREE_STRING_BTREE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <type_traits>
+#include "util/btree/allocator.h"
+
+namespace util {
+  namespace btree {
+    // B+ tree with string keys stored inline in the nodes.
+    //
+    // The nodes are slotted pages:
+    // +--------+-------------------------+------+--------------------------+
+    // | header | slots -->               | free |                 <-- heap |
+    // +--------+-------------------------+------+--------------------------+
+    //
+    // The slots are sorted by key and have a fixed width: offset and length
+    // of the key in the heap, first 4 bytes of the key (head, big-endian)
+    // and either the value (leaf nodes) or the child (internal nodes). Most
+    // of the comparisons of a search are decided by the heads, without
+    // leaving the slot array.
+    //
+    // Each node keeps its fence keys (the separators which bound its key
+    // range in the parent). All the keys of the node share the common prefix
+    // of the fence keys, which is stored only once: the heap only holds the
+    // key suffixes. When a leaf node is split, the separator is the shortest
+    // prefix of its right half which separates both halves.
+    //
+    // Keys are compared byte-wise (like std::string::compare()). Values are
+    // copied with memcpy() and must be trivially copyable.
+    template<typename _Tp,
+             size_t _NodeSize = 4096,
+             typename _Allocator = malloc_allocator>
+    class string_btree_map {
+      public:
+        typedef std::string key_type;
+        typedef _Tp value_type;
+        typedef _Allocator allocator_type;
+
+      private:
+        class node {
+          public:
+            enum type {
+              kInternal,
+              kLeaf
+            };
+
+            struct slot {
+              // Offset of the key suffix.
+              uint16_t offset;
+
+              // Length of the key suffix.
+              uint16_t length;
+
+              // First 4 bytes of the key suffix (big-endian, zero padded).
+              uint32_t head;
+
+              union {
+                value_type value;
+                node* child;
+              };
+            };
+
+            struct header {
+              uint16_t type;
+              uint16_t count;
+
+              // The prefix is the beginning of the lower fence key.
+              uint16_t prefix_length;
+
+              uint16_t lower_offset;
+              uint16_t lower_length;
+
+              // Upper fence key (length 0: no upper fence).
+              uint16_t upper_offset;
+              uint16_t upper_length;
+
+              // Beginning of the heap.
+              uint16_t heap;
+
+              // Heap bytes which are not used anymore.
+              uint16_t garbage;
+
+              // Leftmost child (internal nodes).
+              node* first;
+
+              // Previous and next nodes (leaf nodes).
+              node* prev;
+              node* next;
+            };
+
+            // Create node.
+            static node* create(type type,
+                                const uint8_t* lower,
+                                size_t lower_length,
+                                const uint8_t* upper,
+                                size_t upper_length,
+                                allocator_type& allocator);
+
+            // Destroy node (and its subtree).
+            static void destroy(node* n, allocator_type& allocator);
+
+            // Initialize node.
+            void init(type type,
+                      const uint8_t* lower,
+                      size_t lower_length,
+                      const uint8_t* upper,
+                      size_t upper_length);
+
+            // Get slots.
+            const slot* slots() const;
+            slot* slots();
+
+            // Get child (internal nodes). The leftmost child is 0.
+            node* child(uint16_t i) const;
+
+            // Get fence keys.
+            const uint8_t* lower_fence() const;
+            const uint8_t* upper_fence() const;
+
+            // Get prefix.
+            const uint8_t* prefix() const;
+
+            // Get key (prefix + suffix), returns its length.
+            size_t key(uint16_t pos, uint8_t* buf) const;
+
+            // Get number of bytes in use.
+            size_t used() const;
+
+            // Get number of free bytes between the slots and the heap.
+            size_t free_space() const;
+
+            // Get number of bytes the slots would take if the node's prefix
+            // had 'prefix_length' bytes.
+            size_t slot_bytes(size_t prefix_length) const;
+
+            // Lower bound: position of the first key which is greater or
+            // equal than key.
+            uint16_t lower_bound(const uint8_t* key,
+                                 size_t len,
+                                 bool& found) const;
+
+            // Upper bound: position of the first key which is greater than
+            // key.
+            uint16_t upper_bound(const uint8_t* key, size_t len) const;
+
+            // Insert slot at position 'pos' (the key must share the node's
+            // prefix). The heap is compacted into 'buffer' if needed.
+            // Returns the slot (the caller fills the value or the child) or
+            // NULL if the slot doesn't fit.
+            slot* insert_slot(uint16_t pos,
+                              const uint8_t* key,
+                              size_t len,
+                              uint8_t* buffer);
+
+            // Remove slot.
+            void remove(uint16_t pos);
+
+            // Append the slots [from, to) of 'src' (they must fit).
+            void append(const node* src, uint16_t from, uint16_t to);
+
+            // Compact heap.
+            void compact(uint8_t* buffer);
+
+            // Get the length of the common prefix.
+            static size_t common_prefix(const uint8_t* x,
+                                        size_t xlen,
+                                        const uint8_t* y,
+                                        size_t ylen);
+
+            // Compare keys.
+            static int compare(const uint8_t* x,
+                               size_t xlen,
+                               const uint8_t* y,
+                               size_t ylen);
+
+            header _M_header;
+
+          private:
+            // Get node data.
+            const uint8_t* data() const;
+            uint8_t* data();
+
+            // Store (x + y)[skip:] in the heap, returns its offset.
+            uint16_t store(const uint8_t* x,
+                           size_t xlen,
+                           const uint8_t* y,
+                           size_t ylen,
+                           size_t skip);
+
+            // Strip the prefix from the key.
+            // Returns < 0 if the key is less than the keys of the node, > 0
+            // if it is greater, 0 otherwise.
+            int strip(const uint8_t*& key, size_t& len) const;
+
+            // Get head.
+            static uint32_t head(const uint8_t* s, size_t n);
+
+            // Compare the suffix of a slot with the suffix 's'.
+            int compare(const slot& sl,
+                        const uint8_t* s,
+                        size_t n,
+                        uint32_t h) const;
+        };
+
+      public:
+        // Maximum key length.
+        // At most 1/8 of the node is taken by a slot and its key, so a split
+        // node (with its new fence keys) always has room for the key which
+        // caused the split.
+        static const size_t kMaxKeyLength =
+                       ((_NodeSize - sizeof(typename node::header)) / 8) -
+                       sizeof(typename node::slot);
+
+        class const_iterator {
+          friend class string_btree_map;
+
+          public:
+            typedef typename string_btree_map::key_type key_type;
+            typedef typename string_btree_map::value_type value_type;
+
+            // Get key (prefix + suffix).
+            key_type key() const;
+
+            // Get value.
+            const value_type& value() const;
+
+            // Comparison operators.
+            bool operator==(const const_iterator& other) const;
+            bool operator!=(const const_iterator& other) const;
+
+          private:
+            const node* _M_node;
+            uint16_t _M_pos;
+        };
+
+        // Constructor.
+        string_btree_map();
+
+        // Destructor.
+        ~string_btree_map();
+
+        // Clear.
+        void clear();
+
+        // Get number of keys.
+        size_t count() const;
+
+        // Insert key.
+        // If the key has been already inserted, the value is replaced.
+        // Returns false if the key is longer than kMaxKeyLength.
+        bool insert(const key_type& key, const value_type& value);
+
+        // Erase key.
+        bool erase(const key_type& key);
+
+        // Get value.
+        bool get(const key_type& key, value_type& value) const;
+
+        // Begin.
+        bool begin(const_iterator& it) const;
+
+        // End.
+        bool end(const_iterator& it) const;
+
+        // Previous.
+        bool prev(const_iterator& it) const;
+
+        // Next.
+        bool next(const_iterator& it) const;
+
+        // Find.
+        bool find(const key_type& key, const_iterator& it) const;
+
+        // Lower bound.
+        // Positions the iterator on the first key which is greater or equal
+        // than 'key'. Returns false if there is no such key.
+        bool lower_bound(const key_type& key, const_iterator& it) const;
+
+      private:
+        static_assert(std::is_trivially_copyable<_Tp>::value,
+                      "Values must be trivially copyable.");
+
+        static_assert(alignof(_Tp) <= 8, "Values must be 8-byte aligned.");
+
+        static_assert(_NodeSize <= 32 * 1024,
+                      "The node size must fit in the 16-bit offsets.");
+
+        static_assert(_NodeSize >= 512, "The node size is too small.");
+
+        // Maximum height of the tree.
+        static const size_t kMaxHeight = 32;
+
+        // Nodes using less than this are merged with a sibling (if the
+        // result fits in a node).
+        static const size_t kMinUsed = _NodeSize / 4;
+
+        node* _M_root;
+        size_t _M_nkeys;
+
+        allocator_type _M_allocator;
+
+        // Scratch node used to rebuild nodes.
+        alignas(8) uint8_t _M_buffer[_NodeSize];
+
+        // Find leaf node.
+        const node* find_leaf(const uint8_t* key, size_t len) const;
+
+        // Split node: the upper half of the keys of x are moved to y and
+        // the separator is returned in 'sep'.
+        void split(node* x, node* y, uint8_t* sep, size_t& seplen);
+
+        // Merge 'left' and its right sibling 'right' (key k of 'parent').
+        // Returns false if they don't fit in a node.
+        bool merge(node* parent, uint16_t k, node* left, node* right);
+
+        // Disable copy constructor and assignment operator.
+        string_btree_map(const string_btree_map&) = delete;
+        string_btree_map& operator=(const string_btree_map&) = delete;
+    };
+
+    template<typename _Tp, size_t _NodeSize, typename _Allocator>
+    typename string_btree_map<_Tp, _NodeSize, _Allocator>::node*
+    string_btree_map<_Tp, _NodeSize, _Allocator>::node::create(
+                                                   type type,
+                                                   const uint8_t* lower,
+                                                   size_t lower_length,
+                                                   const uint8_t* upper,
+                                                   size_t upper_length,
+                                                   allocator_type& allocator
+                                                 )
+    {
+      void* p;
+      if ((p = allocator.allocate(_NodeSize)) == NULL) {
+        return NULL;
+      }
+
+      node* n = static_cast<node*>(p);
+      n->init(type, lower, lower_length, upper, upper_length);
+
+      return n;
+    }
+
+    template<typename _Tp, size_t _NodeSize, typename _Allocator>
+    void string_btree_map<_Tp, _NodeSize, _Allocator>::node::destroy(
+                                                   node* n,
+                                                   allocator_type& allocator
+                                                 )
+    {
+      // Internal node?
+      if (n->_M_header.type == kInternal) {
+        uint16_t count = n->_M_header.count;
+        for (uint16_t i = 0; i <= count; i++) {
+          destroy(n->child(i), allocator);
+        }
+      }
+
+      allocator.deallocate(n, _NodeSize);
+    }
+
+    template<typename _Tp, size_t _NodeSize, typename _Allocator>
+    void string_btree_map<_Tp, _NodeSize, _Allocator>::node::init(
+                                                   type type,
+                                                   const uint8_t* lower,
+                                                   size_t lower_length,
+                                                   const uint8_t* upper,
+                                                   size_t upper_length
+                                                 )
+    {
+      _M_header.type = type;
+      _M_header.count = 0;
+      _M_header.heap = _NodeSize;
+      _M_header.garbage = 0;
+      _M_header.first = NULL;
+      _M_header.prev = NULL;
+      _M_header.next = NULL;
+
+      _M_header.upper_offset = store(upper, upper_length, NULL, 0, 0);
+      _M_header.upper_length = upper_length;
+
+      _M_header.lower_offset = store(lower, lower_length, NULL, 0, 0);
+      _M_header.lower_length = lower_length;
+
+      // Every key of the node is in [lower, upper), so it shares their
+      // common prefix.
+      if (upper_length > 0) {
+        _M_header.prefix_length = common_prefix(lower,
+                                                lower_length,
+                                                upper,
+                                                upper_length);
+      } else {
+        _M_header.prefix_length = 0;
+      }
+    }
+
+    template<typename _Tp, size_t _NodeSize, typename _Allocator>
+    inline const typename string_btree_map<_Tp,
+                                           _NodeSize,
+                                           _Allocator>::node::slot*
+    string_btree_map<_Tp, _NodeSize, _Allocator>::node::slots() const
+    {
+      return reinterpret_cast<const slot*>(data() + sizeof(node));
+    }
+
+    template<typename _Tp, size_t _NodeSize, typename _Allocator>
+    inline typename string_btree_map<_Tp, _NodeSize, _Allocator>::node::slot*
+    string_btree_map<_Tp, _NodeSize, _Allocator>::node::slots()
+    {
+      return reinterpret_cast<slot*>(data() + sizeof(node));
+    }
+
+    template<typename _Tp, size_t _NodeSize, typename _Allocator>
+    inline typename string_btree_map<_Tp, _NodeSize, _Allocator>::node*
+    string_btree_map<_Tp, _NodeSize, _Allocator>::node::child(uint16_t i) const
+    {
+      return (i == 0) ? _M_header.first : slots()[i - 1].child;
+    }
+
+    template<typename _Tp, size_t _NodeSize, typename _Allocator>
+    inline const uint8_t*
+    string_btree_map<_Tp, _NodeSize, _Allocator>::node::lower_fence() const
+    {
+      return data() + _M_header.lower_offset;
+    }
+
+    template<typename _Tp, size_t _NodeSize, typename _Allocator>
+    inline const uint8_t*
+    string_btree_map<_Tp, _NodeSize, _Allocator>::node::upper_fence() const
+    {
+      return data() + _M_header.upper_offset;
+    }
+
+    template<typename _Tp, size_t _NodeSize, typename _Allocator>
+    inline const uint8_t*
+    string_btree_map<_Tp, _NodeSize, _Allocator>::node::prefix() const
+    {
+      return lower_fence();
+    }
+
+    template<typename _Tp, size_t _NodeSize, typename _Allocator>
+    inline size_t
+    string_btree_map<_Tp, _NodeSize, _Allocator>::node::key(uint16_t pos,
+                                                            uint8_t* buf) const
+    {
+      const slot& s = slots()[pos];
+
+      memcpy(buf, prefix(), _M_header.prefix_length);
+      memcpy(buf + _M_header.prefix_length, data() + s.offset, s.length);
+
+      return _M_header.prefix_length + s.length;
+    }
+
+    template<typename _Tp, size_t _NodeSize, typename _Allocator>
+    inline size_t
+    string_btree_map<_Tp, _NodeSize, _Allocator>::node::used() const
+    {
+      return sizeof(node) +
+             (_M_header.count * sizeof(slot)) +
+             (_NodeSize - _M_header.heap) -
+             _M_header.garbage;
+    }
+
+    template<typename _Tp, size_t _NodeSize, typename _Allocator>
+    inline size_t
+    string_btree_map<_Tp, _NodeSize, _Allocator>::node::free_space() const
+    {
+      return _M_header.heap - sizeof(node) - (_M_header.count * sizeof(slot));
+    }
+
+    template<typename _Tp, size_t _NodeSize, typename _Allocator>
+    size_t string_btree_map<_Tp, _NodeSize, _Allocator>::node::slot_bytes(
+                                                     size_t prefix_length
+                                                   ) const
+    {
+      const slot* s = slots();
+      uint16_t count = _M_header.count;
+
+      size_t size = count * (sizeof(slot) +
+                             _M_header.prefix_length -
+                             prefix_length);
+
+      for (uint16_t i = 0; i < count; i++) {
+        size += s[i].length;
+      }
+
+      return size;
+    }
+
+    template<typename _Tp, size_t _NodeSize, typename _Allocator>
+    uint16_t string_btree_map<_Tp, _NodeSize, _Allocator>::node::lower_bound(
+                                                     const uint8_t* key,
+                                                     size_t len,
+                                                     bool& found
+                                                   ) const
+    {
+      found = false;
+
+      int r;
+      if ((r = strip(key, len)) != 0) {
+        return (r < 0) ? 0 : _M_header.count;
+      }
+
+      const slot* s = slots();
+      uint32_t h = head(key, len);
+
+      uint16_t left = 0;
+      uint16_t right = _M_header.count;
+
+      while (left != right) {
+        uint16_t mid = (left + right) / 2;
+
+        if (compare(s[mid], key, len, h) < 0) {
+          left = mid + 1;
+        } else {
+          right = mid;
+        }
+      }
+
+      found = ((left < _M_header.count) && (compare(s[left], key, len, h) == 0));
+
+      return left;
+    }
+
+    template<typename _Tp, size_t _NodeSize, typename _Allocator>
+    uint16_t string_btree_map<_Tp, _NodeSize, _Allocator>::node::upper_bound(
+                                                     const uint8_t* key,
+                                                     size_t len
+                                                   ) const
+    {
+      int r;
+      if ((r = strip(key, len)) != 0) {
+        return (r < 0) ? 0 : _M_header.count;
+      }
+
+      const slot* s = slots();
+      uint32_t h = head(key, len);
+
+      uint16_t left = 0;
+      uint16_t right = _M_header.count;
+
+      while (left != right) {
+        uint16_t mid = (left + right) / 2;
+
+        if (compare(s[mid], key, len, h) <= 0) {
+          left = mid + 1;
+        } else {
+          right = mid;
+        }
+      }
+
+      return left;
+    }
+
+    template<typename _Tp, size_t _NodeSize, typename _Allocator>
+    typename string_btree_map<_Tp, _NodeSize, _Allocator>::node::slot*
+    string_btree_map<_Tp, _NodeSize, _Allocator>::node::insert_slot(
+                                                     uint16_t pos,
+                                                     const uint8_t* key,
+                                                     size_t len,
+                                                     uint8_t* buffer
+                                                   )
+    {
+      size_t prefix_length = _M_header.prefix_length;
+      size_t needed = sizeof(slot) + (len - prefix_length);
+
+      // If there is not enough contiguous free space...
+      if (free_space() < needed) {
+        if ((!buffer) || (free_space() + _M_header.garbage < needed)) {
+          return NULL;
+        }
+
+        compact(buffer);
+      }
+
+      slot* s = slots();
+      memmove(&s[pos + 1], &s[pos], (_M_header.count - pos) * sizeof(slot));
+
+      s[pos].offset = store(key, len, NULL, 0, prefix_length);
+      s[pos].length = len - prefix_length;
+      s[pos].head = head(key + prefix_length, len - prefix_length);
+
+      _M_header.count++;
+
+      return &s[pos];
+    }
+
+    template<typename _Tp, size_t _NodeSize, typename _Allocator>
+    inline void
+    string_btree_map<_Tp, _NodeSize, _Allocator>::node::remove(uint16_t pos)
+    {
+      slot* s = slots();
+
+      _M_header.garbage += s[pos].length;
+
+      memmove(&s[pos],
+              &s[pos + 1],
+              (_M_header.count - pos - 1) * sizeof(slot));
+
+      _M_header.count--;
+    }
+
+    template<typename _Tp, size_t _NodeSize, typename _Allocator>
+    void string_btree_map<_Tp, _NodeSize, _Allocator>::node::append(
+                                                           const node* src,
+                                                           uint16_t from,
+                                                           uint16_t to
+                                                         )
+    {
+      const slot* ss = src->slots();
+      size_t src_prefix_length = src->_M_header.prefix_length;
+
+      slot* s = slots();
+      size_t prefix_length = _M_header.prefix_length;
+
+      for (uint16_t i = from; i < to; i++) {
+        slot& d = s[_M_header.count++];
+
+        // The prefixes might have different lengths: store the key minus
+        // the prefix of this node.
+        d.offset = store(src->prefix(),
+                         src_prefix_length,
+                         src->data() + ss[i].offset,
+                         ss[i].length,
+                         prefix_length);
+
+        d.length = src_prefix_length + ss[i].length - prefix_length;
+        d.head = head(data() + d.offset, d.length);
+
+        if (_M_header.type == kLeaf) {
+          d.value = ss[i].value;
+        } else {
+          d.child = ss[i].child;
+        }
+      }
+    }
+
+    template<typename _Tp, size_t _NodeSize, typename _Allocator>
+    void string_btree_map<_Tp, _NodeSize, _Allocator>::node::compact(
+                                                           uint8_t* buffer
+                                                         )
+    {
+      node* tmp = reinterpret_cast<node*>(buffer);
+
+      tmp->init(static_cast<type>(_M_header.type),
+                lower_fence(),
+                _M_header.lower_length,
+                upper_fence(),
+                _M_header.upper_length);
+
+      tmp->append(this, 0, _M_header.count);
+
+      tmp->_M_header.first = _M_header.first;
+      tmp->_M_header.prev = _M_header.prev;
+      tmp->_M_header.next = _M_header.next;
+
+      memcpy(this, tmp, _NodeSize);
+    }
+
+    template<typename _Tp, size_t _NodeSize, typename _Allocator>
+    inline size_t
+    string_btree_map<_Tp, _NodeSize, _Allocator>::node::common_prefix(
+                                                           const uint8_t* x,
+                                                           size_t xlen,
+                                                           const uint8_t* y,
+                                                           size_t ylen
+                                                         )
+    {
+      size_t n = (xlen < ylen) ? xlen : ylen;
+
+      size_t i = 0;
+      while ((i < n) && (x[i] == y[i])) {
+        i++;
+      }
+
+      return i;
+    }
+
+    template<typename _Tp, size_t _NodeSize, typename _Allocator>
+    inline int string_btree_map<_Tp, _NodeSize, _Allocator>::node::compare(
+                                                           const uint8_t* x,
+                                                           size_t xlen,
+                                                           const uint8_t* y,
+                                                           size_t ylen
+                                                         )
+    {
+      int r;
+      if ((r = memcmp(x, y, (xlen < ylen) ? xlen : ylen)) != 0) {
+        return r;
+      }
+
+      return (xlen > ylen) - (xlen < ylen);
+    }
+
+    template<typename _Tp, size_t _NodeSize, typename _Allocator>
+    inline const uint8_t*
+    string_btree_map<_Tp, _NodeSize, _Allocator>::node::data() const
+    {
+      return reinterpret_cast<const uint8_t*>(this);
+    }
+
+    template<typename _Tp, size_t _NodeSize, typename _Allocator>
+    inline uint8_t* string_btree_map<_Tp, _NodeSize, _Allocator>::node::data()
+    {
+      return reinterpret_cast<uint8_t*>(this);
+    }
+
+    template<typename _Tp, size_t _NodeSize, typename _Allocator>
+    inline uint16_t string_btree_map<_Tp, _NodeSize, _Allocator>::node::store(
+                                                           const uint8_t* x,
+                                                           size_t xlen,
+                                                           const uint8_t* y,
+                                                           size_t ylen,
+                                                           size_t skip
+                                                         )
+    {
+      _M_header.heap -= (xlen + ylen - skip);
+
+      uint8_t* p = data() + _M_header.heap;
+
+      if (skip < xlen) {
+        memcpy(p, x + skip, xlen - skip);
+        p += (xlen - skip);
+
+        if (ylen > 0) {
+          memcpy(p, y, ylen);
+        }
+      } else if (skip < xlen + ylen) {
+        memcpy(p, y + (skip - xlen), ylen - (skip - xlen));
+      }
+
+      return _M_header.heap;
+    }
+
+    template<typename _Tp, size_t _NodeSize, typename _Allocator>
+    inline int string_btree_map<_Tp, _NodeSize, _Allocator>::node::strip(
+                                                           const uint8_t*& key,
+                                                           size_t& len
+                                                         ) const
+    {
+      size_t prefix_length = _M_header.prefix_length;
+      if (prefix_length == 0) {
+        return 0;
+      }
+
+      int r;
+      if ((r = memcmp(key,
+                      prefix(),
+                      (len < prefix_length) ? len : prefix_length)) != 0) {
+        return r;
+      }
+
+      // If the key is a prefix of the prefix...
+      if (len < prefix_length) {
+        return -1;
+      }
+
+      key += prefix_length;
+      len -= prefix_length;
+
+      return 0;
+    }
+
+    template<typename _Tp, size_t _NodeSize, typename _Allocator>
+    inline uint32_t string_btree_map<_Tp, _NodeSize, _Allocator>::node::head(
+                                                           const uint8_t* s,
+                                                           size_t n
+                                                         )
+    {
+      uint32_t h = 0;
+      for (size_t i = 0; i < 4; i++) {
+        h = (h << 8) | ((i < n) ? s[i] : 0);
+      }
+
+      return h;
+    }
+
+    template<typename _Tp, size_t _NodeSize, typename _Allocator>
+    inline int string_btree_map<_Tp, _NodeSize, _Allocator>::node::compare(
+                                                           const slot& sl,
+                                                           const uint8_t* s,
+                                                           size_t n,
+                                                           uint32_t h
+                                                         ) const
+    {
+      // If the heads are different, they decide.
+      if (sl.head != h) {
+        return (sl.head < h) ? -1 : 1;
+      }
+
+      // The first min(length, n, 4) bytes are equal.
+      size_t len = (sl.length < n) ? sl.length : n;
+      if (len > 4) {
+        int r;
+        if ((r = memcmp(data() + sl.offset + 4, s + 4, len - 4)) != 0) {
+          return r;
+        }
+      }
+
+      return (sl.length > n) - (sl.length < n);
+    }
+
+    template<typename _Tp, size_t _NodeSize, typename _Allocator>
+    inline typename string_btree_map<_Tp, _NodeSize, _Allocator>::key_type
+    string_btree_map<_Tp, _NodeSize, _Allocator>::const_iterator::key() const
+    {
+      uint8_t buf[kMaxKeyLength];
+      size_t len = _M_node->key(_M_pos, buf);
+
+      return key_type(reinterpret_cast<const char*>(buf), len);
+    }
+
+    template<typename _Tp, size_t _NodeSize, typename _Allocator>
+    inline const typename string_btree_map<_Tp,
+                                           _NodeSize,
+                                           _Allocator>::value_type&
+    string_btree_map<_Tp, _NodeSize, _Allocator>::const_iterator::value() const
+    {
+      return _M_node->slots()[_M_pos].value;
+    }
+
+    template<typename _Tp, size_t _NodeSize, typename _Allocator>
+    inline bool
+    string_btree_map<_Tp, _NodeSize, _Allocator>::const_iterator::operator==(
+                                               const const_iterator& other
+                                             ) const
+    {
+      return ((_M_node == other._M_node) && (_M_pos == other._M_pos));
+    }
+
+    template<typename _Tp, size_t _NodeSize, typename _Allocator>
+    inline bool
+    string_btree_map<_Tp, _NodeSize, _Allocator>::const_iterator::operator!=(
+                                               const const_iterator& other
+                                             ) const
+    {
+      return ((_M_node != other._M_node) || (_M_pos != other._M_pos));
+    }
+
+    template<typename _Tp, size_t _NodeSize, typename _Allocator>
+    inline string_btree_map<_Tp, _NodeSize, _Allocator>::string_btree_map()
+      : _M_root(NULL),
+        _M_nkeys(0)
+    {
+    }
+
+    template<typename _Tp, size_t _NodeSize, typename _Allocator>
+    inline string_btree_map<_Tp, _NodeSize, _Allocator>::~string_btree_map()
+    {
+      clear();
+    }
+
+    template<typename _Tp, size_t _NodeSize, typename _Allocator>
+    inline void string_btree_map<_Tp, _NodeSize, _Allocator>::clear()
+    {
+      if (_M_root) {
+        if (allocator_type::kArena) {
+          _M_allocator.reset();
+        } else {
+          node::destroy(_M_root, _M_allocator);
+        }
+
+        _M_root = NULL;
+      }
+
+      _M_nkeys = 0;
+    }
+
+    template<typename _Tp, size_t _NodeSize, typename _Allocator>
+    inline size_t string_btree_map<_Tp, _NodeSize, _Allocator>::count() const
+    {
+      return _M_nkeys;
+    }
+
+    template<typename _Tp, size_t _NodeSize, typename _Allocator>
+    bool string_btree_map<_Tp, _NodeSize, _Allocator>::insert(
+                                                     const key_type& key,
+                                                     const value_type& value
+                                                   )
+    {
+      const uint8_t* k = reinterpret_cast<const uint8_t*>(key.data());
+      size_t len = key.length();
+
+      if (len > kMaxKeyLength) {
+        return false;
+      }
+
+      if (!_M_root) {
+        if ((_M_root = node::create(node::kLeaf,
+                                    NULL,
+                                    0,
+                                    NULL,
+                                    0,
+                                    _M_allocator)) == NULL) {
+          return false;
+        }
+      }
+
+      node* path[kMaxHeight];
+      size_t height = 0;
+
+      node* x = _M_root;
+      while (x->_M_header.type == node::kInternal) {
+        path[height++] = x;
+        x = x->child(x->upper_bound(k, len));
+      }
+
+      bool found;
+      uint16_t pos = x->lower_bound(k, len, found);
+
+      // If the key has been already inserted...
+      if (found) {
+        x->slots()[pos].value = value;
+        return true;
+      }
+
+      typename node::slot* s;
+      if ((s = x->insert_slot(pos, k, len, _M_buffer)) != NULL) {
+        s->value = value;
+        _M_nkeys++;
+
+        return true;
+      }
+
+      // The leaf node has to be split. Allocate beforehand the nodes for
+      // the parents which might have to be split as well (and for the new
+      // root), so the tree is never left half-split.
+      node* spare[kMaxHeight + 2];
+      size_t nspare = 1;
+
+      size_t level = height;
+      while ((level > 0) &&
+             (path[level - 1]->free_space() +
+              path[level - 1]->_M_header.garbage <
+              sizeof(typename node::slot) + kMaxKeyLength)) {
+        nspare++;
+        level--;
+      }
+
+      if (level == 0) {
+        nspare++;
+      }
+
+      for (size_t i = 0; i < nspare; i++) {
+        if ((spare[i] = node::create(node::kLeaf,
+                                     NULL,
+                                     0,
+                                     NULL,
+                                     0,
+                                     _M_allocator)) == NULL) {
+          while (i > 0) {
+            _M_allocator.deallocate(spare[--i], _NodeSize);
+          }
+
+          return false;
+        }
+      }
+
+      // Separators (pending key of the parent and separator of the split).
+      uint8_t separators[2][kMaxKeyLength];
+      unsigned current = 0;
+
+      const uint8_t* pending = k;
+      size_t pending_length = len;
+      node* pending_child = NULL;
+
+      for (;;) {
+        node* y = spare[--nspare];
+
+        uint8_t* sep = separators[current];
+        size_t seplen;
+        split(x, y, sep, seplen);
+
+        // Insert the pending key in the corresponding half.
+        node* target = (node::compare(pending,
+                                      pending_length,
+                                      sep,
+                                      seplen) < 0) ? x : y;
+
+        if (target->_M_header.type == node::kLeaf) {
+          pos = target->lower_bound(pending, pending_length, found);
+          s = target->insert_slot(pos, pending, pending_length, _M_buffer);
+          s->value = value;
+        } else {
+          pos = target->upper_bound(pending, pending_length);
+          s = target->insert_slot(pos, pending, pending_length, _M_buffer);
+          s->child = pending_child;
+        }
+
+        // The separator is inserted in the parent.
+        pending = sep;
+        pending_length = seplen;
+        pending_child = y;
+        current ^= 1;
+
+        // If the root has been split...
+        if (height == 0) {
+          node* root = spare[--nspare];
+          root->init(node::kInternal, NULL, 0, NULL, 0);
+          root->_M_header.first = x;
+
+          s = root->insert_slot(0, pending, pending_length, _M_buffer);
+          s->child = pending_child;
+
+          _M_root = root;
+
+          break;
+        }
+
+        x = path[--height];
+
+        pos = x->upper_bound(pending, pending_length);
+        if ((s = x->insert_slot(pos,
+                                pending,
+                                pending_length,
+                                _M_buffer)) != NULL) {
+          s->child = pending_child;
+          break;
+        }
+      }
+
+      // Release the nodes which haven't been used.
+      while (nspare > 0) {
+        _M_allocator.deallocate(spare[--nspare], _NodeSize);
+      }
+
+      _M_nkeys++;
+
+      return true;
+    }
+
+    template<typename _Tp, size_t _NodeSize, typename _Allocator>
+    bool string_btree_map<_Tp, _NodeSize, _Allocator>::erase(
+                                                     const key_type& key
+                                                   )
+    {
+      if (!_M_root) {
+        return false;
+      }
+
+      const uint8_t* k = reinterpret_cast<const uint8_t*>(key.data());
+      size_t len = key.length();
+
+      node* path[kMaxHeight];
+      uint16_t index[kMaxHeight];
+      size_t height = 0;
+
+      node* x = _M_root;
+      while (x->_M_header.type == node::kInternal) {
+        uint16_t i = x->upper_bound(k, len);
+
+        path[height] = x;
+        index[height] = i;
+        height++;
+
+        x = x->child(i);
+      }
+
+      bool found;
+      uint16_t pos = x->lower_bound(k, len, found);
+      if (!found) {
+        return false;
+      }
+
+      x->remove(pos);
+      _M_nkeys--;
+
+      // Merge the underfull nodes with a sibling.
+      while ((height > 0) && (x->used() < kMinUsed)) {
+        node* parent = path[height - 1];
+        uint16_t i = index[height - 1];
+
+        if (i < parent->_M_header.count) {
+          if (!merge(parent, i, x, parent->child(i + 1))) {
+            break;
+          }
+        } else if (i > 0) {
+          if (!merge(parent, i - 1, parent->child(i - 1), x)) {
+            break;
+          }
+        } else {
+          break;
+        }
+
+        x = parent;
+        height--;
+      }
+
+      // Shrink the tree.
+      while ((_M_root->_M_header.type == node::kInternal) &&
+             (_M_root->_M_header.count == 0)) {
+        node* root = _M_root;
+        _M_root = root->_M_header.first;
+
+        _M_allocator.deallocate(root, _NodeSize);
+      }
+
+      if (_M_nkeys == 0) {
+        clear();
+      }
+
+      return true;
+    }
+
+    template<typename _Tp, size_t _NodeSize, typename _Allocator>
+    bool string_btree_map<_Tp, _NodeSize, _Allocator>::get(
+                                                     const key_type& key,
+                                                     value_type& value
+                                                   ) const
+    {
+      const_iterator it;
+      if (!find(key, it)) {
+        return false;
+      }
+
+      value = it.value();
+
+      return true;
+    }
+
+    template<typename _Tp, size_t _NodeSize, typename _Allocator>
+    bool string_btree_map<_Tp, _NodeSize, _Allocator>::begin(
+                                                     const_iterator& it
+                                                   ) const
+    {
+      if (_M_nkeys == 0) {
+        return false;
+      }
+
+      const node* x = _M_root;
+      while (x->_M_header.type == node::kInternal) {
+        x = x->_M_header.first;
+      }
+
+      // Skip empty leaves (which couldn't be merged).
+      while (x->_M_header.count == 0) {
+        x = x->_M_header.next;
+      }
+
+      it._M_node = x;
+      it._M_pos = 0;
+
+      return true;
+    }
+
+    template<typename _Tp, size_t _NodeSize, typename _Allocator>
+    bool string_btree_map<_Tp, _NodeSize, _Allocator>::end(
+                                                     const_iterator& it
+                                                   ) const
+    {
+      if (_M_nkeys == 0) {
+        return false;
+      }
+
+      const node* x = _M_root;
+      while (x->_M_header.type == node::kInternal) {
+        x = x->child(x->_M_header.count);
+      }
+
+      // Skip empty leaves (which couldn't be merged).
+      while (x->_M_header.count == 0) {
+        x = x->_M_header.prev;
+      }
+
+      it._M_node = x;
+      it._M_pos = x->_M_header.count - 1;
+
+      return true;
+    }
+
+    template<typename _Tp, size_t _NodeSize, typename _Allocator>
+    bool string_btree_map<_Tp, _NodeSize, _Allocator>::prev(
+                                                     const_iterator& it
+                                                   ) const
+    {
+      if (it._M_pos > 0) {
+        it._M_pos--;
+        return true;
+      }
+
+      const node* x = it._M_node->_M_header.prev;
+      while ((x) && (x->_M_header.count == 0)) {
+        x = x->_M_header.prev;
+      }
+
+      if (!x) {
+        return false;
+      }
+
+      it._M_node = x;
+      it._M_pos = x->_M_header.count - 1;
+
+      return true;
+    }
+
+    template<typename _Tp, size_t _NodeSize, typename _Allocator>
+    bool string_btree_map<_Tp, _NodeSize, _Allocator>::next(
+                                                     const_iterator& it
+                                                   ) const
+    {
+      if (it._M_pos + 1 < it._M_node->_M_header.count) {
+        it._M_pos++;
+        return true;
+      }
+
+      const node* x = it._M_node->_M_header.next;
+      while ((x) && (x->_M_header.count == 0)) {
+        x = x->_M_header.next;
+      }
+
+      if (!x) {
+        return false;
+      }
+
+      it._M_node = x;
+      it._M_pos = 0;
+
+      return true;
+    }
+
+    template<typename _Tp, size_t _NodeSize, typename _Allocator>
+    bool string_btree_map<_Tp, _NodeSize, _Allocator>::find(
+                                                     const key_type& key,
+                                                     const_iterator& it
+                                                   ) const
+    {
+      const uint8_t* k = reinterpret_cast<const uint8_t*>(key.data());
+      size_t len = key.length();
+
+      const node* x;
+      if ((x = find_leaf(k, len)) == NULL) {
+        return false;
+      }
+
+      bool found;
+      it._M_node = x;
+      it._M_pos = x->lower_bound(k, len, found);
+
+      return found;
+    }
+
+    template<typename _Tp, size_t _NodeSize, typename _Allocator>
+    bool string_btree_map<_Tp, _NodeSize, _Allocator>::lower_bound(
+                                                     const key_type& key,
+                                                     const_iterator& it
+                                                   ) const
+    {
+      const uint8_t* k = reinterpret_cast<const uint8_t*>(key.data());
+      size_t len = key.length();
+
+      const node* x;
+      if ((x = find_leaf(k, len)) == NULL) {
+        return false;
+      }
+
+      bool found;
+      it._M_node = x;
+      it._M_pos = x->lower_bound(k, len, found);
+
+      // If all the keys of the leaf node are less than the key...
+      if (it._M_pos == x->_M_header.count) {
+        it._M_pos = 0;
+
+        do {
+          if ((it._M_node = it._M_node->_M_header.next) == NULL) {
+            return false;
+          }
+        } while (it._M_node->_M_header.count == 0);
+      }
+
+      return true;
+    }
+
+    template<typename _Tp, size_t _NodeSize, typename _Allocator>
+    inline const typename string_btree_map<_Tp, _NodeSize, _Allocator>::node*
+    string_btree_map<_Tp, _NodeSize, _Allocator>::find_leaf(
+                                                     const uint8_t* key,
+                                                     size_t len
+                                                   ) const
+    {
+      if (_M_nkeys == 0) {
+        return NULL;
+      }
+
+      const node* x = _M_root;
+      while (x->_M_header.type == node::kInternal) {
+        x = x->child(x->upper_bound(key, len));
+      }
+
+      return x;
+    }
+
+    template<typename _Tp, size_t _NodeSize, typename _Allocator>
+    void string_btree_map<_Tp, _NodeSize, _Allocator>::split(node* x,
+                                                             node* y,
+                                                             uint8_t* sep,
+                                                             size_t& seplen)
+    {
+      const typename node::slot* s = x->slots();
+      uint16_t count = x->_M_header.count;
+
+      // Split the slot bytes in halves.
+      size_t half = x->slot_bytes(x->_M_header.prefix_length) / 2;
+
+      size_t size = 0;
+      uint16_t m = 0;
+      while ((m < count) && (size < half)) {
+        size += sizeof(typename node::slot) + s[m].length;
+        m++;
+      }
+
+      if (m == 0) {
+        m = 1;
+      } else if (m == count) {
+        m = count - 1;
+      }
+
+      node* tmp = reinterpret_cast<node*>(_M_buffer);
+
+      if (x->_M_header.type == node::kLeaf) {
+        // Separator: shortest prefix of the first key of the right half
+        // which is greater than the last key of the left half.
+        uint8_t last[kMaxKeyLength];
+        size_t last_length = x->key(m - 1, last);
+
+        seplen = x->key(m, sep);
+        seplen = node::common_prefix(last, last_length, sep, seplen) + 1;
+
+        y->init(node::kLeaf,
+                sep,
+                seplen,
+                x->upper_fence(),
+                x->_M_header.upper_length);
+
+        y->append(x, m, count);
+
+        tmp->init(node::kLeaf,
+                  x->lower_fence(),
+                  x->_M_header.lower_length,
+                  sep,
+                  seplen);
+
+        tmp->append(x, 0, m);
+
+        y->_M_header.prev = x;
+        y->_M_header.next = x->_M_header.next;
+
+        if (x->_M_header.next) {
+          x->_M_header.next->_M_header.prev = y;
+        }
+
+        tmp->_M_header.prev = x->_M_header.prev;
+        tmp->_M_header.next = y;
+      } else {
+        // The middle key moves up to the parent.
+        seplen = x->key(m, sep);
+
+        y->init(node::kInternal,
+                sep,
+                seplen,
+                x->upper_fence(),
+                x->_M_header.upper_length);
+
+        y->_M_header.first = s[m].child;
+        y->append(x, m + 1, count);
+
+        tmp->init(node::kInternal,
+                  x->lower_fence(),
+                  x->_M_header.lower_length,
+                  sep,
+                  seplen);
+
+        tmp->_M_header.first = x->_M_header.first;
+        tmp->append(x, 0, m);
+      }
+
+      memcpy(x, tmp, _NodeSize);
+    }
+
+    template<typename _Tp, size_t _NodeSize, typename _Allocator>
+    bool string_btree_map<_Tp, _NodeSize, _Allocator>::merge(node* parent,
+                                                             uint16_t k,
+                                                             node* left,
+                                                             node* right)
+    {
+      // Separator (pulled down into internal nodes).
+      uint8_t sep[kMaxKeyLength];
+      size_t seplen = parent->key(k, sep);
+
+      const uint8_t* lower = left->lower_fence();
+      size_t lower_length = left->_M_header.lower_length;
+      const uint8_t* upper = right->upper_fence();
+      size_t upper_length = right->_M_header.upper_length;
+
+      size_t prefix_length = 0;
+      if (upper_length > 0) {
+        prefix_length = node::common_prefix(lower,
+                                            lower_length,
+                                            upper,
+                                            upper_length);
+      }
+
+      size_t size = sizeof(node) +
+                    lower_length +
+                    upper_length +
+                    left->slot_bytes(prefix_length) +
+                    right->slot_bytes(prefix_length);
+
+      bool internal = (left->_M_header.type == node::kInternal);
+      if (internal) {
+        size += sizeof(typename node::slot) + seplen - prefix_length;
+      }
+
+      // If they don't fit in a node...
+      if (size > _NodeSize) {
+        return false;
+      }
+
+      node* tmp = reinterpret_cast<node*>(_M_buffer);
+
+      tmp->init(static_cast<typename node::type>(left->_M_header.type),
+                lower,
+                lower_length,
+                upper,
+                upper_length);
+
+      tmp->append(left, 0, left->_M_header.count);
+
+      if (internal) {
+        typename node::slot* s = tmp->insert_slot(tmp->_M_header.count,
+                                                  sep,
+                                                  seplen,
+                                                  NULL);
+        s->child = right->_M_header.first;
+      }
+
+      tmp->append(right, 0, right->_M_header.count);
+
+      tmp->_M_header.first = left->_M_header.first;
+      tmp->_M_header.prev = left->_M_header.prev;
+      tmp->_M_header.next = right->_M_header.next;
+
+      if (right->_M_header.next) {
+        right->_M_header.next->_M_header.prev = left;
+      }
+
+      memcpy(left, tmp, _NodeSize);
+
+      // Remove the separator and the right node from the parent.
+      parent->remove(k);
+
+      _M_allocator.deallocate(right, _NodeSize);
+
+      return true;
+    }
+  }
+}
+
+#endif // UTIL_BTREE_STRING_BTREE_H
@@ -0,0 +1,114 @@
+#ifndef UTIL_BTREE_VERSION_LOCK_H
+#define UTIL_BTREE_VERSION_LOCK_H
+
+#include <stdint.h>
+#include <atomic>
+
+namespace util {
+  namespace btree {
+    // Version lock (optimistic lock coupling).
+    //
+    // The version word has the following layout:
+    // +---------------------------------------+--------+----------+
+    // |             version (62 bits)         | locked | obsolete |
+    // +---------------------------------------+--------+----------+
+    //
+    // Readers don't write the lock: they read the version before reading
+    // the protected data and validate it afterwards; if it has changed, the
+    // data they have read might be inconsistent and they have to restart.
+    // Writers upgrade a version they have read to the locked state; the
+    // upgrade fails if somebody else has modified the data in between.
+    // Unlocking increments the version.
+    class version_lock {
+      public:
+        // Constructor.
+        version_lock();
+
+        // Read lock.
+        // Waits while the lock is locked. Returns false if the protected
+        // data is obsolete.
+        bool read_lock(uint64_t& version) const;
+
+        // Validate version.
+        // Returns true if the data hasn't been modified since 'version' was
+        // read.
+        bool validate(uint64_t version) const;
+
+        // Upgrade read lock to write lock.
+        // Returns false if the data has been modified since 'version' was
+        // read.
+        bool upgrade(uint64_t version);
+
+        // Unlock.
+        void unlock();
+
+        // Unlock and mark the protected data as obsolete.
+        void unlock_obsolete();
+
+      private:
+        static const uint64_t kObsolete = 1;
+        static const uint64_t kLocked = 2;
+
+        std::atomic<uint64_t> _M_version;
+
+        // Disable copy constructor and assignment operator.
+        version_lock(const version_lock&) = delete;
+        version_lock& operator=(const version_lock&) = delete;
+    };
+
+    inline version_lock::version_lock()
+      : _M_version(0)
+    {
+    }
+
+    inline bool version_lock::read_lock(uint64_t& version) const
+    {
+      while (((version = _M_version.load(std::memory_order_acquire)) &
+              kLocked) != 0) {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+      }
+
+      return ((version & kObsolete) == 0);
+    }
+
+    inline bool version_lock::validate(uint64_t version) const
+    {
+      // The reads of the protected data must not be reordered after the
+      // read of the version.
+      std::atomic_thread_fence(std::memory_order_acquire);
+
+      return (_M_version.load(std::memory_order_relaxed) == version);
+    }
+
+    inline bool version_lock::upgrade(uint64_t version)
+    {
+      if (!_M_version.compare_exchange_strong(version,
+                                              version + kLocked,
+                                              std::memory_order_acquire)) {
+        return false;
+      }
+
+      // The writes to the protected data must not be reordered before the
+      // lock.
+      std::atomic_thread_fence(std::memory_order_release);
+
+      return true;
+    }
+
+    inline void version_lock::unlock()
+    {
+      // locked -> unlocked, version + 1.
+      _M_version.fetch_add(kLocked, std::memory_order_release);
+    }
+
+    inline void version_lock::unlock_obsolete()
+    {
+      // locked -> unlocked and obsolete, version + 1.
+      _M_version.fetch_add(kLocked | kObsolete, std::memory_order_release);
+    }
+  }
+}
+
+#endif // UTIL_BTREE_VERSION_LOCK_H
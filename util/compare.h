@@ -0,0 +1,21 @@
+#ifndef UTIL_COMPARE_H
+#define UTIL_COMPARE_H
+
+namespace util {
+  // Three-way comparator: returns a negative number if x < y, 0 if x == y
+  // and a positive number if x > y.
+  // Unlike util::minus, it doesn't overflow and it is branch-free for
+  // arithmetic types.
+  template<typename _T>
+  struct compare {
+    int operator()(const _T& x, const _T& y) const;
+  };
+
+  template<typename _T>
+  inline int compare<_T>::operator()(const _T& x, const _T& y) const
+  {
+    return (x > y) - (x < y);
+  }
+}
+
+#endif // UTIL_COMPARE_H
@@ -0,0 +1,19 @@
+#ifndef UTIL_LESS_H
+#define UTIL_LESS_H
+
+namespace util {
+  // Strict weak ordering comparator (std::less style): returns true if
+  // x < y.
+  template<typename _T>
+  struct less {
+    bool operator()(const _T& x, const _T& y) const;
+  };
+
+  template<typename _T>
+  inline bool less<_T>::operator()(const _T& x, const _T& y) const
+  {
+    return x < y;
+  }
+}
+
+#endif // UTIL_LESS_H
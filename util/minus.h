@@ -2,6 +2,9 @@
 #define UTIL_MINUS_H
 
 namespace util {
+  // Three-way comparator which returns x - y.
+  // The subtraction might overflow (for example, for 64-bit keys): use
+  // util::compare or util::less instead.
   template<typename _T>
   struct minus {
     int operator()(const _T& x, const _T& y) const;
@@ -23,12 +23,24 @@ namespace util {
     return static_cast<typename remove_reference<_T>::type&&>(a);
   }
 
+  template<typename _T>
+  constexpr _T&& forward(typename remove_reference<_T>::type& a) noexcept
+  {
+    return static_cast<_T&&>(a);
+  }
+
+  template<typename _T>
+  constexpr _T&& forward(typename remove_reference<_T>::type&& a) noexcept
+  {
+    return static_cast<_T&&>(a);
+  }
+
   template<typename _T>
   inline void swap(_T& a, _T& b)
   {
-    _T tmp(move(a));
-    a = move(b);
-    b = move(tmp);
+    _T tmp(util::move(a));
+    a = util::move(b);
+    b = util::move(tmp);
   }
 }
 
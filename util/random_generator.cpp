@@ -1,8 +1,16 @@
-#include <string.h>
 #include "util/random_generator.h"
 
 bool util::random_generator::init(size_t size)
 {
+  clear();
+
+  // Each key is drawn from its own slice of [0, RAND_MAX], so the keys are
+  // unique and already sorted: O(n).
+  size_t slice = (static_cast<size_t>(RAND_MAX) + 1) / ((size > 0) ? size : 1);
+  if (slice == 0) {
+    return false;
+  }
+
   if ((_M_unordered = reinterpret_cast<long*>(
                         malloc(size * sizeof(long))
                       )) == NULL) {
@@ -12,50 +20,25 @@ bool util::random_generator::init(size_t size)
   if ((_M_ordered = reinterpret_cast<long*>(
                       malloc(size * sizeof(long))
                     )) == NULL) {
+    clear();
     return false;
   }
 
   for (size_t i = 0; i < size; i++) {
-    long rnd;
-    size_t pos;
-    do {
-      rnd = random();
-    } while (search(i, rnd, pos));
-
-    if (pos < i) {
-      memmove(&_M_ordered[pos + 1],
-              &_M_ordered[pos],
-              (i - pos) * sizeof(long));
-    }
-
-    _M_unordered[i] = rnd;
-    _M_ordered[pos] = rnd;
+    _M_ordered[i] = static_cast<long>(i * slice + random() % slice);
+    _M_unordered[i] = _M_ordered[i];
   }
 
-  _M_size = size;
+  // Shuffle (Fisher-Yates).
+  for (size_t i = size; i > 1; i--) {
+    size_t j = static_cast<size_t>(random()) % i;
 
-  return true;
-}
-
-bool util::random_generator::search(size_t count, long rnd, size_t& pos) const
-{
-  int left = 0;
-  int right = count - 1;
-
-  while (left <= right) {
-    int mid = (left + right) / 2;
-
-    if (rnd < _M_ordered[mid]) {
-      right = mid - 1;
-    } else if (rnd > _M_ordered[mid]) {
-      left = mid + 1;
-    } else {
-      pos = mid;
-      return true;
-    }
+    long tmp = _M_unordered[i - 1];
+    _M_unordered[i - 1] = _M_unordered[j];
+    _M_unordered[j] = tmp;
   }
 
-  pos = left;
+  _M_size = size;
 
-  return false;
+  return true;
 }
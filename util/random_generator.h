@@ -17,6 +17,7 @@ namespace util {
       void clear();
 
       // Initialize.
+      // Generates 'size' unique random numbers in [0, RAND_MAX].
       bool init(size_t size);
 
       // Get at.
@@ -27,9 +28,6 @@ namespace util {
       long* _M_unordered;
       long* _M_ordered;
       size_t _M_size;
-
-      // Search.
-      bool search(size_t count, long rnd, size_t& pos) const;
   };
 
   inline random_generator::random_generator()
@@ -0,0 +1,264 @@
+#include <math.h>
+#include <string.h>
+#include "util/workload.h"
+
+const double util::key_distribution::kDefaultTheta = 0.99;
+const double util::key_distribution::kDefaultHotKeys = 0.2;
+const double util::key_distribution::kDefaultHotOperations = 0.8;
+
+const util::workload util::kWorkloadA = {
+  "a", 50, 50, 0, 0, 0, util::key_distribution::kZipfian, 0
+};
+
+const util::workload util::kWorkloadB = {
+  "b", 95, 5, 0, 0, 0, util::key_distribution::kZipfian, 0
+};
+
+const util::workload util::kWorkloadC = {
+  "c", 100, 0, 0, 0, 0, util::key_distribution::kZipfian, 0
+};
+
+const util::workload util::kWorkloadD = {
+  "d", 95, 0, 5, 0, 0, util::key_distribution::kLatest, 0
+};
+
+const util::workload util::kWorkloadE = {
+  "e", 0, 0, 5, 95, 0, util::key_distribution::kZipfian, 100
+};
+
+util::key_distribution::key_distribution()
+  : _M_type(kUniform),
+    _M_nkeys(0),
+    _M_theta(kDefaultTheta),
+    _M_alpha(0),
+    _M_zeta2(0),
+    _M_zetan(0),
+    _M_eta(0),
+    _M_zeta_keys(0),
+    _M_hot_keys(kDefaultHotKeys),
+    _M_hot_operations(kDefaultHotOperations)
+{
+}
+
+bool util::key_distribution::init(type t,
+                                  uint64_t nkeys,
+                                  uint64_t seed,
+                                  double theta,
+                                  double hot_keys,
+                                  double hot_operations)
+{
+  // Sanity checks.
+  if ((theta <= 0) ||
+      (theta >= 1) ||
+      (hot_keys <= 0) ||
+      (hot_keys > 1) ||
+      (hot_operations < 0) ||
+      (hot_operations > 1)) {
+    return false;
+  }
+
+  _M_type = t;
+  _M_random.seed(seed);
+
+  _M_nkeys = nkeys;
+
+  _M_theta = theta;
+  _M_alpha = 1.0 / (1.0 - theta);
+  _M_zeta2 = 1.0 + pow(0.5, theta);
+  _M_zetan = 0;
+  _M_eta = 0;
+  _M_zeta_keys = 0;
+
+  _M_hot_keys = hot_keys;
+  _M_hot_operations = hot_operations;
+
+  return true;
+}
+
+void util::key_distribution::keys(uint64_t nkeys)
+{
+  // If the number of keys shrinks, zeta(n) has to be computed again.
+  if (nkeys < _M_zeta_keys) {
+    _M_zetan = 0;
+    _M_zeta_keys = 0;
+  }
+
+  _M_nkeys = nkeys;
+}
+
+uint64_t util::key_distribution::next()
+{
+  if (_M_nkeys == 0) {
+    return 0;
+  }
+
+  switch (_M_type) {
+    case kUniform:
+      return _M_random.next(_M_nkeys);
+    case kZipfian:
+      return next_zipfian();
+    case kScrambledZipfian:
+      return scramble(next_zipfian()) % _M_nkeys;
+    case kLatest:
+      return _M_nkeys - 1 - next_zipfian();
+    case kHotspot:
+      {
+        uint64_t hot = static_cast<uint64_t>(_M_hot_keys * _M_nkeys);
+        if (hot == 0) {
+          hot = 1;
+        }
+
+        if ((hot == _M_nkeys) ||
+            (_M_random.next_double() < _M_hot_operations)) {
+          return _M_random.next(hot);
+        }
+
+        return hot + _M_random.next(_M_nkeys - hot);
+      }
+  }
+
+  return 0;
+}
+
+const char* util::key_distribution::name(type t)
+{
+  switch (t) {
+    case kUniform:
+      return "uniform";
+    case kZipfian:
+      return "zipfian";
+    case kScrambledZipfian:
+      return "scrambled_zipfian";
+    case kLatest:
+      return "latest";
+    case kHotspot:
+      return "hotspot";
+  }
+
+  return "unknown";
+}
+
+bool util::key_distribution::parse(const char* name, type& t)
+{
+  static const type types[] = {
+    kUniform,
+    kZipfian,
+    kScrambledZipfian,
+    kLatest,
+    kHotspot
+  };
+
+  for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+    if (strcmp(name, key_distribution::name(types[i])) == 0) {
+      t = types[i];
+      return true;
+    }
+  }
+
+  return false;
+}
+
+uint64_t util::key_distribution::next_zipfian()
+{
+  // Algorithm from "Quickly Generating Billion-Record Synthetic Databases"
+  // (Gray et al.), as used by YCSB.
+  if (_M_zeta_keys != _M_nkeys) {
+    update_zeta();
+  }
+
+  double u = _M_random.next_double();
+  double uz = u * _M_zetan;
+
+  if (uz < 1.0) {
+    return 0;
+  }
+
+  if ((uz < _M_zeta2) && (_M_nkeys > 1)) {
+    return 1;
+  }
+
+  uint64_t rank = static_cast<uint64_t>(
+                    _M_nkeys * pow(_M_eta * u - _M_eta + 1.0, _M_alpha)
+                  );
+
+  return (rank < _M_nkeys) ? rank : _M_nkeys - 1;
+}
+
+void util::key_distribution::update_zeta()
+{
+  // zeta(n) = sum(1 / i ^ theta), i = 1..n, extended incrementally.
+  for (uint64_t i = _M_zeta_keys + 1; i <= _M_nkeys; i++) {
+    _M_zetan += 1.0 / pow(static_cast<double>(i), _M_theta);
+  }
+
+  _M_zeta_keys = _M_nkeys;
+
+  _M_eta = (1.0 - pow(2.0 / _M_nkeys, 1.0 - _M_theta)) /
+           (1.0 - _M_zeta2 / _M_zetan);
+}
+
+bool util::workload_generator::init(const workload& w,
+                                    uint64_t records,
+                                    uint64_t seed)
+{
+  // Sanity checks.
+  if ((w.read + w.update + w.insert + w.scan + w.erase != 100) ||
+      ((w.scan > 0) && (w.max_scan_length == 0))) {
+    return false;
+  }
+
+  // The operations and the keys use different streams.
+  if (!_M_distribution.init(w.distribution,
+                            records,
+                            key_distribution::scramble(seed))) {
+    return false;
+  }
+
+  _M_workload = w;
+  _M_random.seed(seed);
+  _M_records = records;
+
+  return true;
+}
+
+util::workload_generator::operation
+util::workload_generator::next(uint64_t& key, size_t& scan_length)
+{
+  unsigned op = static_cast<unsigned>(_M_random.next(100));
+
+  if (op < _M_workload.read) {
+    key = _M_distribution.next();
+    return kRead;
+  }
+
+  op -= _M_workload.read;
+
+  if (op < _M_workload.update) {
+    key = _M_distribution.next();
+    return kUpdate;
+  }
+
+  op -= _M_workload.update;
+
+  if (op < _M_workload.insert) {
+    key = _M_records++;
+    _M_distribution.keys(_M_records);
+
+    return kInsert;
+  }
+
+  op -= _M_workload.insert;
+
+  if (op < _M_workload.scan) {
+    key = _M_distribution.next();
+    scan_length = 1 + static_cast<size_t>(
+                        _M_random.next(_M_workload.max_scan_length)
+                      );
+
+    return kScan;
+  }
+
+  key = _M_distribution.next();
+
+  return kErase;
+}
@@ -0,0 +1,246 @@
+#ifndef UTIL_WORKLOAD_H
+#define UTIL_WORKLOAD_H
+
+#include <stdlib.h>
+#include <stdint.h>
+
+namespace util {
+  // splitmix64 pseudo-random number generator.
+  // Deterministic: the same seed always produces the same sequence.
+  class splitmix64 {
+    public:
+      // Constructor.
+      splitmix64(uint64_t seed = 0);
+
+      // Seed.
+      void seed(uint64_t seed);
+
+      // Get next random number.
+      uint64_t next();
+
+      // Get next random number in [0, n).
+      uint64_t next(uint64_t n);
+
+      // Get next random number in [0, 1).
+      double next_double();
+
+    private:
+      uint64_t _M_state;
+  };
+
+  // Key distribution.
+  // Produces key indices in [0, number of keys). The number of keys can grow
+  // (as keys are inserted) without recomputing the distribution from scratch.
+  class key_distribution {
+    public:
+      enum type {
+        // All the keys are equally likely.
+        kUniform,
+
+        // The first keys are the most popular ones: the key of rank i is
+        // picked with probability proportional to 1 / (i + 1) ^ theta.
+        kZipfian,
+
+        // Zipfian, but the popular keys are spread over the key space.
+        kScrambledZipfian,
+
+        // Zipfian, the most recently inserted keys being the most popular.
+        kLatest,
+
+        // A fraction of the operations (hot_operations) go to a fraction of
+        // the keys at the beginning of the key space (hot_keys).
+        kHotspot
+      };
+
+      static const double kDefaultTheta;
+      static const double kDefaultHotKeys;
+      static const double kDefaultHotOperations;
+
+      // Constructor.
+      key_distribution();
+
+      // Initialize.
+      bool init(type t,
+                uint64_t nkeys,
+                uint64_t seed,
+                double theta = kDefaultTheta,
+                double hot_keys = kDefaultHotKeys,
+                double hot_operations = kDefaultHotOperations);
+
+      // Get type.
+      type get_type() const;
+
+      // Get number of keys.
+      uint64_t keys() const;
+
+      // Set number of keys.
+      // Growing the Zipfian distributions costs O(number of new keys).
+      void keys(uint64_t nkeys);
+
+      // Get next key index.
+      uint64_t next();
+
+      // Get name of the distribution.
+      static const char* name(type t);
+
+      // Parse name of the distribution.
+      static bool parse(const char* name, type& t);
+
+      // Scramble value (FNV-1a hash).
+      static uint64_t scramble(uint64_t x);
+
+    private:
+      type _M_type;
+
+      splitmix64 _M_random;
+
+      uint64_t _M_nkeys;
+
+      // Zipfian.
+      double _M_theta;
+      double _M_alpha;
+      double _M_zeta2;
+      double _M_zetan;
+      double _M_eta;
+      uint64_t _M_zeta_keys;
+
+      // Hotspot.
+      double _M_hot_keys;
+      double _M_hot_operations;
+
+      // Get next Zipfian rank in [0, number of keys).
+      uint64_t next_zipfian();
+
+      // Update zeta(n) up to the current number of keys.
+      void update_zeta();
+  };
+
+  // Workload.
+  // Percentages of each operation (they must add up to 100) and the
+  // distribution of the keys.
+  struct workload {
+    const char* name;
+
+    unsigned read;
+    unsigned update;
+    unsigned insert;
+    unsigned scan;
+    unsigned erase;
+
+    key_distribution::type distribution;
+
+    // Maximum number of keys of a scan.
+    size_t max_scan_length;
+  };
+
+  // Standard workloads (as defined by YCSB).
+  extern const workload kWorkloadA; // 50% read, 50% update, Zipfian.
+  extern const workload kWorkloadB; // 95% read, 5% update, Zipfian.
+  extern const workload kWorkloadC; // 100% read, Zipfian.
+  extern const workload kWorkloadD; // 95% read, 5% insert, latest.
+  extern const workload kWorkloadE; // 95% scan, 5% insert, Zipfian.
+
+  // Workload generator.
+  // Produces a stream of operations on key indices. The first 'records'
+  // indices are expected to be loaded before the run; inserts append new
+  // indices (records, records + 1, ...).
+  class workload_generator {
+    public:
+      enum operation {
+        kRead,
+        kUpdate,
+        kInsert,
+        kScan,
+        kErase
+      };
+
+      // Constructor.
+      workload_generator();
+
+      // Initialize.
+      bool init(const workload& w, uint64_t records, uint64_t seed);
+
+      // Get next operation.
+      // 'key' receives the key index and 'scan_length' the number of keys
+      // to scan (only for kScan).
+      operation next(uint64_t& key, size_t& scan_length);
+
+      // Get number of records (including the inserted ones).
+      uint64_t records() const;
+
+    private:
+      workload _M_workload;
+
+      key_distribution _M_distribution;
+      splitmix64 _M_random;
+
+      uint64_t _M_records;
+  };
+
+  inline splitmix64::splitmix64(uint64_t seed)
+    : _M_state(seed)
+  {
+  }
+
+  inline void splitmix64::seed(uint64_t seed)
+  {
+    _M_state = seed;
+  }
+
+  inline uint64_t splitmix64::next()
+  {
+    uint64_t z = (_M_state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+  }
+
+  inline uint64_t splitmix64::next(uint64_t n)
+  {
+    __extension__ typedef unsigned __int128 uint128_t;
+
+    // Multiply and shift (no division).
+    return static_cast<uint64_t>((static_cast<uint128_t>(next()) * n) >> 64);
+  }
+
+  inline double splitmix64::next_double()
+  {
+    // 53 bits of mantissa.
+    return (next() >> 11) * (1.0 / 9007199254740992.0);
+  }
+
+  inline key_distribution::type key_distribution::get_type() const
+  {
+    return _M_type;
+  }
+
+  inline uint64_t key_distribution::keys() const
+  {
+    return _M_nkeys;
+  }
+
+  inline uint64_t key_distribution::scramble(uint64_t x)
+  {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for (unsigned i = 0; i < 8; i++) {
+      hash ^= x & 0xff;
+      hash *= 0x100000001b3ULL;
+      x >>= 8;
+    }
+
+    return hash;
+  }
+
+  inline workload_generator::workload_generator()
+    : _M_records(0)
+  {
+  }
+
+  inline uint64_t workload_generator::records() const
+  {
+    return _M_records;
+  }
+}
+
+#endif // UTIL_WORKLOAD_H